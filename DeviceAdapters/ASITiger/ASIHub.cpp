@@ -44,13 +44,13 @@ using namespace std;
 ASIHub::ASIHub() :
       ASIBase< ::HubBase, ASIHub >(""), // do not pass a name
       port_("Undefined"),
-      serialAnswer_(""),
       manualSerialAnswer_(""),
-      serialCommand_(""),
       serialTerminator_(g_SerialTerminatorDefault),
       serialRepeatDuration_(0),
       serialRepeatPeriod_(500),
       serialOnlySendChanged_(true),
+      transport_(this),
+      commandQueue_(transport_),
       updatingSharedProperties_(false)
 {
    CPropertyAction* pAct = new CPropertyAction(this, &ASIHub::OnPort);
@@ -88,10 +88,17 @@ ASIHub::ASIHub() :
    AddAllowedValue(g_SerialTerminatorPropertyName, g_SerialTerminator_2);
    AddAllowedValue(g_SerialTerminatorPropertyName, g_SerialTerminator_3);
    AddAllowedValue(g_SerialTerminatorPropertyName, g_SerialTerminator_4);
+
+   // how many commands can be sent ahead of the replies to earlier ones; 1 waits for each reply before sending
+   pAct = new CPropertyAction (this, &ASIHub::OnSerialCommandPipelineDepth);
+   CreateProperty(g_SerialCommandPipelineDepthPropertyName, "1", MM::Integer, false, pAct);
+   SetPropertyLimits(g_SerialCommandPipelineDepthPropertyName, 1, 8);
 }
 
 int ASIHub::ClearComPort(void)
 {
+   // wait for the replies to commands in flight, which would otherwise be lost
+   HubCommandQueue::ConnectionGuard guard(commandQueue_);
    return PurgeComPort(port_.c_str());
 }
 
@@ -100,22 +107,24 @@ int ASIHub::ClearComPort(void)
    */
 int ASIHub::QueryCommandUnterminatedResponse(const char *command, const long timeoutMs)
 {
-   RETURN_ON_MM_ERROR ( ClearComPort() );
+   // the reply can't be matched by the command queue, so take the port to ourselves
+   HubCommandQueue::ConnectionGuard guard(commandQueue_);
+   RETURN_ON_MM_ERROR ( PurgeComPort(port_.c_str()) );
    RETURN_ON_MM_ERROR ( SendSerialCommand(port_.c_str(), command, "\r") );
-   serialCommand_ = command;
+   SerialCommand() = command;
    char rcvBuf[MM::MaxStrLength];
    memset(rcvBuf, 0, MM::MaxStrLength);
    unsigned long read = 0;
    int ret = DEVICE_OK;
    MM::TimeoutMs timerOut(GetCurrentMMTime(), timeoutMs);
-   serialAnswer_ = "";
+   SerialAnswer() = "";
    while (ret == DEVICE_OK && read == 0 && !timerOut.expired(GetCurrentMMTime()))
    {
       ret = ReadFromComPort(port_.c_str(), (unsigned char*)rcvBuf, MM::MaxStrLength, read);
    }
    if (read > 0)
    {
-      serialAnswer_ = rcvBuf;
+      SerialAnswer() = rcvBuf;
    }
    return ret;
 }
@@ -145,20 +154,41 @@ int ASIHub::QueryCommandUnterminatedResponse(const char *command, const long tim
 
 int ASIHub::QueryCommand(const char *command, const char *replyTerminator, const long delayMs)
 {
-   MMThreadGuard g(threadLock_);
-   RETURN_ON_MM_ERROR ( ClearComPort() );
-   RETURN_ON_MM_ERROR ( SendSerialCommand(port_.c_str(), command, "\r") );
-   serialCommand_ = command;
-   if (delayMs >= 0)  CDeviceUtils::SleepMs(delayMs);
-   RETURN_ON_MM_ERROR ( GetSerialAnswer(port_.c_str(), replyTerminator, serialAnswer_) );
+   // identical status queries from different peripherals waiting to be sent are sent only once
+   string answer;
+   RETURN_ON_MM_ERROR ( commandQueue_.Query(command, replyTerminator, delayMs, IsStatusQuery(command), answer) );
+   SerialCommand() = command;
+   SerialAnswer() = answer;
    return DEVICE_OK;
 }
 
+ASIHub::ThreadId ASIHub::CurrentThreadId()
+{
+#ifdef WIN32
+   return ::GetCurrentThreadId();
+#else
+   return ::pthread_self();
+#endif
+}
+
+ASIHub::SerialExchange& ASIHub::LastExchange() const
+{
+   // entries are never removed, so the reference stays valid after the lock is released
+   MMThreadGuard g(exchangesLock_);
+   return exchanges_[CurrentThreadId()];
+}
+
+bool ASIHub::IsStatusQuery(const string& command)
+{
+   // "/" is the controller status, "<cmd> <axis>?" queries don't change anything
+   return (command == "/") || (!command.empty() && command[command.size()-1] == '?');
+}
+
 int ASIHub::QueryCommandVerify(const char *command, const char *expectedReplyPrefix, const char *replyTerminator, const long delayMs)
 {
    RETURN_ON_MM_ERROR ( QueryCommand(command, replyTerminator, delayMs) );
    // if doesn't match expected prefix, then look for ASI error code
-   if (serialAnswer_.substr(0, strlen(expectedReplyPrefix)).compare(expectedReplyPrefix) != 0)
+   if (SerialAnswer().substr(0, strlen(expectedReplyPrefix)).compare(expectedReplyPrefix) != 0)
    {
       int errNo = ParseErrorReply();
       return errNo;
@@ -168,9 +198,9 @@ int ASIHub::QueryCommandVerify(const char *command, const char *expectedReplyPre
 
 int ASIHub::ParseErrorReply() const
 {
-   if (serialAnswer_.substr(0, 2).compare(":N") == 0 && serialAnswer_.length() > 2)
+   if (SerialAnswer().substr(0, 2).compare(":N") == 0 && SerialAnswer().length() > 2)
    {
-      int errNo = atoi(serialAnswer_.substr(3).c_str());
+      int errNo = atoi(SerialAnswer().substr(3).c_str());
       return ERR_ASICODE_OFFSET + errNo;
     }
     return ERR_UNRECOGNIZED_ANSWER;
@@ -178,187 +208,187 @@ int ASIHub::ParseErrorReply() const
 
 int ASIHub::ParseAnswerAfterEquals(double &val)
 {
-   size_t pos = serialAnswer_.find("=");
-   if ((pos == string::npos) || ((pos+1) >= serialAnswer_.length()))
+   size_t pos = SerialAnswer().find("=");
+   if ((pos == string::npos) || ((pos+1) >= SerialAnswer().length()))
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atof(serialAnswer_.substr(serialAnswer_.find("=")+1).c_str());
+   val = atof(SerialAnswer().substr(SerialAnswer().find("=")+1).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterEquals(long &val)
 {
-   size_t pos = serialAnswer_.find("=");
-   if ((pos == string::npos) || ((pos+1) >= serialAnswer_.length()))
+   size_t pos = SerialAnswer().find("=");
+   if ((pos == string::npos) || ((pos+1) >= SerialAnswer().length()))
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atol(serialAnswer_.substr(serialAnswer_.find("=")+1).c_str());
+   val = atol(SerialAnswer().substr(SerialAnswer().find("=")+1).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterEquals(unsigned int &val)
 {
-   size_t pos = serialAnswer_.find("=");
-   if ((pos == string::npos) || ((pos+1) >= serialAnswer_.length()))
+   size_t pos = SerialAnswer().find("=");
+   if ((pos == string::npos) || ((pos+1) >= SerialAnswer().length()))
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atol(serialAnswer_.substr(serialAnswer_.find("=")+1).c_str());
+   val = atol(SerialAnswer().substr(SerialAnswer().find("=")+1).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterUnderscore(unsigned int &val)
 {
-   size_t pos = serialAnswer_.find("_");
-   if ((pos == string::npos) || ((pos+1) >= serialAnswer_.length()))
+   size_t pos = SerialAnswer().find("_");
+   if ((pos == string::npos) || ((pos+1) >= SerialAnswer().length()))
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atol(serialAnswer_.substr(serialAnswer_.find("_")+1).c_str());
+   val = atol(SerialAnswer().substr(SerialAnswer().find("_")+1).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterColon(double &val)
 {
-   size_t pos = serialAnswer_.find(":");
-   if ((pos == string::npos) || ((pos+1) >= serialAnswer_.length()))
+   size_t pos = SerialAnswer().find(":");
+   if ((pos == string::npos) || ((pos+1) >= SerialAnswer().length()))
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atof(serialAnswer_.substr(serialAnswer_.find(":")+1).c_str());
+   val = atof(SerialAnswer().substr(SerialAnswer().find(":")+1).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterColon(long& val)
 {
-   size_t pos = serialAnswer_.find(":");
-   if ((pos == string::npos) || ((pos+1) >= serialAnswer_.length()))
+   size_t pos = SerialAnswer().find(":");
+   if ((pos == string::npos) || ((pos+1) >= SerialAnswer().length()))
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atol(serialAnswer_.substr(serialAnswer_.find(":")+1).c_str());
+   val = atol(SerialAnswer().substr(SerialAnswer().find(":")+1).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterPosition(unsigned int pos, double &val)
 {
    // specify position as 3 to parse skipping the first 3 characters, e.g. for ":A 45.1"
-   if (pos >= serialAnswer_.length())
+   if (pos >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atof(serialAnswer_.substr(pos).c_str());
+   val = atof(SerialAnswer().substr(pos).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterPosition(unsigned int pos, long &val)
 {
    // specify position as 3 to parse skipping the first 3 characters, e.g. for ":A 45.1"
-   if (pos >= serialAnswer_.length())
+   if (pos >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atol(serialAnswer_.substr(pos).c_str());
+   val = atol(SerialAnswer().substr(pos).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterPosition(unsigned int pos, unsigned int &val)
 {
    // specify position as 3 to parse skipping the first 3 characters, e.g. for ":A 45.1"
-   if (pos >= serialAnswer_.length())
+   if (pos >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = (unsigned int)atol(serialAnswer_.substr(pos).c_str());
+   val = (unsigned int)atol(SerialAnswer().substr(pos).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterPosition2(double &val)
 {
-   if (2 >= serialAnswer_.length())
+   if (2 >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atof(serialAnswer_.substr(2).c_str());
+   val = atof(SerialAnswer().substr(2).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterPosition2(long &val)
 {
-   if (2 >= serialAnswer_.length())
+   if (2 >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atol(serialAnswer_.substr(2).c_str());
+   val = atol(SerialAnswer().substr(2).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterPosition2(unsigned int &val)
 {
-   if (2 >= serialAnswer_.length())
+   if (2 >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = (unsigned int)atol(serialAnswer_.substr(2).c_str());
+   val = (unsigned int)atol(SerialAnswer().substr(2).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterPosition3(double &val)
 {
-   if (3 >= serialAnswer_.length())
+   if (3 >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atof(serialAnswer_.substr(3).c_str());
+   val = atof(SerialAnswer().substr(3).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterPosition3(long &val)
 {
-   if (3 >= serialAnswer_.length())
+   if (3 >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = atol(serialAnswer_.substr(3).c_str());
+   val = atol(SerialAnswer().substr(3).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::ParseAnswerAfterPosition3(unsigned int &val)
 {
-   if (3 >= serialAnswer_.length())
+   if (3 >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = (unsigned int)atol(serialAnswer_.substr(3).c_str());
+   val = (unsigned int)atol(SerialAnswer().substr(3).c_str());
    return DEVICE_OK;
 }
 
 int ASIHub::GetAnswerCharAtPosition(unsigned int pos, char &val)
 {
-   if (pos >= serialAnswer_.length())
+   if (pos >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = serialAnswer_.at(pos);
+   val = SerialAnswer().at(pos);
    return DEVICE_OK;
 }
 
 int ASIHub::GetAnswerCharAtPosition3(char &val)
 {
-   if (3 >= serialAnswer_.length())
+   if (3 >= SerialAnswer().length())
    {
       return ERR_UNRECOGNIZED_ANSWER;
    }
-   val = serialAnswer_.at(3);
+   val = SerialAnswer().at(3);
    return DEVICE_OK;
 }
 
 vector<string> ASIHub::SplitAnswerOnDelim(string delim) const
 {
    vector<string> elems;
-   CDeviceUtils::Tokenize(serialAnswer_, elems, delim);
+   CDeviceUtils::Tokenize(SerialAnswer(), elems, delim);
    return elems;
 }
 
@@ -576,7 +606,7 @@ int ASIHub::OnSerialCommand(MM::PropertyBase* pProp, MM::ActionType eAct)
          last_command = tmpstr;
          QueryCommand(tmpstr);
          // TODO add some sort of check if command was successful, update manualSerialAnswer_ accordingly (e.g. leave blank for invalid command like aoeu)
-         manualSerialAnswer_ = serialAnswer_;  // remember this reply even if SendCommand is called elsewhere
+         manualSerialAnswer_ = SerialAnswer();  // remember this reply even if SendCommand is called elsewhere
       }
    }
    return DEVICE_OK;
@@ -641,6 +671,21 @@ int ASIHub::OnSerialCommandRepeatPeriod(MM::PropertyBase* pProp, MM::ActionType
    return DEVICE_OK;
 }
 
+int ASIHub::OnSerialCommandPipelineDepth(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)commandQueue_.GetMaxOutstanding());
+   }
+   else if (eAct == MM::AfterSet) {
+      long tmp = 1;
+      pProp->Get(tmp);
+      if (tmp < 1) tmp = 1;
+      commandQueue_.SetMaxOutstanding((unsigned)tmp);
+   }
+   return DEVICE_OK;
+}
+
 int ASIHub::OnSerialCommandOnlySendChanged(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    string tmpstr;
@@ -29,6 +29,7 @@
 #include "../../MMDevice/MMDevice.h"
 #include "../../MMDevice/DeviceBase.h"
 #include "../../MMDevice/DeviceThreads.h"
+#include "../../MMDevice/HubCommandQueue.h"
 #include <string>
 
 using namespace std;
@@ -82,9 +83,10 @@ public:
       { return QueryCommandVerify(command.c_str(), expectedReplyPrefix.c_str(), replyTerminator.c_str(), delayMs); }
 
    // accessing serial commands and answers
-   string LastSerialAnswer() const { return serialAnswer_; } // use with caution!; crashes to access something that doesn't exist!
-   string LastSerialCommand() const { return serialCommand_; }
-   void SetLastSerialAnswer(string s) { serialAnswer_ = s; }  // used to parse subsets of full answer for commands like PZINFO using "Split" functions
+   // the last command and answer are kept for each calling thread, so that peripherals using the hub at the same time don't see each other's replies
+   string LastSerialAnswer() const { return SerialAnswer(); } // use with caution!; crashes to access something that doesn't exist!
+   string LastSerialCommand() const { return SerialCommand(); }
+   void SetLastSerialAnswer(string s) { SerialAnswer() = s; }  // used to parse subsets of full answer for commands like PZINFO using "Split" functions
 
    // Interpreting serial response
    int ParseAnswerAfterEquals(double &val);  // finds next number after equals sign and returns as float
@@ -138,25 +140,55 @@ public:
    int OnSerialCommandRepeatDuration(MM::PropertyBase* pProp, MM::ActionType eAct);
    int OnSerialCommandRepeatPeriod  (MM::PropertyBase* pProp, MM::ActionType eAct);
    int OnSerialCommandOnlySendChanged(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSerialCommandPipelineDepth (MM::PropertyBase* pProp, MM::ActionType eAct);
 
 protected:
    string port_;         // port to use for communication
 
 private:
+   // serial port as seen by commandQueue_
+   class SerialTransport : public HubCommandQueue::Transport
+   {
+   public:
+      SerialTransport(ASIHub* hub) : hub_(hub) { }
+      int Purge() { return hub_->PurgeComPort(hub_->port_.c_str()); }
+      int Send(const string& command) { return hub_->SendSerialCommand(hub_->port_.c_str(), command.c_str(), "\r"); }
+      int Receive(const string& terminator, string& reply) { return hub_->GetSerialAnswer(hub_->port_.c_str(), terminator.c_str(), reply); }
+   private:
+      ASIHub* hub_;
+   };
+
+#ifdef WIN32
+   typedef DWORD ThreadId;
+#else
+   typedef pthread_t ThreadId;
+#endif
+   struct SerialExchange
+   {
+      string command;
+      string answer;
+   };
+   static ThreadId CurrentThreadId();
+   SerialExchange& LastExchange() const;  // of the calling thread
+   string& SerialAnswer() const { return LastExchange().answer; }
+   string& SerialCommand() const { return LastExchange().command; }
+
 	int ParseErrorReply() const;
+	static bool IsStatusQuery(const string& command);
 	static string EscapeControlCharacters(const string v);
 	static string UnescapeControlCharacters(const string v0 );
 	static vector<char> ConvertStringVector2CharVector(const vector<string> v);
 	static vector<int> ConvertStringVector2IntVector(const vector<string> v);
 
-   string serialAnswer_;      // the last answer received from any communication with the controller
    string manualSerialAnswer_; // last answer received when the SerialCommand property was used
-   string serialCommand_;     // the last command sent, or can be set for calling commands without args
+   mutable MMThreadLock exchangesLock_;
+   mutable map<ThreadId, SerialExchange> exchanges_;  // the last command sent and answer received, by calling thread
    string serialTerminator_;  // only used when parsing command sent via OnSerialCommand action handler
    long serialRepeatDuration_; // for how long total time the command is repeatedly sent
    long serialRepeatPeriod_;  // how often in ms the command is sent
    bool serialOnlySendChanged_;        // if true the serial command is only sent when it has changed
-   MMThreadLock threadLock_;  // used to lock thread during serial transaction
+   SerialTransport transport_;
+   HubCommandQueue commandQueue_;  // serializes (and pipelines) the serial transactions of all peripherals
    bool updatingSharedProperties_;
    map<string, string> deviceMap_;  // to implement properties shared between devices
         // key is the device name, value is the Tiger address (normally a single character, see note about addressChar_ in ASIPeripheralBase)
@@ -160,6 +160,7 @@ const char* const g_SerialTerminatorPropertyName = "SerialResponseTerminator";
 const char* const g_SerialCommandOnlySendChangedPropertyName = "OnlySendSerialCommandOnChange";
 const char* const g_SerialCommandRepeatDurationPropertyName = "SerialCommandRepeatDuration(s)";
 const char* const g_SerialCommandRepeatPeriodPropertyName = "SerialCommandRepeatPeriod(ms)";
+const char* const g_SerialCommandPipelineDepthPropertyName = "SerialCommandPipelineDepth";
 const char* const g_SerialComPortPropertyName = "SerialComPort";
 
 // motorized stage property names (XY and Z)
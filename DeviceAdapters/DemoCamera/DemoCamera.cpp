@@ -1058,27 +1058,30 @@ int CDemoCamera::StartSequenceAcquisition(long numImages, double interval_ms, bo
 }
 
 /*
- * Inserts Image and MetaData into MMCore circular Buffer
+ * Metadata generated for each image of a sequence
  */
-int CDemoCamera::InsertImage()
+MM::FrameMetadata CDemoCamera::GetSequenceImageMetadata()
 {
    MM::MMTime timeStamp = this->GetCurrentMMTime();
-   char label[MM::MaxStrLength];
-   this->GetLabel(label);
  
    // Important:  metadata about the image are generated here:
-   Metadata md;
-   md.put("Camera", label);
-   md.put(MM::g_Keyword_Metadata_StartTime, CDeviceUtils::ConvertToString(sequenceStartTime_.getMsec()));
-   md.put(MM::g_Keyword_Elapsed_Time_ms, CDeviceUtils::ConvertToString((timeStamp - sequenceStartTime_).getMsec()));
-   md.put(MM::g_Keyword_Metadata_ROI_X, CDeviceUtils::ConvertToString( (long) roiX_)); 
-   md.put(MM::g_Keyword_Metadata_ROI_Y, CDeviceUtils::ConvertToString( (long) roiY_)); 
+   // (the Core adds the camera label)
+   MM::FrameMetadata md;
+   md.SetStartTimeMs(sequenceStartTime_.getMsec());
+   md.SetElapsedTimeMs((timeStamp - sequenceStartTime_).getMsec());
+   md.SetROI((long) roiX_, (long) roiY_);
+   md.SetBinning(binSize_);
+   return md;
+}
 
-   imageCounter_++;
+/*
+ * Inserts Image and MetaData into MMCore circular Buffer
+ */
+int CDemoCamera::InsertImage()
+{
+   MM::FrameMetadata md = GetSequenceImageMetadata();
 
-   char buf[MM::MaxStrLength];
-   GetProperty(MM::g_Keyword_Binning, buf);
-   md.put(MM::g_Keyword_Binning, buf);
+   imageCounter_++;
 
    MMThreadGuard g(imgPixelsLock_);
 
@@ -1089,13 +1092,13 @@ int CDemoCamera::InsertImage()
    unsigned int h = GetImageHeight();
    unsigned int b = GetImageBytesPerPixel();
 
-   int ret = GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_, md.Serialize().c_str());
+   int ret = GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_, md);
    if (!stopOnOverflow_ && ret == DEVICE_BUFFER_OVERFLOW)
    {
       // do not stop on overflow - just reset the buffer
       GetCoreCallback()->ClearImageBuffer(this);
       // don't process this same image again...
-      return GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_, md.Serialize().c_str(), false);
+      return GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_, md, false);
    }
    else
    {
@@ -1103,14 +1106,41 @@ int CDemoCamera::InsertImage()
    }
 }
 
+/*
+ * Generates the next image directly in a slot of the MMCore circular buffer,
+ * so that neither img_ nor a copy of it is involved
+ */
+int CDemoCamera::InsertSyntheticImageInPlace(double exposure)
+{
+   unsigned int w = GetImageWidth();
+   unsigned int h = GetImageHeight();
+   unsigned int b = GetImageBytesPerPixel();
+
+   unsigned char* pixels = 0;
+   int ret = GetCoreCallback()->AcquireFrameSlot(this, w, h, b, nComponents_, pixels);
+   if (!stopOnOverflow_ && ret == DEVICE_BUFFER_OVERFLOW)
+   {
+      // do not stop on overflow - just reset the buffer
+      GetCoreCallback()->ClearImageBuffer(this);
+      ret = GetCoreCallback()->AcquireFrameSlot(this, w, h, b, nComponents_, pixels);
+   }
+   if (ret != DEVICE_OK)
+      return ret;
+
+   ImgBuffer slotImg(pixels, w, h, b);
+   GenerateSyntheticImage(slotImg, exposure);
+
+   MM::FrameMetadata md = GetSequenceImageMetadata();
+   imageCounter_++;
+   return GetCoreCallback()->CommitFrameSlot(this, pixels, md);
+}
+
 /*
  * Do actual capturing
  * Called from inside the thread  
  */
 int CDemoCamera::RunSequenceOnThread(MM::MMTime startTime)
 {
-   int ret=DEVICE_ERR;
-   
    // Trigger
    if (triggerDevice_.length() > 0) {
       MM::Device* triggerDev = GetDevice(triggerDevice_.c_str());
@@ -1122,11 +1152,6 @@ int CDemoCamera::RunSequenceOnThread(MM::MMTime startTime)
 
    double exposure = GetSequenceExposure();
 
-   if (!fastImage_)
-   {
-      GenerateSyntheticImage(img_, exposure);
-   }
-
    // Simulate exposure duration
    double finishTime = exposure * (imageCounter_ + 1);
    while ((GetCurrentMMTime() - startTime).getMsec() < finishTime)
@@ -1134,13 +1159,12 @@ int CDemoCamera::RunSequenceOnThread(MM::MMTime startTime)
       CDeviceUtils::SleepMs(1);
    }
 
-   ret = InsertImage();
-
-   if (ret != DEVICE_OK)
+   if (fastImage_)
    {
-      return ret;
+      // Reinsert the same image
+      return InsertImage();
    }
-   return ret;
+   return InsertSyntheticImageInPlace(exposure);
 };
 
 bool CDemoCamera::IsCapturing() {
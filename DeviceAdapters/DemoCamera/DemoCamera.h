@@ -153,6 +153,7 @@ public:
    int StartSequenceAcquisition(long numImages, double interval_ms, bool stopOnOverflow);
    int StopSequenceAcquisition();
    int InsertImage();
+   int InsertSyntheticImageInPlace(double exposure);
    int RunSequenceOnThread(MM::MMTime startTime);
    bool IsCapturing();
    void OnThreadExiting() throw(); 
@@ -210,6 +211,7 @@ public:
 
 private:
    int SetAllowedBinning();
+   MM::FrameMetadata GetSequenceImageMetadata();
    void TestResourceLocking(const bool);
    void GenerateEmptyImage(ImgBuffer& img);
    void GenerateSyntheticImage(ImgBuffer& img, double exp);
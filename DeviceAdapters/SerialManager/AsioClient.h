@@ -29,7 +29,11 @@
 #include <boost/asio/serial_port.hpp>
 #include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
 
+#include <algorithm>
 #include <deque>
 #include <exception>
 #include <string>
@@ -270,7 +274,7 @@ public:
    {
       // clear read buffer;
       {
-      MMThreadGuard g(readBufferLock_);
+      boost::mutex::scoped_lock g(readBufferLock_);
       data_read_.clear();
       }
 
@@ -286,7 +290,7 @@ public:
    bool ReadOneCharacter(char& msg)
    {
       bool retval = false;
-      MMThreadGuard g(readBufferLock_);
+      boost::mutex::scoped_lock g(readBufferLock_);
       if( 0 < data_read_.size())
       {
          retval = true;
@@ -296,6 +300,47 @@ public:
       return retval;
    }
 
+   // read up to maxLen characters that are available, without waiting.
+   // ret. is the number of characters read.
+   size_t ReadCharacters(char* buf, size_t maxLen)
+   {
+      boost::mutex::scoped_lock g(readBufferLock_);
+      size_t count = (std::min)(maxLen, data_read_.size());
+      std::copy(data_read_.begin(), data_read_.begin() + count, buf);
+      data_read_.erase(data_read_.begin(), data_read_.begin() + count);
+      return count;
+   }
+
+   // Read characters into buf, starting at pos, until the last characters
+   // read are term, buf is full, or timeout has elapsed. Sleeps until
+   // characters arrive rather than polling. Characters following the
+   // terminator are left for the next read. ret. is true if term was found
+   // (never, if term is empty).
+   bool ReadUntil(char* buf, size_t bufLen, size_t& pos,
+         const std::string& term,
+         const boost::posix_time::time_duration& timeout)
+   {
+      const boost::system_time deadline = boost::get_system_time() + timeout;
+      boost::mutex::scoped_lock g(readBufferLock_);
+      for (;;)
+      {
+         while (!data_read_.empty() && pos < bufLen)
+         {
+            buf[pos++] = data_read_.front();
+            data_read_.pop_front();
+
+            // Only the newly read character can complete the terminator
+            if (!term.empty() && pos >= term.size() &&
+                  std::equal(term.begin(), term.end(), buf + pos - term.size()))
+               return true;
+         }
+         if (pos >= bufLen || !active_)
+            return false;
+         if (!dataAvailable_.timed_wait(g, deadline) && data_read_.empty())
+            return false;
+      }
+   }
+
    void ShutDownInProgress(const bool v){ shutDownInProgress_ = v;};
 
 
@@ -329,13 +374,10 @@ private:
       if (!error) 
       { // read completed, so process the data 
          {
-            MMThreadGuard g(readBufferLock_);
-            for(unsigned int ib = 0; ib < bytes_transferred; ++ib)
-            {
-               data_read_.push_back(read_msg_[ib]);
-            }
+            boost::mutex::scoped_lock g(readBufferLock_);
+            data_read_.insert(data_read_.end(), read_msg_, read_msg_ + bytes_transferred);
          }
-         CDeviceUtils::SleepMs(1);
+         dataAvailable_.notify_all();
          ReadStart(); // start waiting for another asynchronous read again 
       } 
       else 
@@ -414,7 +456,12 @@ private:
          MMThreadGuard g(implementationLock_);
          serialPortImplementation_.close(); 
       }
-      active_ = false; 
+      {
+         // Wake up readers, which then stop waiting
+         boost::mutex::scoped_lock g(readBufferLock_);
+         active_ = false; 
+      }
+      dataAvailable_.notify_all();
    } 
 
 
@@ -428,7 +475,8 @@ private:
    SerialPort* pSerialPortAdapter_;
    std::string device_;
 
-   MMThreadLock readBufferLock_;
+   boost::mutex readBufferLock_;
+   boost::condition_variable dataAvailable_; // signaled when data_read_ grows
    MMThreadLock writeBufferLock_;
    MMThreadLock implementationLock_;
    bool shutDownInProgress_;
@@ -44,6 +44,7 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
@@ -353,7 +354,9 @@ SerialPort::SerialPort(const char* portName) :
    pPort_(0),
    pThread_(0),
    verbose_(true),
-   dtrEnable_(true)
+   dtrEnable_(true),
+   commandTime_(0.0),
+   commandPending_(false)
 {
 
    portName_ = portName;
@@ -448,6 +451,10 @@ SerialPort::SerialPort(const char* portName) :
    AddAllowedValue("Verbose", "0");
    AddAllowedValue("Verbose", "1");
 
+   // latency of answers, from the command (or from the call to GetAnswer())
+   CPropertyAction* pActLatency = new CPropertyAction (this, &SerialPort::OnAnswerLatency);
+   ret = CreateProperty("AnswerLatencyHistogram", "", MM::String, true, pActLatency);
+   assert(ret == DEVICE_OK);
 }
 
 SerialPort::~SerialPort()
@@ -687,6 +694,9 @@ int SerialPort::SetCommand(const char* command, const char* term)
       return DEVICE_OK;
    }
 
+   commandTime_ = GetCurrentMMTime();
+   commandPending_ = true;
+
    if (transmitCharWaitMs_ < 0.001)
    {
       pPort_->WriteCharactersAsynchronously(sendText.c_str(), sendText.length());
@@ -715,68 +725,64 @@ int SerialPort::GetAnswer(char* answer, unsigned bufLen, const char* term)
       LogMessage("BUFFER_OVERRUN error occured!");
       return ERR_BUFFER_OVERRUN;
    }
-   std::ostringstream logMsg;
-   unsigned long answerOffset = 0;
    memset(answer,0,bufLen);
-   char theData = 0;
 
    MM::MMTime startTime = GetCurrentMMTime();
-   MM::MMTime answerTimeout(answerTimeoutMs_ * 1000.0);
-   MM::MMTime nonTerminatedAnswerTimeout(5.0 * 1000.0); // For bug-compatibility
-   while ((GetCurrentMMTime() - startTime)  < answerTimeout)
+   MM::MMTime transactionStart = commandPending_ ? commandTime_ : startTime;
+   commandPending_ = false;
+
+   const std::string terminator(term ? term : "");
+   double timeoutMs = answerTimeoutMs_;
+   const double nonTerminatedAnswerTimeoutMs = 5.0 * 1000.0; // For bug-compatibility
+   if (terminator.empty())
+      timeoutMs = (std::min)(timeoutMs, nonTerminatedAnswerTimeoutMs);
+
+   // Read the whole answer at once, waking up as characters arrive. The
+   // answer is always null-terminated, because the terminator is erased.
+   size_t answerOffset = 0;
+   bool terminated = pPort_->ReadUntil(answer, bufLen, answerOffset, terminator,
+         boost::posix_time::microseconds(static_cast<long>(timeoutMs * 1000.0)));
+
+   if (terminated)
    {
-      bool anyRead =  pPort_->ReadOneCharacter(theData);        
-      if( anyRead )
-      {
-         if (bufLen <= answerOffset)
-         {
-            answer[answerOffset] = '\0';
-            LogMessage("BUFFER_OVERRUN error occured!");
-            return ERR_BUFFER_OVERRUN;
-         }
-         answer[answerOffset++] = theData;
-      }
-      else
-      {
-         //Yield to other threads:
-         CDeviceUtils::SleepMs(1);
-      }
+      MM::MMTime now = GetCurrentMMTime();
+      answerLatency_.Add((now - transactionStart).getMsec());
 
-      // look for the terminator, if any
-      if (term && term[0])
-      {
-         // check for terminating sequence
-         char* termPos = strstr(answer, term);
-         if (termPos != 0) // found the terminator
-         {
-            LogAsciiCommunication("GetAnswer", true, answer);
+      LogAsciiCommunication("GetAnswer", true, std::string(answer, answerOffset));
 
-            // erase the terminator from the answer:
-            *termPos = '\0';
+      // erase the terminator from the answer:
+      answer[answerOffset - terminator.size()] = '\0';
 
-            return DEVICE_OK;
-         }
-      }
-      else
-      {
-         // XXX Shouldn't it be an error to not have a terminator?
-         // TODO Make it a precondition check (immediate error) once we've made
-         // sure that no device adapter calls us without a terminator. For now,
-         // keep the behavior for the sake of bug-compatibility.
+      return DEVICE_OK;
+   }
 
-         MM::MMTime elapsed = GetCurrentMMTime() - startTime;
-         if (elapsed > nonTerminatedAnswerTimeout)
-         {
-            LogAsciiCommunication("GetAnswer", true, answer);
-            long millisecs = static_cast<long>(elapsed.getMsec());
-            LogMessage(("GetAnswer without terminator returning after " +
-                     boost::lexical_cast<std::string>(millisecs) +
-                     "msec").c_str(), true);
-            return DEVICE_OK;
-         }
+   if (answerOffset >= bufLen)
+   {
+      answer[bufLen - 1] = '\0';
+      LogMessage("BUFFER_OVERRUN error occured!");
+      return ERR_BUFFER_OVERRUN;
+   }
+
+   if (terminator.empty())
+   {
+      // XXX Shouldn't it be an error to not have a terminator?
+      // TODO Make it a precondition check (immediate error) once we've made
+      // sure that no device adapter calls us without a terminator. For now,
+      // keep the behavior for the sake of bug-compatibility.
+
+      MM::MMTime elapsed = GetCurrentMMTime() - startTime;
+      if (elapsed.getMsec() >= nonTerminatedAnswerTimeoutMs)
+      {
+         LogAsciiCommunication("GetAnswer", true, answer);
+         long millisecs = static_cast<long>(elapsed.getMsec());
+         LogMessage(("GetAnswer without terminator returning after " +
+                  boost::lexical_cast<std::string>(millisecs) +
+                  "msec").c_str(), true);
+         return DEVICE_OK;
       }
    }
 
+   answerLatency_.AddTimeout();
    LogMessage("TERM_TIMEOUT error occured!");
    return ERR_TERM_TIMEOUT;
 }
@@ -790,6 +796,9 @@ int SerialPort::Write(const unsigned char* buf, unsigned long bufLen)
       return DEVICE_OK;
    }
 
+   commandTime_ = GetCurrentMMTime();
+   commandPending_ = true;
+
    if (transmitCharWaitMs_ < 0.001)
    {
       pPort_->WriteCharactersAsynchronously(reinterpret_cast<const char*>(buf), bufLen);
@@ -821,26 +830,8 @@ int SerialPort::Read(unsigned char* buf, unsigned long bufLen, unsigned long& ch
       memset(buf, 0, bufLen);
       charsRead = 0;
       
-      bool anyRead = false;
-      char theData = 0;
-      for( ;; )
-      {
-         anyRead = pPort_->ReadOneCharacter(theData); 
-         if( anyRead)
-         {
-            buf[charsRead] = (unsigned char)theData;
-            if( bufLen <= ++charsRead)
-            {
-               // buffer is full
-               break;
-            }
-         }
-         else
-         {
-            // no data was available
-            break;
-         }
-      }
+      charsRead = static_cast<unsigned long>(
+            pPort_->ReadCharacters(reinterpret_cast<char*>(buf), bufLen));
       if( 0 < charsRead)
       {
          if(verbose_)
@@ -1036,6 +1027,95 @@ int SerialPort::OnDelayBetweenCharsMs(MM::PropertyBase* pProp, MM::ActionType eA
 }
 
 
+int SerialPort::OnAnswerLatency(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(answerLatency_.Format().c_str());
+   }
+
+   return DEVICE_OK;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// LatencyHistogram
+//
+const double LatencyHistogram::firstBucketMs_ = 0.0625;
+
+void LatencyHistogram::Add(double latencyMs)
+{
+   MMThreadGuard g(lock_);
+   int bucket = 0;
+   while (bucket < bucketCount_ - 1 && latencyMs > BucketLimitMs(bucket))
+      ++bucket;
+   ++counts_[bucket];
+   ++total_;
+   sumMs_ += latencyMs;
+   if (latencyMs > maxMs_)
+      maxMs_ = latencyMs;
+}
+
+void LatencyHistogram::AddTimeout()
+{
+   MMThreadGuard g(lock_);
+   ++timeouts_;
+}
+
+void LatencyHistogram::Clear()
+{
+   MMThreadGuard g(lock_);
+   for (int i = 0; i < bucketCount_; ++i)
+      counts_[i] = 0;
+   total_ = 0;
+   timeouts_ = 0;
+   sumMs_ = 0.0;
+   maxMs_ = 0.0;
+}
+
+double LatencyHistogram::BucketLimitMs(int bucket) const
+{
+   return firstBucketMs_ * (1L << bucket);
+}
+
+// Upper limit of the bucket holding the given fraction of latencies
+double LatencyHistogram::PercentileLimitMs(double fraction) const
+{
+   long cumulative = 0;
+   for (int i = 0; i < bucketCount_ - 1; ++i)
+   {
+      cumulative += counts_[i];
+      if (cumulative >= fraction * total_)
+         return BucketLimitMs(i);
+   }
+   return maxMs_;
+}
+
+std::string LatencyHistogram::Format()
+{
+   MMThreadGuard g(lock_);
+   std::ostringstream oss;
+   oss << "n=" << total_ << " timeouts=" << timeouts_;
+   if (total_ == 0)
+      return oss.str();
+
+   oss << " mean=" << sumMs_ / total_ << "ms" <<
+      " p50<=" << PercentileLimitMs(0.5) << "ms" <<
+      " p99<=" << PercentileLimitMs(0.99) << "ms" <<
+      " max=" << maxMs_ << "ms;";
+   for (int i = 0; i < bucketCount_; ++i)
+   {
+      if (counts_[i] == 0)
+         continue;
+      if (i < bucketCount_ - 1)
+         oss << " <=" << BucketLimitMs(i) << "ms:" << counts_[i];
+      else
+         oss << " >" << BucketLimitMs(i - 1) << "ms:" << counts_[i];
+   }
+   return oss.str();
+}
+
+
 // Helper functions for message logging
 // (TODO: Do these have any utility outside of SerialManager?)
 
@@ -66,6 +66,37 @@ class AsioClient;
 #define ERR_PORT_NOTINITIALIZED 111
 
 
+//////////////////////////////////////////////////////////////////////////////
+// Latency statistics of command/answer transactions
+//
+class LatencyHistogram
+{
+public:
+   LatencyHistogram() { Clear(); }
+
+   void Add(double latencyMs);
+   void AddTimeout();
+   void Clear();
+   // Count, percentiles and the nonempty buckets, as one line of text
+   std::string Format();
+
+private:
+   // Bucket i holds latencies up to 2^i * firstBucketMs_; the last bucket
+   // holds the longer ones
+   static const int bucketCount_ = 16;
+   static const double firstBucketMs_;
+   double BucketLimitMs(int bucket) const;
+   double PercentileLimitMs(double fraction) const;
+
+   MMThreadLock lock_;
+   long counts_[bucketCount_];
+   long total_;
+   long timeouts_;
+   double sumMs_;
+   double maxMs_;
+};
+
+
 //////////////////////////////////////////////////////////////////////////////
 // Implementation of the MMDevice and MMStateDevice interfaces
 //
@@ -112,6 +143,7 @@ public:
    int OnBaud(MM::PropertyBase* pProp, MM::ActionType eAct);
    int OnTimeout(MM::PropertyBase* pProp, MM::ActionType eAct);
    int OnDelayBetweenCharsMs(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnAnswerLatency(MM::PropertyBase* pProp, MM::ActionType eAct);
 
    int OnVerbose(MM::PropertyBase* pProp, MM::ActionType eAct);
 
@@ -148,6 +180,12 @@ private:
    bool verbose_; // if false, turn off LogBinaryMessage even in Debug Log
    bool dtrEnable_; // currently only used on Windows
 
+   // Time of the last command not yet answered, from which the latency of
+   // the answer is measured
+   MM::MMTime commandTime_;
+   bool commandPending_;
+   LatencyHistogram answerLatency_;
+
 #ifdef _WIN32
    int OpenWin32SerialPort(const std::string& portName, HANDLE& portHandle);
 #endif
@@ -0,0 +1,76 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Description of a multi-dimensional acquisition, image by
+//                image, for running it with hardware sequences
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "AcquisitionPlan.h"
+
+#include "../MMDevice/MMDevice.h"
+
+#include <sstream>
+
+
+AcquisitionEvent::AcquisitionEvent() :
+   hasZ_(false),
+   z_(0.0),
+   hasXY_(false),
+   x_(0.0),
+   y_(0.0),
+   hasExposure_(false),
+   exposureMs_(0.0)
+{
+}
+
+void AcquisitionEvent::setZPosition(double z)
+{
+   hasZ_ = true;
+   z_ = z;
+}
+
+void AcquisitionEvent::setXYPosition(double x, double y)
+{
+   hasXY_ = true;
+   x_ = x;
+   y_ = y;
+}
+
+void AcquisitionEvent::setExposure(double exposureMs)
+{
+   hasExposure_ = true;
+   exposureMs_ = exposureMs;
+}
+
+void AcquisitionEvent::setProperty(const char* label, const char* propName,
+      const char* value)
+{
+   properties_.addSetting(PropertySetting(label, propName, value));
+}
+
+void AcquisitionEvent::setProperties(const Configuration& config)
+{
+   for (size_t i = 0; i < config.size(); ++i)
+      properties_.addSetting(config.getSetting(i));
+}
+
+AcquisitionEvent AcquisitionPlan::getEvent(size_t index) const throw (CMMError)
+{
+   if (index >= events_.size())
+   {
+      std::ostringstream errTxt;
+      errTxt << (unsigned int)index << " - invalid acquisition event index";
+      throw CMMError(errTxt.str().c_str(), MMERR_DEVICE_GENERIC);
+   }
+   return events_[index];
+}
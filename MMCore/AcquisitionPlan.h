@@ -0,0 +1,79 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Description of a multi-dimensional acquisition, image by
+//                image, for running it with hardware sequences
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Configuration.h"
+
+#include <vector>
+
+/**
+ * The state of the hardware for one image of an acquisition: the focus
+ * (Z) position, the XY position, the exposure and any property values
+ * (e.g. the settings of a channel preset). Items that are not set keep
+ * their value from the previous image. Designed to be wrapped by SWIG.
+ */
+class AcquisitionEvent
+{
+public:
+   AcquisitionEvent();
+
+   void setZPosition(double z);
+   bool hasZPosition() const { return hasZ_; }
+   double getZPosition() const { return z_; }
+
+   void setXYPosition(double x, double y);
+   bool hasXYPosition() const { return hasXY_; }
+   double getXPosition() const { return x_; }
+   double getYPosition() const { return y_; }
+
+   void setExposure(double exposureMs);
+   bool hasExposure() const { return hasExposure_; }
+   double getExposure() const { return exposureMs_; }
+
+   void setProperty(const char* label, const char* propName, const char* value);
+   // Adds the settings of a configuration (e.g. a preset)
+   void setProperties(const Configuration& config);
+   Configuration getProperties() const { return properties_; }
+
+private:
+   bool hasZ_;
+   double z_;
+   bool hasXY_;
+   double x_;
+   double y_;
+   bool hasExposure_;
+   double exposureMs_;
+   Configuration properties_;
+};
+
+/**
+ * The images of an acquisition, in the order they are to be taken (e.g. a
+ * time point of a multi-position, multi-channel Z-stack). Designed to be
+ * wrapped by SWIG.
+ */
+class AcquisitionPlan
+{
+public:
+   void addEvent(const AcquisitionEvent& event) { events_.push_back(event); }
+   size_t size() const { return events_.size(); }
+   AcquisitionEvent getEvent(size_t index) const throw (CMMError);
+   void clear() { events_.clear(); }
+
+private:
+   std::vector<AcquisitionEvent> events_;
+};
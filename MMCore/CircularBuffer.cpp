@@ -3,10 +3,10 @@
 // PROJECT:       Micro-Manager
 // SUBSYSTEM:     MMCore
 //-----------------------------------------------------------------------------
-// DESCRIPTION:   Generic implementation of the circular buffer. The buffer
-//                allows only one thread to enter at a time by using a mutex lock.
-//                This makes the buffer susceptible to race conditions if the
-//                calling threads are mutually dependent.
+// DESCRIPTION:   Generic implementation of the circular buffer. Inserting
+//                threads are serialized by a mutex; readers use atomic
+//                indices and per-slot sequence numbers and never block the
+//                inserting thread.
 //              
 // COPYRIGHT:     University of California, San Francisco, 2007,
 //
@@ -26,32 +26,102 @@
 #include "CircularBuffer.h"
 #include "CoreUtils.h"
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
 #include "../MMDevice/DeviceUtils.h"
+#include "../MMDevice/MMDeviceConstants.h"
+
+#include <algorithm>
+#include <cstring>
 
 
 const long long bytesInMB = 1 << 20;
-const long adjustThreshold = LONG_MAX / 2;
 const unsigned long maxCBSize = 100000;    //a reasonable limit to circular buffer size
+const long long emptySlot = -1;            // slot sequence number of an empty or partially written slot
+const double maxPendingSlotWaitMs = 1000.0; // how long an insert waits for a slot reserved by AcquireSlot()
 
 CircularBuffer::CircularBuffer(unsigned int memorySizeMB) :
    width_(0), 
    height_(0), 
    pixDepth_(0), 
    imageCounter_(0), 
+   metadataKeys_(new mm::MetadataKeyTable()),
+   pendingIndex_(-1),
+   pendingComponents_(0),
    insertIndex_(0), 
    saveIndex_(0), 
    memorySizeMB_(memorySizeMB), 
-   overflow_(false)
+   numChannels_(0),
+   overflow_(false),
+   reallocate_(false),
+   overflowPolicy_(ReportOverflow),
+   overflowTimeoutMs_(0.0),
+   overflowCount_(0),
+   droppedCount_(0),
+   spilledCount_(0),
+   allocationTimeMs_(0.0),
+   hasHugePages_(false),
+   isNumaBound_(false),
+   firstPassInserts_(0),
+   firstPassTotalInsertUs_(0.0),
+   firstPassMaxInsertUs_(0.0),
+   spillCapacityMB_(4096),
+   spillHighWaterMark_(0.75),
+   spillFileCapacityMB_(0),
+   spillCount_(0),
+   migratorWakeRequested_(false),
+   migratorStopRequested_(false)
 {
 }
 
-CircularBuffer::~CircularBuffer() {}
+CircularBuffer::CircularBuffer(unsigned int memorySizeMB, boost::shared_ptr<mm::MetadataKeyTable> metadataKeys) :
+   width_(0), 
+   height_(0), 
+   pixDepth_(0), 
+   imageCounter_(0), 
+   metadataKeys_(metadataKeys),
+   pendingIndex_(-1),
+   pendingComponents_(0),
+   insertIndex_(0), 
+   saveIndex_(0), 
+   memorySizeMB_(memorySizeMB), 
+   numChannels_(0),
+   overflow_(false),
+   reallocate_(false),
+   overflowPolicy_(ReportOverflow),
+   overflowTimeoutMs_(0.0),
+   overflowCount_(0),
+   droppedCount_(0),
+   spilledCount_(0),
+   allocationTimeMs_(0.0),
+   hasHugePages_(false),
+   isNumaBound_(false),
+   firstPassInserts_(0),
+   firstPassTotalInsertUs_(0.0),
+   firstPassMaxInsertUs_(0.0),
+   spillCapacityMB_(4096),
+   spillHighWaterMark_(0.75),
+   spillFileCapacityMB_(0),
+   spillCount_(0),
+   migratorWakeRequested_(false),
+   migratorStopRequested_(false)
+{
+}
+
+CircularBuffer::~CircularBuffer()
+{
+   StopMigrator();
+}
 
 bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int h, unsigned int pixDepth)
 {
-   MMThreadGuard guard(g_bufferLock);
+   MMThreadGuard guard(insertLock_);
    imageNumbers_.clear();
 
+   // The migrator thread reads frameArray_; it is restarted when needed
+   StopMigrator();
+
    bool ret = true;
    try
    {
@@ -59,27 +129,47 @@ bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int
          return false; // does not make sense
 
       if (w == width_ && height_ == h && pixDepth_ == pixDepth && channels == numChannels_)
-         if (frameArray_.size() > 0)
+         if (frameArray_.size() > 0 && !reallocate_)
+         {
+            PrepareSpillFile();
             return true; // nothing to change
+         }
 
       width_ = w;
       height_ = h;
       pixDepth_ = pixDepth;
       numChannels_ = channels;
 
-      insertIndex_ = 0;
-      saveIndex_ = 0;
-      overflow_ = false;
+      insertIndex_.store(0);
+      saveIndex_.store(0);
+      overflow_.store(false);
+      reallocate_ = false;
+      pendingIndex_ = -1;
+      firstPassInserts_.store(0);
+      firstPassTotalInsertUs_.store(0.0);
+      firstPassMaxInsertUs_.store(0.0);
+
+      {
+         MMThreadGuard migrateGuard(migrateLock_);
+         MMThreadGuard spillGuard(spillLock_);
+         spill_.reset();
+         spillCount_.store(0);
+         spillPopFrame_.Clear();
+         spillPeekFrame_.Clear();
+      }
 
       // calculate the size of the entire buffer array once all images get allocated
       // the actual size at the time of the creation is going to be less, because
       // images are not allocated until pixels become available
-      unsigned long frameSizeBytes = width_ * height_ * pixDepth_ * numChannels_;
+      std::size_t frameSizeBytes = (std::size_t)width_ * height_ * pixDepth_ * numChannels_;
       unsigned long cbSize = (unsigned long) ((memorySizeMB_ * bytesInMB) / frameSizeBytes);
 
       if (cbSize == 0) 
       {
          frameArray_.resize(0);
+         slab_.reset();
+         slotSequence_.reset();
+         slotPins_.reset();
          return false; // memory footprint too small
       }
 
@@ -93,32 +183,58 @@ bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int
          frameArray_[i].Clear();
 
       // allocate buffers  - could conceivably throw an out-of-memory exception
+      slab_.reset();
+      slab_.reset(new mm::FrameSlab(cbSize * frameSizeBytes, slabOptions_));
+      allocationTimeMs_.store(slab_->GetAllocationTimeMs());
+      hasHugePages_.store(slab_->HasHugePages());
+      isNumaBound_.store(slab_->IsNumaBound());
+
       frameArray_.resize(cbSize);
       for (unsigned long i=0; i<frameArray_.size(); i++)
       {
          frameArray_[i].Resize(w, h, pixDepth);
-         frameArray_[i].Preallocate(numChannels_);
+         frameArray_[i].Preallocate(numChannels_, slab_->GetAddress() + i * frameSizeBytes);
       }
+
+      slotSequence_.reset(new boost::atomic<long long>[cbSize]);
+      for (unsigned long i=0; i<cbSize; i++)
+         slotSequence_[i].store(emptySlot);
+      // Leases of frames of the previous slots keep the previous counts
+      slotPins_.reset(new boost::atomic<int>[cbSize]);
+      for (unsigned long i=0; i<cbSize; i++)
+         slotPins_[i].store(0);
+
+      // Frames read back from the spill file
+      MMThreadGuard spillGuard(spillLock_);
+      spillPopFrame_.Resize(w, h, pixDepth);
+      spillPopFrame_.Preallocate(numChannels_);
+      spillPeekFrame_.Resize(w, h, pixDepth);
+      spillPeekFrame_.Preallocate(numChannels_);
    }
 
-   catch( ... /* std::bad_alloc& ex */)
+   catch( ... /* std::bad_alloc& ex, CMMError& ex */)
    {
       frameArray_.resize(0);
+      slab_.reset();
+      slotSequence_.reset();
+      slotPins_.reset();
       ret = false;
    }
+   if (ret)
+      PrepareSpillFile();
    return ret;
 }
 
 unsigned long CircularBuffer::GetSize() const
 {
-   MMThreadGuard guard(g_bufferLock);
    return (unsigned long)frameArray_.size();
 }
 
 unsigned long CircularBuffer::GetFreeSize() const
 {
-   MMThreadGuard guard(g_bufferLock);
-   long freeSize = (long)frameArray_.size() - (insertIndex_ - saveIndex_);
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+   long long freeSize = (long long)frameArray_.size() - (insertIndex - saveIndex);
    if (freeSize < 0)
       return 0;
    else
@@ -127,8 +243,100 @@ unsigned long CircularBuffer::GetFreeSize() const
 
 unsigned long CircularBuffer::GetRemainingImageCount() const
 {
-   MMThreadGuard guard(g_bufferLock);
-   return (unsigned long)(insertIndex_ - saveIndex_);
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+   unsigned long spilled = spillCount_.load(boost::memory_order_acquire);
+   if (insertIndex < saveIndex)
+      return spilled;
+   return (unsigned long)(insertIndex - saveIndex) + spilled;
+}
+
+/**
+* Discards all images not yet retrieved. May be called concurrently with
+* inserting and reading threads.
+*/
+void CircularBuffer::Clear()
+{
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   for (;;)
+   {
+      long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+      if (saveIndex >= insertIndex)
+         break;
+      if (saveIndex_.compare_exchange_weak(saveIndex, insertIndex,
+               boost::memory_order_acq_rel, boost::memory_order_acquire))
+         break;
+   }
+
+   {
+      MMThreadGuard spillGuard(spillLock_);
+      if (spill_)
+         spill_->Clear();
+      spillCount_.store(0, boost::memory_order_release);
+   }
+
+   overflow_.store(false, boost::memory_order_release);
+}
+
+void CircularBuffer::ClearAfterOverflow()
+{
+   droppedCount_ += GetRemainingImageCount();
+   Clear();
+}
+
+void CircularBuffer::SetOverflowPolicy(OverflowPolicy policy)
+{
+   overflowPolicy_.store(policy);
+   PrepareSpillFile();
+}
+
+void CircularBuffer::SetSpillDirectory(const std::string& directory)
+{
+   {
+      MMThreadGuard spillGuard(spillLock_);
+      spillDirectory_ = directory;
+   }
+   PrepareSpillFile();
+}
+
+void CircularBuffer::SetSpillCapacityMB(unsigned long capacityMB)
+{
+   spillCapacityMB_.store(capacityMB);
+   PrepareSpillFile();
+}
+
+std::string CircularBuffer::GetSpillDirectory() const
+{
+   MMThreadGuard spillGuard(spillLock_);
+   return spillDirectory_;
+}
+
+void CircularBuffer::SetAllocationOptions(const mm::FrameSlab::Options& options)
+{
+   MMThreadGuard guard(insertLock_);
+   slabOptions_ = options;
+   reallocate_ = true;
+}
+
+mm::FrameSlab::Options CircularBuffer::GetAllocationOptions() const
+{
+   MMThreadGuard guard(insertLock_);
+   return slabOptions_;
+}
+
+double CircularBuffer::GetFirstPassMeanInsertTimeUs() const
+{
+   const long long count = firstPassInserts_.load();
+   if (count == 0)
+      return 0.0;
+   return firstPassTotalInsertUs_.load() / count;
+}
+
+void CircularBuffer::ResetOverflowCounters()
+{
+   overflowCount_.store(0);
+   droppedCount_.store(0);
+   spilledCount_.store(0);
 }
 
 /**
@@ -144,196 +352,578 @@ bool CircularBuffer::InsertImage(const unsigned char* pixArray, unsigned int wid
 */
 bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, const Metadata* pMd) throw (CMMError)
 {
-   MMThreadGuard guard(g_insertLock);
+   // Without a component count, 4-byte pixels have always been taken to be RGB
+   const unsigned nComponents = (byteDepth == 4) ? 4 : 1;
+   return InsertMultiChannel(pixArray, numChannels, width, height, byteDepth, nComponents, pMd);
+}
+
+/**
+* Inserts a single image in the buffer.
+*/
+bool CircularBuffer::InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError)
+{
+    return InsertMultiChannel(pixArray, 1, width, height, byteDepth, nComponents, pMd);
+}
+ 
+/**
+* Inserts a multi-channel frame in the buffer.
+*/
+bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd) throw (CMMError)
+{
+   MM::FrameMetadata md;
+   boost::shared_ptr<const Metadata> tags;
+   LegacyMetadataToRecord(pMd, md, tags);
+   return InsertChannels(pixArray, numChannels, width, height, byteDepth, nComponents, md, tags);
+}
+
+/**
+* Inserts a single image in the buffer. The tags, if any, are added to those
+* in the record when the metadata is read; they are not copied.
+*/
+bool CircularBuffer::InsertImage(const unsigned char* pixArray, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const MM::FrameMetadata& md, const boost::shared_ptr<const Metadata>& tags) throw (CMMError)
+{
+   return InsertChannels(pixArray, 1, width, height, byteDepth, nComponents, md, tags);
+}
+
+bool CircularBuffer::InsertChannels(const unsigned char* pixArray, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const MM::FrameMetadata& md, const boost::shared_ptr<const Metadata>& tags) throw (CMMError)
+{
+   MMThreadGuard guard(insertLock_);
+   if (!WaitForPendingSlot())
+      return false;
 
-   mm::ImgBuffer* pImg;
    unsigned long singleChannelSize = (unsigned long)width * height * byteDepth;
 
-   {
-      MMThreadGuard guard(g_bufferLock);
+   // Checked before a slot is reserved, since the slot cannot be given back
+   if (numChannels > numChannels_)
+      return false;
+
+   long long insertIndex;
+   const InsertTarget target = BeginInsert(width, height, byteDepth, insertIndex);
+   if (target != InsertIntoRing)
+      return target == DropImage;
 
-      // check image dimensions
-      if (width != width_ || height != height_ || byteDepth != pixDepth_)
-         throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+   // Inserts into slots not yet written to are timed, to show the cost of
+   // page faults if the memory was not prefaulted
+   const bool firstPass = insertIndex < static_cast<long long>(frameArray_.size());
+   const MM::MMTime start = GetMMTimeNow();
 
-      bool overflowed = (insertIndex_ - saveIndex_) >= static_cast<long>(frameArray_.size());
-      if (overflowed) {
-         overflow_ = true;
+   // TODO: the same metadata is inserted for each channel ???
+   // Perhaps we need to add specific tags to each channel
+   MM::FrameMetadata stamped(md);
+   StampMetadata(stamped, tags.get(), width, height, byteDepth, nComponents);
+
+   mm::FrameBuffer& frame = frameArray_[(unsigned long)(insertIndex % frameArray_.size())];
+   for (unsigned i=0; i<numChannels; i++)
+   {
+      // we assume that all buffers are pre-allocated
+      mm::ImgBuffer* pImg = frame.FindImage(i);
+      if (!pImg)
+      {
+         // Publish the slot as it is rather than leave it invalidated
+         EndInsert(insertIndex);
          return false;
       }
+
+      pImg->SetMetadata(stamped, tags, metadataKeys_.get());
+      pImg->SetInsertTimeUs(start.getUsec());
+      pImg->SetPixels(pixArray + i*singleChannelSize);
    }
 
-   for (unsigned i=0; i<numChannels; i++)
+   if (firstPass)
+      RecordFirstPassInsert((GetMMTimeNow() - start).getUsec());
+
+   EndInsert(insertIndex);
+   if (AboveHighWaterMark())
+      WakeMigrator();
+   return true;
+}
+
+/**
+* Reserves the next slot so that the caller can write a single-channel frame
+* into it directly. Returns the slot's pixel memory, or null if the buffer is
+* full. On success, the slot stays reserved until CommitSlot() or
+* DiscardSlot() is called.
+*/
+unsigned char* CircularBuffer::AcquireSlot(unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents) throw (CMMError)
+{
+   MMThreadGuard guard(insertLock_);
+   if (!WaitForPendingSlot())
+      return 0;
+
+   long long insertIndex;
+   const InsertTarget target = BeginInsert(width, height, byteDepth, insertIndex);
+   mm::ImgBuffer* pImg = 0;
+   if (target == InsertIntoRing)
+      pImg = frameArray_[(unsigned long)(insertIndex % frameArray_.size())].FindImage(0);
+   // A frame that would be dropped cannot be written in place, so the
+   // camera is told about the overflow.
+   if (!pImg)
+      return 0;
+
+   pendingIndex_ = insertIndex;
+   pendingOwner_ = boost::this_thread::get_id();
+   pendingComponents_ = nComponents;
+   return pImg->GetPixelsRW();
+}
+
+/**
+* Publishes the slot reserved with AcquireSlot().
+*/
+bool CircularBuffer::CommitSlot(const unsigned char* pixels, const Metadata* pMd)
+{
+   MM::FrameMetadata md;
+   boost::shared_ptr<const Metadata> tags;
+   LegacyMetadataToRecord(pMd, md, tags);
+   return CommitSlot(pixels, md, tags);
+}
+
+bool CircularBuffer::CommitSlot(const unsigned char* pixels, const MM::FrameMetadata& md, const boost::shared_ptr<const Metadata>& tags)
+{
+   MMThreadGuard guard(insertLock_);
+   mm::ImgBuffer* pImg = FindPendingSlot(pixels);
+   if (!pImg)
+      return false;
+
+   MM::FrameMetadata stamped(md);
+   StampMetadata(stamped, tags.get(), width_, height_, pixDepth_, pendingComponents_);
+
+   pImg->SetMetadata(stamped, tags, metadataKeys_.get());
+   pImg->SetInsertTimeUs(GetMMTimeNow().getUsec());
+   EndInsert(pendingIndex_);
+   pendingIndex_ = -1;
+   if (AboveHighWaterMark())
+      WakeMigrator();
+   return true;
+}
+
+/**
+* Releases the slot reserved with AcquireSlot() without publishing it.
+*/
+bool CircularBuffer::DiscardSlot(const unsigned char* pixels)
+{
+   MMThreadGuard guard(insertLock_);
+   if (!FindPendingSlot(pixels))
+      return false;
+
+   // The slot sequence number stays invalid; the slot is simply reused by
+   // the next insertion.
+   pendingIndex_ = -1;
+   return true;
+}
+
+/**
+* Waits until no slot is reserved by AcquireSlot(), releasing insertLock_
+* (which the caller holds) so that the camera can commit it. Returns false,
+* and reports an overflow, if the slot is reserved by the calling thread or
+* is not given back in time.
+*/
+bool CircularBuffer::WaitForPendingSlot()
+{
+   const MM::MMTime deadline = GetMMTimeNow() + MM::MMTime(maxPendingSlotWaitMs * 1000.0);
+   while (pendingIndex_ >= 0)
    {
-      Metadata md;
+      if (pendingOwner_ == boost::this_thread::get_id() || GetMMTimeNow() > deadline)
       {
-         MMThreadGuard guard(g_bufferLock);
-         // we assume that all buffers are pre-allocated
-         pImg = frameArray_[insertIndex_ % frameArray_.size()].FindImage(i);
-         if (!pImg)
-            return false;
+         ++overflowCount_;
+         overflow_.store(true, boost::memory_order_release);
+         return false;
+      }
+      insertLock_.Unlock();
+      boost::this_thread::sleep(boost::posix_time::microseconds(100));
+      insertLock_.Lock();
+   }
+   return true;
+}
 
-         if (pMd)
-         {
-            // TODO: the same metadata is inserted for each channel ???
-            // Perhaps we need to add specific tags to each channel
-            md = *pMd;
-         }
+mm::ImgBuffer* CircularBuffer::FindPendingSlot(const unsigned char* pixels)
+{
+   if (pendingIndex_ < 0)
+      return 0;
+   mm::ImgBuffer* pImg = frameArray_[(unsigned long)(pendingIndex_ % frameArray_.size())].FindImage(0);
+   if (!pImg || pImg->GetPixels() != pixels)
+      return 0;
+   return pImg;
+}
 
-         std::string cameraName = md.GetSingleTag("Camera").GetValue();
-         if (imageNumbers_.end() == imageNumbers_.find(cameraName))
-         {
-            imageNumbers_[cameraName] = 0;
-         }
+/**
+* Decides where the next frame goes, applying the overflow policy if the
+* buffer is full. For InsertIntoRing, sets insertIndex to the index of the
+* new frame and invalidates the slot that will receive it. Must be called
+* with insertLock_ held.
+*
+* The slot is published to readers only by EndInsert(): its sequence number
+* is invalidated first, and insertIndex_ is advanced only after the new
+* sequence number has been stored.
+*/
+CircularBuffer::InsertTarget CircularBuffer::BeginInsert(unsigned width, unsigned height, unsigned byteDepth, long long& insertIndex) throw (CMMError)
+{
+   // check image dimensions
+   if (width != width_ || height != height_ || byteDepth != pixDepth_)
+      throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+
+   if (frameArray_.empty())
+      return RejectImage;
 
-         // insert image number. 
-         md.put(MM::g_Keyword_Metadata_ImageNumber, CDeviceUtils::ConvertToString(imageNumbers_[cameraName]));
-         ++imageNumbers_[cameraName];
+   const OverflowPolicy policy = overflowPolicy_.load(boost::memory_order_relaxed);
+
+   insertIndex = insertIndex_.load(boost::memory_order_relaxed);
+   const long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   if (insertIndex - saveIndex >= static_cast<long long>(frameArray_.size()))
+   {
+      ++overflowCount_;
+      switch (policy)
+      {
+         case SpillToDisk:
+            // The migrator thread has fallen behind (or the file is full)
+            if (!MigrateOldest())
+            {
+               overflow_.store(true, boost::memory_order_release);
+               return RejectImage;
+            }
+            break;
+         case DropOldest:
+         case BlockProducer:
+            if (!MakeRoom(insertIndex))
+            {
+               ++droppedCount_;
+               return DropImage;
+            }
+            break;
+         default:
+            overflow_.store(true, boost::memory_order_release);
+            return RejectImage;
       }
+   }
 
-      if (!md.HasTag(MM::g_Keyword_Elapsed_Time_ms))
+   // Invalidate the slot before touching its contents, so that a reader
+   // holding a stale index can detect that the frame is being replaced.
+   const unsigned long slot = (unsigned long)(insertIndex % frameArray_.size());
+   if (!InvalidateSlot(slot))
+   {
+      // The frame in the slot is leased (and was retrieved, or would have
+      // been dropped); there is nowhere to put the new one
+      ++overflowCount_;
+      if (policy == DropOldest || policy == BlockProducer)
       {
-         // if time tag was not supplied by the camera insert current timestamp
-         MM::MMTime timestamp = GetMMTimeNow();
-         md.PutImageTag(MM::g_Keyword_Elapsed_Time_ms, CDeviceUtils::ConvertToString(timestamp.getMsec()));
+         ++droppedCount_;
+         return DropImage;
       }
+      overflow_.store(true, boost::memory_order_release);
+      return RejectImage;
+   }
+   boost::atomic_thread_fence(boost::memory_order_release);
 
-      md.PutImageTag("Width",width);
-      md.PutImageTag("Height",height);
-      if (byteDepth == 1)
-         md.PutImageTag("PixelType","GRAY8");
-      else if (byteDepth == 2)
-         md.PutImageTag("PixelType","GRAY16");
-      else if (byteDepth == 4)
-         md.PutImageTag("PixelType","RGB32");
-      else if (byteDepth == 8)
-         md.PutImageTag("PixelType","RGB64");
-      else
-         md.PutImageTag("PixelType","Unknown"); 
-
-      pImg->SetMetadata(md);
-      pImg->SetPixels(pixArray + i*singleChannelSize);
+   return InsertIntoRing;
+}
+
+/**
+* Marks the slot as being rewritten, unless its frame is leased. With
+* BlockProducer, waits (up to the overflow timeout) for the leases to be
+* released.
+*
+* Pairs with PinSlot(): each side announces itself before checking the
+* other (with sequentially consistent operations), so that a lease is either
+* seen here or finds the slot invalidated.
+*/
+bool CircularBuffer::InvalidateSlot(unsigned long slot)
+{
+   const long long previous = slotSequence_[slot].exchange(emptySlot,
+         boost::memory_order_seq_cst);
+   if (slotPins_[slot].load(boost::memory_order_seq_cst) == 0)
+      return true;
+
+   if (overflowPolicy_.load(boost::memory_order_relaxed) == BlockProducer)
+   {
+      const MM::MMTime deadline = GetMMTimeNow() +
+         MM::MMTime(overflowTimeoutMs_.load(boost::memory_order_relaxed) * 1000.0);
+      while (slotPins_[slot].load(boost::memory_order_seq_cst) > 0)
+      {
+         if (GetMMTimeNow() > deadline)
+         {
+            slotSequence_[slot].store(previous, boost::memory_order_release);
+            return false;
+         }
+         boost::this_thread::sleep(boost::posix_time::microseconds(100));
+      }
+      return true;
    }
 
+   slotSequence_[slot].store(previous, boost::memory_order_release);
+   return false;
+}
+
+/**
+* Increments the pin count of the slot if it (still) holds the given frame.
+*/
+bool CircularBuffer::PinSlot(unsigned long slot, long long frameIndex) const
+{
+   slotPins_[slot].fetch_add(1, boost::memory_order_seq_cst);
+   if (slotSequence_[slot].load(boost::memory_order_seq_cst) == frameIndex)
+      return true;
+   slotPins_[slot].fetch_sub(1, boost::memory_order_release);
+   return false;
+}
+
+boost::shared_ptr<mm::FrameLease> CircularBuffer::LeaseSlot(unsigned long slot, unsigned channel) const
+{
+   const mm::ImgBuffer* img = frameArray_[slot].FindImage(channel);
+   if (!img)
    {
-      MMThreadGuard guard(g_bufferLock);
+      slotPins_[slot].fetch_sub(1, boost::memory_order_release);
+      return boost::shared_ptr<mm::FrameLease>();
+   }
+   return boost::shared_ptr<mm::FrameLease>(new mm::FrameLease(slab_,
+            slotPins_, slot, *img, metadataKeys_));
+}
+
+/**
+* Frees a slot in the full buffer, either by discarding the oldest frame
+* (DropOldest) or by waiting for it to be retrieved (BlockProducer). Returns
+* false if the wait timed out.
+*/
+bool CircularBuffer::MakeRoom(long long insertIndex)
+{
+   const long long size = static_cast<long long>(frameArray_.size());
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
 
-      imageCounter_++;
-      insertIndex_++;
-      if ((insertIndex_ - (long)frameArray_.size()) > adjustThreshold && (saveIndex_- (long)frameArray_.size()) > adjustThreshold)
+   if (overflowPolicy_.load(boost::memory_order_relaxed) == DropOldest)
+   {
+      while (insertIndex - saveIndex >= size)
       {
-         // adjust buffer indices to avoid overflowing integer size
-         insertIndex_ -= adjustThreshold;
-         saveIndex_ -= adjustThreshold;
+         // Competes with readers retrieving the same frame
+         if (saveIndex_.compare_exchange_weak(saveIndex, saveIndex + 1,
+                  boost::memory_order_acq_rel, boost::memory_order_acquire))
+         {
+            ++droppedCount_;
+            break;
+         }
       }
+      return true;
    }
 
+   const MM::MMTime deadline = GetMMTimeNow() +
+      MM::MMTime(overflowTimeoutMs_.load(boost::memory_order_relaxed) * 1000.0);
+   while (insertIndex - saveIndex_.load(boost::memory_order_acquire) >= size)
+   {
+      if (GetMMTimeNow() > deadline)
+         return false;
+      boost::this_thread::sleep(boost::posix_time::microseconds(100));
+   }
    return true;
 }
 
+bool CircularBuffer::AboveHighWaterMark() const
+{
+   if (overflowPolicy_.load(boost::memory_order_relaxed) != SpillToDisk)
+      return false;
+   const long long count = insertIndex_.load(boost::memory_order_acquire) -
+      saveIndex_.load(boost::memory_order_acquire);
+   return count > spillHighWaterMark_.load(boost::memory_order_relaxed) * frameArray_.size();
+}
+
 /**
-* Inserts a single image in the buffer.
+* Creates the spill file if the SpillToDisk policy is selected and the
+* buffer is initialized, replacing an empty file created with other
+* settings. Reserving the disk space can take seconds (some file systems
+* write every block), so this is not left to the inserting thread. If the
+* file cannot be created, frames are not spilled and overflow is reported.
 */
-bool CircularBuffer::InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError)
+void CircularBuffer::PrepareSpillFile()
 {
-    return InsertMultiChannel(pixArray, 1, width, height, byteDepth, nComponents, pMd);
+   MMThreadGuard migrateGuard(migrateLock_);
+
+   std::string directory;
+   {
+      MMThreadGuard spillGuard(spillLock_);
+      directory = spillDirectory_;
+   }
+   const unsigned long capacityMB = spillCapacityMB_.load();
+   const bool wanted = overflowPolicy_.load() == SpillToDisk &&
+      !frameArray_.empty();
+
+   if (spill_)
+   {
+      const bool current = wanted && directory == spillFileDirectory_ &&
+         capacityMB == spillFileCapacityMB_;
+      // A file holding frames is kept until they are retrieved or cleared
+      if (current || spill_->GetCount() > 0)
+         return;
+      MMThreadGuard spillGuard(spillLock_);
+      spill_.reset();
+      spillCount_.store(0, boost::memory_order_release);
+   }
+   if (!wanted)
+      return;
+
+   // Created without spillLock_, so that readers are not kept waiting
+   boost::scoped_ptr<mm::SpillFile> spill;
+   try
+   {
+      spill.reset(new mm::SpillFile(directory, capacityMB,
+               numChannels_, width_, height_, pixDepth_));
+   }
+   catch (const CMMError&)
+   {
+      return;
+   }
+   MMThreadGuard spillGuard(spillLock_);
+   spill_.swap(spill);
+   spillFileDirectory_ = directory;
+   spillFileCapacityMB_ = capacityMB;
 }
- 
+
 /**
-* Inserts a multi-channel frame in the buffer.
+* Moves the oldest frame in memory to the spill file. Returns false if there
+* is no frame to move, or no file (see PrepareSpillFile()) or it cannot take
+* it.
 */
-bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd) throw (CMMError)
+bool CircularBuffer::MigrateOldest()
 {
-    MMThreadGuard guard(g_insertLock);
- 
-    mm::ImgBuffer* pImg;
-    unsigned long singleChannelSize = (unsigned long)width * height * byteDepth;
- 
-    {
-       MMThreadGuard guard(g_bufferLock);
- 
-       // check image dimensions
-       if (width != width_ || height != height_ || byteDepth != pixDepth_)
-          throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
- 
-       bool overflowed = (insertIndex_ - saveIndex_) >= static_cast<long>(frameArray_.size());
-       if (overflowed) {
-          overflow_ = true;
-          return false;
-       }
-    }
- 
-    for (unsigned i=0; i<numChannels; i++)
-    {
-       Metadata md;
-       {
-          MMThreadGuard guard(g_bufferLock);
-          // we assume that all buffers are pre-allocated
-          pImg = frameArray_[insertIndex_ % frameArray_.size()].FindImage(i);
-          if (!pImg)
-             return false;
- 
-          if (pMd)
-          {
-             // TODO: the same metadata is inserted for each channel ???
-             // Perhaps we need to add specific tags to each channel
-             md = *pMd;
-          }
-
-         std::string cameraName = md.GetSingleTag("Camera").GetValue();
-         if (imageNumbers_.end() == imageNumbers_.find(cameraName))
-         {
-            imageNumbers_[cameraName] = 0;
-         }
+   MMThreadGuard migrateGuard(migrateLock_);
 
-         // insert image number. 
-         md.put(MM::g_Keyword_Metadata_ImageNumber, CDeviceUtils::ConvertToString(imageNumbers_[cameraName]));
-         ++imageNumbers_[cameraName];
-      }
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   if (insertIndex_.load(boost::memory_order_acquire) - saveIndex < 1)
+      return false;
 
-      if (!md.HasTag(MM::g_Keyword_Elapsed_Time_ms))
-      {
-         // if time tag was not supplied by the camera insert current timestamp
-         MM::MMTime timestamp = GetMMTimeNow();
-         md.PutImageTag(MM::g_Keyword_Elapsed_Time_ms, CDeviceUtils::ConvertToString(timestamp.getMsec()));
-      }
+   {
+      MMThreadGuard spillGuard(spillLock_);
+      if (!spill_ || spill_->IsFull())
+         return false;
+   }
 
-      md.PutImageTag("Width",width);
-      md.PutImageTag("Height",height);
-      if (byteDepth == 1)
-         md.PutImageTag("PixelType","GRAY8");
-      else if (byteDepth == 2)
-         md.PutImageTag("PixelType","GRAY16");
-      else if (byteDepth == 4)
-      {
-         if (nComponents == 1)
-            md.PutImageTag("PixelType","GRAY32");
-         else
-            md.PutImageTag("PixelType","RGB32");
-      }
-      else if (byteDepth == 8)
-         md.PutImageTag("PixelType","RGB64");
-      else
-         md.PutImageTag("PixelType","Unknown"); 
+   // Copy without holding spillLock_, so that readers are not kept waiting.
+   // The frame cannot be overwritten while saveIndex_ has not passed it; if
+   // a reader retrieves it in the meantime, the copy is abandoned below.
+   const unsigned long slot = (unsigned long)(saveIndex % frameArray_.size());
+   spill_->Write(frameArray_[slot]);
 
-      pImg->SetMetadata(md);
-      pImg->SetPixels(pixArray + i*singleChannelSize);
+   MMThreadGuard spillGuard(spillLock_);
+   if (!saveIndex_.compare_exchange_strong(saveIndex, saveIndex + 1,
+            boost::memory_order_acq_rel, boost::memory_order_acquire))
+      return true; // Retrieved by a reader; still progress
+   spill_->Append();
+   spillCount_.store(spill_->GetCount(), boost::memory_order_release);
+   ++spilledCount_;
+   return true;
+}
+
+/**
+* Has the migrator thread (started on first use) move frames to the spill
+* file until the buffer is back below the high-water mark.
+*/
+void CircularBuffer::WakeMigrator()
+{
+   boost::lock_guard<boost::mutex> lock(migratorMutex_);
+   if (!migratorThread_.joinable())
+   {
+      migratorStopRequested_ = false;
+      boost::thread t(boost::bind(&CircularBuffer::MigratorLoop, this));
+      boost::swap(migratorThread_, t);
    }
+   migratorWakeRequested_ = true;
+   migratorCondVar_.notify_one();
+}
 
+void CircularBuffer::StopMigrator()
+{
    {
-      MMThreadGuard guard(g_bufferLock);
+      boost::lock_guard<boost::mutex> lock(migratorMutex_);
+      if (!migratorThread_.joinable())
+         return;
+      migratorStopRequested_ = true;
+      migratorCondVar_.notify_one();
+   }
+   migratorThread_.join();
 
-      imageCounter_++;
-      insertIndex_++;
-      if ((insertIndex_ - (long)frameArray_.size()) > adjustThreshold && (saveIndex_- (long)frameArray_.size()) > adjustThreshold)
+   boost::lock_guard<boost::mutex> lock(migratorMutex_);
+   boost::thread t;
+   boost::swap(migratorThread_, t);
+   migratorWakeRequested_ = false;
+}
+
+void CircularBuffer::MigratorLoop()
+{
+   for (;;)
+   {
+      {
+         boost::unique_lock<boost::mutex> lock(migratorMutex_);
+         while (!migratorWakeRequested_ && !migratorStopRequested_)
+            migratorCondVar_.wait(lock);
+         if (migratorStopRequested_)
+            return;
+         migratorWakeRequested_ = false;
+      }
+
+      // If the file is full, wait for the next insertion before retrying
+      while (AboveHighWaterMark() && MigrateOldest())
       {
-         // adjust buffer indices to avoid overflowing integer size
-         insertIndex_ -= adjustThreshold;
-         saveIndex_ -= adjustThreshold;
+         boost::lock_guard<boost::mutex> lock(migratorMutex_);
+         if (migratorStopRequested_)
+            return;
       }
    }
+}
 
-   return true;
+const mm::ImgBuffer* CircularBuffer::PeekSpill(unsigned long n, unsigned channel) const
+{
+   MMThreadGuard spillGuard(spillLock_);
+   if (!spill_ || !spill_->Peek(n, spillPeekFrame_, metadataKeys_.get()))
+      return 0;
+   return spillPeekFrame_.FindImage(channel);
+}
+
+/**
+* Stores Metadata supplied with an image as the image's additional tags, and
+* fills in the record's camera key from its "Camera" tag.
+*/
+void CircularBuffer::LegacyMetadataToRecord(const Metadata* pMd, MM::FrameMetadata& md, boost::shared_ptr<const Metadata>& tags)
+{
+   if (!pMd)
+      return;
+
+   tags.reset(new Metadata(*pMd));
+   if (tags->HasTag("Camera"))
+      md.SetCameraKey(metadataKeys_->Intern(tags->GetSingleTag("Camera").GetValue(), "_"));
+}
+
+/**
+* Adds the fields the buffer is responsible for: image number, elapsed time
+* (if not supplied by the camera), and image dimensions and pixel type.
+* Must be called with insertLock_ held.
+*/
+void CircularBuffer::StampMetadata(MM::FrameMetadata& md, const Metadata* tags, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents)
+{
+   // insert image number. 
+   const long camera = md.HasCameraKey() ? (long)md.GetCameraKey() : -1;
+   long& imageNumber = imageNumbers_[camera];
+   md.SetImageNumber(imageNumber);
+   ++imageNumber;
+
+   if (!md.HasElapsedTimeMs() && !(tags && tags->HasTag(MM::g_Keyword_Elapsed_Time_ms)))
+   {
+      // if time tag was not supplied by the camera insert current timestamp
+      MM::MMTime timestamp = GetMMTimeNow();
+      md.SetElapsedTimeMs(timestamp.getMsec());
+   }
+
+   md.SetImageFormat(width, height, byteDepth, nComponents);
+}
+
+void CircularBuffer::RecordFirstPassInsert(double us)
+{
+   ++firstPassInserts_;
+   firstPassTotalInsertUs_.store(firstPassTotalInsertUs_.load() + us);
+   if (us > firstPassMaxInsertUs_.load())
+      firstPassMaxInsertUs_.store(us);
+}
+
+void CircularBuffer::EndInsert(long long insertIndex)
+{
+   const unsigned long slot = (unsigned long)(insertIndex % frameArray_.size());
+   slotSequence_[slot].store(insertIndex, boost::memory_order_release);
+
+   imageCounter_++;
+   insertIndex_.store(insertIndex + 1, boost::memory_order_release);
 }
  
 
@@ -358,18 +948,31 @@ const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(unsigned long n) c
 const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(long n,
       unsigned channel) const
 {
-   MMThreadGuard guard(g_bufferLock);
-
-   long availableImages = insertIndex_ - saveIndex_;
-   if (n + 1 > availableImages)
+   if (n < 0 || frameArray_.empty())
       return 0;
 
-   long targetIndex = insertIndex_ - n - 1L;
-   while (targetIndex < 0)
-      targetIndex += frameArray_.size();
-   targetIndex %= frameArray_.size();
+   for (;;)
+   {
+      long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+      long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+
+      long long availableImages = insertIndex - saveIndex;
+      if (n + 1 > availableImages)
+      {
+         // Older frames may have been moved to the spill file
+         if (spillCount_.load(boost::memory_order_acquire) == 0)
+            return 0;
+         return PeekSpill((unsigned long)(n - availableImages), channel);
+      }
+
+      long long targetIndex = insertIndex - n - 1;
+      unsigned long slot = (unsigned long)(targetIndex % frameArray_.size());
 
-   return frameArray_[targetIndex].FindImage(channel);
+      // If the inserting thread has wrapped around onto this slot since we
+      // read the indices, try again with fresh indices.
+      if (slotSequence_[slot].load(boost::memory_order_acquire) == targetIndex)
+         return frameArray_[slot].FindImage(channel);
+   }
 }
 
 const unsigned char* CircularBuffer::GetNextImage()
@@ -382,13 +985,261 @@ const unsigned char* CircularBuffer::GetNextImage()
 
 const mm::ImgBuffer* CircularBuffer::GetNextImageBuffer(unsigned channel)
 {
-   MMThreadGuard guard(g_bufferLock);
+   if (frameArray_.empty())
+      return 0;
+
+   if (overflowPolicy_.load(boost::memory_order_relaxed) != SpillToDisk &&
+         spillCount_.load(boost::memory_order_acquire) == 0)
+      return PopFromRing(channel);
+
+   // Frames in the spill file are older than those in memory. Holding
+   // spillLock_ keeps frames from being moved to the file meanwhile.
+   MMThreadGuard spillGuard(spillLock_);
+   if (spill_ && spill_->GetCount() > 0)
+   {
+      if (!spill_->Pop(spillPopFrame_, metadataKeys_.get()))
+         return 0;
+      spillCount_.store(spill_->GetCount(), boost::memory_order_release);
+      return spillPopFrame_.FindImage(channel);
+   }
+   return PopFromRing(channel);
+}
 
-   long availableImages = insertIndex_ - saveIndex_;
-   if (availableImages < 1)
+/**
+* Retrieves a batch of frames in one call. Frames in memory are pinned before
+* they are claimed, so that the inserting thread cannot overwrite them while
+* they are copied; if another reader claims any of them meanwhile, they are
+* unpinned and the claim is repeated.
+*/
+unsigned long CircularBuffer::PopImages(unsigned long maxCount, unsigned channel, unsigned char* dest, std::vector<Metadata>& md)
+{
+   if (frameArray_.empty() || maxCount == 0 || channel >= numChannels_)
       return 0;
 
-   long targetIndex = saveIndex_ % frameArray_.size();
-   ++saveIndex_;
-   return frameArray_[targetIndex].FindImage(channel);
+   const unsigned long frameBytes = (unsigned long)width_ * height_ * pixDepth_;
+
+   if (overflowPolicy_.load(boost::memory_order_relaxed) == SpillToDisk ||
+         spillCount_.load(boost::memory_order_acquire) > 0)
+   {
+      // Frames may be in the spill file; read them one by one, without
+      // letting any more be moved there meanwhile
+      MMThreadGuard spillGuard(spillLock_);
+      unsigned long count = 0;
+      for (; count < maxCount; ++count)
+      {
+         const mm::ImgBuffer* img = GetNextImageBuffer(channel);
+         if (!img)
+            break;
+         memcpy(dest + count * frameBytes, img->GetPixels(), frameBytes);
+         md.push_back(img->GetMetadata());
+      }
+      return count;
+   }
+
+   long long firstIndex;
+   unsigned long count;
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   for (;;)
+   {
+      long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+      if (insertIndex - saveIndex < 1)
+         return 0;
+      const unsigned long available = (unsigned long)std::min<long long>(maxCount, insertIndex - saveIndex);
+
+      // Pin as many of the frames as are still there
+      firstIndex = saveIndex;
+      count = 0;
+      while (count < available && PinSlot((unsigned long)((firstIndex + count) %
+                  frameArray_.size()), firstIndex + count))
+         ++count;
+
+      // On failure saveIndex is reloaded and we try again
+      if (count > 0 && saveIndex_.compare_exchange_strong(saveIndex,
+               firstIndex + count, boost::memory_order_acq_rel,
+               boost::memory_order_acquire))
+         break;
+
+      for (unsigned long i = 0; i < count; ++i)
+         slotPins_[(unsigned long)((firstIndex + i) % frameArray_.size())].
+            fetch_sub(1, boost::memory_order_release);
+      if (count == 0)
+         saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   }
+
+   for (unsigned long i = 0; i < count; ++i)
+   {
+      const unsigned long slot = (unsigned long)((firstIndex + i) % frameArray_.size());
+      const mm::ImgBuffer* img = frameArray_[slot].FindImage(channel);
+      memcpy(dest + i * frameBytes, img->GetPixels(), frameBytes);
+      md.push_back(img->GetMetadata());
+      slotPins_[slot].fetch_sub(1, boost::memory_order_release);
+   }
+   return count;
+}
+
+/**
+* Retrieves the next frame, leasing it in place. The frame is pinned before
+* it is claimed, so that it cannot be replaced once retrieved.
+*/
+boost::shared_ptr<mm::FrameLease> CircularBuffer::LeaseNextImage(unsigned channel)
+{
+   if (frameArray_.empty())
+      return boost::shared_ptr<mm::FrameLease>();
+
+   if (overflowPolicy_.load(boost::memory_order_relaxed) == SpillToDisk ||
+         spillCount_.load(boost::memory_order_acquire) > 0)
+   {
+      // Frames in the spill file are copied
+      MMThreadGuard spillGuard(spillLock_);
+      if (spill_ && spill_->GetCount() > 0)
+      {
+         const mm::ImgBuffer* img = GetNextImageBuffer(channel);
+         if (!img)
+            return boost::shared_ptr<mm::FrameLease>();
+         return boost::shared_ptr<mm::FrameLease>(new mm::FrameLease(*img,
+                  metadataKeys_));
+      }
+   }
+
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   for (;;)
+   {
+      long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+      if (insertIndex - saveIndex < 1)
+         return boost::shared_ptr<mm::FrameLease>();
+
+      const unsigned long slot = (unsigned long)(saveIndex % frameArray_.size());
+      if (!PinSlot(slot, saveIndex))
+      {
+         // Dropped and replaced meanwhile
+         saveIndex = saveIndex_.load(boost::memory_order_acquire);
+         continue;
+      }
+
+      if (saveIndex_.compare_exchange_strong(saveIndex, saveIndex + 1,
+               boost::memory_order_acq_rel, boost::memory_order_acquire))
+         return LeaseSlot(slot, channel);
+
+      // Another reader took the frame; saveIndex has been reloaded
+      slotPins_[slot].fetch_sub(1, boost::memory_order_release);
+   }
+}
+
+/**
+* Leases the most recently inserted frame, without retrieving it.
+*/
+boost::shared_ptr<mm::FrameLease> CircularBuffer::LeaseTopImage(unsigned channel) const
+{
+   if (frameArray_.empty())
+      return boost::shared_ptr<mm::FrameLease>();
+
+   for (;;)
+   {
+      long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+      long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+      if (insertIndex - saveIndex < 1)
+      {
+         if (spillCount_.load(boost::memory_order_acquire) == 0)
+            return boost::shared_ptr<mm::FrameLease>();
+         // The newest frame is in the spill file; copy it while no other
+         // reader can reuse the scratch frame
+         MMThreadGuard spillGuard(spillLock_);
+         const mm::ImgBuffer* img = PeekSpill(0, channel);
+         if (!img)
+            return boost::shared_ptr<mm::FrameLease>();
+         return boost::shared_ptr<mm::FrameLease>(new mm::FrameLease(*img,
+                  metadataKeys_));
+      }
+
+      const long long targetIndex = insertIndex - 1;
+      const unsigned long slot = (unsigned long)(targetIndex % frameArray_.size());
+      if (PinSlot(slot, targetIndex))
+         return LeaseSlot(slot, channel);
+   }
+}
+
+/**
+* Gets the time at which the frame GetNextImageBuffer() would return entered
+* the buffer, so that the frames of several buffers can be retrieved in the
+* order they arrived. Returns false if there is no such frame.
+*/
+bool CircularBuffer::GetNextInsertTimeUs(double& us) const
+{
+   if (frameArray_.empty())
+      return false;
+
+   if (spillCount_.load(boost::memory_order_acquire) > 0)
+   {
+      MMThreadGuard spillGuard(spillLock_);
+      if (spill_ && spill_->GetCount() > 0)
+      {
+         us = spill_->GetOldestInsertTimeUs();
+         return true;
+      }
+   }
+
+   for (;;)
+   {
+      long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+      long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+      if (insertIndex - saveIndex < 1)
+         return false;
+
+      // Pinned so that the slot cannot be rewritten while it is read
+      unsigned long slot = (unsigned long)(saveIndex % frameArray_.size());
+      if (!PinSlot(slot, saveIndex))
+         continue;
+      const mm::ImgBuffer* img = frameArray_[slot].FindImage(0);
+      if (img)
+         us = img->GetInsertTimeUs();
+      slotPins_[slot].fetch_sub(1, boost::memory_order_release);
+
+      // If the frame was popped meanwhile, the next one is wanted
+      if (saveIndex_.load(boost::memory_order_acquire) == saveIndex)
+         return img != 0;
+   }
+}
+
+/**
+* Picks, among the buffers whose frames have the given size and depth, the
+* one whose next frame entered first. Buffers of other formats are skipped,
+* so that the caller can size the frame it gets without asking the buffer.
+*/
+CircularBuffer* CircularBuffer::EarliestOfFormat(
+      const std::vector<CircularBuffer*>& buffers,
+      unsigned int width, unsigned int height, unsigned int pixDepth)
+{
+   CircularBuffer* earliest = 0;
+   double earliestUs = 0.0;
+   for (std::vector<CircularBuffer*>::const_iterator it = buffers.begin();
+         it != buffers.end(); ++it)
+   {
+      double us;
+      if ((*it)->HasFormat(width, height, pixDepth) &&
+            (*it)->GetNextInsertTimeUs(us) && (!earliest || us < earliestUs))
+      {
+         earliest = *it;
+         earliestUs = us;
+      }
+   }
+   return earliest;
+}
+
+const mm::ImgBuffer* CircularBuffer::PopFromRing(unsigned channel)
+{
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   for (;;)
+   {
+      long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+      if (insertIndex - saveIndex < 1)
+         return 0;
+
+      // Claim the frame; on failure saveIndex is reloaded and we retry.
+      if (saveIndex_.compare_exchange_weak(saveIndex, saveIndex + 1,
+               boost::memory_order_acq_rel, boost::memory_order_acquire))
+         break;
+   }
+
+   unsigned long slot = (unsigned long)(saveIndex % frameArray_.size());
+   return frameArray_[slot].FindImage(channel);
 }
@@ -27,10 +27,22 @@
 #include "Error.h"
 #include "ErrorCodes.h"
 #include "FrameBuffer.h"
+#include "FrameLease.h"
+#include "FrameSlab.h"
+#include "MetadataKeyTable.h"
+#include "SpillFile.h"
 
 #include "../MMDevice/DeviceThreads.h"
 #include "../MMDevice/MMDevice.h"
 
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+#include <string>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -38,10 +50,64 @@
 #endif
 
 
+/**
+ * Sequence buffer shared between the camera (producer) and the application
+ * (consumers).
+ *
+ * Frames are stored in a ring of preallocated slots. The insert and save
+ * indices are atomic counters that only ever increase, and each slot records
+ * the index of the frame it currently holds. Inserting threads are serialized
+ * among themselves (insertLock_), but never wait for readers; readers
+ * (GetNextImageBuffer(), GetNthFromTopImageBuffer()) never take a lock.
+ *
+ * A camera can also fill a slot in place: AcquireSlot() reserves the next
+ * slot and returns its pixel memory, and CommitSlot() publishes it. No lock
+ * is held in between; other insertions wait until the slot is committed or
+ * discarded.
+ *
+ * Metadata is stored as an MM::FrameMetadata record plus an optional shared
+ * set of additional tags; it is converted to Metadata only when read (see
+ * mm::ImgBuffer::GetMetadata()). Images inserted with Metadata are stored
+ * the same way, with the Metadata as the additional tags.
+ *
+ * When a frame is inserted into a full buffer, the overflow policy decides
+ * what happens (see OverflowPolicy). With SpillToDisk, the buffer has a
+ * second tier: a memory-mapped file (mm::SpillFile). Once the frames in
+ * memory pass the high-water mark, a background thread moves the oldest of
+ * them to the file; if it falls behind, the inserting thread moves one
+ * itself to make room. Readers retrieve frames from the file first, so that
+ * memory and file together behave as one FIFO.
+ *
+ * Readers can also lease a frame (mm::FrameLease) to read it in place. The
+ * inserting thread does not overwrite a slot while its pin count is
+ * nonzero, and treats such a slot like a full buffer.
+ *
+ * The pixels of all slots are allocated as one mm::FrameSlab, whose options
+ * (huge pages, prefaulting, NUMA node) take effect the next time Initialize()
+ * allocates the slots.
+ *
+ * Initialize() reallocates the slots and must not be called while other
+ * threads are reading from or inserting into the buffer.
+ */
 class CircularBuffer
 {
 public:
+   enum OverflowPolicy
+   {
+      // Reject the new frame and set the overflow flag; the camera then
+      // stops or clears the buffer. This is the default.
+      ReportOverflow,
+      // Discard the oldest frame to make room
+      DropOldest,
+      // Wait for a frame to be retrieved; discard the new frame on timeout
+      BlockProducer,
+      // Move the oldest frames to a memory-mapped file
+      SpillToDisk
+   };
+
    CircularBuffer(unsigned int memorySizeMB);
+   // Keys in inserted MM::FrameMetadata records refer to metadataKeys
+   CircularBuffer(unsigned int memorySizeMB, boost::shared_ptr<mm::MetadataKeyTable> metadataKeys);
    ~CircularBuffer();
 
    unsigned GetMemorySizeMB() const { return memorySizeMB_; }
@@ -51,42 +117,201 @@ public:
    unsigned long GetFreeSize() const;
    unsigned long GetRemainingImageCount() const;
 
-   unsigned int Width() const {MMThreadGuard guard(g_bufferLock); return width_;}
-   unsigned int Height() const {MMThreadGuard guard(g_bufferLock); return height_;}
-   unsigned int Depth() const {MMThreadGuard guard(g_bufferLock); return pixDepth_;}
+   unsigned int Width() const {return width_;}
+   unsigned int Height() const {return height_;}
+   unsigned int Depth() const {return pixDepth_;}
+   bool HasFormat(unsigned int width, unsigned int height, unsigned int pixDepth) const
+   {return width_ == width && height_ == height && pixDepth_ == pixDepth;}
 
    bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError);
    bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError);
-    bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
+   bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
    bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
+   bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const MM::FrameMetadata& md, const boost::shared_ptr<const Metadata>& tags) throw (CMMError);
+   unsigned char* AcquireSlot(unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents) throw (CMMError);
+   bool CommitSlot(const unsigned char* pixels, const Metadata* pMd);
+   bool CommitSlot(const unsigned char* pixels, const MM::FrameMetadata& md, const boost::shared_ptr<const Metadata>& tags);
+   bool DiscardSlot(const unsigned char* pixels);
    const unsigned char* GetTopImage() const;
    const unsigned char* GetNextImage();
    const mm::ImgBuffer* GetTopImageBuffer(unsigned channel) const;
    const mm::ImgBuffer* GetNthFromTopImageBuffer(unsigned long n) const;
    const mm::ImgBuffer* GetNthFromTopImageBuffer(long n, unsigned channel) const;
    const mm::ImgBuffer* GetNextImageBuffer(unsigned channel);
-   void Clear() {MMThreadGuard guard(g_bufferLock); insertIndex_=0; saveIndex_=0; overflow_ = false;}
+   // Removes up to maxCount frames, copying the channel's pixels of each
+   // into dest, one frame after the other, and appending their metadata to
+   // md. Returns the number of frames removed.
+   unsigned long PopImages(unsigned long maxCount, unsigned channel,
+         unsigned char* dest, std::vector<Metadata>& md);
+   // Like GetNextImageBuffer() and GetTopImageBuffer(), but giving access to
+   // the frame through a lease; null if there is no frame
+   boost::shared_ptr<mm::FrameLease> LeaseNextImage(unsigned channel);
+   boost::shared_ptr<mm::FrameLease> LeaseTopImage(unsigned channel) const;
+   // When the frame GetNextImageBuffer() would return was inserted
+   bool GetNextInsertTimeUs(double& us) const;
+   // Of the buffers holding frames of the given format, the one whose next
+   // frame was inserted first; null if none of them has a frame
+   static CircularBuffer* EarliestOfFormat(const std::vector<CircularBuffer*>& buffers,
+         unsigned int width, unsigned int height, unsigned int pixDepth);
+   void Clear();
+   // Clear() on request of the camera, counting the discarded frames as lost
+   void ClearAfterOverflow();
+
+   bool Overflow() {return overflow_.load(boost::memory_order_acquire);}
+
+   void SetOverflowPolicy(OverflowPolicy policy);
+   OverflowPolicy GetOverflowPolicy() const {return overflowPolicy_.load();}
+   void SetOverflowTimeoutMs(double timeoutMs) {overflowTimeoutMs_.store(timeoutMs);}
+   double GetOverflowTimeoutMs() const {return overflowTimeoutMs_.load();}
+   // The SpillToDisk file is created, and its disk space reserved, when the
+   // policy is selected, when its settings change and on Initialize(); never
+   // by an inserting thread.
+   // Directory for the SpillToDisk file; empty for the system default. It
+   // should be on disk, not in memory (tmpfs).
+   void SetSpillDirectory(const std::string& directory);
+   std::string GetSpillDirectory() const;
+   // Size of the SpillToDisk file
+   void SetSpillCapacityMB(unsigned long capacityMB);
+   unsigned long GetSpillCapacityMB() const {return spillCapacityMB_.load();}
+   // Fraction of the buffer above which frames are moved to the spill file
+   void SetSpillHighWaterMark(double fraction) {spillHighWaterMark_.store(fraction);}
+   double GetSpillHighWaterMark() const {return spillHighWaterMark_.load();}
+
+   // Number of times a frame was inserted into a full buffer
+   long long GetOverflowCount() const {return overflowCount_.load();}
+   // Number of frames lost to overflows
+   long long GetDroppedImageCount() const {return droppedCount_.load();}
+   // Number of frames moved to the spill file
+   long long GetSpilledImageCount() const {return spilledCount_.load();}
+   void ResetOverflowCounters();
 
-   bool Overflow() {MMThreadGuard guard(g_bufferLock); return overflow_;}
+   // Memory options; take effect at the next Initialize()
+   void SetAllocationOptions(const mm::FrameSlab::Options& options);
+   mm::FrameSlab::Options GetAllocationOptions() const;
+   // Time taken by the last allocation of the slots, including prefaulting
+   double GetAllocationTimeMs() const {return allocationTimeMs_.load();}
+   bool HasHugePages() const {return hasHugePages_.load();}
+   bool IsNumaBound() const {return isNumaBound_.load();}
+   // Time taken to copy frames into slots not written to since allocation
+   double GetFirstPassMeanInsertTimeUs() const;
+   double GetFirstPassMaxInsertTimeUs() const {return firstPassMaxInsertUs_.load();}
 
-   mutable MMThreadLock g_bufferLock;
-   mutable MMThreadLock g_insertLock;
+   mm::MetadataKeyTable& GetMetadataKeys() const {return *metadataKeys_;}
 
 private:
+   enum InsertTarget
+   {
+      InsertIntoRing,
+      RejectImage, // Report overflow
+      DropImage // Discard without reporting overflow
+   };
+
+   bool InsertChannels(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const MM::FrameMetadata& md, const boost::shared_ptr<const Metadata>& tags) throw (CMMError);
+   void LegacyMetadataToRecord(const Metadata* pMd, MM::FrameMetadata& md, boost::shared_ptr<const Metadata>& tags);
+   InsertTarget BeginInsert(unsigned int width, unsigned int height, unsigned int byteDepth, long long& insertIndex) throw (CMMError);
+   bool MakeRoom(long long insertIndex);
+   bool InvalidateSlot(unsigned long slot);
+   bool PinSlot(unsigned long slot, long long frameIndex) const;
+   boost::shared_ptr<mm::FrameLease> LeaseSlot(unsigned long slot, unsigned channel) const;
+   bool AboveHighWaterMark() const;
+   void PrepareSpillFile();
+   bool MigrateOldest();
+   void WakeMigrator();
+   void StopMigrator();
+   void MigratorLoop();
+   const mm::ImgBuffer* PopFromRing(unsigned channel);
+   const mm::ImgBuffer* PeekSpill(unsigned long n, unsigned channel) const;
+   void StampMetadata(MM::FrameMetadata& md, const Metadata* tags, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents);
+   void EndInsert(long long insertIndex);
+   void RecordFirstPassInsert(double us);
+   bool WaitForPendingSlot();
+   mm::ImgBuffer* FindPendingSlot(const unsigned char* pixels);
+
    unsigned int width_;
    unsigned int height_;
    unsigned int pixDepth_;
    long imageCounter_;
-   std::map<std::string, long> imageNumbers_;
+   boost::shared_ptr<mm::MetadataKeyTable> metadataKeys_;
+   // Next image number for each camera key (or -1 for images without a
+   // camera). Synchronized by insertLock_.
+   std::map<long, long> imageNumbers_;
+
+   // Serializes inserting threads and reallocation. Readers never take it.
+   mutable MMThreadLock insertLock_;
+
+   // Frame index reserved by AcquireSlot(), or -1, and the thread that
+   // reserved it. Synchronized by insertLock_.
+   long long pendingIndex_;
+   boost::thread::id pendingOwner_;
+   unsigned int pendingComponents_;
 
    // Invariants:
    // 0 <= saveIndex_ <= insertIndex_
    // insertIndex_ - saveIndex_ <= frameArray_.size()
-   long insertIndex_;
-   long saveIndex_;
+   // Only inserting threads (holding insertLock_) modify insertIndex_;
+   // readers advance saveIndex_ by compare-and-swap.
+   boost::atomic<long long> insertIndex_;
+   boost::atomic<long long> saveIndex_;
 
    unsigned long memorySizeMB_;
    unsigned int numChannels_;
-   bool overflow_;
+   boost::atomic<bool> overflow_;
+
+   mm::FrameSlab::Options slabOptions_; // Synchronized by insertLock_
+   bool reallocate_; // Options changed since the last allocation
+   // Holds the pixels of frameArray_; must outlive it. Shared with leases.
+   boost::shared_ptr<mm::FrameSlab> slab_;
    std::vector<mm::FrameBuffer> frameArray_;
+
+   // For each slot of frameArray_, the index of the frame it holds, or -1
+   // while it is empty or being (re)written.
+   boost::scoped_array< boost::atomic<long long> > slotSequence_;
+   // For each slot of frameArray_, the number of leases of its frame
+   mm::FrameLease::PinCounts slotPins_;
+
+   boost::atomic<OverflowPolicy> overflowPolicy_;
+   boost::atomic<double> overflowTimeoutMs_;
+   boost::atomic<long long> overflowCount_;
+   boost::atomic<long long> droppedCount_;
+   boost::atomic<long long> spilledCount_;
+
+   boost::atomic<double> allocationTimeMs_;
+   boost::atomic<bool> hasHugePages_;
+   boost::atomic<bool> isNumaBound_;
+   // Written with insertLock_ held
+   boost::atomic<long long> firstPassInserts_;
+   boost::atomic<double> firstPassTotalInsertUs_;
+   boost::atomic<double> firstPassMaxInsertUs_;
+
+   boost::atomic<unsigned long> spillCapacityMB_;
+   boost::atomic<double> spillHighWaterMark_;
+
+   // Frames in the spill file are all older than those in frameArray_.
+   // Readers hold spillLock_ while choosing between the two, and a frame
+   // moves from frameArray_ to the file (saveIndex_ is advanced and the
+   // file appended to) in a single critical section, so that no frame is
+   // retrieved out of order.
+   mutable MMThreadLock spillLock_;
+   std::string spillDirectory_; // Synchronized by spillLock_
+   // Created and deleted with spillLock_ and migrateLock_ held
+   boost::scoped_ptr<mm::SpillFile> spill_;
+   // The settings spill_ was created with. Protected by migrateLock_
+   std::string spillFileDirectory_;
+   unsigned long spillFileCapacityMB_;
+   boost::atomic<unsigned long> spillCount_; // Written with spillLock_ held
+   // Frames read back from the spill file. Synchronized by spillLock_
+   mm::FrameBuffer spillPopFrame_;
+   mutable mm::FrameBuffer spillPeekFrame_;
+
+   // Serializes moving frames to the spill file (by the migrator thread,
+   // or by an inserting thread when the buffer is full). Acquired before
+   // spillLock_, and after insertLock_ if both are needed.
+   MMThreadLock migrateLock_;
+
+   // Background thread moving frames to the spill file
+   boost::mutex migratorMutex_;
+   boost::condition_variable migratorCondVar_;
+   bool migratorWakeRequested_; // Protected by migratorMutex_
+   bool migratorStopRequested_; // Protected by migratorMutex_
+   boost::thread migratorThread_; // Protected by migratorMutex_
 };
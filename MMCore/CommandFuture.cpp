@@ -0,0 +1,106 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Completion and result of an asynchronous core command
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "CommandFuture.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+
+namespace mm {
+
+namespace {
+
+boost::posix_time::ptime Now()
+{
+   return boost::posix_time::microsec_clock::universal_time();
+}
+
+double Milliseconds(const boost::posix_time::time_duration& d)
+{
+   return d.total_microseconds() / 1000.0;
+}
+
+} // anonymous namespace
+
+
+CommandFuture::CommandFuture(const std::string& description) :
+   description_(description),
+   submitted_(Now()),
+   done_(false)
+{
+}
+
+bool CommandFuture::IsDone() const
+{
+   boost::mutex::scoped_lock lock(mutex_);
+   return done_;
+}
+
+void CommandFuture::Wait() const throw (CMMError)
+{
+   boost::mutex::scoped_lock lock(mutex_);
+   while (!done_)
+      doneCond_.wait(lock);
+   if (error_)
+      throw CMMError(*error_);
+}
+
+bool CommandFuture::WaitFor(double timeoutMs) const
+{
+   const boost::posix_time::ptime deadline = Now() +
+      boost::posix_time::microseconds(static_cast<long>(timeoutMs * 1000.0));
+   boost::mutex::scoped_lock lock(mutex_);
+   while (!done_)
+   {
+      if (!doneCond_.timed_wait(lock, deadline))
+         return done_;
+   }
+   return true;
+}
+
+double CommandFuture::GetQueuedMs() const
+{
+   boost::mutex::scoped_lock lock(mutex_);
+   if (started_.is_not_a_date_time())
+      return -1.0;
+   return Milliseconds(started_ - submitted_);
+}
+
+double CommandFuture::GetLatencyMs() const
+{
+   boost::mutex::scoped_lock lock(mutex_);
+   if (!done_)
+      return -1.0;
+   return Milliseconds(finished_ - started_);
+}
+
+void CommandFuture::SetStarted()
+{
+   boost::mutex::scoped_lock lock(mutex_);
+   started_ = Now();
+}
+
+void CommandFuture::SetDone(const CMMError* error)
+{
+   boost::mutex::scoped_lock lock(mutex_);
+   finished_ = Now();
+   if (error)
+      error_.reset(new CMMError(*error));
+   done_ = true;
+   doneCond_.notify_all();
+}
+
+} // namespace mm
@@ -0,0 +1,73 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Completion and result of an asynchronous core command
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Error.h"
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include <string>
+
+namespace mm {
+
+/**
+ * The outcome of a command issued with one of the asynchronous core
+ * functions (e.g. CMMCore::setPositionAsync()).
+ *
+ * The command is done when it has been carried out and the devices it
+ * moved are no longer busy. Wait() then returns, or throws the error that
+ * the command failed with.
+ */
+class CommandFuture : boost::noncopyable
+{
+public:
+   explicit CommandFuture(const std::string& description);
+
+   std::string GetDescription() const { return description_; }
+
+   bool IsDone() const;
+   // Waits for the command to be done; throws its error, if it failed
+   void Wait() const throw (CMMError);
+   // Returns false if the command is not done after timeoutMs
+   bool WaitFor(double timeoutMs) const;
+
+   // Time spent waiting for earlier commands to the same devices, and time
+   // taken by the command itself; -1 if not yet known
+   double GetQueuedMs() const;
+   double GetLatencyMs() const;
+
+   // For the scheduler
+   void SetStarted();
+   void SetDone(const CMMError* error);
+
+private:
+   const std::string description_;
+
+   mutable boost::mutex mutex_;
+   mutable boost::condition_variable doneCond_;
+   const boost::posix_time::ptime submitted_;
+   boost::posix_time::ptime started_;
+   boost::posix_time::ptime finished_;
+   bool done_;
+   boost::scoped_ptr<CMMError> error_;
+};
+
+} // namespace mm
@@ -0,0 +1,140 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Runs asynchronous core commands, in order per device module
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "CommandScheduler.h"
+
+#include "ThreadPool.h"
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <algorithm>
+#include <set>
+
+
+namespace mm {
+
+CommandScheduler::CommandScheduler(boost::shared_ptr<ThreadPool> pool,
+      DoneCallback onDone) :
+   pool_(pool),
+   onDone_(onDone),
+   pendingCount_(0)
+{
+}
+
+CommandScheduler::~CommandScheduler()
+{
+   WaitForAll();
+}
+
+boost::shared_ptr<CommandFuture>
+CommandScheduler::Submit(const std::string& description,
+      const std::vector<Key>& keys, const Command& command)
+{
+   EntryPtr entry = boost::make_shared<Entry>();
+   entry->command = command;
+   entry->keys = keys;
+   std::sort(entry->keys.begin(), entry->keys.end());
+   entry->keys.erase(std::unique(entry->keys.begin(), entry->keys.end()),
+         entry->keys.end());
+   entry->future = boost::make_shared<CommandFuture>(description);
+
+   bool runNow;
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      for (std::vector<Key>::const_iterator it = entry->keys.begin(),
+            end = entry->keys.end(); it != end; ++it)
+         lines_[*it].push_back(entry);
+      ++pendingCount_;
+      runNow = IsFirstInLine(entry);
+   }
+   if (runNow)
+      pool_->Submit(boost::bind(&CommandScheduler::Run, this, entry));
+   return entry->future;
+}
+
+void CommandScheduler::WaitForAll()
+{
+   boost::mutex::scoped_lock lock(mutex_);
+   while (pendingCount_ > 0)
+      allDone_.wait(lock);
+}
+
+bool CommandScheduler::IsFirstInLine(const EntryPtr& entry) const
+{
+   for (std::vector<Key>::const_iterator it = entry->keys.begin(),
+         end = entry->keys.end(); it != end; ++it)
+   {
+      std::map< Key, std::deque<EntryPtr> >::const_iterator line =
+         lines_.find(*it);
+      if (line == lines_.end() || line->second.front() != entry)
+         return false;
+   }
+   return true;
+}
+
+void CommandScheduler::Run(EntryPtr entry)
+{
+   entry->future->SetStarted();
+   try
+   {
+      entry->command();
+      entry->future->SetDone(0);
+   }
+   catch (const CMMError& e)
+   {
+      entry->future->SetDone(&e);
+   }
+   catch (const std::exception& e)
+   {
+      CMMError err(std::string("Unexpected error: ") + e.what());
+      entry->future->SetDone(&err);
+   }
+   catch (...)
+   {
+      CMMError err("Unexpected error");
+      entry->future->SetDone(&err);
+   }
+
+   if (onDone_)
+      onDone_(*entry->future);
+
+   // Hand the turn on each key to the next command; those that now have
+   // their turn on all their keys can run
+   std::set<EntryPtr> runnable;
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      for (std::vector<Key>::const_iterator it = entry->keys.begin(),
+            end = entry->keys.end(); it != end; ++it)
+      {
+         std::map< Key, std::deque<EntryPtr> >::iterator line = lines_.find(*it);
+         line->second.pop_front();
+         if (line->second.empty())
+            lines_.erase(line);
+         else if (IsFirstInLine(line->second.front()))
+            runnable.insert(line->second.front());
+      }
+   }
+   for (std::set<EntryPtr>::const_iterator it = runnable.begin(),
+         end = runnable.end(); it != end; ++it)
+      pool_->Submit(boost::bind(&CommandScheduler::Run, this, *it));
+
+   boost::mutex::scoped_lock lock(mutex_);
+   --pendingCount_;
+   allDone_.notify_all();
+}
+
+} // namespace mm
@@ -0,0 +1,86 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Runs asynchronous core commands, in order per device module
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "CommandFuture.h"
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace mm {
+
+class ThreadPool;
+
+/**
+ * Runs commands on a thread pool, each after all earlier commands that
+ * share a key with it.
+ *
+ * The core uses the adapter modules that a command calls into as its keys,
+ * so that the commands to a module run one at a time, in the order they
+ * were issued (as they would when issued from one thread), while commands
+ * to independent modules run concurrently. A command with several keys
+ * waits for its turn on all of them; since turns are handed out in
+ * submission order, this cannot deadlock.
+ */
+class CommandScheduler : boost::noncopyable
+{
+public:
+   typedef const void* Key;
+   // May throw CMMError, which is passed on to the future
+   typedef boost::function<void ()> Command;
+   typedef boost::function<void (const CommandFuture&)> DoneCallback;
+
+   // onDone is called on the pool thread after each command
+   CommandScheduler(boost::shared_ptr<ThreadPool> pool, DoneCallback onDone);
+   ~CommandScheduler(); // Waits for the submitted commands
+
+   boost::shared_ptr<CommandFuture> Submit(const std::string& description,
+         const std::vector<Key>& keys, const Command& command);
+
+   // Waits until all submitted commands are done
+   void WaitForAll();
+
+private:
+   struct Entry
+   {
+      Command command;
+      std::vector<Key> keys;
+      boost::shared_ptr<CommandFuture> future;
+   };
+   typedef boost::shared_ptr<Entry> EntryPtr;
+
+   bool IsFirstInLine(const EntryPtr& entry) const; // Called with mutex_ held
+   void Run(EntryPtr entry);
+
+   boost::shared_ptr<ThreadPool> pool_;
+   DoneCallback onDone_;
+
+   boost::mutex mutex_;
+   boost::condition_variable allDone_;
+   std::map< Key, std::deque<EntryPtr> > lines_; // Per key, in order
+   size_t pendingCount_;
+};
+
+} // namespace mm
@@ -26,7 +26,15 @@
 #define _CONFIG_GROUP_H_
 
 #include "Configuration.h"
+#include "PresetMatcher.h"
+
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 /**
  * Encapsulates a collection (map) of user-defined presets.
@@ -42,6 +50,7 @@ public:
    void Define(const char* configName)
    {
       configs_[configName];
+      InvalidateMatcher();
    }
 
 	/**
@@ -50,8 +59,12 @@ public:
    void Define(const char* configName, const char* deviceLabel, const char* propName, const char* value)
    {
       PropertySetting setting(deviceLabel, propName, value);
-      configs_[configName].addSetting(setting);
-	   }
+      T& config = configs_[configName];
+      if (!config.isPropertyIncluded(deviceLabel, propName))
+         ++propertyPresetCounts_[setting.getKey()];
+      config.addSetting(setting);
+      InvalidateMatcher();
+   }
 
    /**
     * Finds preset by name.
@@ -74,12 +87,21 @@ public:
       if (strlen(oldConfigName) == 0)
          return true;
 
-      typename std::map<std::string, T>::const_iterator it = configs_.find(oldConfigName);
+      typename std::map<std::string, T>::iterator it = configs_.find(oldConfigName);
       if (it == configs_.end())
          return false;
-	  
-	  configs_[newConfigName] = it->second;
-      configs_.erase(it->first);
+
+      T config = it->second;
+      Unindex(it->second);
+      configs_.erase(it);
+
+      // A preset already using the new name is replaced
+      it = configs_.find(newConfigName);
+      if (it != configs_.end())
+         Unindex(it->second);
+      configs_[newConfigName] = config;
+      Index(config);
+      InvalidateMatcher();
       return true;
    }
 
@@ -92,10 +114,12 @@ public:
       if (strlen(configName) == 0)
          return true;
 
-      typename std::map<std::string, T>::const_iterator it = configs_.find(configName);
+      typename std::map<std::string, T>::iterator it = configs_.find(configName);
       if (it == configs_.end())
          return false;
-      configs_.erase(configName);
+      Unindex(it->second);
+      configs_.erase(it);
+      InvalidateMatcher();
       return true;
    }
 
@@ -108,14 +132,17 @@ public:
       if (strlen(configName) == 0)
          return true;
 
-	  // Check if configuration with configName exists:
-	  typename std::map<std::string, T>::const_iterator it = configs_.find(configName);
-	  if (it == configs_.end())
-		  return false;
-	  
-	  // Delete the specified property
-      configs_[configName].deleteSetting(deviceLabel,propName);
-	  return true;
+      // Check if configuration with configName exists:
+      typename std::map<std::string, T>::iterator it = configs_.find(configName);
+      if (it == configs_.end())
+         return false;
+
+      // Delete the specified property
+      if (it->second.isPropertyIncluded(deviceLabel, propName))
+         Unindex(PropertySetting::generateKey(deviceLabel, propName));
+      it->second.deleteSetting(deviceLabel, propName);
+      InvalidateMatcher();
+      return true;
    }
 
    /**
@@ -136,11 +163,94 @@ public:
       return configs_.size() == 0;
    }
 
+   /**
+    * Checks if any preset includes the property.
+    */
+   bool IsPropertyIncluded(const char* deviceLabel, const char* propName) const
+   {
+      return IsPropertyIncluded(PropertySetting::generateKey(deviceLabel, propName));
+   }
+
+   /**
+    * Checks if any preset includes the property, given its setting key (see
+    * PropertySetting::getKey()).
+    */
+   bool IsPropertyIncluded(const std::string& key) const
+   {
+      return propertyPresetCounts_.find(key) != propertyPresetCounts_.end();
+   }
+
+   /**
+    * Returns the presets compiled for finding the one that matches the
+    * current property values. They are compiled when first needed after a
+    * change.
+    */
+   boost::shared_ptr<const mm::PresetMatcher> GetMatcher() const
+   {
+      boost::shared_ptr<const mm::PresetMatcher> matcher = boost::atomic_load(&matcher_);
+      if (!matcher)
+      {
+         boost::shared_ptr<mm::PresetMatcher> compiled = boost::make_shared<mm::PresetMatcher>();
+         for (typename std::map<std::string, T>::const_iterator it = configs_.begin();
+               it != configs_.end(); ++it)
+            compiled->AddPreset(it->first, it->second);
+         matcher = compiled;
+         boost::atomic_store(&matcher_, matcher);
+      }
+      return matcher;
+   }
+
+   /**
+    * Returns the setting keys of the properties included in any preset.
+    */
+   std::vector<std::string> GetIncludedProperties() const
+   {
+      std::vector<std::string> keys;
+      for (std::map<std::string, int>::const_iterator it = propertyPresetCounts_.begin();
+            it != propertyPresetCounts_.end(); ++it)
+         keys.push_back(it->first);
+      return keys;
+   }
+
 protected:
    ConfigGroupBase() {}
    virtual ~ConfigGroupBase() {}
 
+   void Index(const T& config)
+   {
+      for (size_t i = 0; i < config.size(); ++i)
+         ++propertyPresetCounts_[config.getSetting(i).getKey()];
+   }
+
+   void Unindex(const T& config)
+   {
+      for (size_t i = 0; i < config.size(); ++i)
+         Unindex(config.getSetting(i).getKey());
+   }
+
+   void InvalidateMatcher()
+   {
+      boost::atomic_store(&matcher_, boost::shared_ptr<const mm::PresetMatcher>());
+   }
+
+   void Unindex(const std::string& key)
+   {
+      std::map<std::string, int>::iterator it = propertyPresetCounts_.find(key);
+      if (it != propertyPresetCounts_.end() && --it->second == 0)
+         propertyPresetCounts_.erase(it);
+   }
+
    std::map<std::string, T> configs_;
+
+   // Number of presets that include each property, by setting key, so that
+   // the presets affected by a property change are found without scanning
+   // them
+   std::map<std::string, int> propertyPresetCounts_;
+
+private:
+   // Shared by copies, since it is immutable; accessed atomically because
+   // it is compiled lazily by whichever thread first needs it
+   mutable boost::shared_ptr<const mm::PresetMatcher> matcher_;
 };
 
 
@@ -173,6 +283,7 @@ public:
    void Define(const char* groupName, const char* configName, const char* deviceLabel, const char* propName, const char* value)
    {
       groups_[groupName].Define(configName, deviceLabel, propName, value);
+      propertyGroups_[PropertySetting::generateKey(deviceLabel, propName)].insert(groupName);
    }
 
    /**
@@ -257,6 +368,8 @@ public:
          return false; // group not found
       if (it->second.Delete(configName, deviceLabel, propName))
       {
+         Reindex(groupName, std::vector<std::string>(1,
+                  PropertySetting::generateKey(deviceLabel, propName)));
          return true;
       }
       else
@@ -276,8 +389,10 @@ public:
       std::map<std::string, ConfigGroup>::iterator it = groups_.find(groupName);
       if (it == groups_.end())
          return false; // group not found
+      std::vector<std::string> keys = it->second.GetIncludedProperties();
       if (it->second.Delete(configName))
       {
+         Reindex(groupName, keys);
          // NOTE: changed to not remove empty groups, N.A. 1.31.2006
          // check if the config group is empty, and if so remove it
          //if (it->second.IsEmpty())
@@ -300,7 +415,9 @@ public:
       std::map<std::string, ConfigGroup>::iterator it = groups_.find(groupName);
       if (it != groups_.end())
       {
-         groups_.erase(it->first);
+         std::vector<std::string> keys = it->second.GetIncludedProperties();
+         groups_.erase(it);
+         Reindex(groupName, keys);
          return true;
       }
       return false; //not found
@@ -320,8 +437,19 @@ public:
          std::map<std::string, ConfigGroup>::iterator it = groups_.find(oldGroupName);
          if (it != groups_.end())
          {
+            std::vector<std::string> keys = it->second.GetIncludedProperties();
+            // A group already using the new name is replaced
+            std::map<std::string, ConfigGroup>::iterator replaced = groups_.find(newGroupName);
+            if (replaced != groups_.end())
+            {
+               std::vector<std::string> replacedKeys = replaced->second.GetIncludedProperties();
+               keys.insert(keys.end(), replacedKeys.begin(), replacedKeys.end());
+            }
+
             groups_[newGroupName] = it->second;
-            groups_.erase(it->first);
+            groups_.erase(it);
+            Reindex(oldGroupName, keys);
+            Reindex(newGroupName, keys);
             return true;
          }
          return false; //not found
@@ -361,14 +489,67 @@ public:
       return confList;
    }
 
+   /**
+    * Returns the compiled presets of a group (see ConfigGroupBase::GetMatcher()),
+    * or null if the group does not exist.
+    */
+   boost::shared_ptr<const mm::PresetMatcher> GetMatcher(const char* groupName) const
+   {
+      std::map<std::string, ConfigGroup>::const_iterator it = groups_.find(groupName);
+      if (it == groups_.end())
+         return boost::shared_ptr<const mm::PresetMatcher>();
+      return it->second.GetMatcher();
+   }
+
+   /**
+    * Returns the names of the groups that have a preset including the
+    * property.
+    */
+   std::vector<std::string> GetGroupsIncludingProperty(const char* deviceLabel, const char* propName) const
+   {
+      std::vector<std::string> groupList;
+      std::map<std::string, std::set<std::string> >::const_iterator it =
+         propertyGroups_.find(PropertySetting::generateKey(deviceLabel, propName));
+      if (it != propertyGroups_.end())
+         groupList.assign(it->second.begin(), it->second.end());
+      return groupList;
+   }
+
    void Clear()
    {
       groups_.clear();
+      propertyGroups_.clear();
    }
 
 
 private:
+   // Brings the index entries of the given properties up to date for a
+   // group that has been changed, renamed or deleted
+   void Reindex(const std::string& groupName, const std::vector<std::string>& keys)
+   {
+      std::map<std::string, ConfigGroup>::const_iterator group = groups_.find(groupName);
+      for (std::vector<std::string>::const_iterator key = keys.begin();
+            key != keys.end(); ++key)
+      {
+         if (group != groups_.end() && group->second.IsPropertyIncluded(*key))
+         {
+            propertyGroups_[*key].insert(groupName);
+            continue;
+         }
+         std::map<std::string, std::set<std::string> >::iterator it =
+            propertyGroups_.find(*key);
+         if (it == propertyGroups_.end())
+            continue;
+         it->second.erase(groupName);
+         if (it->second.empty())
+            propertyGroups_.erase(it);
+      }
+   }
+
    std::map<std::string, ConfigGroup> groups_;
+
+   // Groups that have a preset including each property, by setting key
+   std::map<std::string, std::set<std::string> > propertyGroups_;
 };
 
 /**
@@ -400,7 +581,10 @@ public:
    bool DefinePixelSize(const char* resolutionID, const char* deviceLabel, const char* propName, const char* value, double pixSizeUm)
    {
       PropertySetting setting(deviceLabel, propName, value);
+      if (!configs_[resolutionID].isPropertyIncluded(deviceLabel, propName))
+         ++propertyPresetCounts_[setting.getKey()];
       configs_[resolutionID].addSetting(setting);
+      InvalidateMatcher();
       if (configs_[resolutionID].getPixelSizeUm() == 0.0)
       {
          // this is the first setting, so it is OK to set pixel size
@@ -93,7 +93,7 @@ PropertySetting Configuration::getSetting(size_t index) const throw (CMMError)
 
 bool Configuration::isPropertyIncluded(const char* device, const char* prop)
 {
-   map<string, int>::iterator it = index_.find(PropertySetting::generateKey(device, prop));
+   IndexMap::iterator it = index_.find(PropertySetting::generateKey(device, prop));
    if (it != index_.end())
       return true;
    else
@@ -106,7 +106,7 @@ bool Configuration::isPropertyIncluded(const char* device, const char* prop)
 
 PropertySetting Configuration::getSetting(const char* device, const char* prop)
 {
-   map<string, int>::iterator it = index_.find(PropertySetting::generateKey(device, prop));
+   IndexMap::iterator it = index_.find(PropertySetting::generateKey(device, prop));
    if (it == index_.end())
    {
       std::ostringstream errTxt;
@@ -122,13 +122,21 @@ PropertySetting Configuration::getSetting(const char* device, const char* prop)
    return settings_[it->second];
 }
 
+const string* Configuration::findValue(const string& key) const
+{
+   IndexMap::const_iterator it = index_.find(key);
+   if (it == index_.end())
+      return 0;
+   return &settings_[it->second].value_;
+}
+
 /**
   * Checks whether the setting is included in the  configuration.
   */
 
 bool Configuration::isSettingIncluded(const PropertySetting& ps)
 {
-   map<string, int>::iterator it = index_.find(ps.getKey());
+   IndexMap::iterator it = index_.find(ps.getKey());
    if (it != index_.end() && settings_[it->second].getPropertyValue().compare(ps.getPropertyValue()) == 0)
       return true;
    else
@@ -156,7 +164,7 @@ bool Configuration::isConfigurationIncluded(const Configuration& cfg)
  */
 void Configuration::addSetting(const PropertySetting& setting)
 {
-   map<string, int>::iterator it = index_.find(setting.getKey());
+   IndexMap::iterator it = index_.find(setting.getKey());
    if (it != index_.end())
    {
       // replace
@@ -175,7 +183,7 @@ void Configuration::addSetting(const PropertySetting& setting)
  */
 void Configuration::deleteSetting(const char* device, const char* prop)
 {
-   map<string, int>::iterator it = index_.find(PropertySetting::generateKey(device, prop));
+   IndexMap::iterator it = index_.find(PropertySetting::generateKey(device, prop));
    if (it == index_.end())
    {
       std::ostringstream errTxt;
@@ -30,6 +30,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <boost/unordered_map.hpp>
 #include "Error.h"
 
 
@@ -79,6 +80,8 @@ struct PropertySetting
    bool isEqualTo(const PropertySetting& ps);
 
 private:
+   friend class Configuration;
+
    std::string deviceLabel_;
    std::string propertyName_;
    std::string value_;
@@ -139,6 +142,10 @@ public:
 
    PropertySetting getSetting(size_t index) const throw (CMMError);
    PropertySetting getSetting(const char* device, const char* prop);
+   // Returns the value of the setting with the given key (see
+   // PropertySetting::getKey()) without copying it, or null if the property
+   // is not included; valid until the configuration is changed
+   const std::string* findValue(const std::string& key) const;
    
    /**
     * Returns the number of settings.
@@ -147,8 +154,10 @@ public:
    std::string getVerbose() const;
  
 private:
+   typedef boost::unordered_map<std::string, int> IndexMap;
+
    std::vector<PropertySetting> settings_;
-   std::map<std::string, int> index_;
+   IndexMap index_; // By setting key
 };
 
 /**
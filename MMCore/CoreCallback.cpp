@@ -29,8 +29,11 @@
 #include "../MMDevice/DeviceUtils.h"
 #include "../MMDevice/ImgBuffer.h"
 #include "CircularBuffer.h"
+#include "ConfigGroup.h"
 #include "CoreCallback.h"
 #include "DeviceManager.h"
+#include "IdleNotifier.h"
+#include "MetadataKeyTable.h"
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <string>
@@ -223,23 +226,64 @@ CoreCallback::AddCameraMetadata(const MM::Device* caller, const Metadata* pMd)
    std::string label = camera->GetLabel();
    newMD.put("Camera", label);
 
-   std::string serializedMD;
+   boost::shared_ptr<const Metadata> cameraTags;
    try
    {
-      serializedMD = camera->GetTags();
+      cameraTags = camera->GetTagMetadata();
    }
    catch (const CMMError&)
    {
       return newMD;
    }
 
-   Metadata devMD;
-   devMD.Restore(serializedMD.c_str());
-   newMD.Merge(devMD);
+   if (cameraTags)
+      newMD.Merge(*cameraTags);
 
    return newMD;
 }
 
+/**
+ * Sets the camera key of md to that of the device caller, and returns the
+ * camera's tags (which may be null) to be stored alongside md.
+ */
+boost::shared_ptr<const Metadata>
+CoreCallback::AddCameraMetadata(const MM::Device* caller, MM::FrameMetadata& md)
+{
+   boost::shared_ptr<CameraInstance> camera =
+      boost::static_pointer_cast<CameraInstance>(
+            core_->deviceManager_->GetDevice(caller));
+
+   md.SetCameraKey(camera->GetLabelKey(*core_->metadataKeys_));
+
+   try
+   {
+      return camera->GetTagMetadata();
+   }
+   catch (const CMMError&)
+   {
+      return boost::shared_ptr<const Metadata>();
+   }
+}
+
+CircularBuffer*
+CoreCallback::GetSequenceBuffer(const MM::Device* caller,
+      boost::shared_ptr<CircularBuffer>& holder)
+{
+   try
+   {
+      boost::shared_ptr<CameraInstance> camera =
+         boost::dynamic_pointer_cast<CameraInstance>(
+               core_->deviceManager_->GetDevice(caller));
+      if (camera)
+         holder = camera->GetSequenceBuffer();
+   }
+   catch (const CMMError&)
+   {
+      // Not a loaded device
+   }
+   return holder ? holder.get() : core_->cbuf_;
+}
+
 int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess)
 {
    Metadata md;
@@ -261,7 +305,8 @@ int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf
             ip->Process(const_cast<unsigned char*>(buf), width, height, byteDepth);
          }
       }
-      if (core_->cbuf_->InsertImage(buf, width, height, byteDepth, &md))
+      boost::shared_ptr<CircularBuffer> holder;
+      if (GetSequenceBuffer(caller, holder)->InsertImage(buf, width, height, byteDepth, &md))
          return DEVICE_OK;
       else
          return DEVICE_BUFFER_OVERFLOW;
@@ -293,7 +338,35 @@ int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf
             ip->Process(const_cast<unsigned char*>(buf), width, height, byteDepth);
          }
       }
-      if (core_->cbuf_->InsertImage(buf, width, height, byteDepth, nComponents, &md))
+      boost::shared_ptr<CircularBuffer> holder;
+      if (GetSequenceBuffer(caller, holder)->InsertImage(buf, width, height, byteDepth, nComponents, &md))
+         return DEVICE_OK;
+      else
+         return DEVICE_BUFFER_OVERFLOW;
+   }
+   catch (CMMError& /*e*/)
+   {
+      return DEVICE_INCOMPATIBLE_IMAGE;
+   }
+}
+
+int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const MM::FrameMetadata& md, bool doProcess)
+{
+   try 
+   {
+      MM::FrameMetadata cameraMd(md);
+      boost::shared_ptr<const Metadata> tags = AddCameraMetadata(caller, cameraMd);
+
+      if(doProcess)
+      {
+         MM::ImageProcessor* ip = GetImageProcessor(caller);
+         if( NULL != ip)
+         {
+            ip->Process(const_cast<unsigned char*>(buf), width, height, byteDepth);
+         }
+      }
+      boost::shared_ptr<CircularBuffer> holder;
+      if (GetSequenceBuffer(caller, holder)->InsertImage(buf, width, height, byteDepth, nComponents, cameraMd, tags))
          return DEVICE_OK;
       else
          return DEVICE_BUFFER_OVERFLOW;
@@ -304,6 +377,14 @@ int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf
    }
 }
 
+int CoreCallback::RegisterMetadataKey(const MM::Device* /*caller*/, const char* key, const char* deviceLabel, unsigned& keyId)
+{
+   if (!key || !deviceLabel)
+      return DEVICE_INVALID_INPUT_PARAM;
+   keyId = core_->metadataKeys_->Intern(key, deviceLabel);
+   return DEVICE_OK;
+}
+
 int CoreCallback::InsertImage(const MM::Device* caller, const ImgBuffer & imgBuf)
 {
    Metadata md = imgBuf.GetMetadata();
@@ -318,9 +399,95 @@ int CoreCallback::InsertImage(const MM::Device* caller, const ImgBuffer & imgBuf
       imgBuf.Height(), imgBuf.Depth(), &md);
 }
 
-void CoreCallback::ClearImageBuffer(const MM::Device* /*caller*/)
+int CoreCallback::AcquireFrameSlot(const MM::Device* caller, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, unsigned char*& pixels)
+{
+   pixels = 0;
+   try
+   {
+      boost::shared_ptr<CircularBuffer> holder;
+      pixels = GetSequenceBuffer(caller, holder)->AcquireSlot(width, height, byteDepth, nComponents);
+      if (!pixels)
+         return DEVICE_BUFFER_OVERFLOW;
+      return DEVICE_OK;
+   }
+   catch (CMMError& /*e*/)
+   {
+      return DEVICE_INCOMPATIBLE_IMAGE;
+   }
+}
+
+int CoreCallback::CommitFrameSlot(const MM::Device* caller, unsigned char* pixels, const char* serializedMetadata, const bool doProcess)
+{
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = GetSequenceBuffer(caller, holder);
+   try
+   {
+      Metadata devMd;
+      devMd.Restore(serializedMetadata);
+      Metadata md = AddCameraMetadata(caller, &devMd);
+
+      if (doProcess)
+      {
+         MM::ImageProcessor* ip = GetImageProcessor(caller);
+         if (NULL != ip)
+         {
+            ip->Process(pixels, cbuf->Width(), cbuf->Height(), cbuf->Depth());
+         }
+      }
+      if (cbuf->CommitSlot(pixels, &md))
+         return DEVICE_OK;
+      return DEVICE_ERR;
+   }
+   catch (CMMError& /*e*/)
+   {
+      // Do not leave the buffer reserved
+      cbuf->DiscardSlot(pixels);
+      return DEVICE_ERR;
+   }
+}
+
+int CoreCallback::CommitFrameSlot(const MM::Device* caller, unsigned char* pixels, const MM::FrameMetadata& md, const bool doProcess)
+{
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = GetSequenceBuffer(caller, holder);
+   try
+   {
+      MM::FrameMetadata cameraMd(md);
+      boost::shared_ptr<const Metadata> tags = AddCameraMetadata(caller, cameraMd);
+
+      if (doProcess)
+      {
+         MM::ImageProcessor* ip = GetImageProcessor(caller);
+         if (NULL != ip)
+         {
+            ip->Process(pixels, cbuf->Width(), cbuf->Height(), cbuf->Depth());
+         }
+      }
+      if (cbuf->CommitSlot(pixels, cameraMd, tags))
+         return DEVICE_OK;
+      return DEVICE_ERR;
+   }
+   catch (CMMError& /*e*/)
+   {
+      // Do not leave the buffer reserved
+      cbuf->DiscardSlot(pixels);
+      return DEVICE_ERR;
+   }
+}
+
+int CoreCallback::DiscardFrameSlot(const MM::Device* caller, unsigned char* pixels)
 {
-   core_->cbuf_->Clear();
+   boost::shared_ptr<CircularBuffer> holder;
+   if (GetSequenceBuffer(caller, holder)->DiscardSlot(pixels))
+      return DEVICE_OK;
+   return DEVICE_ERR;
+}
+
+void CoreCallback::ClearImageBuffer(const MM::Device* caller)
+{
+   // Called by cameras to recover from an overflow
+   boost::shared_ptr<CircularBuffer> holder;
+   GetSequenceBuffer(caller, holder)->ClearAfterOverflow();
 }
 
 bool CoreCallback::InitializeImageBuffer(unsigned channels, unsigned slices,
@@ -350,7 +517,8 @@ int CoreCallback::InsertMultiChannel(const MM::Device* caller,
       {
          ip->Process( const_cast<unsigned char*>(buf), width, height, byteDepth);
       }
-      if (core_->cbuf_->InsertMultiChannel(buf, numChannels, width, height, byteDepth, &md))
+      boost::shared_ptr<CircularBuffer> holder;
+      if (GetSequenceBuffer(caller, holder)->InsertMultiChannel(buf, numChannels, width, height, byteDepth, &md))
          return DEVICE_OK;
       else
          return DEVICE_BUFFER_OVERFLOW;
@@ -462,69 +630,48 @@ int CoreCallback::OnPropertiesChanged(const MM::Device* /* caller */)
  */
 int CoreCallback::OnPropertyChanged(const MM::Device* device, const char* propName, const char* value)
 {
+   char label[MM::MaxStrLength];
+   device->GetLabel(label);
+
+   // Keep the cache up to date even without a listener, so that it need not
+   // be refreshed by querying the device
+   bool readOnly;
+   device->GetPropertyReadOnly(propName, readOnly);
+   {
+      MMThreadGuard scg(core_->stateCacheLock_);
+      core_->stateCache_.addSetting(PropertySetting(label, propName, value, readOnly));
+   }
+
    if (core_->externalCallback_) 
    {
       MMThreadGuard g(*pValueChangeLock_);
-      char label[MM::MaxStrLength];
-      device->GetLabel(label);
-      bool readOnly;
-      device->GetPropertyReadOnly(propName, readOnly);
-      const PropertySetting* ps = new PropertySetting(label, propName, value, readOnly);
-      {
-         MMThreadGuard scg(core_->stateCacheLock_);
-         core_->stateCache_.addSetting(*ps);
-      }
       core_->externalCallback_->onPropertyChanged(label, propName, value);
 
-      // Find all configs that contain this property and callback to indicate 
-      // that the config group changed
-      // TODO: Assess whether performance is better by maintaining a map tying
-      // property to configurations
-      std::vector<std::string> configGroups = 
-         core_->getAvailableConfigGroups ();
-      for (std::vector<std::string>::iterator it = configGroups.begin(); 
-            it != configGroups.end(); ++it) 
+      // Notify each config group that has a preset containing this
+      // property that the group changed. Get the new config from cache
+      // rather than by querying the hardware
+      std::vector<std::string> configGroups =
+         core_->configGroups_->GetGroupsIncludingProperty(label, propName);
+      for (std::vector<std::string>::iterator it = configGroups.begin();
+            it != configGroups.end(); ++it)
       {
-         std::vector<std::string> configs = 
-            core_->getAvailableConfigs((*it).c_str());
-         bool found = false;
-         for (std::vector<std::string>::iterator itc = configs.begin();
-               itc != configs.end() && !found; itc++) 
-         {
-            Configuration config = 
-               core_->getConfigData((*it).c_str(), (*itc).c_str());
-            if (config.isPropertyIncluded(label, propName)) {
-               found = true;
-               // If we are part of this configuration, notify that it 
-               // was changed. Get the new config from cache rather 
-               // than by querying the hardware
-               std::string currentConfig = 
-                  core_->getCurrentConfigFromCache( (*it).c_str() );
-               OnConfigGroupChanged((*it).c_str(), currentConfig.c_str());
-            }
-         }
+         std::string currentConfig =
+            core_->getCurrentConfigFromCache((*it).c_str());
+         OnConfigGroupChanged((*it).c_str(), currentConfig.c_str());
       }
-          
 
       // Check if pixel size was potentially affected.  If so, update from cache
-      std::vector<std::string> pixelSizeConfigs = core_->getAvailablePixelSizeConfigs();
-      bool found = false;
-      for (std::vector<std::string>::iterator itpsc = pixelSizeConfigs.begin();
-            itpsc != pixelSizeConfigs.end() && !found; itpsc++) 
+      if (core_->pixelSizeGroup_->IsPropertyIncluded(label, propName))
       {
-         Configuration pixelSizeConfig = core_->getPixelSizeConfigData( (*itpsc).c_str());
-         if (pixelSizeConfig.isPropertyIncluded(label, propName)) {
-            found = true;
-            double pixSizeUm;
-            try {
-               // update pixel size from cache
-               pixSizeUm = core_->getPixelSizeUm(true);
-            }
-            catch (CMMError ) {
-               pixSizeUm = 0.0;
-            }
-            OnPixelSizeChanged(pixSizeUm);
+         double pixSizeUm;
+         try {
+            // update pixel size from cache
+            pixSizeUm = core_->getPixelSizeUm(true);
          }
+         catch (CMMError ) {
+            pixSizeUm = 0.0;
+         }
+         OnPixelSizeChanged(pixSizeUm);
       }
    }
 
@@ -634,6 +781,16 @@ int CoreCallback::OnMagnifierChanged(const MM::Device* /* device */)
    return DEVICE_OK;
 }
 
+/**
+ * Handler for the end of a device's busy state; wakes threads waiting for
+ * the device
+ */
+int CoreCallback::OnDeviceIdle(const MM::Device* device)
+{
+   core_->idleNotifier_->Notify(device);
+   return DEVICE_OK;
+}
+
 
 
 int CoreCallback::SetSerialProperties(const char* portName,
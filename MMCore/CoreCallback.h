@@ -88,11 +88,17 @@ public:
    int InsertImage(const MM::Device* caller, const ImgBuffer& imgBuf); // Note: _not_ mm::ImgBuffer
    int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess = true);
    int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const char* serializedMetadata, const bool doProcess = true);
+   int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const MM::FrameMetadata& md, const bool doProcess = true);
+   int RegisterMetadataKey(const MM::Device* caller, const char* key, const char* deviceLabel, unsigned& keyId);
 
    /*Deprecated*/ int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const Metadata* pMd = 0, const bool doProcess = true);
    /*Deprecated*/ int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd = 0, const bool doProcess = true);
 
    /*Deprecated*/ int InsertMultiChannel(const MM::Device* caller, const unsigned char* buf, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, Metadata* pMd = 0);
+   int AcquireFrameSlot(const MM::Device* caller, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, unsigned char*& pixels);
+   int CommitFrameSlot(const MM::Device* caller, unsigned char* pixels, const char* serializedMetadata, const bool doProcess = true);
+   int CommitFrameSlot(const MM::Device* caller, unsigned char* pixels, const MM::FrameMetadata& md, const bool doProcess = true);
+   int DiscardFrameSlot(const MM::Device* caller, unsigned char* pixels);
    void ClearImageBuffer(const MM::Device* caller);
    bool InitializeImageBuffer(unsigned channels, unsigned slices, unsigned int w, unsigned int h, unsigned int pixDepth);
 
@@ -122,6 +128,7 @@ public:
    int OnExposureChanged(const MM::Device* device, double newExposure);
    int OnSLMExposureChanged(const MM::Device* device, double newExposure);
    int OnMagnifierChanged(const MM::Device* device);
+   int OnDeviceIdle(const MM::Device* device);
 
 
    void NextPostedError(int& errorCode, char* pMessage, int maxlen, int& messageLength);
@@ -143,6 +150,11 @@ private:
    MMThreadLock* pValueChangeLock_;
 
    Metadata AddCameraMetadata(const MM::Device* caller, const Metadata* pMd);
+   boost::shared_ptr<const Metadata> AddCameraMetadata(const MM::Device* caller, MM::FrameMetadata& md);
+   // The sequence buffer for images from caller; holder keeps a camera's own
+   // buffer alive while it is used
+   CircularBuffer* GetSequenceBuffer(const MM::Device* caller,
+         boost::shared_ptr<CircularBuffer>& holder);
 
    int OnConfigGroupChanged(const char* groupName, const char* newConfigName);
    int OnPixelSizeChanged(double newPixelSizeUm);
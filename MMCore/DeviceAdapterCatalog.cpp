@@ -0,0 +1,271 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Persistent record of the devices provided by device adapter
+//                modules, so that they can be listed without loading them
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "DeviceAdapterCatalog.h"
+
+#include "../MMDevice/ModuleInterface.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <cstdio>
+#include <fstream>
+
+namespace mm {
+
+namespace {
+
+// First field of the header line; followed by the format version and the
+// module and device interface versions
+const char* const CATALOG_SIGNATURE = "MMDeviceAdapterCatalog";
+const int CATALOG_FORMAT_VERSION = 1;
+
+// Fields are tab-separated; tabs, line breaks and backslashes within a field
+// are escaped
+std::string
+Escape(const std::string& s)
+{
+   std::string escaped;
+   escaped.reserve(s.size());
+   for (std::string::const_iterator it = s.begin(); it != s.end(); ++it)
+   {
+      switch (*it)
+      {
+         case '\\': escaped += "\\\\"; break;
+         case '\t': escaped += "\\t"; break;
+         case '\n': escaped += "\\n"; break;
+         case '\r': escaped += "\\r"; break;
+         default: escaped += *it; break;
+      }
+   }
+   return escaped;
+}
+
+bool
+Unescape(const std::string& s, std::string& unescaped)
+{
+   unescaped.clear();
+   for (std::string::const_iterator it = s.begin(); it != s.end(); ++it)
+   {
+      if (*it != '\\')
+      {
+         unescaped += *it;
+         continue;
+      }
+      if (++it == s.end())
+         return false;
+      switch (*it)
+      {
+         case '\\': unescaped += '\\'; break;
+         case 't': unescaped += '\t'; break;
+         case 'n': unescaped += '\n'; break;
+         case 'r': unescaped += '\r'; break;
+         default: return false;
+      }
+   }
+   return true;
+}
+
+bool
+SplitLine(const std::string& line, std::vector<std::string>& fields)
+{
+   fields.clear();
+   std::string::size_type start = 0;
+   for (;;)
+   {
+      std::string::size_type tab = line.find('\t', start);
+      std::string field;
+      if (!Unescape(line.substr(start,
+                  tab == std::string::npos ? std::string::npos : tab - start),
+               field))
+         return false;
+      fields.push_back(field);
+      if (tab == std::string::npos)
+         return true;
+      start = tab + 1;
+   }
+}
+
+template <typename T>
+bool
+ParseNumber(const std::string& s, T& value)
+{
+   try
+   {
+      value = boost::lexical_cast<T>(s);
+      return true;
+   }
+   catch (const boost::bad_lexical_cast&)
+   {
+      return false;
+   }
+}
+
+std::string
+HeaderLine()
+{
+   return std::string(CATALOG_SIGNATURE) + "\t" +
+      boost::lexical_cast<std::string>(CATALOG_FORMAT_VERSION) + "\t" +
+      boost::lexical_cast<std::string>(MODULE_INTERFACE_VERSION) + "\t" +
+      boost::lexical_cast<std::string>(DEVICE_INTERFACE_VERSION);
+}
+
+} // anonymous namespace
+
+
+bool
+DeviceAdapterCatalog::GetFileStamp(const std::string& path, FileStamp& stamp)
+{
+#ifdef WIN32
+   struct _stati64 info;
+   if (_stati64(path.c_str(), &info) != 0)
+      return false;
+#else
+   struct stat info;
+   if (stat(path.c_str(), &info) != 0)
+      return false;
+#endif
+   if (!(info.st_mode & S_IFREG))
+      return false;
+   stamp.modificationTime = static_cast<long long>(info.st_mtime);
+   stamp.size = static_cast<long long>(info.st_size);
+   return true;
+}
+
+
+const std::vector<DeviceAdapterCatalog::Device>*
+DeviceAdapterCatalog::Find(const std::string& path,
+      const FileStamp& stamp) const
+{
+   std::map<std::string, Entry>::const_iterator it = entries_.find(path);
+   if (it == entries_.end() || it->second.stamp != stamp)
+      return 0;
+   return &it->second.devices;
+}
+
+
+void
+DeviceAdapterCatalog::Store(const std::string& path, const FileStamp& stamp,
+      const std::vector<Device>& devices)
+{
+   Entry& entry = entries_[path];
+   entry.stamp = stamp;
+   entry.devices = devices;
+}
+
+
+bool
+DeviceAdapterCatalog::Load(const std::string& filename)
+{
+   entries_.clear();
+
+   std::ifstream file(filename.c_str());
+   std::string line;
+   if (!file || !std::getline(file, line) || line != HeaderLine())
+      return false;
+
+   std::map<std::string, Entry> entries;
+   Entry* entry = 0;
+   std::vector<std::string> fields;
+   while (std::getline(file, line))
+   {
+      if (!SplitLine(line, fields))
+         return false;
+      if (fields[0] == "M" && fields.size() == 4)
+      {
+         FileStamp stamp;
+         if (!ParseNumber(fields[2], stamp.modificationTime) ||
+               !ParseNumber(fields[3], stamp.size))
+            return false;
+         entry = &entries[fields[1]];
+         entry->stamp = stamp;
+         entry->devices.clear();
+      }
+      else if (fields[0] == "D" && fields.size() == 4 && entry)
+      {
+         Device device;
+         device.name = fields[1];
+         if (!ParseNumber(fields[2], device.type))
+            return false;
+         device.description = fields[3];
+         entry->devices.push_back(device);
+      }
+      else
+      {
+         return false;
+      }
+   }
+   if (file.bad())
+      return false;
+
+   entries_.swap(entries);
+   return true;
+}
+
+
+bool
+DeviceAdapterCatalog::Save(const std::string& filename) const
+{
+   const std::string tempFilename = filename + ".tmp";
+   {
+      std::ofstream file(tempFilename.c_str(),
+            std::ios::out | std::ios::trunc | std::ios::binary);
+      if (!file)
+         return false;
+
+      file << HeaderLine() << '\n';
+      for (std::map<std::string, Entry>::const_iterator it = entries_.begin(),
+            end = entries_.end(); it != end; ++it)
+      {
+         FileStamp current;
+         if (!GetFileStamp(it->first, current) || current != it->second.stamp)
+            continue;
+
+         file << "M\t" << Escape(it->first) << '\t' <<
+            it->second.stamp.modificationTime << '\t' <<
+            it->second.stamp.size << '\n';
+         const std::vector<Device>& devices = it->second.devices;
+         for (std::vector<Device>::const_iterator dit = devices.begin(),
+               dend = devices.end(); dit != dend; ++dit)
+         {
+            file << "D\t" << Escape(dit->name) << '\t' << dit->type << '\t' <<
+               Escape(dit->description) << '\n';
+         }
+      }
+      file.close();
+      if (!file)
+      {
+         std::remove(tempFilename.c_str());
+         return false;
+      }
+   }
+
+#ifdef WIN32
+   // rename() does not replace an existing file on Windows
+   std::remove(filename.c_str());
+#endif
+   if (std::rename(tempFilename.c_str(), filename.c_str()) != 0)
+   {
+      std::remove(tempFilename.c_str());
+      return false;
+   }
+   return true;
+}
+
+} // namespace mm
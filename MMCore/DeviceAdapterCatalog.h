@@ -0,0 +1,98 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Persistent record of the devices provided by device adapter
+//                modules, so that they can be listed without loading them
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace mm {
+
+/**
+ * The devices advertised by each device adapter module file, keyed by the
+ * file's path, modification time and size.
+ *
+ * An entry only answers for the exact file it was made from: replacing or
+ * rebuilding the module changes its stamp, and the entry is ignored (and
+ * dropped on the next Save()). The file format also records the module and
+ * device interface versions of the Core, so that a catalog written by a
+ * different Core is not trusted.
+ */
+class DeviceAdapterCatalog
+{
+public:
+   struct Device
+   {
+      std::string name;
+      std::string description;
+      long type; // MM::DeviceType; MM::UnknownType if not advertised
+
+      Device() : type(0) {}
+   };
+
+   struct FileStamp
+   {
+      long long modificationTime; // Seconds since the epoch
+      long long size;
+
+      FileStamp() : modificationTime(-1), size(-1) {}
+      bool operator==(const FileStamp& rhs) const
+      { return modificationTime == rhs.modificationTime && size == rhs.size; }
+      bool operator!=(const FileStamp& rhs) const { return !(*this == rhs); }
+   };
+
+   // Returns false if the file does not exist or cannot be examined
+   static bool GetFileStamp(const std::string& path, FileStamp& stamp);
+
+   // Returns null unless there is an entry for path with the given stamp
+   const std::vector<Device>* Find(const std::string& path,
+         const FileStamp& stamp) const;
+   void Store(const std::string& path, const FileStamp& stamp,
+         const std::vector<Device>& devices);
+   void Clear() { entries_.clear(); }
+   size_t GetModuleCount() const { return entries_.size(); }
+
+   /**
+    * Replace the entries with those read from a catalog file.
+    *
+    * Returns false, leaving the catalog empty, if the file is missing,
+    * unreadable, malformed, or written for other interface versions. Being a
+    * cache, the catalog is then simply rebuilt as modules are examined.
+    */
+   bool Load(const std::string& filename);
+
+   /**
+    * Write the entries whose module file is unchanged to a catalog file.
+    *
+    * The file is written under a temporary name and then renamed, so that a
+    * concurrent Load() (say, by another process) never sees a partial file.
+    * Returns false on failure.
+    */
+   bool Save(const std::string& filename) const;
+
+private:
+   struct Entry
+   {
+      FileStamp stamp;
+      std::vector<Device> devices;
+   };
+
+   std::map<std::string, Entry> entries_;
+};
+
+} // namespace mm
@@ -0,0 +1,287 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Initializes devices of different adapter modules
+//                concurrently, respecting the dependencies between devices
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "DeviceInitializer.h"
+
+#include "Error.h"
+#include "ThreadPool.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+
+namespace mm {
+
+namespace {
+
+void AddPrerequisite(std::vector<size_t>& prerequisites, size_t device)
+{
+   if (std::find(prerequisites.begin(), prerequisites.end(), device) ==
+         prerequisites.end())
+      prerequisites.push_back(device);
+}
+
+} // anonymous namespace
+
+
+// The state of a concurrent Run(), shared with the pool threads
+class DeviceInitializer::Schedule
+{
+public:
+   Schedule(DeviceInitializer& initializer,
+         const InitializeFunction& initialize) :
+      initializer_(initializer),
+      initialize_(initialize),
+      running_(0)
+   {
+      const size_t n = initializer_.prerequisites_.size();
+      waitingFor_.resize(n);
+      for (size_t i = 0; i < n; ++i)
+      {
+         waitingFor_[i] = initializer_.prerequisites_[i].size();
+         if (waitingFor_[i] == 0)
+            ready_.push_back(i);
+      }
+      remaining_ = n;
+   }
+
+   // Returns when all devices have been initialized, or when the started
+   // ones have finished after a failure
+   void Run()
+   {
+      boost::unique_lock<boost::mutex> lock(mutex_);
+      for (;;)
+      {
+         if (!error_)
+         {
+            while (!ready_.empty())
+            {
+               size_t device = ready_.front();
+               ready_.pop_front();
+               ++running_;
+               initializer_.pool_->Submit(
+                     boost::bind(&Schedule::InitializeOne, this, device));
+            }
+         }
+         if (running_ == 0 && (error_ || remaining_ == 0))
+            break;
+         changed_.wait(lock);
+      }
+
+      if (error_)
+         throw *error_;
+   }
+
+private:
+   // Runs on a pool thread
+   void InitializeOne(size_t device)
+   {
+      double timeMs;
+      boost::shared_ptr<CMMError> error =
+         initializer_.InitializeTimed(initialize_, device, timeMs);
+
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      initializer_.timesMs_[device] = timeMs;
+      initializer_.initialized_[device] = !error;
+      --running_;
+      --remaining_;
+      if (error)
+      {
+         if (!error_)
+            error_ = error;
+      }
+      else
+      {
+         const std::vector<size_t>& dependents =
+            initializer_.dependents_[device];
+         for (size_t i = 0; i < dependents.size(); ++i)
+         {
+            if (--waitingFor_[dependents[i]] == 0)
+               ready_.push_back(dependents[i]);
+         }
+      }
+      changed_.notify_one();
+   }
+
+   DeviceInitializer& initializer_;
+   const InitializeFunction& initialize_;
+
+   boost::mutex mutex_;
+   boost::condition_variable changed_;
+   std::vector<size_t> waitingFor_; // Prerequisites not yet initialized
+   std::deque<size_t> ready_;
+   size_t running_;
+   size_t remaining_;
+   boost::shared_ptr<CMMError> error_; // The first failure
+};
+
+
+DeviceInitializer::DeviceInitializer(boost::shared_ptr<ThreadPool> pool,
+      const std::vector<Device>& devices) :
+   pool_(pool),
+   prerequisites_(devices.size()),
+   dependents_(devices.size()),
+   hasCycle_(false),
+   initialized_(devices.size(), false),
+   timesMs_(devices.size(), 0.0),
+   totalTimeMs_(0.0)
+{
+   std::map<std::string, size_t> indexOfLabel;
+   for (size_t i = 0; i < devices.size(); ++i)
+      indexOfLabel[devices[i].label] = i;
+
+   std::map<const void*, size_t> lastOfModule;
+   std::map<std::string, size_t> lastUserOfPort;
+   for (size_t i = 0; i < devices.size(); ++i)
+   {
+      const Device& device = devices[i];
+      std::vector<size_t>& prerequisites = prerequisites_[i];
+
+      std::map<const void*, size_t>::iterator moduleIt =
+         lastOfModule.find(device.module);
+      if (moduleIt != lastOfModule.end())
+         AddPrerequisite(prerequisites, moduleIt->second);
+      lastOfModule[device.module] = i;
+
+      std::map<std::string, size_t>::const_iterator found =
+         indexOfLabel.find(device.parentLabel);
+      if (!device.parentLabel.empty() && found != indexOfLabel.end() &&
+            found->second != i)
+         AddPrerequisite(prerequisites, found->second);
+
+      if (!device.port.empty())
+      {
+         found = indexOfLabel.find(device.port);
+         if (found != indexOfLabel.end() && found->second != i)
+            AddPrerequisite(prerequisites, found->second);
+         std::map<std::string, size_t>::iterator portIt =
+            lastUserOfPort.find(device.port);
+         if (portIt != lastUserOfPort.end())
+            AddPrerequisite(prerequisites, portIt->second);
+         lastUserOfPort[device.port] = i;
+      }
+
+      for (size_t j = 0; j < prerequisites.size(); ++j)
+         dependents_[prerequisites[j]].push_back(i);
+   }
+
+   // Look for a cycle by removing the devices with no prerequisites left
+   std::vector<size_t> waitingFor(devices.size());
+   std::vector<size_t> ready;
+   for (size_t i = 0; i < devices.size(); ++i)
+   {
+      waitingFor[i] = prerequisites_[i].size();
+      if (waitingFor[i] == 0)
+         ready.push_back(i);
+   }
+   size_t removed = 0;
+   while (!ready.empty())
+   {
+      size_t device = ready.back();
+      ready.pop_back();
+      ++removed;
+      for (size_t j = 0; j < dependents_[device].size(); ++j)
+      {
+         if (--waitingFor[dependents_[device][j]] == 0)
+            ready.push_back(dependents_[device][j]);
+      }
+   }
+   hasCycle_ = (removed < devices.size());
+}
+
+void
+DeviceInitializer::Run(const InitializeFunction& initialize, bool parallel)
+{
+   std::fill(initialized_.begin(), initialized_.end(), false);
+   std::fill(timesMs_.begin(), timesMs_.end(), 0.0);
+
+   const boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
+   try
+   {
+      if (parallel && !hasCycle_)
+         RunConcurrently(initialize);
+      else
+         RunInOrder(initialize);
+   }
+   catch (const CMMError&)
+   {
+      totalTimeMs_ = (boost::posix_time::microsec_clock::universal_time() -
+            start).total_microseconds() / 1000.0;
+      throw;
+   }
+   totalTimeMs_ = (boost::posix_time::microsec_clock::universal_time() -
+         start).total_microseconds() / 1000.0;
+}
+
+void
+DeviceInitializer::RunInOrder(const InitializeFunction& initialize)
+{
+   for (size_t i = 0; i < prerequisites_.size(); ++i)
+   {
+      boost::shared_ptr<CMMError> error =
+         InitializeTimed(initialize, i, timesMs_[i]);
+      initialized_[i] = !error;
+      if (error)
+         throw *error;
+   }
+}
+
+void
+DeviceInitializer::RunConcurrently(const InitializeFunction& initialize)
+{
+   Schedule schedule(*this, initialize);
+   schedule.Run();
+}
+
+boost::shared_ptr<CMMError>
+DeviceInitializer::InitializeTimed(const InitializeFunction& initialize,
+      size_t device, double& timeMs)
+{
+   boost::shared_ptr<CMMError> error;
+   const boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
+   try
+   {
+      initialize(device);
+   }
+   catch (const CMMError& e)
+   {
+      error = boost::make_shared<CMMError>(e);
+   }
+   catch (const std::exception& e)
+   {
+      // Pool tasks must not throw
+      error = boost::make_shared<CMMError>(std::string(e.what()));
+   }
+   catch (...)
+   {
+      error = boost::make_shared<CMMError>("Unexpected error");
+   }
+   timeMs = (boost::posix_time::microsec_clock::universal_time() -
+         start).total_microseconds() / 1000.0;
+   return error;
+}
+
+} // namespace mm
@@ -0,0 +1,106 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Initializes devices of different adapter modules
+//                concurrently, respecting the dependencies between devices
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <string>
+#include <vector>
+
+class CMMError;
+
+namespace mm {
+
+class ThreadPool;
+
+/**
+ * Initializes a list of devices, running those that do not depend on each
+ * other on the device thread pool.
+ *
+ * A device is initialized after
+ * - the device before it in the list from the same adapter module (so that
+ *   each module sees its devices in list order, as when initializing one at
+ *   a time, and no pool thread waits for a module lock),
+ * - its hub (parent), and
+ * - the serial port it uses, and the device before it in the list that uses
+ *   the same port.
+ *
+ * If these dependencies form a cycle (say, a hub listed after its
+ * peripheral, in a module also holding the hub's port), the devices are
+ * initialized one at a time in list order.
+ */
+class DeviceInitializer : boost::noncopyable
+{
+public:
+   struct Device
+   {
+      std::string label;
+      const void* module; // Identifies the adapter module
+      std::string parentLabel; // Empty if none
+      std::string port; // Label of the serial port device used; empty if none
+
+      Device() : module(0) {}
+   };
+
+   // Initializes the device of the given index; throws CMMError on failure
+   typedef boost::function<void (size_t)> InitializeFunction;
+
+   DeviceInitializer(boost::shared_ptr<ThreadPool> pool,
+         const std::vector<Device>& devices);
+
+   // Indices of the devices that must be initialized before the given one
+   const std::vector<size_t>& GetPrerequisites(size_t device) const
+   { return prerequisites_[device]; }
+   bool HasCycle() const { return hasCycle_; }
+
+   /**
+    * Initializes the devices, concurrently unless parallel is false (or
+    * there is a cycle). Once a device fails, no more devices are started;
+    * the error of the first failure is rethrown when those already started
+    * have finished.
+    */
+   void Run(const InitializeFunction& initialize, bool parallel);
+
+   bool WasInitialized(size_t device) const { return initialized_[device]; }
+   // Time taken by Initialize(), in ms; 0 if not started
+   double GetTimeMs(size_t device) const { return timesMs_[device]; }
+   // Time taken by the last Run(), in ms
+   double GetTotalTimeMs() const { return totalTimeMs_; }
+
+private:
+   class Schedule;
+
+   void RunInOrder(const InitializeFunction& initialize);
+   void RunConcurrently(const InitializeFunction& initialize);
+   // Returns the error, or null on success
+   boost::shared_ptr<CMMError> InitializeTimed(
+         const InitializeFunction& initialize, size_t device, double& timeMs);
+
+   boost::shared_ptr<ThreadPool> pool_;
+   std::vector< std::vector<size_t> > prerequisites_;
+   std::vector< std::vector<size_t> > dependents_;
+   bool hasCycle_;
+
+   std::vector<bool> initialized_;
+   std::vector<double> timesMs_;
+   double totalTimeMs_;
+};
+
+} // namespace mm
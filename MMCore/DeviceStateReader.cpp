@@ -0,0 +1,207 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Reads the property values of all devices for the system
+//                state cache
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "DeviceStateReader.h"
+
+#include "../MMDevice/MMDeviceConstants.h"
+#include "DeviceManager.h"
+#include "Devices/DeviceInstance.h"
+#include "ThreadPool.h"
+
+#include <boost/bind.hpp>
+
+namespace mm {
+
+DeviceStateReader::DeviceStateReader(boost::shared_ptr<ThreadPool> pool) :
+   pool_(pool),
+   lastSkippedCount_(0)
+{
+}
+
+std::vector<PropertySetting>
+DeviceStateReader::Read(
+      const std::vector< boost::shared_ptr<DeviceInstance> >& devices,
+      Configuration& cache)
+{
+   std::vector< std::vector<PropertySetting> > deviceSettings(devices.size());
+   std::vector<size_t> skipped(devices.size(), 0);
+
+   // One task per module, reading its devices in turn
+   std::map<LoadedDeviceAdapter*, std::vector<size_t> > devicesOfModule;
+   for (size_t i = 0; i < devices.size(); ++i)
+      devicesOfModule[devices[i]->GetAdapterModule().get()].push_back(i);
+
+   ReadContext context = { &devices, &cache, &deviceSettings, &skipped };
+   std::vector<ThreadPool::Task> tasks;
+   for (std::map<LoadedDeviceAdapter*, std::vector<size_t> >::const_iterator
+         it = devicesOfModule.begin(), end = devicesOfModule.end();
+         it != end; ++it)
+   {
+      tasks.push_back(boost::bind(&DeviceStateReader::ReadDevices, this,
+               boost::cref(context), boost::cref(it->second)));
+   }
+   pool_->RunAll(tasks);
+
+   std::vector<PropertySetting> settings;
+   size_t skippedCount = 0;
+   for (size_t i = 0; i < devices.size(); ++i)
+   {
+      settings.insert(settings.end(), deviceSettings[i].begin(),
+            deviceSettings[i].end());
+      skippedCount += skipped[i];
+   }
+
+   MMThreadGuard g(lock_);
+   lastSkippedCount_ = skippedCount;
+   return settings;
+}
+
+void
+DeviceStateReader::Forget(boost::shared_ptr<DeviceInstance> device)
+{
+   MMThreadGuard g(lock_);
+   entries_.erase(device.get());
+}
+
+void
+DeviceStateReader::ForgetAll()
+{
+   MMThreadGuard g(lock_);
+   entries_.clear();
+}
+
+size_t
+DeviceStateReader::GetLastSkippedCount()
+{
+   MMThreadGuard g(lock_);
+   return lastSkippedCount_;
+}
+
+void
+DeviceStateReader::ReadDevices(const ReadContext& context,
+      const std::vector<size_t>& indices)
+{
+   for (std::vector<size_t>::const_iterator it = indices.begin(),
+         end = indices.end(); it != end; ++it)
+   {
+      ReadDevice((*context.devices)[*it], *context.cache,
+            (*context.settings)[*it], (*context.skipped)[*it]);
+   }
+}
+
+void
+DeviceStateReader::ReadDevice(boost::shared_ptr<DeviceInstance> device,
+      Configuration& cache, std::vector<PropertySetting>& settings,
+      size_t& skipped)
+{
+   const std::string label = device->GetLabel();
+   StaticProperties staticProperties;
+   const bool known = LookUp(device, staticProperties);
+
+   DeviceModuleLockGuard guard(device);
+   std::vector<std::string> propertyNames = device->GetPropertyNames();
+   for (std::vector<std::string>::const_iterator it = propertyNames.begin(),
+         end = propertyNames.end(); it != end; ++it)
+   {
+      if (known)
+      {
+         StaticProperties::const_iterator found = staticProperties.find(*it);
+         if (found != staticProperties.end() &&
+               cache.isPropertyIncluded(label.c_str(), it->c_str()))
+         {
+            settings.push_back(PropertySetting(label.c_str(), it->c_str(),
+                     cache.getSetting(label.c_str(), it->c_str()).
+                        getPropertyValue().c_str(),
+                     found->second));
+            ++skipped;
+            continue;
+         }
+      }
+
+      std::string val;
+      try
+      {
+         val = device->GetProperty(*it);
+      }
+      catch (const CMMError&)
+      {
+         // XXX BUG This should not be ignored, but the interface does not
+         // allow throwing from this function. Keeping old behavior for now.
+      }
+
+      bool readOnly = false;
+      try
+      {
+         readOnly = device->GetPropertyReadOnly(it->c_str());
+      }
+      catch (const CMMError&)
+      {
+         // XXX BUG As above
+      }
+      settings.push_back(PropertySetting(label.c_str(), it->c_str(),
+               val.c_str(), readOnly));
+
+      if (!known)
+      {
+         bool isStatic = readOnly && (*it == MM::g_Keyword_Name ||
+               *it == MM::g_Keyword_Description);
+         try
+         {
+            isStatic = isStatic || device->GetPropertyInitStatus(it->c_str());
+         }
+         catch (const CMMError&)
+         {
+         }
+         if (isStatic)
+            staticProperties[*it] = readOnly;
+      }
+   }
+
+   if (!known)
+      Remember(device, staticProperties);
+}
+
+bool
+DeviceStateReader::LookUp(boost::shared_ptr<DeviceInstance> device,
+      StaticProperties& staticProperties)
+{
+   MMThreadGuard g(lock_);
+   std::map<const DeviceInstance*, DeviceEntry>::iterator it =
+      entries_.find(device.get());
+   if (it == entries_.end())
+      return false;
+   if (it->second.device.lock() != device)
+   {
+      // A device that has been unloaded, at the same address
+      entries_.erase(it);
+      return false;
+   }
+   staticProperties = it->second.staticProperties;
+   return true;
+}
+
+void
+DeviceStateReader::Remember(boost::shared_ptr<DeviceInstance> device,
+      const StaticProperties& staticProperties)
+{
+   MMThreadGuard g(lock_);
+   DeviceEntry& entry = entries_[device.get()];
+   entry.device = device;
+   entry.staticProperties = staticProperties;
+}
+
+} // namespace mm
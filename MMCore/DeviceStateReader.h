@@ -0,0 +1,103 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Reads the property values of all devices for the system
+//                state cache
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "../MMDevice/DeviceThreads.h"
+#include "Configuration.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class DeviceInstance;
+
+namespace mm {
+
+class ThreadPool;
+
+/**
+ * Reads the values of all properties of a set of devices, reading the
+ * devices of different adapter modules concurrently.
+ *
+ * Properties that cannot change once their device is initialized
+ * (pre-initialization properties, and the read-only name and description)
+ * are only read from the device the first time; afterwards their values are
+ * taken from the state cache, which is updated whenever they are set. Call
+ * Forget() when a device is (re)initialized.
+ */
+class DeviceStateReader : boost::noncopyable
+{
+public:
+   explicit DeviceStateReader(boost::shared_ptr<ThreadPool> pool);
+
+   /**
+    * Returns the settings of devices, in order. Errors reading a property
+    * are ignored (the value is left empty).
+    *
+    * cache is only read, but may be used by several threads.
+    */
+   std::vector<PropertySetting> Read(
+         const std::vector< boost::shared_ptr<DeviceInstance> >& devices,
+         Configuration& cache);
+
+   void Forget(boost::shared_ptr<DeviceInstance> device);
+   void ForgetAll();
+
+   // Number of property values taken from the cache by the last Read()
+   size_t GetLastSkippedCount();
+
+private:
+   // Read-only flags of the static properties, by name
+   typedef std::map<std::string, bool> StaticProperties;
+
+   struct DeviceEntry
+   {
+      boost::weak_ptr<DeviceInstance> device; // To detect address reuse
+      StaticProperties staticProperties;
+   };
+
+   struct ReadContext
+   {
+      const std::vector< boost::shared_ptr<DeviceInstance> >* devices;
+      Configuration* cache;
+      std::vector< std::vector<PropertySetting> >* settings;
+      std::vector<size_t>* skipped;
+   };
+
+   // Reads the devices of one module
+   void ReadDevices(const ReadContext& context, const std::vector<size_t>& indices);
+   void ReadDevice(boost::shared_ptr<DeviceInstance> device,
+         Configuration& cache, std::vector<PropertySetting>& settings,
+         size_t& skipped);
+   bool LookUp(boost::shared_ptr<DeviceInstance> device,
+         StaticProperties& staticProperties);
+   void Remember(boost::shared_ptr<DeviceInstance> device,
+         const StaticProperties& staticProperties);
+
+   boost::shared_ptr<ThreadPool> pool_;
+
+   MMThreadLock lock_;
+   std::map<const DeviceInstance*, DeviceEntry> entries_;
+   size_t lastSkippedCount_;
+};
+
+} // namespace mm
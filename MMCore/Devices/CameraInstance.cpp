@@ -21,6 +21,8 @@
 
 #include "CameraInstance.h"
 
+#include "../MetadataKeyTable.h"
+
 
 int CameraInstance::SnapImage() { return GetImpl()->SnapImage(); }
 const unsigned char* CameraInstance::GetImageBuffer() { return GetImpl()->GetImageBuffer(); }
@@ -137,6 +139,50 @@ std::string CameraInstance::GetTags()
    return serializedMetadataBuf.Get();
 }
 
+boost::shared_ptr<const Metadata> CameraInstance::GetTagMetadata()
+{
+   DeviceStringBuffer serializedMetadataBuf(this, "GetTags");
+   GetImpl()->GetTags(serializedMetadataBuf.GetBuffer());
+   const char* serialized = serializedMetadataBuf.GetBuffer();
+   if (serializedMetadataBuf.IsEmpty())
+      serialized = "0";
+
+   MMThreadGuard g(tagCacheLock_);
+   if (cachedSerializedTags_ != serialized)
+   {
+      boost::shared_ptr<Metadata> tags(new Metadata());
+      tags->Restore(serialized);
+      if (tags->GetKeys().empty())
+         tags.reset();
+      cachedTags_ = tags;
+      cachedSerializedTags_ = serialized;
+   }
+   return cachedTags_;
+}
+
+unsigned CameraInstance::GetLabelKey(mm::MetadataKeyTable& keys)
+{
+   MMThreadGuard g(tagCacheLock_);
+   if (!hasLabelKey_)
+   {
+      labelKey_ = keys.Intern(GetLabel(), "_");
+      hasLabelKey_ = true;
+   }
+   return labelKey_;
+}
+
+boost::shared_ptr<CircularBuffer> CameraInstance::GetSequenceBuffer()
+{
+   MMThreadGuard g(sequenceBufferLock_);
+   return sequenceBuffer_;
+}
+
+void CameraInstance::SetSequenceBuffer(boost::shared_ptr<CircularBuffer> buffer)
+{
+   MMThreadGuard g(sequenceBufferLock_);
+   sequenceBuffer_ = buffer;
+}
+
 void CameraInstance::AddTag(const char* key, const char* deviceLabel, const char* value) { return GetImpl()->AddTag(key, deviceLabel, value); }
 void CameraInstance::RemoveTag(const char* key) { return GetImpl()->RemoveTag(key); }
 int CameraInstance::IsExposureSequenceable(bool& isSequenceable) const { return GetImpl()->IsExposureSequenceable(isSequenceable); }
@@ -21,6 +21,17 @@
 
 #include "DeviceInstanceBase.h"
 
+#include "../../MMDevice/DeviceThreads.h"
+#include "../../MMDevice/ImageMetadata.h"
+
+#include <boost/shared_ptr.hpp>
+
+class CircularBuffer;
+
+namespace mm {
+   class MetadataKeyTable;
+}
+
 
 class CameraInstance : public DeviceInstanceBase<MM::Camera>
 {
@@ -33,7 +44,9 @@ public:
          const std::string& label,
          mm::logging::Logger deviceLogger,
          mm::logging::Logger coreLogger) :
-      DeviceInstanceBase<MM::Camera>(core, adapter, name, pDevice, deleteFunction, label, deviceLogger, coreLogger)
+      DeviceInstanceBase<MM::Camera>(core, adapter, name, pDevice, deleteFunction, label, deviceLogger, coreLogger),
+      hasLabelKey_(false),
+      labelKey_(0)
    {}
 
    int SnapImage();
@@ -73,6 +86,15 @@ public:
    int PrepareSequenceAcqusition();
    bool IsCapturing();
    std::string GetTags();
+   // The camera tags as Metadata, or null if there are none. Parsed only
+   // when they have changed since the last call.
+   boost::shared_ptr<const Metadata> GetTagMetadata();
+   // This camera's label, interned in keys
+   unsigned GetLabelKey(mm::MetadataKeyTable& keys);
+   // The camera's own sequence buffer, or null if its images go to the
+   // Core's shared buffer
+   boost::shared_ptr<CircularBuffer> GetSequenceBuffer();
+   void SetSequenceBuffer(boost::shared_ptr<CircularBuffer> buffer);
    void AddTag(const char* key, const char* deviceLabel, const char* value);
    void RemoveTag(const char* key);
    int IsExposureSequenceable(bool& isSequenceable) const;
@@ -82,4 +104,13 @@ public:
    int ClearExposureSequence();
    int AddToExposureSequence(double exposureTime_ms);
    int SendExposureSequence() const;
+
+private:
+   MMThreadLock tagCacheLock_;
+   std::string cachedSerializedTags_; // Synchronized by tagCacheLock_
+   boost::shared_ptr<const Metadata> cachedTags_; // Synchronized by tagCacheLock_
+   bool hasLabelKey_; // Synchronized by tagCacheLock_
+   unsigned labelKey_; // Synchronized by tagCacheLock_
+   MMThreadLock sequenceBufferLock_;
+   boost::shared_ptr<CircularBuffer> sequenceBuffer_; // Synchronized by sequenceBufferLock_
 };
@@ -329,6 +329,10 @@ bool
 DeviceInstance::UsesDelay()
 { return pImpl_->UsesDelay(); }
 
+bool
+DeviceInstance::NotifiesIdle()
+{ return pImpl_->NotifiesIdle(); }
+
 void
 DeviceInstance::Initialize()
 {
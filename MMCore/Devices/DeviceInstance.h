@@ -199,6 +199,7 @@ public:
    double GetDelayMs() const;
    void SetDelayMs(double delay);
    bool UsesDelay();
+   bool NotifiesIdle();
    void Initialize();
    void Shutdown();
    MM::DeviceType GetType() const; // TODO Make private (can use RTTI)
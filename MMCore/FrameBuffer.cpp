@@ -18,21 +18,39 @@
 
 #include "FrameBuffer.h"
 
+#include "MetadataKeyTable.h"
+
+#include "../MMDevice/MMDeviceConstants.h"
+
 #include <cmath>
+#include <cstdio>
 #include <cstring>
 
+#ifdef _WIN32
+#define snprintf _snprintf
+#endif
+
 namespace mm {
 
 ImgBuffer::ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth) :
-   pixels_(0), width_(xSize), height_(ySize), pixDepth_(pixDepth)
+   pixels_(0), ownsPixels_(true), width_(xSize), height_(ySize), pixDepth_(pixDepth), keys_(0),
+   insertTimeUs_(0.0)
 {
    pixels_ = new unsigned char[xSize * ySize * pixDepth];
    memset(pixels_, 0, xSize * ySize * pixDepth);
 }
 
+ImgBuffer::ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth,
+      unsigned char* pixels) :
+   pixels_(pixels), ownsPixels_(false), width_(xSize), height_(ySize), pixDepth_(pixDepth), keys_(0),
+   insertTimeUs_(0.0)
+{
+}
+
 ImgBuffer::~ImgBuffer()
 {
-   delete[] pixels_;
+   if (ownsPixels_)
+      delete[] pixels_;
 }
 
 const unsigned char* ImgBuffer::GetPixels() const
@@ -50,8 +68,10 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize, unsigned pixDepth)
    // re-allocate internal buffer if it is not big enough
    if (width_ * height_ * pixDepth_ < xSize * ySize * pixDepth)
    {
-      delete[] pixels_;
+      if (ownsPixels_)
+         delete[] pixels_;
       pixels_ = new unsigned char [xSize * ySize * pixDepth];
+      ownsPixels_ = true;
    }
 
    width_ = xSize;
@@ -64,8 +84,10 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize)
    // re-allocate internal buffer if it is not big enough
    if (width_ * height_ < xSize * ySize)
    {
-      delete[] pixels_;
+      if (ownsPixels_)
+         delete[] pixels_;
       pixels_ = new unsigned char[xSize * ySize * pixDepth_];
+      ownsPixels_ = true;
    }
 
    width_ = xSize;
@@ -74,13 +96,120 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize)
    memset(pixels_, 0, width_ * height_ * pixDepth_);
 }
 
-void ImgBuffer::SetMetadata(const Metadata& md)
+void ImgBuffer::SetMetadata(const MM::FrameMetadata& record,
+      const boost::shared_ptr<const Metadata>& tags,
+      const MetadataKeyTable* keys)
+{
+   record_ = record;
+   tags_ = tags;
+   keys_ = keys;
+}
+
+namespace {
+
+// Equivalent to Metadata::PutTag(), without formatting through a stream
+void Put(Metadata& md, const char* key, const char* deviceLabel,
+      const char* value)
+{
+   MetadataSingleTag tag(key, deviceLabel, true);
+   tag.SetValue(value);
+   md.SetTag(tag);
+}
+
+void PutLong(Metadata& md, const char* key, long value)
+{
+   char buf[32];
+   snprintf(buf, sizeof(buf), "%ld", value);
+   Put(md, key, "_", buf);
+}
+
+// Same formatting as CDeviceUtils::ConvertToString(double)
+void PutMs(Metadata& md, const char* key, double value)
+{
+   char buf[64];
+   snprintf(buf, sizeof(buf), "%.2f", value);
+   Put(md, key, "_", buf);
+}
+
+const char* PixelType(unsigned byteDepth, unsigned nComponents)
+{
+   switch (byteDepth)
+   {
+      case 1: return "GRAY8";
+      case 2: return "GRAY16";
+      case 4: return nComponents == 1 ? "GRAY32" : "RGB32";
+      case 8: return "RGB64";
+      default: return "Unknown";
+   }
+}
+
+} // anonymous namespace
+
+/**
+* Builds the Metadata for this image. Tags supplied by the camera for the
+* frame come first, then the camera's own tags (or the tags of an image
+* inserted with serialized metadata), and finally the tags maintained by the
+* Core.
+*/
+Metadata ImgBuffer::GetMetadata() const
 {
-   //metadata_ = md;
-   // Serialize/Restore instead of =operator used to avoid object new/delete
-   // issues across the DLL boundary (on Windows)
-   // TODO: this is inefficient and should be revised
-    metadata_.Restore(md.Serialize().c_str());
+   Metadata md;
+
+   if (record_.HasStartTimeMs())
+      PutMs(md, MM::g_Keyword_Metadata_StartTime, record_.GetStartTimeMs());
+   if (record_.HasElapsedTimeMs())
+      PutMs(md, MM::g_Keyword_Elapsed_Time_ms, record_.GetElapsedTimeMs());
+   if (record_.HasROI())
+   {
+      PutLong(md, MM::g_Keyword_Metadata_ROI_X, record_.GetROIX());
+      PutLong(md, MM::g_Keyword_Metadata_ROI_Y, record_.GetROIY());
+   }
+   if (record_.HasBinning())
+      PutLong(md, MM::g_Keyword_Binning, record_.GetBinning());
+
+   std::string name;
+   std::string deviceLabel;
+   for (unsigned i = 0; i < record_.GetTagCount(); ++i)
+   {
+      const MM::FrameMetadata::Tag& tag = record_.GetTag(i);
+      if (!keys_ || !keys_->Lookup(tag.key, name, deviceLabel))
+         continue;
+
+      char buf[64];
+      const char* value = buf;
+      switch (tag.type)
+      {
+         case MM::FrameMetadata::LongTag:
+            snprintf(buf, sizeof(buf), "%ld", tag.longValue);
+            break;
+         case MM::FrameMetadata::DoubleTag:
+            // Same as the default formatting of Metadata::PutTag()
+            snprintf(buf, sizeof(buf), "%g", tag.doubleValue);
+            break;
+         default:
+            value = tag.stringValue;
+            break;
+      }
+      Put(md, name.c_str(), deviceLabel.c_str(), value);
+   }
+
+   if (tags_)
+      md.Merge(*tags_);
+
+   if (record_.HasCameraKey() && keys_ &&
+         keys_->Lookup(record_.GetCameraKey(), name, deviceLabel))
+      Put(md, "Camera", "_", name.c_str());
+   if (record_.HasImageNumber())
+      PutLong(md, MM::g_Keyword_Metadata_ImageNumber, record_.GetImageNumber());
+   if (record_.HasImageFormat())
+   {
+      PutLong(md, "Width", record_.GetWidth());
+      PutLong(md, "Height", record_.GetHeight());
+      Put(md, "PixelType", "_", PixelType(record_.GetByteDepth(),
+               record_.GetNumberOfComponents()));
+   }
+
+   return md;
 }
 
 
@@ -127,6 +256,17 @@ void FrameBuffer::Preallocate(unsigned channels)
    }
 }
 
+void FrameBuffer::Preallocate(unsigned channels, unsigned char* memory)
+{
+   const unsigned long channelBytes = (unsigned long)width_ * height_ * depth_;
+   for (unsigned i=0; i<channels; i++)
+   {
+      ImgBuffer* img = FindImage(i);
+      if (!img)
+         InsertNewImage(i, memory + i * channelBytes);
+   }
+}
+
 void FrameBuffer::Resize(unsigned xSize, unsigned ySize, unsigned byteDepth)
 {
    Clear();
@@ -170,11 +310,12 @@ ImgBuffer* FrameBuffer::FindImage(unsigned channel) const
    return channels_[channel];
 }
 
-ImgBuffer* FrameBuffer::InsertNewImage(unsigned channel)
+ImgBuffer* FrameBuffer::InsertNewImage(unsigned channel, unsigned char* pixels)
 {
    if (channel >= channels_.size())
       channels_.resize(channel + 1, 0);
-   ImgBuffer* img = new ImgBuffer(width_, height_, depth_);
+   ImgBuffer* img = pixels ? new ImgBuffer(width_, height_, depth_, pixels) :
+      new ImgBuffer(width_, height_, depth_);
    channels_[channel] = img;
    return img;
 }
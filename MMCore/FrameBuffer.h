@@ -20,22 +20,38 @@
 
 #include "../MMDevice/ImageMetadata.h"
 
+#include <boost/shared_ptr.hpp>
+
 #include <string>
 #include <vector>
 #include <map>
 
 namespace mm {
 
+class MetadataKeyTable;
+
 class ImgBuffer
 {
    unsigned char* pixels_;
+   bool ownsPixels_; // False if pixels_ points into memory owned elsewhere
    unsigned int width_;
    unsigned int height_;
    unsigned int pixDepth_;
-   Metadata metadata_;
+
+   // The metadata is kept as inserted and converted to Metadata only when
+   // requested. tags_ holds any tags not in record_ (camera tags, or all
+   // tags of an image inserted with serialized metadata), and may be
+   // shared between images.
+   MM::FrameMetadata record_;
+   boost::shared_ptr<const Metadata> tags_;
+   const MetadataKeyTable* keys_;
+   double insertTimeUs_; // When the image entered the sequence buffer
 
 public:
    ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth);
+   // Uses the given memory, which must outlive the image, for the pixels
+   ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth,
+         unsigned char* pixels);
    ~ImgBuffer();
 
    unsigned int Width() const {return width_;}
@@ -43,12 +59,19 @@ public:
    unsigned int Depth() const {return pixDepth_;}
    void SetPixels(const void* pixArray);
    const unsigned char* GetPixels() const;
+   unsigned char* GetPixelsRW() {return pixels_;}
 
    void Resize(unsigned xSize, unsigned ySize, unsigned pixDepth);
    void Resize(unsigned xSize, unsigned ySize);
 
-   void SetMetadata(const Metadata& md);
-   const Metadata& GetMetadata() const {return metadata_;}
+   void SetMetadata(const MM::FrameMetadata& record,
+         const boost::shared_ptr<const Metadata>& tags,
+         const MetadataKeyTable* keys);
+   Metadata GetMetadata() const;
+   const MM::FrameMetadata& GetRecord() const {return record_;}
+   const boost::shared_ptr<const Metadata>& GetTags() const {return tags_;}
+   void SetInsertTimeUs(double us) {insertTimeUs_ = us;}
+   double GetInsertTimeUs() const {return insertTimeUs_;}
 
 private:
    ImgBuffer& operator=(const ImgBuffer&);
@@ -71,6 +94,9 @@ public:
    void Resize(unsigned xSize, unsigned ySize, unsigned pixDepth);
    void Clear();
    void Preallocate(unsigned channels);
+   // Allocates the images in memory, which holds the channels one after the
+   // other and must outlive them
+   void Preallocate(unsigned channels, unsigned char* memory);
 
    ImgBuffer* FindImage(unsigned channel) const;
    const unsigned char* GetPixels(unsigned channel) const;
@@ -87,7 +113,7 @@ private:
    // FrameBuffer& operator=(const FrameBuffer&);
 
 private:
-   ImgBuffer* InsertNewImage(unsigned channel);
+   ImgBuffer* InsertNewImage(unsigned channel, unsigned char* pixels = 0);
 };
 
 } // namespace mm
@@ -0,0 +1,55 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   In-place read access to a frame of the sequence buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "FrameLease.h"
+
+#include "FrameSlab.h"
+#include "MetadataKeyTable.h"
+
+namespace mm {
+
+FrameLease::FrameLease(boost::shared_ptr<FrameSlab> slab, PinCounts pins,
+      unsigned long slot, const ImgBuffer& image,
+      boost::shared_ptr<MetadataKeyTable> keys) :
+   slab_(slab),
+   pins_(pins),
+   slot_(slot),
+   keys_(keys),
+   image_(image.Width(), image.Height(), image.Depth(),
+         const_cast<unsigned char*>(image.GetPixels()))
+{
+   image_.SetMetadata(image.GetRecord(), image.GetTags(), keys_.get());
+   image_.SetInsertTimeUs(image.GetInsertTimeUs());
+}
+
+FrameLease::FrameLease(const ImgBuffer& image,
+      boost::shared_ptr<MetadataKeyTable> keys) :
+   slot_(0),
+   keys_(keys),
+   image_(image.Width(), image.Height(), image.Depth())
+{
+   image_.SetPixels(image.GetPixels());
+   image_.SetMetadata(image.GetRecord(), image.GetTags(), keys_.get());
+   image_.SetInsertTimeUs(image.GetInsertTimeUs());
+}
+
+FrameLease::~FrameLease()
+{
+   if (pins_)
+      pins_[slot_].fetch_sub(1, boost::memory_order_release);
+}
+
+} // namespace mm
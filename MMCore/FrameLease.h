@@ -0,0 +1,75 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   In-place read access to a frame of the sequence buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "FrameBuffer.h"
+
+#include "../MMDevice/ImageMetadata.h"
+
+#include <boost/atomic.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+namespace mm {
+
+class FrameSlab;
+class MetadataKeyTable;
+
+/**
+ * Read-only access to one frame of the sequence buffer, without copying its
+ * pixels.
+ *
+ * While the lease exists, the buffer does not reuse the frame's slot for a
+ * new frame (a camera finding the slot still leased is handled like one
+ * overflowing the buffer), and the pixels remain valid even if the buffer is
+ * reinitialized or destroyed. Leases should therefore be released as soon
+ * as the frame is no longer needed.
+ *
+ * A frame that is in the spill file rather than in memory cannot be leased
+ * in place; the lease then holds a copy (IsCopy()).
+ */
+class FrameLease : boost::noncopyable
+{
+public:
+   typedef boost::shared_array< boost::atomic<int> > PinCounts;
+
+   // Leases the frame in slot of the buffer memory slab, whose pin count the
+   // caller has already incremented
+   FrameLease(boost::shared_ptr<FrameSlab> slab, PinCounts pins,
+         unsigned long slot, const ImgBuffer& image,
+         boost::shared_ptr<MetadataKeyTable> keys);
+   // Holds a copy of image
+   FrameLease(const ImgBuffer& image, boost::shared_ptr<MetadataKeyTable> keys);
+   ~FrameLease();
+
+   const unsigned char* GetPixels() const { return image_.GetPixels(); }
+   unsigned Width() const { return image_.Width(); }
+   unsigned Height() const { return image_.Height(); }
+   unsigned Depth() const { return image_.Depth(); }
+   Metadata GetMetadata() const { return image_.GetMetadata(); }
+   bool IsCopy() const { return !slab_; }
+
+private:
+   boost::shared_ptr<FrameSlab> slab_;
+   PinCounts pins_;
+   unsigned long slot_;
+   boost::shared_ptr<MetadataKeyTable> keys_;
+   ImgBuffer image_;
+};
+
+} // namespace mm
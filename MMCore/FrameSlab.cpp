@@ -0,0 +1,206 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Single block of memory backing the sequence buffer frames
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "FrameSlab.h"
+
+#include "CoreUtils.h"
+#include "ErrorCodes.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+namespace mm {
+
+namespace {
+
+#ifdef __linux__
+// Size of transparent huge pages on x86-64 and most other platforms
+const std::size_t hugePageSize = 2 << 20;
+
+// From <numaif.h>, to avoid depending on libnuma
+const int mpolBind = 2;
+
+bool BindToNode(void* address, std::size_t size, int node)
+{
+   if (node < 0 || node >= (int)(8 * sizeof(unsigned long)))
+      return false;
+   unsigned long nodeMask = 1UL << node;
+   return syscall(SYS_mbind, address, size, mpolBind, &nodeMask,
+         8 * sizeof(unsigned long), 0) == 0;
+}
+#endif
+
+std::size_t RoundUp(std::size_t size, std::size_t multiple)
+{
+   return (size + multiple - 1) / multiple * multiple;
+}
+
+} // anonymous namespace
+
+FrameSlab::FrameSlab(std::size_t bytes, const Options& options) throw (CMMError) :
+   address_(0),
+   size_(bytes),
+   base_(0),
+   mappedSize_(0),
+   hugePages_(false),
+   numaBound_(false),
+   allocationTimeMs_(0.0)
+{
+   MM::MMTime start = GetMMTimeNow();
+   Allocate(options);
+   if (!address_)
+      throw CMMError("Cannot allocate sequence buffer memory",
+            MMERR_OutOfMemory);
+   if (options.prefault)
+      Prefault();
+   allocationTimeMs_ = (GetMMTimeNow() - start).getMsec();
+}
+
+#ifdef _WIN32
+
+void FrameSlab::Allocate(const Options& options)
+{
+   // Large pages require the "Lock pages in memory" privilege; without it,
+   // the allocation fails and ordinary pages are used.
+   const SIZE_T largePage = GetLargePageMinimum();
+   const DWORD type = MEM_RESERVE | MEM_COMMIT;
+   if (options.hugePages != NoHugePages && largePage > 0)
+   {
+      mappedSize_ = RoundUp(size_, largePage);
+      if (options.numaNode >= 0)
+         base_ = VirtualAllocExNuma(GetCurrentProcess(), NULL, mappedSize_,
+               type | MEM_LARGE_PAGES, PAGE_READWRITE, options.numaNode);
+      else
+         base_ = VirtualAlloc(NULL, mappedSize_, type | MEM_LARGE_PAGES,
+               PAGE_READWRITE);
+      hugePages_ = (base_ != NULL);
+   }
+   if (!base_)
+   {
+      mappedSize_ = size_;
+      if (options.numaNode >= 0)
+         base_ = VirtualAllocExNuma(GetCurrentProcess(), NULL, mappedSize_,
+               type, PAGE_READWRITE, options.numaNode);
+      else
+         base_ = VirtualAlloc(NULL, mappedSize_, type, PAGE_READWRITE);
+   }
+   numaBound_ = (base_ != NULL && options.numaNode >= 0);
+   address_ = static_cast<unsigned char*>(base_);
+}
+
+FrameSlab::~FrameSlab()
+{
+   if (base_)
+      VirtualFree(base_, 0, MEM_RELEASE);
+}
+
+void FrameSlab::Prefault()
+{
+   // Large pages are committed in full when allocated
+   if (hugePages_)
+      return;
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   volatile unsigned char* p = address_;
+   for (std::size_t i = 0; i < size_; i += info.dwPageSize)
+      p[i] = 0;
+}
+
+#else // POSIX
+
+void FrameSlab::Allocate(const Options& options)
+{
+   const int prot = PROT_READ | PROT_WRITE;
+   const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#ifdef __linux__
+   if (options.hugePages == ExplicitHugePages)
+   {
+      mappedSize_ = RoundUp(size_, hugePageSize);
+      base_ = mmap(0, mappedSize_, prot, flags | MAP_HUGETLB, -1, 0);
+      if (base_ == MAP_FAILED)
+         base_ = 0;
+      else
+      {
+         hugePages_ = true;
+         address_ = static_cast<unsigned char*>(base_);
+      }
+   }
+
+   if (!base_ && options.hugePages != NoHugePages)
+   {
+      // Transparent huge pages are only used for aligned 2 MB ranges
+      mappedSize_ = RoundUp(size_, hugePageSize) + hugePageSize;
+      base_ = mmap(0, mappedSize_, prot, flags, -1, 0);
+      if (base_ == MAP_FAILED)
+         base_ = 0;
+      else
+      {
+         address_ = reinterpret_cast<unsigned char*>(RoundUp(
+                  reinterpret_cast<std::size_t>(base_), hugePageSize));
+         hugePages_ = (madvise(address_, RoundUp(size_, hugePageSize),
+                  MADV_HUGEPAGE) == 0);
+      }
+   }
+#endif
+
+   if (!base_)
+   {
+      mappedSize_ = size_;
+      base_ = mmap(0, mappedSize_, prot, flags, -1, 0);
+      if (base_ == MAP_FAILED)
+      {
+         base_ = 0;
+         return;
+      }
+      address_ = static_cast<unsigned char*>(base_);
+   }
+
+#ifdef __linux__
+   // Must precede the first access to the pages
+   if (options.numaNode >= 0)
+      numaBound_ = BindToNode(base_, mappedSize_, options.numaNode);
+#endif
+}
+
+FrameSlab::~FrameSlab()
+{
+   if (base_)
+      munmap(base_, mappedSize_);
+}
+
+void FrameSlab::Prefault()
+{
+   const std::size_t pageSize = (std::size_t)sysconf(_SC_PAGESIZE);
+   volatile unsigned char* p = address_;
+   for (std::size_t i = 0; i < size_; i += pageSize)
+      p[i] = 0;
+}
+
+#endif
+
+} // namespace mm
@@ -0,0 +1,89 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Single block of memory backing the sequence buffer frames
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Error.h"
+
+#include <boost/utility.hpp>
+
+#include <cstddef>
+
+namespace mm {
+
+/**
+ * Page-aligned memory obtained directly from the operating system, for the
+ * pixels of all frames of the sequence buffer.
+ *
+ * Allocating the frames from one block replaces many heap allocations with
+ * one, and allows the use of huge pages (fewer TLB misses when streaming
+ * through gigabytes of frames), binding the memory to a NUMA node (e.g. the
+ * one the camera's frame grabber is attached to), and touching every page
+ * in advance so that the first pass of the camera through the buffer does
+ * not take page faults.
+ *
+ * Huge pages and NUMA binding are best effort: if not available, ordinary
+ * memory is used; HasHugePages() and IsNumaBound() tell what was obtained.
+ */
+class FrameSlab : boost::noncopyable
+{
+public:
+   enum HugePageMode
+   {
+      NoHugePages,
+      // Ask the kernel to back the memory with huge pages when it can
+      // (Linux transparent huge pages; large pages on Windows)
+      TransparentHugePages,
+      // Allocate from the reserved huge page pool (Linux hugetlbfs; large
+      // pages on Windows), falling back to ordinary pages
+      ExplicitHugePages
+   };
+
+   struct Options
+   {
+      HugePageMode hugePages;
+      bool prefault;
+      int numaNode; // -1 for no binding
+
+      Options() : hugePages(NoHugePages), prefault(true), numaNode(-1) {}
+   };
+
+   // Throws CMMError (MMERR_OutOfMemory) if the memory cannot be allocated
+   FrameSlab(std::size_t bytes, const Options& options) throw (CMMError);
+   ~FrameSlab();
+
+   unsigned char* GetAddress() const { return address_; }
+   std::size_t GetSize() const { return size_; }
+
+   bool HasHugePages() const { return hugePages_; }
+   bool IsNumaBound() const { return numaBound_; }
+   // Time taken to allocate (and prefault) the memory
+   double GetAllocationTimeMs() const { return allocationTimeMs_; }
+
+private:
+   void Allocate(const Options& options);
+   void Prefault();
+
+   unsigned char* address_;
+   std::size_t size_;
+   void* base_; // Start of the mapping, before alignment
+   std::size_t mappedSize_;
+   bool hugePages_;
+   bool numaBound_;
+   double allocationTimeMs_;
+};
+
+} // namespace mm
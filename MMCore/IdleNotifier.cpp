@@ -0,0 +1,56 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Wakes threads waiting for devices that report becoming idle
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "IdleNotifier.h"
+
+namespace mm {
+
+unsigned long
+IdleNotifier::GetCount(const MM::Device* device)
+{
+   boost::mutex::scoped_lock lock(mutex_);
+   std::map<const MM::Device*, unsigned long>::const_iterator it =
+      counts_.find(device);
+   return it == counts_.end() ? 0 : it->second;
+}
+
+void
+IdleNotifier::Notify(const MM::Device* device)
+{
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      ++counts_[device];
+   }
+   changed_.notify_all();
+}
+
+bool
+IdleNotifier::WaitForChange(const MM::Device* device, unsigned long count,
+      const boost::posix_time::ptime& deadline)
+{
+   boost::mutex::scoped_lock lock(mutex_);
+   for (;;)
+   {
+      std::map<const MM::Device*, unsigned long>::const_iterator it =
+         counts_.find(device);
+      if ((it == counts_.end() ? 0 : it->second) != count)
+         return true;
+      if (!changed_.timed_wait(lock, deadline))
+         return false;
+   }
+}
+
+} // namespace mm
@@ -0,0 +1,57 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Wakes threads waiting for devices that report becoming idle
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include <map>
+
+namespace MM
+{
+   class Device;
+}
+
+namespace mm {
+
+/**
+ * Counts the idle notifications (MM::Core::OnDeviceIdle()) of each device.
+ *
+ * To wait for a device without missing a notification, take the count
+ * before checking whether the device is busy, then wait for the count to
+ * change.
+ */
+class IdleNotifier : boost::noncopyable
+{
+public:
+   unsigned long GetCount(const MM::Device* device);
+   void Notify(const MM::Device* device);
+
+   // Returns false if deadline passed before the count of device differed
+   // from count
+   bool WaitForChange(const MM::Device* device, unsigned long count,
+         const boost::posix_time::ptime& deadline);
+
+private:
+   boost::mutex mutex_;
+   boost::condition_variable changed_;
+   std::map<const MM::Device*, unsigned long> counts_;
+};
+
+} // namespace mm
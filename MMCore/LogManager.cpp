@@ -39,7 +39,9 @@ LogManager::LogManager() :
    primaryLogLevel_(LogLevelInfo),
    usingStdErr_(false),
    nextSecondaryHandle_(0)
-{}
+{
+   UpdateMinEntryLevel();
+}
 
 
 void
@@ -60,6 +62,7 @@ LogManager::SetUseStdErr(bool flag)
                boost::make_shared<LevelFilter>(primaryLogLevel_));
       }
       loggingCore_->AddSink(stdErrSink_, PrimarySinkMode);
+      UpdateMinEntryLevel();
 
       LOG_INFO(internalLogger_) << "Enabled logging to stderr";
    }
@@ -68,6 +71,7 @@ LogManager::SetUseStdErr(bool flag)
       LOG_INFO(internalLogger_) << "Disabling logging to stderr";
 
       loggingCore_->RemoveSink(stdErrSink_, PrimarySinkMode);
+      UpdateMinEntryLevel();
    }
 }
 
@@ -97,6 +101,7 @@ LogManager::SetPrimaryLogFilename(const std::string& filename, bool truncate)
          LOG_INFO(internalLogger_) << "Disabling primary log file";
          loggingCore_->RemoveSink(primaryFileSink_, PrimarySinkMode);
          primaryFileSink_.reset();
+         UpdateMinEntryLevel();
       }
       return;
    }
@@ -104,7 +109,7 @@ LogManager::SetPrimaryLogFilename(const std::string& filename, bool truncate)
    boost::shared_ptr<LogSink> newSink;
    try
    {
-      newSink = boost::make_shared<FileLogSink>(primaryFilename_, !truncate);
+      newSink = NewFileSink(primaryFilename_, !truncate, primaryRotation_);
    }
    catch (const CannotOpenFileException&)
    {
@@ -117,6 +122,7 @@ LogManager::SetPrimaryLogFilename(const std::string& filename, bool truncate)
       }
       primaryFileSink_.reset();
       primaryFilename_.clear();
+      UpdateMinEntryLevel();
       throw CMMError("Cannot open file " + ToQuotedString(filename));
    }
 
@@ -126,25 +132,14 @@ LogManager::SetPrimaryLogFilename(const std::string& filename, bool truncate)
    {
       loggingCore_->AddSink(newSink, PrimarySinkMode);
       primaryFileSink_ = newSink;
+      UpdateMinEntryLevel();
       LOG_INFO(internalLogger_) << "Enabled primary log file " <<
          primaryFilename_;
    }
    else
    {
-      // We will use atomic swapping so that no entries get lost between the
-      // two files. This makes it possible to use this function for log
-      // rotation.
-
       LOG_INFO(internalLogger_) << "Switching primary log file";
-      std::vector< std::pair<boost::shared_ptr<LogSink>, SinkMode> > toRemove;
-      std::vector< std::pair<boost::shared_ptr<LogSink>, SinkMode> > toAdd;
-      toRemove.push_back(
-            std::make_pair(primaryFileSink_, PrimarySinkMode));
-      toAdd.push_back(std::make_pair(newSink, PrimarySinkMode));
-
-      loggingCore_->AtomicSwapSinks(toRemove.begin(), toRemove.end(),
-            toAdd.begin(), toAdd.end());
-      primaryFileSink_ = newSink;
+      SwapPrimaryFileSink(newSink);
       LOG_INFO(internalLogger_) << "Switched primary log file to " <<
          primaryFilename_;
    }
@@ -167,6 +162,57 @@ LogManager::IsUsingPrimaryLogFile() const
 }
 
 
+void
+LogManager::SetPrimaryLogRotation(const FileRotationPolicy& policy)
+{
+   boost::lock_guard<boost::mutex> lock(mutex_);
+
+   primaryRotation_ = policy;
+   if (policy.compress && !internal::CanCompressLogSegments())
+   {
+      LOG_WARNING(internalLogger_) << "Log compression is not available "
+         "in this build; rotated log files will be kept uncompressed";
+   }
+
+   if (!primaryFileSink_)
+      return;
+
+   boost::shared_ptr<LogSink> newSink;
+   try
+   {
+      newSink = NewFileSink(primaryFilename_, true, primaryRotation_);
+   }
+   catch (const CannotOpenFileException&)
+   {
+      LOG_ERROR(internalLogger_) << "Failed to reopen primary log file " <<
+         primaryFilename_ << "; rotation settings not applied";
+      throw CMMError("Cannot open file " + ToQuotedString(primaryFilename_));
+   }
+   newSink->SetFilter(boost::make_shared<LevelFilter>(primaryLogLevel_));
+
+   SwapPrimaryFileSink(newSink);
+   if (policy.RotationEnabled())
+   {
+      LOG_INFO(internalLogger_) << "Primary log file will be rotated at " <<
+         policy.maxSegmentBytes << " bytes or " << policy.maxSegmentSeconds <<
+         " s (0 = no limit), keeping at most " << policy.maxTotalBytes <<
+         " bytes in all";
+   }
+   else
+   {
+      LOG_INFO(internalLogger_) << "Primary log file will not be rotated";
+   }
+}
+
+
+FileRotationPolicy
+LogManager::GetPrimaryLogRotation() const
+{
+   boost::lock_guard<boost::mutex> lock(mutex_);
+   return primaryRotation_;
+}
+
+
 void
 LogManager::SetPrimaryLogLevel(LogLevel level)
 {
@@ -177,6 +223,8 @@ LogManager::SetPrimaryLogLevel(LogLevel level)
 
    LogLevel oldLevel = primaryLogLevel_;
    primaryLogLevel_ = level;
+   if (level < oldLevel)
+      UpdateMinEntryLevel();
 
    LOG_INFO(internalLogger_) << "Switching primary log level from " <<
       StringForLogLevel(oldLevel) << " to " << StringForLogLevel(level);
@@ -204,6 +252,8 @@ LogManager::SetPrimaryLogLevel(LogLevel level)
    }
 
    loggingCore_->AtomicSetSinkFilters(changes.begin(), changes.end());
+   if (level > oldLevel)
+      UpdateMinEntryLevel();
 
    LOG_INFO(internalLogger_) << "Switched primary log level from " <<
       StringForLogLevel(oldLevel) << " to " << StringForLogLevel(level);
@@ -220,14 +270,15 @@ LogManager::GetPrimaryLogLevel() const
 
 LogManager::LogFileHandle
 LogManager::AddSecondaryLogFile(LogLevel level,
-      const std::string& filename, bool truncate, SinkMode mode)
+      const std::string& filename, bool truncate, SinkMode mode,
+      const FileRotationPolicy& rotation)
 {
    boost::lock_guard<boost::mutex> lock(mutex_);
 
    boost::shared_ptr<LogSink> sink;
    try
    {
-      sink = boost::make_shared<FileLogSink>(filename, !truncate);
+      sink = NewFileSink(filename, !truncate, rotation);
    }
    catch (const CannotOpenFileException&)
    {
@@ -240,9 +291,10 @@ LogManager::AddSecondaryLogFile(LogLevel level,
 
    LogFileHandle handle = nextSecondaryHandle_++;
    secondaryLogFiles_.insert(std::make_pair(handle,
-            LogFileInfo(filename, sink, mode)));
+            LogFileInfo(filename, sink, mode, level)));
 
    loggingCore_->AddSink(sink, mode);
+   UpdateMinEntryLevel();
 
    LOG_INFO(internalLogger_) << "Added secondary log file " << filename <<
       " with log level " << StringForLogLevel(level);
@@ -269,6 +321,35 @@ LogManager::RemoveSecondaryLogFile(LogManager::LogFileHandle handle)
       foundIt->second.filename_;
    loggingCore_->RemoveSink(foundIt->second.sink_, foundIt->second.mode_);
    secondaryLogFiles_.erase(foundIt);
+   UpdateMinEntryLevel();
+}
+
+
+void
+LogManager::SetAsyncQueueOverflowPolicy(QueueOverflowPolicy policy)
+{
+   loggingCore_->SetAsyncQueueOverflowPolicy(policy, LogLevelInfo);
+}
+
+
+QueueOverflowPolicy
+LogManager::GetAsyncQueueOverflowPolicy() const
+{
+   return loggingCore_->GetAsyncQueueOverflowPolicy();
+}
+
+
+long long
+LogManager::GetAsyncQueueOverflowCount() const
+{
+   return loggingCore_->GetAsyncQueueOverflowCount();
+}
+
+
+long long
+LogManager::GetAsyncQueueDroppedCount() const
+{
+   return loggingCore_->GetAsyncQueueDroppedCount();
 }
 
 
@@ -278,4 +359,51 @@ LogManager::NewLogger(const std::string& label)
    return loggingCore_->NewLogger(label);
 }
 
+
+boost::shared_ptr<LogSink>
+LogManager::NewFileSink(const std::string& filename, bool append,
+      const FileRotationPolicy& rotation)
+{
+   if (rotation.RotationEnabled())
+      return boost::make_shared<RotatingFileLogSink>(filename, rotation, append);
+   return boost::make_shared<FileLogSink>(filename, append);
+}
+
+
+// We use atomic swapping so that no entries get lost between the two files
+// (or the two sinks writing to the same file).
+void
+LogManager::SwapPrimaryFileSink(boost::shared_ptr<LogSink> newSink)
+{
+   std::vector< std::pair<boost::shared_ptr<LogSink>, SinkMode> > toRemove;
+   std::vector< std::pair<boost::shared_ptr<LogSink>, SinkMode> > toAdd;
+   toRemove.push_back(
+         std::make_pair(primaryFileSink_, PrimarySinkMode));
+   toAdd.push_back(std::make_pair(newSink, PrimarySinkMode));
+
+   loggingCore_->AtomicSwapSinks(toRemove.begin(), toRemove.end(),
+         toAdd.begin(), toAdd.end());
+   primaryFileSink_ = newSink;
+}
+
+
+// Let the loggers discard, before formatting, the entries that no sink will
+// accept
+void
+LogManager::UpdateMinEntryLevel()
+{
+   int minLevel = LogLevelFatal + 1; // No sinks: nothing is logged
+   if (usingStdErr_ || primaryFileSink_)
+      minLevel = primaryLogLevel_;
+   for (std::map<LogFileHandle, LogFileInfo>::const_iterator it =
+         secondaryLogFiles_.begin(), end = secondaryLogFiles_.end();
+         it != end; ++it)
+   {
+      int level = it->second.level_;
+      if (level < minLevel)
+         minLevel = level;
+   }
+   loggingCore_->SetMinEntryLevel(minLevel);
+}
+
 } // namespace mm
@@ -30,6 +30,7 @@ private:
    boost::shared_ptr<logging::LogSink> stdErrSink_;
 
    std::string primaryFilename_;
+   logging::FileRotationPolicy primaryRotation_;
    boost::shared_ptr<logging::LogSink> primaryFileSink_;
 
    LogFileHandle nextSecondaryHandle_;
@@ -38,13 +39,15 @@ private:
       std::string filename_;
       boost::shared_ptr<logging::LogSink> sink_;
       logging::SinkMode mode_;
+      logging::LogLevel level_;
 
       LogFileInfo(const std::string& filename,
             boost::shared_ptr<logging::LogSink> sink,
-            logging::SinkMode mode) :
+            logging::SinkMode mode, logging::LogLevel level) :
          filename_(filename),
          sink_(sink),
-         mode_(mode)
+         mode_(mode),
+         level_(level)
       {}
    };
    std::map<LogFileHandle, LogFileInfo> secondaryLogFiles_;
@@ -62,17 +65,39 @@ public:
    std::string GetPrimaryLogFilename() const;
    bool IsUsingPrimaryLogFile() const;
 
+   // Applies to the current primary log file (continued, not truncated) and
+   // to any set later
+   void SetPrimaryLogRotation(const logging::FileRotationPolicy& policy);
+   logging::FileRotationPolicy GetPrimaryLogRotation() const;
+
    void SetPrimaryLogLevel(logging::LogLevel level);
    logging::LogLevel GetPrimaryLogLevel() const;
 
    LogFileHandle AddSecondaryLogFile(logging::LogLevel level,
          const std::string& filename, bool truncate = true,
-         logging::SinkMode mode = logging::SinkModeAsynchronous);
+         logging::SinkMode mode = logging::SinkModeAsynchronous,
+         const logging::FileRotationPolicy& rotation =
+            logging::FileRotationPolicy());
    void RemoveSecondaryLogFile(LogFileHandle handle);
-   // We could add an atomic SwapSecondaryLogFile(handle, filename, truncate),
-   // nice for log rotation, but we don't need it now.
+
+   // Policy for entries to the asynchronous sinks (which include the primary
+   // log file) when the queue is full; the low-level entries dropped first
+   // are those below info
+   void SetAsyncQueueOverflowPolicy(logging::QueueOverflowPolicy policy);
+   logging::QueueOverflowPolicy GetAsyncQueueOverflowPolicy() const;
+   long long GetAsyncQueueOverflowCount() const;
+   long long GetAsyncQueueDroppedCount() const;
 
    logging::Logger NewLogger(const std::string& label);
+
+private:
+   // Throws CannotOpenFileException
+   static boost::shared_ptr<logging::LogSink> NewFileSink(
+         const std::string& filename, bool append,
+         const logging::FileRotationPolicy& rotation);
+   // The following are called with mutex_ held
+   void SwapPrimaryFileSink(boost::shared_ptr<logging::LogSink> newSink);
+   void UpdateMinEntryLevel();
 };
 
 } // namespace mm
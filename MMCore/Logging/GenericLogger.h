@@ -16,9 +16,12 @@
 
 #pragma once
 
+#include <boost/atomic.hpp>
 #include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/utility.hpp>
 
+#include <limits>
 #include <sstream>
 #include <string>
 
@@ -31,23 +34,66 @@ namespace internal
 {
 
 
+/**
+ * Lock-free check, made before an entry is formatted, of whether any sink
+ * can accept the entry's level.
+ *
+ * The gate only needs to be as selective as the least selective sink; the
+ * sinks' filters still make the final decision.
+ */
+template <typename TEntryData>
+class GenericEntryGate : boost::noncopyable
+{
+   boost::atomic<int> minLevel_;
+
+public:
+   GenericEntryGate() :
+      minLevel_(std::numeric_limits<int>::min())
+   {}
+
+   bool IsOpen(const TEntryData& entryData) const
+   {
+      return static_cast<int>(entryData.GetLevel()) >=
+         minLevel_.load(boost::memory_order_relaxed);
+   }
+
+   void SetMinLevel(int level)
+   { minLevel_.store(level, boost::memory_order_relaxed); }
+};
+
+
 template <typename TEntryData>
 class GenericLogger
 {
    boost::function<void (TEntryData, const char*)> impl_;
+   boost::shared_ptr< const GenericEntryGate<TEntryData> > gate_;
 
 public:
    typedef TEntryData EntryDataType;
 
-   GenericLogger(boost::function<void (TEntryData, const char*)> f) :
-      impl_(f)
+   GenericLogger(boost::function<void (TEntryData, const char*)> f,
+         boost::shared_ptr< const GenericEntryGate<TEntryData> > gate =
+            boost::shared_ptr< const GenericEntryGate<TEntryData> >()) :
+      impl_(f),
+      gate_(gate)
    {}
 
+   // Whether an entry would be logged by any sink; used by the LOG_* macros
+   // to skip formatting entries that would be discarded
+   bool IsEnabled(TEntryData entryData) const
+   { return !gate_ || gate_->IsOpen(entryData); }
+
    void operator()(TEntryData entryData, const char* message) const
-   { impl_(entryData, message); }
+   {
+      if (IsEnabled(entryData))
+         impl_(entryData, message);
+   }
 
    void operator()(TEntryData entryData, const std::string& message) const
-   { impl_(entryData, message.c_str()); }
+   {
+      if (IsEnabled(entryData))
+         impl_(entryData, message.c_str());
+   }
 };
 
 
@@ -22,10 +22,13 @@
 #include "GenericPacketQueue.h"
 #include "GenericSink.h"
 
+#include <boost/atomic.hpp>
 #include <boost/bind.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
 
 #include <algorithm>
 #include <string>
@@ -58,16 +61,26 @@ public:
    typedef typename TMetadata::StampDataType StampDataType;
 
    typedef internal::GenericSink<TMetadata> SinkType;
+   typedef internal::GenericEntryGate<EntryDataType> EntryGateType;
 
 private:
    typedef internal::GenericLinePacket<TMetadata> LinePacketType;
    typedef GenericPacketArray<TMetadata> PacketArrayType;
 
+   // Shared with all loggers
+   boost::shared_ptr<EntryGateType> entryGate_;
+
    // When acquiring both syncSinksMutex_ and asyncQueueMutex_, acquire in that
    // order.
 
    boost::mutex syncSinksMutex_; // Protect all access to synchronousSinks_
    std::vector< boost::shared_ptr<SinkType> > synchronousSinks_;
+   // Written with syncSinksMutex_ held; read without it, so that entries
+   // need not take the mutex when there are no synchronous sinks
+   boost::atomic<bool> hasSynchronousSinks_;
+
+   // Reused by each thread to break its entries into packets
+   boost::thread_specific_ptr<PacketArrayType> stagingPackets_;
 
    boost::mutex asyncQueueMutex_; // Protect start/stop and sinks change
    internal::GenericPacketQueue<TMetadata> asyncQueue_;
@@ -76,7 +89,10 @@ private:
    std::vector< boost::shared_ptr<SinkType> > asynchronousSinks_;
 
 public:
-   GenericLoggingCore() { StartAsyncReceiveLoop(); }
+   GenericLoggingCore() :
+      entryGate_(boost::make_shared<EntryGateType>()),
+      hasSynchronousSinks_(false)
+   { StartAsyncReceiveLoop(); }
    ~GenericLoggingCore() { StopAsyncReceiveLoop(); }
 
    /**
@@ -90,9 +106,42 @@ public:
       // guaranteed to be safe to call at any time.
       return internal::GenericLogger<EntryDataType>(
             boost::bind(&GenericLoggingCore::SendEntryToShared,
-               this->shared_from_this(), metadata, _1, _2));
+               this->shared_from_this(), metadata, _1, _2),
+            entryGate_);
    }
 
+   /**
+    * Set the lowest level that loggers pass on to the sinks.
+    *
+    * Entries below this level are discarded by the loggers before they are
+    * formatted. The owner of the sinks should keep this at the lowest level
+    * accepted by any sink's filter.
+    */
+   void SetMinEntryLevel(int level)
+   { entryGate_->SetMinLevel(level); }
+
+   /**
+    * Set what happens to entries for the asynchronous sinks when the queue
+    * to them is full.
+    *
+    * With QueueOverflowDropLowLevelFirst, entries below lowLevelBelow are
+    * the first to be dropped.
+    */
+   void SetAsyncQueueOverflowPolicy(QueueOverflowPolicy policy,
+         int lowLevelBelow)
+   { asyncQueue_.SetOverflowPolicy(policy, lowLevelBelow); }
+
+   QueueOverflowPolicy GetAsyncQueueOverflowPolicy() const
+   { return asyncQueue_.GetOverflowPolicy(); }
+
+   // Number of entries that found the asynchronous queue full
+   long long GetAsyncQueueOverflowCount() const
+   { return asyncQueue_.GetOverflowCount(); }
+
+   // Number of entries dropped from the asynchronous sinks
+   long long GetAsyncQueueDroppedCount() const
+   { return asyncQueue_.GetDroppedCount(); }
+
    /**
     * Add a synchronous or asynchronous sink.
     */
@@ -104,6 +153,7 @@ public:
          {
             boost::lock_guard<boost::mutex> lock(syncSinksMutex_);
             synchronousSinks_.push_back(sink);
+            hasSynchronousSinks_.store(true);
             break;
          }
          case SinkModeAsynchronous:
@@ -135,6 +185,7 @@ public:
                      sink);
             if (it != synchronousSinks_.end())
                synchronousSinks_.erase(it);
+            hasSynchronousSinks_.store(!synchronousSinks_.empty());
             break;
          }
          case SinkModeAsynchronous:
@@ -208,6 +259,7 @@ public:
                break;
          }
       }
+      hasSynchronousSinks_.store(!synchronousSinks_.empty());
 
       StartAsyncReceiveLoop();
    }
@@ -270,9 +322,17 @@ private:
       StampDataType stampData;
       stampData.Stamp();
 
-      PacketArrayType packets;
+      PacketArrayType* staging = stagingPackets_.get();
+      if (!staging)
+      {
+         staging = new PacketArrayType();
+         stagingPackets_.reset(staging);
+      }
+      PacketArrayType& packets = *staging;
+      packets.Clear();
       packets.AppendEntry(loggerData, entryData, stampData, entryText);
 
+      if (hasSynchronousSinks_.load())
       {
          boost::lock_guard<boost::mutex> lock(syncSinksMutex_);
 
@@ -283,7 +343,8 @@ private:
             (*it)->Consume(packets);
          }
       }
-      asyncQueue_.SendPackets(packets.Begin(), packets.End());
+      asyncQueue_.SendPackets(packets.Begin(), packets.End(),
+            static_cast<int>(entryData.GetLevel()));
    }
 
    // Called on the receive thread of GenericPacketQueue
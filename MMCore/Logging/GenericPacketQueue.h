@@ -16,31 +16,95 @@
 
 #pragma once
 
+#include "GenericPacketArray.h"
+
+#include <boost/atomic.hpp>
 #include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/function.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/thread.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
 
 
 namespace mm
 {
 namespace logging
 {
+
+
+enum QueueOverflowPolicy
+{
+   // Entries wait for the backend to make room; nothing is lost
+   QueueOverflowBlock,
+   // Low-level entries are dropped once the queue is three quarters full,
+   // so that room is left for the others, which are dropped only when the
+   // queue is full; the frontend never waits
+   QueueOverflowDropLowLevelFirst,
+};
+
+
 namespace internal
 {
 
+/**
+ * Bounded multi-producer, single-consumer queue of log packets, from the
+ * logging threads to the backend thread that runs the asynchronous sinks.
+ *
+ * Producers reserve a contiguous run of slots for each entry with a single
+ * compare-and-swap, so that they neither take a lock nor interleave their
+ * packets. The first slot of an entry is published last, and the backend
+ * only takes whole entries. When the queue is full, the overflow policy
+ * decides whether the entry waits or is dropped; the number of entries
+ * that found the queue full, and of those dropped, are counted.
+ */
 template <typename TMetadata>
 class GenericPacketQueue
 {
    typedef GenericPacketArray<TMetadata> PacketArrayType;
+   typedef GenericLinePacket<TMetadata> LinePacketType;
+
+public:
+   static const std::size_t DefaultCapacity = 16384; // Packets (about 3 MB)
 
 private:
-   // The "queue" for asynchronous sinks.
+   struct Slot
+   {
+      // Position of the entry plus one once the entry is published (first
+      // slot of each entry only)
+      boost::atomic<boost::uint64_t> published;
+      std::size_t entryPacketCount; // First slot of each entry only
+      typename boost::aligned_storage<sizeof(LinePacketType),
+               boost::alignment_of<LinePacketType>::value>::type packet;
+
+      Slot() : published(0), entryPacketCount(0) {}
+      LinePacketType* Packet()
+      { return reinterpret_cast<LinePacketType*>(&packet); }
+   };
+
+   const std::size_t capacity_; // Power of 2
+   boost::scoped_array<Slot> slots_;
+   boost::atomic<boost::uint64_t> head_; // Next position to reserve
+   boost::atomic<boost::uint64_t> tail_; // Next position to receive
+
+   boost::atomic<QueueOverflowPolicy> overflowPolicy_;
+   boost::atomic<int> lowLevelBelow_; // For QueueOverflowDropLowLevelFirst
+   boost::atomic<long long> overflowCount_;
+   boost::atomic<long long> droppedCount_;
+
+   // mutex_ and condVar_ are only used to wake up the receive loop when it
+   // is idle
    boost::mutex mutex_;
    boost::condition_variable condVar_;
-   PacketArrayType queue_;
+   boost::atomic<bool> receiverWaiting_;
 
-   // Swapped with queue_ and accessed from receiving thread.
+   // Accessed from receiving thread.
    PacketArrayType received_;
 
    bool shutdownRequested_; // Protected by mutex_
@@ -51,16 +115,105 @@ private:
    boost::thread loopThread_; // Protected by threadMutex_
 
 public:
-   GenericPacketQueue() :
+   explicit GenericPacketQueue(std::size_t capacity = DefaultCapacity) :
+      capacity_(RoundUpToPowerOf2(capacity)),
+      slots_(new Slot[capacity_]),
+      head_(0),
+      tail_(0),
+      overflowPolicy_(QueueOverflowBlock),
+      lowLevelBelow_(0),
+      overflowCount_(0),
+      droppedCount_(0),
+      receiverWaiting_(false),
       shutdownRequested_(false)
    {}
 
+   ~GenericPacketQueue()
+   {
+      // Entries left over if the receive loop was never run
+      boost::uint64_t tail = tail_.load();
+      while (tail != head_.load())
+      {
+         Slot& first = slots_[tail & (capacity_ - 1)];
+         std::size_t count = first.entryPacketCount;
+         for (std::size_t i = 0; i < count; ++i)
+            slots_[(tail + i) & (capacity_ - 1)].Packet()->~LinePacketType();
+         tail += count;
+      }
+   }
+
+   std::size_t GetCapacity() const { return capacity_; }
+
+   // Entries whose level is below lowLevelBelow are the first to be dropped
+   // with QueueOverflowDropLowLevelFirst
+   void SetOverflowPolicy(QueueOverflowPolicy policy, int lowLevelBelow)
+   {
+      lowLevelBelow_.store(lowLevelBelow);
+      overflowPolicy_.store(policy);
+   }
+   QueueOverflowPolicy GetOverflowPolicy() const
+   { return overflowPolicy_.load(); }
+
+   long long GetOverflowCount() const { return overflowCount_.load(); }
+   long long GetDroppedCount() const { return droppedCount_.load(); }
+
+   // Sends the packets of one entry
    template <typename TPacketIter>
-   void SendPackets(TPacketIter first, TPacketIter last)
+   void SendPackets(TPacketIter first, TPacketIter last, int level)
    {
-      boost::lock_guard<boost::mutex> lock(mutex_);
-      queue_.Append(first, last);
-      condVar_.notify_one();
+      // An entry too long for the queue is cut short
+      std::size_t count = std::min<std::size_t>(
+            std::distance(first, last), capacity_);
+      if (count == 0)
+         return;
+
+      const QueueOverflowPolicy policy = overflowPolicy_.load();
+      std::size_t limit = capacity_;
+      if (policy == QueueOverflowDropLowLevelFirst &&
+            level < lowLevelBelow_.load())
+         limit = capacity_ / 4 * 3;
+
+      bool overflowed = false;
+      boost::uint64_t pos = head_.load(boost::memory_order_relaxed);
+      for (;;)
+      {
+         // pos may be older than tail (others sent and the receiver consumed
+         // in between), so compare without subtracting; a stale pos only
+         // makes the exchange below fail
+         boost::uint64_t tail = tail_.load(boost::memory_order_acquire);
+         if (pos + count > tail + limit)
+         {
+            if (!overflowed)
+            {
+               overflowed = true;
+               ++overflowCount_;
+            }
+            if (policy != QueueOverflowBlock)
+            {
+               ++droppedCount_;
+               return;
+            }
+            WakeReceiver();
+            boost::this_thread::sleep(boost::posix_time::microseconds(100));
+            pos = head_.load(boost::memory_order_relaxed);
+            continue;
+         }
+         if (head_.compare_exchange_weak(pos, pos + count,
+                  boost::memory_order_relaxed))
+            break;
+      }
+
+      for (std::size_t i = 0; i < count; ++i, ++first)
+         new (slots_[(pos + i) & (capacity_ - 1)].Packet()) LinePacketType(*first);
+      Slot& firstSlot = slots_[pos & (capacity_ - 1)];
+      firstSlot.entryPacketCount = count;
+      firstSlot.published.store(pos + 1, boost::memory_order_release);
+
+      // Pairs with the fence in the receive loop: either the loop sees the
+      // entry, or we see that it is waiting
+      boost::atomic_thread_fence(boost::memory_order_seq_cst);
+      if (receiverWaiting_.load(boost::memory_order_relaxed))
+         WakeReceiver();
    }
 
    void RunReceiveLoop(boost::function<void (PacketArrayType&)>
@@ -103,6 +256,48 @@ public:
    }
 
 private:
+   static std::size_t RoundUpToPowerOf2(std::size_t n)
+   {
+      std::size_t p = 1;
+      while (p < n)
+         p <<= 1;
+      return p;
+   }
+
+   void WakeReceiver()
+   {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      condVar_.notify_one();
+   }
+
+   bool HasPublishedEntry() const
+   {
+      boost::uint64_t tail = tail_.load(boost::memory_order_relaxed);
+      return slots_[tail & (capacity_ - 1)].published.load(
+            boost::memory_order_acquire) == tail + 1;
+   }
+
+   // Moves the published entries to received_, in order
+   void Receive()
+   {
+      boost::uint64_t tail = tail_.load(boost::memory_order_relaxed);
+      for (;;)
+      {
+         Slot& first = slots_[tail & (capacity_ - 1)];
+         if (first.published.load(boost::memory_order_acquire) != tail + 1)
+            break;
+         std::size_t count = first.entryPacketCount;
+         for (std::size_t i = 0; i < count; ++i)
+         {
+            LinePacketType* packet = slots_[(tail + i) & (capacity_ - 1)].Packet();
+            received_.Append(packet, packet + 1);
+            packet->~LinePacketType();
+         }
+         tail += count;
+      }
+      tail_.store(tail, boost::memory_order_release);
+   }
+
    void ReceiveLoop(boost::function<void (PacketArrayType&)> consume)
    {
       // The loop operates in one of two modes: timed wait and untimed wait.
@@ -137,13 +332,13 @@ private:
                   shutdownRequested_ = false; // Allow for restarting
                   shuttingDown = true;
                }
-               if (!shuttingDown && queue_.IsEmpty())
-               {
-                  timedWaitMode = false;
-                  continue;
-               }
-               queue_.Swap(received_);
             }
+            if (!shuttingDown && !HasPublishedEntry())
+            {
+               timedWaitMode = false;
+               continue;
+            }
+            Receive();
             consume(received_);
             received_.Clear();
 
@@ -154,18 +349,21 @@ private:
          {
             {
                boost::unique_lock<boost::mutex> lock(mutex_);
-               while (queue_.IsEmpty())
+               receiverWaiting_.store(true, boost::memory_order_relaxed);
+               boost::atomic_thread_fence(boost::memory_order_seq_cst);
+               while (!HasPublishedEntry())
                {
-                  condVar_.wait(lock);
                   if (shutdownRequested_)
                   {
                      shutdownRequested_ = false; // Allow for restarting
                      shuttingDown = true;
                      break;
                   }
+                  condVar_.wait(lock);
                }
-               queue_.Swap(received_);
+               receiverWaiting_.store(false, boost::memory_order_relaxed);
             }
+            Receive();
             consume(received_);
             received_.Clear();
 
@@ -0,0 +1,276 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Log file sink that rotates the file into segments by size
+//                and age, compresses the closed segments and deletes the
+//                oldest ones to keep within a total size
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "GenericStreamSink.h"
+#include "LogFileSegments.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+namespace mm
+{
+namespace logging
+{
+
+
+// When to rotate a log file, and what to do with the closed segments. A zero
+// limit is no limit; with no segment limit, the file is never rotated.
+struct FileRotationPolicy
+{
+   long long maxSegmentBytes;
+   long maxSegmentSeconds;
+   long long maxTotalBytes; // All segments, including the one being written
+   bool compress; // Ignored if compression is not available
+
+   FileRotationPolicy() :
+      maxSegmentBytes(0),
+      maxSegmentSeconds(0),
+      maxTotalBytes(0),
+      compress(false)
+   {}
+
+   bool RotationEnabled() const
+   { return maxSegmentBytes > 0 || maxSegmentSeconds > 0; }
+};
+
+
+namespace internal
+{
+
+
+// Writes to filename until the segment limits are reached, then renames it
+// to a closed segment (see LogSegmentFilename()) and starts a new file of the
+// same name. Closed segments are compressed and expired on a background
+// thread, so that the logging thread only pays for the rename.
+template <class TMetadata, class UFormatter>
+class GenericRotatingFileLogSink : public GenericSink<TMetadata>,
+   boost::noncopyable
+{
+   const std::string filename_;
+   const FileRotationPolicy policy_;
+   std::ofstream fileStream_;
+   long long segmentBytes_;
+   boost::posix_time::ptime segmentStart_;
+   unsigned nextSequence_;
+   bool hadError_;
+
+   // Closed segments waiting for the background thread
+   boost::mutex segmentsMutex_;
+   boost::condition_variable segmentsCondVar_;
+   std::deque<std::string> closedSegments_;
+   bool shutdownRequested_;
+   boost::thread segmentThread_;
+
+public:
+   typedef GenericSink<TMetadata> Super;
+   typedef typename Super::PacketArrayType PacketArrayType;
+
+   GenericRotatingFileLogSink(const std::string& filename,
+         const FileRotationPolicy& policy, bool append = false) :
+      filename_(filename),
+      policy_(policy),
+      segmentBytes_(0),
+      segmentStart_(boost::posix_time::second_clock::local_time()),
+      nextSequence_(NextLogSegmentSequence(filename)),
+      hadError_(false),
+      shutdownRequested_(false)
+   {
+      std::ios_base::openmode mode = std::ios_base::out;
+      mode |= (append ? std::ios_base::app : std::ios_base::trunc);
+
+      fileStream_.open(filename_.c_str(), mode);
+      if (!fileStream_)
+         throw CannotOpenFileException();
+      if (append)
+      {
+         long long size = LogFileSize(filename_);
+         if (size > 0)
+            segmentBytes_ = size;
+      }
+
+      // Start by expiring segments left by earlier sessions
+      segmentThread_ = boost::thread(boost::bind(
+               &GenericRotatingFileLogSink::RunSegmentLoop, this));
+   }
+
+   virtual ~GenericRotatingFileLogSink()
+   {
+      {
+         boost::lock_guard<boost::mutex> lock(segmentsMutex_);
+         shutdownRequested_ = true;
+      }
+      segmentsCondVar_.notify_one();
+      segmentThread_.join();
+   }
+
+   virtual void Consume(const PacketArrayType& packets)
+   {
+      WritePacketsToStream<UFormatter>(fileStream_,
+            packets.Begin(), packets.End(), this->GetFilter());
+      try
+      {
+         fileStream_.flush();
+      }
+      catch (const std::ios_base::failure& e)
+      {
+         ReportError(e.what());
+      }
+
+      std::streamoff pos = fileStream_.tellp();
+      if (pos > 0)
+         segmentBytes_ = pos;
+      if (SegmentIsFull())
+         Rotate();
+   }
+
+private:
+   bool SegmentIsFull() const
+   {
+      if (segmentBytes_ == 0)
+         return false;
+      if (policy_.maxSegmentBytes > 0 &&
+            segmentBytes_ >= policy_.maxSegmentBytes)
+         return true;
+      if (policy_.maxSegmentSeconds > 0)
+      {
+         boost::posix_time::time_duration age =
+            boost::posix_time::second_clock::local_time() - segmentStart_;
+         if (age.total_seconds() >= policy_.maxSegmentSeconds)
+            return true;
+      }
+      return false;
+   }
+
+   void Rotate()
+   {
+      boost::posix_time::ptime now =
+         boost::posix_time::second_clock::local_time();
+      std::string segment =
+         LogSegmentFilename(filename_, now, nextSequence_++);
+      // Never replace a segment, such as one just closed by another session
+      while (LogSegmentExists(segment))
+         segment = LogSegmentFilename(filename_, now, nextSequence_++);
+
+      fileStream_.close();
+      bool renamed = (std::rename(filename_.c_str(), segment.c_str()) == 0);
+      if (!renamed)
+      {
+         // Keep writing to the same file rather than lose entries
+         ReportError("cannot rename to " + segment);
+         fileStream_.open(filename_.c_str(),
+               std::ios_base::out | std::ios_base::app);
+      }
+      else
+      {
+         fileStream_.open(filename_.c_str(),
+               std::ios_base::out | std::ios_base::trunc);
+      }
+      if (!fileStream_)
+         ReportError("cannot reopen file");
+
+      segmentBytes_ = 0;
+      segmentStart_ = now;
+
+      if (renamed)
+      {
+         {
+            boost::lock_guard<boost::mutex> lock(segmentsMutex_);
+            closedSegments_.push_back(segment);
+         }
+         segmentsCondVar_.notify_one();
+      }
+   }
+
+   void ReportError(const std::string& message)
+   {
+      if (!hadError_)
+      {
+         hadError_ = true;
+         std::cerr << "Logging: cannot write to file " << filename_ <<
+            ": " << message << '\n';
+      }
+   }
+
+   // Runs on segmentThread_; segments closed before shutdown are processed
+   // before the thread exits
+   void RunSegmentLoop()
+   {
+      ExpireSegments();
+      for (;;)
+      {
+         std::string segment;
+         {
+            boost::unique_lock<boost::mutex> lock(segmentsMutex_);
+            while (closedSegments_.empty() && !shutdownRequested_)
+               segmentsCondVar_.wait(lock);
+            if (closedSegments_.empty())
+               return;
+            segment = closedSegments_.front();
+            closedSegments_.pop_front();
+         }
+
+         if (policy_.compress)
+            CompressLogSegment(segment);
+         ExpireSegments();
+      }
+   }
+
+   // Deletes the oldest segments until all of them, with the file being
+   // written, fit within the total size
+   void ExpireSegments()
+   {
+      if (policy_.maxTotalBytes <= 0)
+         return;
+
+      std::vector<std::string> segments = ListLogSegments(filename_);
+      std::vector<long long> sizes(segments.size());
+      long long total = LogFileSize(filename_);
+      if (total < 0)
+         total = 0;
+      for (size_t i = 0; i < segments.size(); ++i)
+      {
+         sizes[i] = LogFileSize(segments[i]);
+         if (sizes[i] > 0)
+            total += sizes[i];
+      }
+
+      for (size_t i = 0; i < segments.size() &&
+            total > policy_.maxTotalBytes; ++i)
+      {
+         if (std::remove(segments[i].c_str()) == 0 && sizes[i] > 0)
+            total -= sizes[i];
+      }
+   }
+};
+
+
+} // namespace internal
+} // namespace logging
+} // namespace mm
@@ -0,0 +1,285 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   File operations on the closed segments of rotated log files
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "LogFileSegments.h"
+
+#ifdef WIN32
+   #include <io.h>
+#else
+   #include <dirent.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_LIBZ
+   #include <zlib.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+
+namespace mm
+{
+namespace logging
+{
+namespace internal
+{
+
+namespace
+{
+
+const char* const compressedSuffix = ".gz";
+const size_t timestampLength = 15; // "YYYYMMDDTHHMMSS"
+
+// Splits "dir/CoreLog.txt" into "dir/", "CoreLog" and ".txt"
+void SplitLogFilename(const std::string& logFilename,
+      std::string& directory, std::string& stem, std::string& extension)
+{
+   size_t nameStart = logFilename.find_last_of("/\\");
+   nameStart = (nameStart == std::string::npos) ? 0 : nameStart + 1;
+   directory = logFilename.substr(0, nameStart);
+   std::string name = logFilename.substr(nameStart);
+   size_t dot = name.find_last_of('.');
+   if (dot == std::string::npos || dot == 0)
+      dot = name.size();
+   stem = name.substr(0, dot);
+   extension = name.substr(dot);
+}
+
+bool IsDigits(const std::string& s, size_t first, size_t last)
+{
+   if (first >= last)
+      return false;
+   for (size_t i = first; i < last; ++i)
+   {
+      if (s[i] < '0' || s[i] > '9')
+         return false;
+   }
+   return true;
+}
+
+bool EndsWith(const std::string& s, const std::string& suffix)
+{
+   return s.size() >= suffix.size() &&
+      s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Whether name is that of a segment as made by LogSegmentFilename()
+bool IsSegmentName(const std::string& name, const std::string& stem,
+      const std::string& extension)
+{
+   const std::string prefix = stem + ".";
+   if (name.compare(0, prefix.size(), prefix) != 0)
+      return false;
+   std::string rest = name.substr(prefix.size());
+
+   size_t suffixLength;
+   if (EndsWith(rest, extension + compressedSuffix))
+      suffixLength = extension.size() + std::strlen(compressedSuffix);
+   else if (EndsWith(rest, extension))
+      suffixLength = extension.size();
+   else
+      return false;
+   if (rest.size() < suffixLength + timestampLength + 2)
+      return false;
+   rest.resize(rest.size() - suffixLength);
+
+   return IsDigits(rest, 0, 8) && rest[8] == 'T' &&
+      IsDigits(rest, 9, timestampLength) && rest[timestampLength] == '-' &&
+      IsDigits(rest, timestampLength + 1, rest.size());
+}
+
+} // anonymous namespace
+
+
+std::string
+LogSegmentFilename(const std::string& logFilename,
+      const boost::posix_time::ptime& closedAt, unsigned sequence)
+{
+   std::string directory, stem, extension;
+   SplitLogFilename(logFilename, directory, stem, extension);
+
+   std::ostringstream name;
+   name << directory << stem << '.' <<
+      boost::posix_time::to_iso_string(closedAt).substr(0, timestampLength) <<
+      '-' << std::setw(4) << std::setfill('0') << sequence << extension;
+   return name.str();
+}
+
+
+std::vector<std::string>
+ListLogSegments(const std::string& logFilename)
+{
+   std::string directory, stem, extension;
+   SplitLogFilename(logFilename, directory, stem, extension);
+
+   std::vector<std::string> names;
+#ifdef WIN32
+   std::string pattern = directory + stem + ".*";
+   struct _finddata_t file;
+   intptr_t hSearch = _findfirst(pattern.c_str(), &file);
+   if (hSearch != -1L)
+   {
+      do {
+         if (IsSegmentName(file.name, stem, extension))
+            names.push_back(file.name);
+      } while (_findnext(hSearch, &file) == 0);
+      _findclose(hSearch);
+   }
+#else
+   DIR* dp = opendir(directory.empty() ? "." : directory.c_str());
+   if (dp)
+   {
+      struct dirent* dirp;
+      while ((dirp = readdir(dp)) != NULL)
+      {
+         if (IsSegmentName(dirp->d_name, stem, extension))
+            names.push_back(dirp->d_name);
+      }
+      closedir(dp);
+   }
+#endif
+
+   // The timestamp and sequence number make the names sort by age. Compare
+   // without the compression suffix, which is added to segments out of order.
+   std::vector< std::pair<std::string, std::string> > keyed;
+   for (size_t i = 0; i < names.size(); ++i)
+   {
+      std::string key = names[i];
+      if (EndsWith(key, compressedSuffix))
+         key.resize(key.size() - std::strlen(compressedSuffix));
+      keyed.push_back(std::make_pair(key, directory + names[i]));
+   }
+   std::sort(keyed.begin(), keyed.end());
+
+   std::vector<std::string> segments;
+   for (size_t i = 0; i < keyed.size(); ++i)
+      segments.push_back(keyed[i].second);
+   return segments;
+}
+
+
+unsigned
+NextLogSegmentSequence(const std::string& logFilename)
+{
+   std::string directory, stem, extension;
+   SplitLogFilename(logFilename, directory, stem, extension);
+
+   std::vector<std::string> segments = ListLogSegments(logFilename);
+   unsigned next = 0;
+   for (size_t i = 0; i < segments.size(); ++i)
+   {
+      std::string name = segments[i];
+      if (EndsWith(name, compressedSuffix))
+         name.resize(name.size() - std::strlen(compressedSuffix));
+      name.resize(name.size() - extension.size());
+      size_t dash = name.find_last_of('-');
+      unsigned sequence = static_cast<unsigned>(
+            std::strtoul(name.c_str() + dash + 1, 0, 10));
+      next = std::max(next, sequence + 1);
+   }
+   return next;
+}
+
+
+bool
+LogSegmentExists(const std::string& segmentFilename)
+{
+   return LogFileSize(segmentFilename) >= 0 ||
+      LogFileSize(segmentFilename + compressedSuffix) >= 0;
+}
+
+
+long long
+LogFileSize(const std::string& filename)
+{
+#ifdef WIN32
+   struct _stati64 info;
+   if (_stati64(filename.c_str(), &info) != 0)
+      return -1;
+#else
+   struct stat info;
+   if (stat(filename.c_str(), &info) != 0)
+      return -1;
+#endif
+   return static_cast<long long>(info.st_size);
+}
+
+
+bool
+CanCompressLogSegments()
+{
+#ifdef HAVE_LIBZ
+   return true;
+#else
+   return false;
+#endif
+}
+
+
+bool
+CompressLogSegment(const std::string& filename)
+{
+#ifdef HAVE_LIBZ
+   const std::string compressedFilename = filename + compressedSuffix;
+
+   std::FILE* in = std::fopen(filename.c_str(), "rb");
+   if (!in)
+      return false;
+   gzFile out = gzopen(compressedFilename.c_str(), "wb");
+   if (!out)
+   {
+      std::fclose(in);
+      return false;
+   }
+
+   bool ok = true;
+   char buffer[65536];
+   size_t count;
+   while (ok && (count = std::fread(buffer, 1, sizeof(buffer), in)) > 0)
+   {
+      if (gzwrite(out, buffer, static_cast<unsigned>(count)) !=
+            static_cast<int>(count))
+         ok = false;
+   }
+   if (std::ferror(in))
+      ok = false;
+   std::fclose(in);
+   if (gzclose(out) != Z_OK)
+      ok = false;
+
+   if (!ok)
+   {
+      std::remove(compressedFilename.c_str());
+      return false;
+   }
+   std::remove(filename.c_str());
+   return true;
+#else
+   (void)filename;
+   return false;
+#endif
+}
+
+
+} // namespace internal
+} // namespace logging
+} // namespace mm
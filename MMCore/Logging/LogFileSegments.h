@@ -0,0 +1,64 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   File operations on the closed segments of rotated log files
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <string>
+#include <vector>
+
+
+namespace mm
+{
+namespace logging
+{
+namespace internal
+{
+
+
+// A closed segment of the log file "dir/CoreLog.txt" is named
+// "dir/CoreLog.20261016T093000-0001.txt" (the time at which it was closed
+// and a sequence number), plus ".gz" once compressed. Names sort in the
+// order the segments were closed.
+std::string LogSegmentFilename(const std::string& logFilename,
+      const boost::posix_time::ptime& closedAt, unsigned sequence);
+
+// The closed segments of the log file, compressed or not, oldest first
+std::vector<std::string> ListLogSegments(const std::string& logFilename);
+
+// One more than the highest sequence number of the existing segments (0 if
+// there are none), so that segments closed by an earlier session in the same
+// second are neither replaced nor sorted after newer ones
+unsigned NextLogSegmentSequence(const std::string& logFilename);
+
+// Whether the segment exists, compressed or not
+bool LogSegmentExists(const std::string& segmentFilename);
+
+// Size of the file in bytes, or -1 if it does not exist
+long long LogFileSize(const std::string& filename);
+
+bool CanCompressLogSegments();
+
+// Writes the gzip-compressed file filename + ".gz" and removes filename.
+// Returns false (leaving filename alone) on failure or if compression is not
+// available.
+bool CompressLogSegment(const std::string& filename);
+
+
+} // namespace internal
+} // namespace logging
+} // namespace mm
@@ -48,8 +48,16 @@ typedef internal::GenericLogStream<Logger> LogStream;
 // In C++ pre-11, the above statement will fail for some data types of x (e.g.
 // const char*). So, to make the left hand side of << an lvalue, we need to use
 // a trick.
+//
+// The entry is only formatted if the logger's gate is open for the level, so
+// that disabled levels (usually debug and trace) cost no more than an atomic
+// load. The gate is tested in a for-loop rather than an if-else, so that the
+// macro can be used as the body of an unbraced if statement without leaving a
+// dangling else.
 
 #define LOG_WITH_LEVEL(logger, level) \
+   for (bool logEnabled = (logger).IsEnabled(level); logEnabled; \
+         logEnabled = false) \
    for (::mm::logging::LogStream strm((logger), (level)); \
          !strm.Used(); strm.MarkUsed()) \
       strm
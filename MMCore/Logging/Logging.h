@@ -17,6 +17,7 @@
 #pragma once
 
 #include "GenericStreamSink.h"
+#include "GenericRotatingFileSink.h"
 #include "GenericEntryFilter.h"
 #include "GenericLoggingCore.h"
 #include "GenericSink.h"
@@ -39,6 +40,8 @@ typedef internal::GenericStdErrLogSink<Metadata, internal::MetadataFormatter>
    StdErrLogSink;
 typedef internal::GenericFileLogSink<Metadata, internal::MetadataFormatter>
    FileLogSink;
+typedef internal::GenericRotatingFileLogSink<Metadata,
+   internal::MetadataFormatter> RotatingFileLogSink;
 
 
 typedef internal::GenericEntryFilter<Metadata> EntryFilter;
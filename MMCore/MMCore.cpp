@@ -42,21 +42,35 @@
 #include "../MMDevice/DeviceUtils.h"
 #include "../MMDevice/ImageMetadata.h"
 #include "../MMDevice/ModuleInterface.h"
+#include "AcquisitionPlan.h"
 #include "CircularBuffer.h"
+#include "CommandFuture.h"
+#include "CommandScheduler.h"
 #include "ConfigGroup.h"
 #include "Configuration.h"
 #include "CoreCallback.h"
 #include "CoreProperty.h"
 #include "CoreUtils.h"
+#include "DeviceAdapterCatalog.h"
+#include "DeviceInitializer.h"
 #include "DeviceManager.h"
+#include "DeviceStateReader.h"
 #include "Devices/DeviceInstances.h"
 #include "Host.h"
+#include "IdleNotifier.h"
 #include "LogManager.h"
 #include "MMCore.h"
 #include "MMEventCallback.h"
 #include "PluginManager.h"
+#include "PresetMatcher.h"
+#include "SequenceCompiler.h"
+#include "ThreadPool.h"
 
+#include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
 
 #include <algorithm>
 #include <assert.h>
@@ -126,12 +140,19 @@ CMMCore::CMMCore() :
    pollingIntervalMs_(10),
    timeoutMs_(5000),
    autoShutter_(true),
+   parallelInitialization_(false),
    callback_(0),
    configGroups_(0),
    properties_(0),
    externalCallback_(0),
    pixelSizeGroup_(0),
    cbuf_(0),
+   metadataKeys_(new mm::MetadataKeyTable()),
+   idleNotifier_(new mm::IdleNotifier()),
+   devicePool_(new mm::ThreadPool(8)),
+   stateReader_(new mm::DeviceStateReader(devicePool_)),
+   commandScheduler_(new mm::CommandScheduler(devicePool_,
+            boost::bind(&CMMCore::logCommandDone, this, _1))),
    pluginManager_(new CPluginManager()),
    deviceManager_(new mm::DeviceManager()),
    pPostedErrorsLock_(NULL)
@@ -145,7 +166,7 @@ CMMCore::CMMCore() :
    callback_ = new CoreCallback(this);
 
    const unsigned seqBufMegabytes = (sizeof(void*) > 4) ? 250 : 25;
-   cbuf_ = new CircularBuffer(seqBufMegabytes);
+   cbuf_ = new CircularBuffer(seqBufMegabytes, metadataKeys_);
 
    CreateCoreProperties();
 }
@@ -156,6 +177,8 @@ CMMCore::CMMCore() :
  */
 CMMCore::~CMMCore()
 {
+   commandScheduler_->WaitForAll();
+
    try
    {
       // TODO We should attempt to continue cleanup beyond the first device
@@ -292,6 +315,151 @@ void CMMCore::stopSecondaryLogFile(int handle) throw (CMMError)
 }
 
 
+namespace
+{
+
+mm::logging::FileRotationPolicy
+MakeRotationPolicy(long maxSegmentMB, long maxSegmentHours, long maxTotalMB,
+      bool compress)
+{
+   if (maxSegmentMB < 0 || maxSegmentHours < 0 || maxTotalMB < 0)
+      throw CMMError("Log rotation limits must not be negative",
+            MMERR_InvalidContents);
+
+   const long long megabyte = 1024 * 1024;
+   mm::logging::FileRotationPolicy policy;
+   policy.maxSegmentBytes = maxSegmentMB * megabyte;
+   policy.maxSegmentSeconds = maxSegmentHours * 3600;
+   policy.maxTotalBytes = maxTotalMB * megabyte;
+   policy.compress = compress;
+   return policy;
+}
+
+} // anonymous namespace
+
+
+/**
+ * Sets the rotation of the primary log file: once it reaches the given size
+ * or age, the file is renamed with the time it was closed (for example
+ * CoreLog.txt to CoreLog.20261016T093000-0000.txt) and a new file is
+ * started. Closed files are compressed (gzip, if available in this build) and
+ * the oldest deleted in the background.
+ *
+ * The settings apply to the current primary log file (which is continued)
+ * and to any set later with setPrimaryLogFile().
+ *
+ * @param maxSegmentMB Size at which to rotate the file, or 0 for no limit.
+ * @param maxSegmentHours Age at which to rotate the file, or 0 for no limit.
+ * If both limits are 0, the file is not rotated.
+ * @param maxTotalMB Total size, including the current file, above which the
+ * oldest closed files are deleted, or 0 to keep them all.
+ * @param compress Whether to compress closed files.
+ */
+void CMMCore::setPrimaryLogRotation(long maxSegmentMB, long maxSegmentHours,
+      long maxTotalMB, bool compress) throw (CMMError)
+{
+   logManager_->SetPrimaryLogRotation(MakeRotationPolicy(maxSegmentMB,
+            maxSegmentHours, maxTotalMB, compress));
+}
+
+
+/**
+ * Start capturing logging output into an additional file that is rotated.
+ * Logging to the file is asynchronous.
+ *
+ * @param filename The filename to which the log will be captured
+ * @param enableDebug Whether to include debug logging.
+ * @param maxSegmentMB Size at which to rotate the file, or 0 for no limit.
+ * @param maxSegmentHours Age at which to rotate the file, or 0 for no limit.
+ * @param maxTotalMB Total size above which the oldest closed files are
+ * deleted, or 0 to keep them all.
+ * @param compress Whether to compress closed files.
+ * @param truncate If false, append to the file.
+ * @returns A handle required when calling stopSecondaryLogFile().
+ * @see setPrimaryLogRotation
+ */
+int CMMCore::startSecondaryRotatingLogFile(const char* filename,
+      bool enableDebug, long maxSegmentMB, long maxSegmentHours,
+      long maxTotalMB, bool compress, bool truncate) throw (CMMError)
+{
+   if (!filename)
+      throw CMMError("Filename is null");
+
+   using namespace mm::logging;
+   typedef mm::LogManager::LogFileHandle LogFileHandle;
+
+   LogFileHandle handle = logManager_->AddSecondaryLogFile(
+            (enableDebug ? LogLevelTrace : LogLevelInfo),
+            filename, truncate, SinkModeAsynchronous,
+            MakeRotationPolicy(maxSegmentMB, maxSegmentHours, maxTotalMB,
+               compress));
+   return static_cast<int>(handle);
+}
+
+
+/**
+ * Sets what happens to log entries when the queue to the log files (other
+ * than synchronous secondary log files) and stderr is full, which happens
+ * when entries are logged faster than they can be written.
+ *
+ * @param policy "Block" (the default): the logging thread waits until there
+ * is room, and no entries are lost. "DropDebugFirst": debug entries are
+ * dropped once the queue is three quarters full, and other entries when it
+ * is full, so that logging never holds up the calling thread.
+ */
+void CMMCore::setLogQueueOverflowPolicy(const char* policy) throw (CMMError)
+{
+   if (!policy)
+      throw CMMError("Null log queue overflow policy", MMERR_NullPointerException);
+
+   using namespace mm::logging;
+   QueueOverflowPolicy value;
+   if (strcmp(policy, "Block") == 0)
+      value = QueueOverflowBlock;
+   else if (strcmp(policy, "DropDebugFirst") == 0)
+      value = QueueOverflowDropLowLevelFirst;
+   else
+      throw CMMError("Unknown log queue overflow policy: " + ToQuotedString(policy),
+            MMERR_InvalidContents);
+
+   logManager_->SetAsyncQueueOverflowPolicy(value);
+   LOG_INFO(coreLogger_) << "Did set log queue overflow policy to " << policy;
+}
+
+/**
+ * Returns the log queue overflow policy.
+ * @see setLogQueueOverflowPolicy
+ */
+std::string CMMCore::getLogQueueOverflowPolicy() const
+{
+   switch (logManager_->GetAsyncQueueOverflowPolicy())
+   {
+      case mm::logging::QueueOverflowDropLowLevelFirst:
+         return "DropDebugFirst";
+      default:
+         return "Block";
+   }
+}
+
+/**
+ * Returns how many log entries found the log queue full, whatever the
+ * overflow policy did with them.
+ */
+long long CMMCore::getLogQueueOverflowCount() const
+{
+   return logManager_->GetAsyncQueueOverflowCount();
+}
+
+/**
+ * Returns how many log entries were dropped because the log queue was full.
+ * @see setLogQueueOverflowPolicy
+ */
+long long CMMCore::getLogDroppedEntryCount() const
+{
+   return logManager_->GetAsyncQueueDroppedCount();
+}
+
+
 /*!
  Displays current user name.
  */
@@ -341,13 +509,23 @@ string CMMCore::getVersionInfo() const
 
 /**
  * Get available devices from the specified device library.
+ *
+ * The device adapter is not loaded if the device adapter catalog has an entry
+ * for its (unchanged) file; see setDeviceAdapterCatalogFile().
  */
 std::vector<std::string>
 CMMCore::getAvailableDevices(const char* moduleName) throw (CMMError)
 {
-   boost::shared_ptr<LoadedDeviceAdapter> module =
-      pluginManager_->GetDeviceAdapter(moduleName);
-   return module->GetAvailableDeviceNames();
+   std::vector<mm::DeviceAdapterCatalog::Device> devices =
+      pluginManager_->GetAvailableDevices(moduleName);
+   std::vector<std::string> names;
+   names.reserve(devices.size());
+   for (std::vector<mm::DeviceAdapterCatalog::Device>::const_iterator
+         it = devices.begin(), end = devices.end(); it != end; ++it)
+   {
+      names.push_back(it->name);
+   }
+   return names;
 }
 
 /**
@@ -358,15 +536,14 @@ CMMCore::getAvailableDeviceDescriptions(const char* moduleName) throw (CMMError)
 {
    // XXX It is a little silly that we return the list of descriptions, rather
    // than provide access to the description of each device.
-   boost::shared_ptr<LoadedDeviceAdapter> module =
-      pluginManager_->GetDeviceAdapter(moduleName);
-   std::vector<std::string> names = module->GetAvailableDeviceNames();
+   std::vector<mm::DeviceAdapterCatalog::Device> devices =
+      pluginManager_->GetAvailableDevices(moduleName);
    std::vector<std::string> descriptions;
-   descriptions.reserve(names.size());
-   for (std::vector<std::string>::const_iterator
-         it = names.begin(), end = names.end(); it != end; ++it)
+   descriptions.reserve(devices.size());
+   for (std::vector<mm::DeviceAdapterCatalog::Device>::const_iterator
+         it = devices.begin(), end = devices.end(); it != end; ++it)
    {
-      descriptions.push_back(module->GetDeviceDescription(*it));
+      descriptions.push_back(it->description);
    }
    return descriptions;
 }
@@ -379,16 +556,20 @@ CMMCore::getAvailableDeviceTypes(const char* moduleName) throw (CMMError)
 {
    // XXX It is a little silly that we return the list of types, rather than
    // provide access to the type of each device.
-   boost::shared_ptr<LoadedDeviceAdapter> module =
-      pluginManager_->GetDeviceAdapter(moduleName);
-   std::vector<std::string> names = module->GetAvailableDeviceNames();
+   std::vector<mm::DeviceAdapterCatalog::Device> devices =
+      pluginManager_->GetAvailableDevices(moduleName);
    std::vector<long> types;
-   types.reserve(names.size());
-   for (std::vector<std::string>::const_iterator
-         it = names.begin(), end = names.end(); it != end; ++it)
+   types.reserve(devices.size());
+   for (std::vector<mm::DeviceAdapterCatalog::Device>::const_iterator
+         it = devices.begin(), end = devices.end(); it != end; ++it)
    {
-      MM::DeviceType devType = module->GetAdvertisedDeviceType(*it);
-      types.push_back(static_cast<long>(devType));
+      if (it->type == MM::UnknownType)
+      {
+         throw CMMError("Cannot get type of device " +
+               ToQuotedString(it->name) + " of device adapter module " +
+               ToQuotedString(moduleName));
+      }
+      types.push_back(it->type);
    }
    return types;
 }
@@ -409,40 +590,19 @@ string CMMCore::getAPIVersionInfo() const
  */
 Configuration CMMCore::getSystemState()
 {
-   Configuration config;
-   vector<string> devices = deviceManager_->GetDeviceList();
-   for (vector<string>::const_iterator i = devices.begin(), end = devices.end(); i != end; ++i)
-   {
-      boost::shared_ptr<DeviceInstance> pDev = deviceManager_->GetDevice(*i);
-      mm::DeviceModuleLockGuard guard(pDev);
-      std::vector<std::string> propertyNames = pDev->GetPropertyNames();
-      for (std::vector<std::string>::const_iterator it = propertyNames.begin(), end = propertyNames.end();
-            it != end; ++it)
-      {
-         std::string val;
-         try
-         {
-            val = pDev->GetProperty(*it);
-         }
-         catch (const CMMError&)
-         {
-            // XXX BUG This should not be ignored, but the interface does not
-            // allow throwing from this function. Keeping old behavior for now.
-         }
+   vector<string> labels = deviceManager_->GetDeviceList();
+   std::vector< boost::shared_ptr<DeviceInstance> > devices;
+   for (vector<string>::const_iterator i = labels.begin(), end = labels.end(); i != end; ++i)
+      devices.push_back(deviceManager_->GetDevice(*i));
 
-         bool readOnly = false;
-         try
-         {
-            readOnly = pDev->GetPropertyReadOnly(it->c_str());
-         }
-         catch (const CMMError&)
-         {
-            // XXX BUG This should not be ignored, but the interface does not
-            // allow throwing from this function. Keeping old behavior for now.
-         }
-         config.addSetting(PropertySetting(i->c_str(), it->c_str(), val.c_str(), readOnly));
-      }
-   }
+   // Values of properties that cannot change are taken from the cache
+   Configuration cache = getSystemStateCache();
+   std::vector<PropertySetting> settings = stateReader_->Read(devices, cache);
+
+   Configuration config;
+   for (std::vector<PropertySetting>::const_iterator it = settings.begin(), end = settings.end();
+         it != end; ++it)
+      config.addSetting(*it);
 
    // add core properties
    vector<string> coreProps = properties_->GetNames();
@@ -513,47 +673,94 @@ Configuration CMMCore::getConfigGroupState(const char* group, bool fromCache) th
 {
    CheckConfigGroupName(group);
 
-   std::vector<std::string> allPresets =
-      configGroups_->GetAvailableConfigs(group);
-
    Configuration state;
+   boost::shared_ptr<const mm::PresetMatcher> matcher =
+      configGroups_->GetMatcher(group);
+   if (!matcher)
+      return state;
 
-   // Loop over every property that appears in every preset, and collect the
-   // value (from cache or from devices).
-   for (std::vector<std::string>::const_iterator
-         it = allPresets.begin(), end = allPresets.end(); it != end; ++it)
+   // Collect the value (from cache or from devices) of every property that
+   // appears in any preset.
+   for (size_t i = 0; i < matcher->GetPropertyCount(); i++)
    {
-      Configuration preset = getConfigData(group, it->c_str());
-
-      for (size_t i = 0; i < preset.size(); i++)
+      const std::string& deviceLabel = matcher->GetDeviceLabel(i);
+      const std::string& propertyName = matcher->GetPropertyName(i);
+      std::string value;
+      if (fromCache)
+      {
+         value = getPropertyFromCache(deviceLabel.c_str(),
+               propertyName.c_str());
+      }
+      else
       {
-         PropertySetting cs = preset.getSetting(i);
-         std::string deviceLabel = cs.getDeviceLabel();
-         std::string propertyName = cs.getPropertyName();
+         value = getProperty(deviceLabel.c_str(), propertyName.c_str());
+      }
 
-         // Skip properties that we have already added.
-         if (!state.isPropertyIncluded(deviceLabel.c_str(),
-                  propertyName.c_str()))
-         {
-            std::string value;
-            if (fromCache)
-            {
-               value = getPropertyFromCache(deviceLabel.c_str(),
-                     propertyName.c_str());
-            }
-            else
-            {
-               value = getProperty(deviceLabel.c_str(),
-                     propertyName.c_str());
-            }
+      PropertySetting ss(deviceLabel.c_str(), propertyName.c_str(),
+            value.c_str());
+      state.addSetting(ss);
+   }
+   return state;
+}
 
-            PropertySetting ss(deviceLabel.c_str(), propertyName.c_str(),
-                  value.c_str());
-            state.addSetting(ss);
-         }
+/**
+ * Returns the first preset (of the group compiled into matcher) that matches
+ * the current property values, or an empty string if none does. Values are
+ * read from the cache or from the devices.
+ *
+ * If errorContext is given, properties whose value cannot be read are
+ * logged under that name and skipped, instead of causing an exception.
+ */
+std::string CMMCore::getMatchingPreset(const mm::PresetMatcher& matcher,
+      bool fromCache, const char* errorContext) throw (CMMError)
+{
+   const size_t count = matcher.GetPropertyCount();
+   std::vector<std::string> readValues(count);
+   std::vector<const std::string*> values(count, 0);
+
+   // Values that are not taken from the state cache
+   for (size_t i = 0; i < count; i++)
+   {
+      const char* label = matcher.GetDeviceLabel(i).c_str();
+      const char* propName = matcher.GetPropertyName(i).c_str();
+      if (fromCache && !IsCoreDeviceLabel(label))
+         continue;
+      try
+      {
+         if (fromCache)
+            readValues[i] = properties_->Get(propName);
+         else
+            readValues[i] = getProperty(label, propName);
+         values[i] = &readValues[i];
+      }
+      catch (const CMMError& err)
+      {
+         if (!errorContext)
+            throw;
+         logError(errorContext, err.getMsg().c_str());
       }
    }
-   return state;
+   if (!fromCache)
+      return matcher.Match(values);
+
+   // Cached values are compared in place, so the cache stays locked
+   MMThreadGuard scg(stateCacheLock_);
+   for (size_t i = 0; i < count; i++)
+   {
+      if (values[i] || IsCoreDeviceLabel(matcher.GetDeviceLabel(i).c_str()))
+         continue;
+      values[i] = stateCache_.findValue(matcher.GetKey(i));
+      if (!values[i])
+      {
+         CMMError err("Property " + ToQuotedString(matcher.GetPropertyName(i)) +
+               " of device " + ToQuotedString(matcher.GetDeviceLabel(i)) +
+               " not found in cache", MMERR_PropertyNotInCache);
+         if (!errorContext)
+            throw err;
+         logError(errorContext, err.getMsg().c_str());
+      }
+   }
+   return matcher.Match(values);
 }
 
 /**
@@ -611,6 +818,47 @@ void CMMCore::setDeviceAdapterSearchPaths(const std::vector<std::string>& paths)
    pluginManager_->SetSearchPaths(paths.begin(), paths.end());
 }
 
+/**
+ * Set the file in which the device adapter catalog is kept.
+ *
+ * The catalog records the devices provided by each device adapter file, so
+ * that getAvailableDevices(), getAvailableDeviceDescriptions() and
+ * getAvailableDeviceTypes() can answer without loading the adapter. Entries
+ * are keyed by the file's path, modification time and size, so an adapter
+ * that is replaced or rebuilt is loaded and examined again. Device adapters
+ * are otherwise only loaded when a device is loaded from them.
+ *
+ * The file is read now, and rewritten with any newly examined adapters when
+ * all devices are unloaded (unloadAllDevices() or reset()), when the catalog
+ * file is changed, and when the Core is destroyed. A missing or outdated
+ * file is not an error; the catalog then starts empty.
+ * By default (or with an empty filename), the catalog is kept in memory
+ * only, and is lost at the end of the session.
+ *
+ * @param filename   the catalog file, or an empty string
+ */
+void CMMCore::setDeviceAdapterCatalogFile(const char* filename) throw (CMMError)
+{
+   if (!filename)
+      throw CMMError("Null filename");
+
+   size_t modules = pluginManager_->SetCatalogFile(filename);
+   if (filename[0] != '\0')
+   {
+      LOG_INFO(coreLogger_) << "Device adapter catalog " << filename <<
+         ": " << modules << " device adapters listed";
+   }
+}
+
+/**
+ * Return the file in which the device adapter catalog is kept; empty if it is
+ * kept in memory only.
+ */
+std::string CMMCore::getDeviceAdapterCatalogFile() const
+{
+   return pluginManager_->GetCatalogFile();
+}
+
 /**
  * Return the names of discoverable device adapters.
  *
@@ -764,10 +1012,15 @@ void CMMCore::unloadDevice(const char* label///< the name of the device to unloa
                            ) throw (CMMError)
 {
    boost::shared_ptr<DeviceInstance> pDevice = deviceManager_->GetDevice(label);
+   commandScheduler_->WaitForAll();
 
    try {
       mm::DeviceModuleLockGuard guard(pDevice);
       LOG_DEBUG(coreLogger_) << "Will unload device " << label;
+      {
+         MMThreadGuard g(cameraBuffersLock_);
+         cameraBuffers_.erase(label);
+      }
       deviceManager_->UnloadDevice(pDevice);
       LOG_DEBUG(coreLogger_) << "Did unload device " << label;
    }
@@ -783,6 +1036,9 @@ void CMMCore::unloadDevice(const char* label///< the name of the device to unloa
  */
 void CMMCore::unloadAllDevices() throw (CMMError)
 {
+   commandScheduler_->WaitForAll();
+   pluginManager_->SaveCatalog();
+
    try {
       configGroups_->Clear();
 
@@ -801,6 +1057,10 @@ void CMMCore::unloadAllDevices() throw (CMMError)
       }
 
       LOG_DEBUG(coreLogger_) << "Will unload all devices";
+      {
+         MMThreadGuard g(cameraBuffersLock_);
+         cameraBuffers_.clear();
+      }
       deviceManager_->UnloadAllDevices();
       LOG_INFO(coreLogger_) << "Did unload all devices";
    
@@ -855,16 +1115,67 @@ void CMMCore::reset() throw (CMMError)
 }
 
 
+namespace
+{
+
+// Called on the device pool threads
+void InitializeOneDevice(mm::logging::Logger logger,
+      const std::vector< boost::shared_ptr<DeviceInstance> >& devices,
+      size_t index)
+{
+   boost::shared_ptr<DeviceInstance> pDevice = devices[index];
+   mm::DeviceModuleLockGuard guard(pDevice);
+   LOG_INFO(logger) << "Will initialize device " << pDevice->GetLabel();
+   pDevice->Initialize();
+   LOG_INFO(logger) << "Did initialize device " << pDevice->GetLabel();
+}
+
+mm::DeviceInitializer::Device
+GetInitializationDependencies(boost::shared_ptr<DeviceInstance> pDevice,
+      mm::DeviceManager& deviceManager)
+{
+   mm::DeviceInitializer::Device dependencies;
+   dependencies.label = pDevice->GetLabel();
+   dependencies.module = pDevice->GetAdapterModule().get();
+
+   mm::DeviceModuleLockGuard guard(pDevice);
+   dependencies.parentLabel = pDevice->GetParentID();
+   if (pDevice->HasProperty(MM::g_Keyword_Port))
+   {
+      try
+      {
+         std::string port = pDevice->GetProperty(MM::g_Keyword_Port);
+         if (deviceManager.GetDevice(port)->GetType() == MM::SerialDevice)
+            dependencies.port = port;
+      }
+      catch (const CMMError&)
+      {
+         // No port set, or not a loaded device
+      }
+   }
+   return dependencies;
+}
+
+} // anonymous namespace
+
 /**
  * Calls Initialize() method for each loaded device.
  * This method also initialized allowed values for core properties, based
  * on the collection of loaded devices.
+ *
+ * Devices are initialized one at a time, in load order, unless enabled
+ * with enableParallelInitialization(); then devices of different adapter
+ * modules are initialized concurrently. A device is still initialized after
+ * its hub, after the serial port it uses, and after the devices loaded
+ * before it from the same module or using the same port.
  */
 void CMMCore::initializeAllDevices() throw (CMMError)
 {
    vector<string> devices = deviceManager_->GetDeviceList();
    LOG_INFO(coreLogger_) << "Will initialize " << devices.size() << " devices";
 
+   std::vector< boost::shared_ptr<DeviceInstance> > pDevices;
+   std::vector<mm::DeviceInitializer::Device> dependencies;
    for (size_t i=0; i<devices.size(); i++)
    {
       boost::shared_ptr<DeviceInstance> pDevice;
@@ -875,19 +1186,76 @@ void CMMCore::initializeAllDevices() throw (CMMError)
          logError(devices[i].c_str(), err.getMsg().c_str());
          throw;
       }
-      mm::DeviceModuleLockGuard guard(pDevice);
-      LOG_INFO(coreLogger_) << "Will initialize device " << devices[i];
-      pDevice->Initialize();
-      LOG_INFO(coreLogger_) << "Did initialize device " << devices[i];
+      stateReader_->Forget(pDevice);
+      pDevices.push_back(pDevice);
+      dependencies.push_back(
+            GetInitializationDependencies(pDevice, *deviceManager_));
+   }
+
+   mm::DeviceInitializer initializer(devicePool_, dependencies);
+   if (parallelInitialization_ && initializer.HasCycle())
+      LOG_WARNING(coreLogger_) << "Devices depend on each other in a cycle; "
+         "initializing them one at a time";
 
-      assignDefaultRole(pDevice);
+   boost::shared_ptr<CMMError> error;
+   try
+   {
+      initializer.Run(boost::bind(&InitializeOneDevice, coreLogger_,
+               boost::cref(pDevices), _1), parallelInitialization_);
+   }
+   catch (const CMMError& e)
+   {
+      error = boost::make_shared<CMMError>(e);
+   }
+
+   // Roles are assigned in load order, as they would be one at a time
+   double sumMs = 0.0;
+   std::ostringstream times;
+   times << std::fixed << std::setprecision(1);
+   for (size_t i = 0; i < pDevices.size(); ++i)
+   {
+      if (!initializer.WasInitialized(i))
+         continue;
+      assignDefaultRole(pDevices[i]);
+      sumMs += initializer.GetTimeMs(i);
+      if (times.tellp() > 0)
+         times << ", ";
+      times << devices[i] << " " << initializer.GetTimeMs(i);
    }
+   LOG_INFO(coreLogger_) << "Device initialization times (ms): " << times.str();
+   if (error)
+      throw *error;
 
-   LOG_INFO(coreLogger_) << "Finished initializing " << devices.size() << " devices";
+   LOG_INFO(coreLogger_) << "Finished initializing " << devices.size() <<
+      " devices in " << std::fixed << std::setprecision(1) <<
+      initializer.GetTotalTimeMs() << " ms (" << sumMs << " ms one at a time)";
 
    updateCoreProperties();
 }
 
+/**
+ * Enables or disables the concurrent initialization of devices of different
+ * adapter modules by initializeAllDevices() (disabled by default). Only
+ * enable it if no device depends on being initialized after another in ways
+ * other than through its hub or serial port. For example, a device that
+ * uses another module's device from its Initialize() (such as the
+ * Utilities "DA Z Stage", which reads the limits of its DA device) could
+ * otherwise find that device not yet initialized.
+ */
+void CMMCore::enableParallelInitialization(bool enable)
+{
+   parallelInitialization_ = enable;
+}
+
+/**
+ * Returns whether devices of different modules are initialized concurrently.
+ * @see enableParallelInitialization
+ */
+bool CMMCore::isParallelInitializationEnabled() const
+{
+   return parallelInitialization_;
+}
+
 void CMMCore::updateCoreProperties() throw (CMMError)
 {
    updateCoreProperty(MM::g_Keyword_CoreCamera, MM::CameraDevice);
@@ -922,6 +1290,7 @@ void CMMCore::initializeDevice(const char* label ///< the device to initialize
                                ) throw (CMMError)
 {
    boost::shared_ptr<DeviceInstance> pDevice = deviceManager_->GetDevice(label);
+   stateReader_->Forget(pDevice);
 
    mm::DeviceModuleLockGuard guard(pDevice);
 
@@ -940,12 +1309,37 @@ void CMMCore::initializeDevice(const char* label ///< the device to initialize
 void CMMCore::updateSystemStateCache()
 {
    LOG_DEBUG(coreLogger_) << "Will update system state cache";
+   const boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
    Configuration wk = getSystemState();
+
+   // Report the settings that were out of date (changes that the devices
+   // did not notify)
+   std::vector<std::string> changed;
    {
       MMThreadGuard scg(stateCacheLock_);
+      for (size_t i = 0; i < wk.size(); ++i)
+      {
+         PropertySetting setting = wk.getSetting(i);
+         if (!stateCache_.isPropertyIncluded(setting.getDeviceLabel().c_str(),
+                  setting.getPropertyName().c_str()) ||
+               stateCache_.getSetting(setting.getDeviceLabel().c_str(),
+                  setting.getPropertyName().c_str()).getPropertyValue() !=
+               setting.getPropertyValue())
+            changed.push_back(setting.getKey());
+      }
       stateCache_ = wk;
    }
-   LOG_INFO(coreLogger_) << "Did update system state cache";
+
+   LOG_INFO(coreLogger_) << "Did update system state cache (" <<
+      wk.size() << " properties, " << stateReader_->GetLastSkippedCount() <<
+      " unchanging ones not read, " << changed.size() << " changed) in " <<
+      std::fixed << std::setprecision(3) <<
+      (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000.0 <<
+      " ms";
+   for (std::vector<std::string>::const_iterator it = changed.begin(), end = changed.end();
+         it != end; ++it)
+      LOG_DEBUG(coreLogger_) << "State cache changed: " << *it;
 }
 
 /**
@@ -1172,18 +1566,50 @@ void CMMCore::waitForDevice(const char* label) throw (CMMError)
 
 /**
  * Waits (blocks the calling thread) until the specified device becomes
+ * non-busy.
+ *
+ * Devices that notify the Core when they become idle are waited for without
+ * polling. Other devices are polled, first at short intervals that are
+ * doubled up to the polling interval, so that short operations are not
+ * rounded up to a whole polling interval. The device module is only locked
+ * while calling Busy().
+ *
  * @param device   the device label
  */
 void CMMCore::waitForDevice(boost::shared_ptr<DeviceInstance> pDev) throw (CMMError)
 {
    LOG_DEBUG(coreLogger_) << "Waiting for device " << pDev->GetLabel() << "...";
 
-   MM::TimeoutMs timeout(GetMMTimeNow(),timeoutMs_);
-   mm::DeviceModuleLockGuard guard(pDev);
-   
-   while (pDev->Busy())
+   const boost::posix_time::ptime deadline =
+      boost::posix_time::microsec_clock::universal_time() +
+      boost::posix_time::milliseconds(timeoutMs_);
+
+   bool notifiesIdle;
+   {
+      mm::DeviceModuleLockGuard guard(pDev);
+      notifiesIdle = pDev->NotifiesIdle();
+   }
+
+   const MM::Device* rawDevice = pDev->GetRawPtr();
+   // A zero interval would turn the wait into a busy loop
+   const long pollingIntervalMs = std::max(1L, pollingIntervalMs_);
+   boost::posix_time::time_duration interval =
+      boost::posix_time::microseconds(std::min(1000L, 1000L * pollingIntervalMs));
+   for (;;)
    {
-      if (timeout.expired(GetMMTimeNow()))
+      // Taken before calling Busy(), so that a notification sent after
+      // Busy() returns is not missed
+      unsigned long idleCount = idleNotifier_->GetCount(rawDevice);
+      bool busy;
+      {
+         mm::DeviceModuleLockGuard guard(pDev);
+         busy = pDev->Busy();
+      }
+      if (!busy)
+         break;
+
+      boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+      if (now >= deadline)
       {
          string label = pDev->GetLabel();
          std::ostringstream mez;
@@ -1194,33 +1620,112 @@ void CMMCore::waitForDevice(boost::shared_ptr<DeviceInstance> pDev) throw (CMMEr
                MMERR_DevicePollingTimeout);
       }
 
-     sleep(pollingIntervalMs_);
+      // A notification also ends the wait of a device that is polled
+      boost::posix_time::ptime wakeup = deadline;
+      if (!notifiesIdle)
+      {
+         wakeup = std::min(now + interval, deadline);
+         interval = std::min(interval * 2,
+               boost::posix_time::time_duration(
+                  boost::posix_time::milliseconds(pollingIntervalMs)));
+      }
+      idleNotifier_->WaitForChange(rawDevice, idleCount, wakeup);
    }
    LOG_DEBUG(coreLogger_) << "Finished waiting for device " << pDev->GetLabel();
 }
-/**
- * Checks the busy status of the entire system. The system will report busy if any
- * of the devices is busy.
- * @return status (true on busy)
- */
-bool CMMCore::systemBusy() throw (CMMError)
-{
-   return deviceTypeBusy(MM::AnyType);
-}
 
+namespace {
 
-/**
- * Blocks until all devices in the system become ready (not-busy).
- */
-void CMMCore::waitForSystem() throw (CMMError)
+// Waits for one device, as a device pool task
+class DeviceWaiter
 {
-   waitForDeviceType(MM::AnyType);
-}
+   boost::function<void ()> wait_;
+   boost::shared_ptr<CMMError> error_;
+public:
+   explicit DeviceWaiter(boost::function<void ()> wait) : wait_(wait) {}
+   void operator()()
+   {
+      try
+      {
+         wait_();
+      }
+      catch (const CMMError& e)
+      {
+         error_.reset(new CMMError(e));
+      }
+      catch (const std::exception& e)
+      {
+         // Pool tasks must not throw
+         error_.reset(new CMMError(std::string("Unexpected error: ") + e.what()));
+      }
+      catch (...)
+      {
+         error_.reset(new CMMError("Unexpected error"));
+      }
+   }
+   const boost::shared_ptr<CMMError>& Error() const { return error_; }
+};
 
+} // anonymous namespace
 
 /**
- * Checks the busy status for all devices of the specific type.
- * The system will report busy if any of the devices of the specified type are busy.
+ * Waits until all of the devices become non-busy. The devices are waited for
+ * concurrently, so that the wait takes as long as that for the slowest
+ * device, not the sum of the waits.
+ *
+ * If waiting for any device fails, the error for the first such device (in
+ * the order given) is thrown after waiting for all the others.
+ */
+void CMMCore::waitForDevices(const std::vector< boost::shared_ptr<DeviceInstance> >& devices) throw (CMMError)
+{
+   typedef void (CMMCore::*WaitForDeviceFunction)(boost::shared_ptr<DeviceInstance>);
+   const WaitForDeviceFunction waitFunc = &CMMCore::waitForDevice;
+
+   std::vector< boost::shared_ptr<DeviceWaiter> > waiters;
+   std::vector<mm::ThreadPool::Task> tasks;
+   for (size_t i = 0; i < devices.size(); ++i)
+   {
+      waiters.push_back(boost::make_shared<DeviceWaiter>(
+               boost::bind(waitFunc, this, devices[i])));
+      tasks.push_back(boost::bind(&DeviceWaiter::operator(), waiters[i]));
+   }
+   if (waiters.empty())
+      return;
+
+   // The calling thread waits for devices too, so this completes even when
+   // all pool threads are busy
+   devicePool_->RunAll(tasks);
+
+   for (size_t i = 0; i < waiters.size(); ++i)
+   {
+      if (waiters[i]->Error())
+         throw *waiters[i]->Error();
+   }
+}
+
+/**
+ * Checks the busy status of the entire system. The system will report busy if any
+ * of the devices is busy.
+ * @return status (true on busy)
+ */
+bool CMMCore::systemBusy() throw (CMMError)
+{
+   return deviceTypeBusy(MM::AnyType);
+}
+
+
+/**
+ * Blocks until all devices in the system become ready (not-busy).
+ */
+void CMMCore::waitForSystem() throw (CMMError)
+{
+   waitForDeviceType(MM::AnyType);
+}
+
+
+/**
+ * Checks the busy status for all devices of the specific type.
+ * The system will report busy if any of the devices of the specified type are busy.
  *
  * @return true on busy
  * @param devType   a constant specifying the device type
@@ -1252,9 +1757,14 @@ bool CMMCore::deviceTypeBusy(MM::DeviceType devType) throw (CMMError)
  */
 void CMMCore::waitForDeviceType(MM::DeviceType devType) throw (CMMError)
 {
-   vector<string> devices = deviceManager_->GetDeviceList(devType);
-   for (size_t i=0; i<devices.size(); i++)
-      waitForDevice(devices[i].c_str());
+   vector<string> labels = deviceManager_->GetDeviceList(devType);
+   std::vector< boost::shared_ptr<DeviceInstance> > devices;
+   for (size_t i=0; i<labels.size(); i++)
+   {
+      if (!IsCoreDeviceLabel(labels[i].c_str()))
+         devices.push_back(deviceManager_->GetDevice(labels[i]));
+   }
+   waitForDevices(devices);
 }
 
 /**
@@ -1269,8 +1779,15 @@ void CMMCore::waitForConfig(const char* group, const char* configName) throw (CM
 
    Configuration cfg = getConfigData(group, configName);
    try {
+      std::set<std::string> labels;
+      std::vector< boost::shared_ptr<DeviceInstance> > devices;
       for(size_t i=0; i<cfg.size(); i++)
-         waitForDevice(cfg.getSetting(i).getDeviceLabel().c_str());
+      {
+         const std::string label = cfg.getSetting(i).getDeviceLabel();
+         if (!IsCoreDeviceLabel(label.c_str()) && labels.insert(label).second)
+            devices.push_back(deviceManager_->GetDevice(label));
+      }
+      waitForDevices(devices);
    } catch (CMMError& err) {
       // trap MM exceptions and keep quiet - this is not a good time to blow up
       logError("waitForConfig", err.getMsg().c_str());
@@ -1282,6 +1799,7 @@ void CMMCore::waitForConfig(const char* group, const char* configName) throw (CM
  */
 void CMMCore::waitForImageSynchro() throw (CMMError)
 {
+   std::vector< boost::shared_ptr<DeviceInstance> > devices;
    for (std::vector< boost::weak_ptr<DeviceInstance> >::iterator
          it = imageSynchroDevices_.begin(), end = imageSynchroDevices_.end();
          it != end; ++it)
@@ -1289,9 +1807,10 @@ void CMMCore::waitForImageSynchro() throw (CMMError)
       boost::shared_ptr<DeviceInstance> device = it->lock();
       if (device)
       {
-         waitForDevice(device);
+         devices.push_back(device);
       }
    }
+   waitForDevices(devices);
 }
 
 /**
@@ -2667,12 +3186,7 @@ void CMMCore::startSequenceAcquisition(long numImages, double intervalMs, bool s
 
 		try
 		{
-			if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
-			{
-				logError(getDeviceName(camera).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
-				throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
-			}
-			cbuf_->Clear();
+         initializeSequenceBuffer(camera);
          mm::DeviceModuleLockGuard guard(camera);
 
          LOG_DEBUG(coreLogger_) << "Will start sequence acquisition from default camera";
@@ -2699,7 +3213,8 @@ void CMMCore::startSequenceAcquisition(long numImages, double intervalMs, bool s
  * Starts streaming camera sequence acquisition for a specified camera.
  * This command does not block the calling thread for the duration of the acquisition.
  * The difference between this method and the one with the same name but operating on the "default"
- * camera is that it does not automatically initialize the circular buffer.
+ * camera is that it does not automatically initialize the circular buffer,
+ * unless the camera has a buffer of its own (see setCameraBufferMemoryFootprint()).
  */
 void CMMCore::startSequenceAcquisition(const char* label, long numImages, double intervalMs, bool stopOnOverflow) throw (CMMError)
 {
@@ -2710,6 +3225,9 @@ void CMMCore::startSequenceAcquisition(const char* label, long numImages, double
    if(pCam->IsCapturing())
       throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(), 
                      MMERR_NotAllowedDuringSequenceAcquisition);
+
+   if (pCam->GetSequenceBuffer())
+      initializeSequenceBuffer(pCam);
    
    LOG_DEBUG(coreLogger_) <<
       "Will start sequence acquisition from camera " << label;
@@ -2766,7 +3284,10 @@ void CMMCore::initializeCircularBuffer() throw (CMMError)
    {
       throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
    }
-   LOG_DEBUG(coreLogger_) << "Circular buffer initialized based on current camera";
+   LOG_DEBUG(coreLogger_) << "Circular buffer initialized based on current camera "
+      "(last allocation took " << cbuf_->GetAllocationTimeMs() << " ms" <<
+      (cbuf_->HasHugePages() ? ", huge pages" : "") <<
+      (cbuf_->IsNumaBound() ? ", NUMA bound" : "") << ")";
 }
 
 /**
@@ -2807,12 +3328,7 @@ void CMMCore::startContinuousSequenceAcquisition(double intervalMs) throw (CMMEr
             ,MMERR_NotAllowedDuringSequenceAcquisition);
       }
 
-      if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
-      {
-         logError(getDeviceName(camera).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
-         throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
-      }
-      cbuf_->Clear();
+      initializeSequenceBuffer(camera);
       LOG_DEBUG(coreLogger_) << "Will start continuous sequence acquisition from current camera";
       int nRet = camera->StartSequenceAcquisition(intervalMs);
       if (nRet != DEVICE_OK)
@@ -2904,7 +3420,9 @@ void* CMMCore::getLastImage() throw (CMMError)
       }
    }
 
-   unsigned char* pBuf = const_cast<unsigned char*>(cbuf_->GetTopImage());
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = getSequenceBuffer(currentCameraDevice_.lock(), holder);
+   unsigned char* pBuf = const_cast<unsigned char*>(cbuf->GetTopImage());
    if (pBuf != 0)
       return pBuf;
    else
@@ -2920,7 +3438,9 @@ void* CMMCore::getLastImageMD(unsigned channel, unsigned slice, Metadata& md) co
    if (slice != 0)
       throw CMMError("Slice must be 0");
 
-   const mm::ImgBuffer* pBuf = cbuf_->GetTopImageBuffer(channel);
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = getSequenceBuffer(currentCameraDevice_.lock(), holder);
+   const mm::ImgBuffer* pBuf = cbuf->GetTopImageBuffer(channel);
    if (pBuf != 0)
    {
       md = pBuf->GetMetadata();
@@ -2945,7 +3465,9 @@ void* CMMCore::getLastImageMD(Metadata& md) const throw (CMMError)
  */
 void* CMMCore::getNBeforeLastImageMD(unsigned long n, Metadata& md) const throw (CMMError)
 {
-   const mm::ImgBuffer* pBuf = cbuf_->GetNthFromTopImageBuffer(n);
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = getSequenceBuffer(currentCameraDevice_.lock(), holder);
+   const mm::ImgBuffer* pBuf = cbuf->GetNthFromTopImageBuffer(n);
    if (pBuf != 0)
    {
       md = pBuf->GetMetadata();
@@ -2958,10 +3480,17 @@ void* CMMCore::getNBeforeLastImageMD(unsigned long n, Metadata& md) const throw
 /**
  * Gets and removes the next image from the circular buffer.
  * Returns 0 if the buffer is empty.
+ *
+ * If some cameras have buffers of their own, the image that arrived first
+ * in any of the buffers is returned, among the images that have the current
+ * camera's size and depth. Images of other cameras' formats are retrieved
+ * with popNextImageMD(const char*, Metadata&).
  */
 void* CMMCore::popNextImage() throw (CMMError)
 {
-   unsigned char* pBuf = const_cast<unsigned char*>(cbuf_->GetNextImage());
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = getNextSequenceBuffer(holder);
+   unsigned char* pBuf = const_cast<unsigned char*>(cbuf->GetNextImage());
    if (pBuf != 0)
       return pBuf;
    else
@@ -2974,7 +3503,9 @@ void* CMMCore::popNextImageMD(unsigned channel, unsigned slice, Metadata& md) th
    if (slice != 0)
       throw CMMError("Slice must be 0");
 
-   const mm::ImgBuffer* pBuf = cbuf_->GetNextImageBuffer(channel);
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = getNextSequenceBuffer(holder);
+   const mm::ImgBuffer* pBuf = cbuf->GetNextImageBuffer(channel);
    if (pBuf != 0)
    {
       md = pBuf->GetMetadata();
@@ -2990,7 +3521,81 @@ void* CMMCore::popNextImageMD(Metadata& md) throw (CMMError)
 }
 
 /**
- * Removes all images from the circular buffer.
+ * Gets and removes up to maxCount images from the circular buffer in one
+ * call, which is much cheaper than calling popNextImageMD() for each image
+ * when the frame rate is high.
+ *
+ * The pixels of the images are copied into pixels, one image after the
+ * other, and their metadata is returned in md (one entry per image). Fewer
+ * than maxCount images are returned if no more are waiting, or if no more
+ * fit in bufferBytes. If the current camera has a buffer of its own, the
+ * images come from that buffer; images in the buffers of other cameras are
+ * left alone, so that all images have the current camera's format.
+ *
+ * @param maxCount     the most images to retrieve
+ * @param pixels       where to copy the pixels of the images
+ * @param bufferBytes  size of pixels, in bytes
+ * @param md           receives the metadata of each image
+ * @return the number of images retrieved
+ */
+unsigned CMMCore::popNextImages(unsigned maxCount, void* pixels,
+      unsigned long bufferBytes, std::vector<Metadata>& md) throw (CMMError)
+{
+   if (!pixels && bufferBytes > 0)
+      throw CMMError("Null image buffer", MMERR_NullPointerException);
+
+   md.clear();
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = getSequenceBuffer(currentCameraDevice_.lock(), holder);
+   const unsigned long frameBytes = static_cast<unsigned long>(
+         cbuf->Width() * cbuf->Height() * cbuf->Depth());
+   if (frameBytes == 0)
+      return 0;
+
+   unsigned long count = std::min<unsigned long>(maxCount,
+         bufferBytes / frameBytes);
+   return static_cast<unsigned>(cbuf->PopImages(count, 0,
+            static_cast<unsigned char*>(pixels), md));
+}
+
+/**
+ * Gives access to the pixels and metadata of the image that was last
+ * inserted into the current camera's buffer, without copying them.
+ *
+ * The image is not reused for a new one while the returned lease exists; a
+ * camera whose next image would go in its place is treated as if the buffer
+ * had overflowed. Release the lease as soon as the image is no longer
+ * needed.
+ */
+boost::shared_ptr<mm::FrameLease> CMMCore::getLastImageLease() const
+   throw (CMMError)
+{
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = getSequenceBuffer(currentCameraDevice_.lock(), holder);
+   boost::shared_ptr<mm::FrameLease> lease = cbuf->LeaseTopImage(0);
+   if (!lease)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+   return lease;
+}
+
+/**
+ * Gets and removes the next image from the circular buffer, like
+ * popNextImageMD(), but gives access to it without copying its pixels. See
+ * getLastImageLease() for the lifetime of the lease.
+ */
+boost::shared_ptr<mm::FrameLease> CMMCore::popNextImageLease() throw (CMMError)
+{
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = getNextSequenceBuffer(holder);
+   boost::shared_ptr<mm::FrameLease> lease = cbuf->LeaseNextImage(0);
+   if (!lease)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+   return lease;
+}
+
+/**
+ * Removes all images from the circular buffer, and from the buffers of
+ * cameras that have their own.
  *
  * It is rarely necessary to call this directly since starting a sequence
  * acquisition or changing the ROI will always clear the buffer.
@@ -2998,6 +3603,322 @@ void* CMMCore::popNextImageMD(Metadata& md) throw (CMMError)
 void CMMCore::clearCircularBuffer() throw (CMMError)
 {
    cbuf_->Clear();
+   std::vector< boost::shared_ptr<CircularBuffer> > buffers = getCameraBuffers();
+   for (std::vector< boost::shared_ptr<CircularBuffer> >::iterator it =
+         buffers.begin(); it != buffers.end(); ++it)
+      (*it)->Clear();
+}
+
+/**
+ * Gives a camera a sequence buffer of its own, so that its images are kept
+ * apart from those of other cameras. The buffer is sized independently of
+ * the circular buffer, but follows the circular buffer's overflow and
+ * allocation settings (setBufferOverflowPolicy() etc.), and its overflow
+ * counts are included in those of the circular buffer.
+ *
+ * Images from the camera can then be retrieved with
+ * popNextImageMD(cameraLabel, md); the calls that do not take a camera
+ * label return images from all buffers, in the order they arrived.
+ *
+ * @param cameraLabel  the camera
+ * @param sizeMB       buffer size in megabytes, or 0 to send the camera's
+ *                     images to the circular buffer again
+ */
+void CMMCore::setCameraBufferMemoryFootprint(const char* cameraLabel,
+      unsigned sizeMB) throw (CMMError)
+{
+   CheckDeviceLabel(cameraLabel);
+   boost::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+
+   mm::DeviceModuleLockGuard guard(camera);
+   if (camera->IsCapturing())
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
+
+   boost::shared_ptr<CircularBuffer> buffer;
+   if (sizeMB > 0)
+   {
+      LOG_DEBUG(coreLogger_) << "Will set buffer size of camera " <<
+         cameraLabel << " to " << sizeMB << " MB";
+      try
+      {
+         buffer.reset(new CircularBuffer(sizeMB, metadataKeys_));
+         copyBufferSettings(*buffer, true);
+         if (!buffer->Initialize(camera->GetNumberOfChannels(),
+                  camera->GetImageWidth(), camera->GetImageHeight(),
+                  camera->GetImageBytesPerPixel()))
+            throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(),
+                  MMERR_CircularBufferFailedToInitialize);
+      }
+      catch (bad_alloc& ex)
+      {
+         ostringstream messs;
+         messs << getCoreErrorText(MMERR_OutOfMemory).c_str() << " " << ex.what() << endl;
+         throw CMMError(messs.str().c_str() , MMERR_OutOfMemory);
+      }
+   }
+
+   camera->SetSequenceBuffer(buffer);
+   MMThreadGuard g(cameraBuffersLock_);
+   if (buffer)
+   {
+      cameraBuffers_[cameraLabel] = buffer;
+      LOG_DEBUG(coreLogger_) << "Did set buffer size of camera " <<
+         cameraLabel << " to " << sizeMB << " MB";
+   }
+   else
+   {
+      cameraBuffers_.erase(cameraLabel);
+      LOG_DEBUG(coreLogger_) << "Camera " << cameraLabel <<
+         " now uses the circular buffer";
+   }
+}
+
+/**
+ * Returns the size of the camera's own sequence buffer in megabytes, or 0 if
+ * the camera uses the circular buffer.
+ */
+unsigned CMMCore::getCameraBufferMemoryFootprint(const char* cameraLabel)
+   throw (CMMError)
+{
+   CheckDeviceLabel(cameraLabel);
+   boost::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+   boost::shared_ptr<CircularBuffer> buffer = camera->GetSequenceBuffer();
+   return buffer ? buffer->GetMemorySizeMB() : 0;
+}
+
+/**
+ * Returns a pointer to the pixels of the image that was last inserted into
+ * the camera's own sequence buffer, and provides its metadata.
+ *
+ * The image must have the current camera's size and depth (which is the case
+ * when the camera is the current camera), since that is what the pixel
+ * arrays of the Java and Python wrappers are sized from.
+ */
+void* CMMCore::getLastImageMD(const char* cameraLabel, Metadata& md) const
+   throw (CMMError)
+{
+   boost::shared_ptr<CircularBuffer> buffer = getCameraBuffer(cameraLabel);
+   const mm::ImgBuffer* pBuf = buffer->GetTopImageBuffer(0);
+   if (pBuf != 0)
+   {
+      checkCurrentImageFormat(cameraLabel, *buffer);
+      md = pBuf->GetMetadata();
+      return const_cast<unsigned char*>(pBuf->GetPixels());
+   }
+   else
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+}
+
+/**
+ * Gets and removes the next image from the camera's own sequence buffer,
+ * and provides its metadata.
+ *
+ * As with getLastImageMD(const char*, Metadata&), the image must have the
+ * current camera's size and depth; otherwise it is left in the buffer.
+ */
+void* CMMCore::popNextImageMD(const char* cameraLabel, Metadata& md)
+   throw (CMMError)
+{
+   boost::shared_ptr<CircularBuffer> buffer = getCameraBuffer(cameraLabel);
+   if (buffer->GetRemainingImageCount() > 0)
+      checkCurrentImageFormat(cameraLabel, *buffer);
+   const mm::ImgBuffer* pBuf = buffer->GetNextImageBuffer(0);
+   if (pBuf != 0)
+   {
+      md = pBuf->GetMetadata();
+      return const_cast<unsigned char*>(pBuf->GetPixels());
+   }
+   else
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+}
+
+/**
+ * Returns the number of images waiting in the camera's own sequence buffer.
+ */
+long CMMCore::getRemainingImageCount(const char* cameraLabel) throw (CMMError)
+{
+   return getCameraBuffer(cameraLabel)->GetRemainingImageCount();
+}
+
+/**
+ * Removes all images from the camera's own sequence buffer.
+ */
+void CMMCore::clearCircularBuffer(const char* cameraLabel) throw (CMMError)
+{
+   getCameraBuffer(cameraLabel)->Clear();
+}
+
+/**
+ * Returns the sequence buffer that receives the camera's images: its own, if
+ * it has one (kept alive by holder), or else the circular buffer.
+ */
+CircularBuffer* CMMCore::getSequenceBuffer(
+      boost::shared_ptr<CameraInstance> camera,
+      boost::shared_ptr<CircularBuffer>& holder) const
+{
+   if (camera)
+      holder = camera->GetSequenceBuffer();
+   return holder ? holder.get() : cbuf_;
+}
+
+boost::shared_ptr<CircularBuffer> CMMCore::getCameraBuffer(
+      const char* cameraLabel) const throw (CMMError)
+{
+   CheckDeviceLabel(cameraLabel);
+   boost::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+   boost::shared_ptr<CircularBuffer> buffer = camera->GetSequenceBuffer();
+   if (!buffer)
+      throw CMMError("Camera " + ToQuotedString(cameraLabel) +
+            " does not have a buffer of its own", MMERR_InvalidContents);
+   return buffer;
+}
+
+std::vector< boost::shared_ptr<CircularBuffer> > CMMCore::getCameraBuffers() const
+{
+   std::vector< boost::shared_ptr<CircularBuffer> > buffers;
+   MMThreadGuard g(cameraBuffersLock_);
+   for (std::map< std::string, boost::shared_ptr<CircularBuffer> >::const_iterator
+         it = cameraBuffers_.begin(); it != cameraBuffers_.end(); ++it)
+      buffers.push_back(it->second);
+   return buffers;
+}
+
+/**
+ * Gives the buffer the overflow and spill settings of the circular buffer,
+ * and its allocation options if requested (which makes the buffer
+ * reallocate its memory the next time it is initialized).
+ */
+void CMMCore::copyBufferSettings(CircularBuffer& buffer,
+      bool allocationOptions) const
+{
+   buffer.SetOverflowPolicy(cbuf_->GetOverflowPolicy());
+   buffer.SetOverflowTimeoutMs(cbuf_->GetOverflowTimeoutMs());
+   buffer.SetSpillDirectory(cbuf_->GetSpillDirectory());
+   buffer.SetSpillCapacityMB(cbuf_->GetSpillCapacityMB());
+   buffer.SetSpillHighWaterMark(cbuf_->GetSpillHighWaterMark());
+   if (allocationOptions)
+      buffer.SetAllocationOptions(cbuf_->GetAllocationOptions());
+}
+
+/**
+ * Applies the settings of the circular buffer to the buffers of cameras
+ * that have their own.
+ */
+void CMMCore::updateCameraBufferSettings(bool allocationOptions)
+{
+   std::vector< boost::shared_ptr<CircularBuffer> > buffers = getCameraBuffers();
+   for (std::vector< boost::shared_ptr<CircularBuffer> >::iterator it =
+         buffers.begin(); it != buffers.end(); ++it)
+      copyBufferSettings(**it, allocationOptions);
+}
+
+/**
+ * Adds up an overflow count of the circular buffer and of the buffers of
+ * cameras that have their own.
+ */
+long long CMMCore::sumBufferCounts(
+      long long (CircularBuffer::*count)() const) const
+{
+   long long sum = (cbuf_->*count)();
+   std::vector< boost::shared_ptr<CircularBuffer> > buffers = getCameraBuffers();
+   for (std::vector< boost::shared_ptr<CircularBuffer> >::iterator it =
+         buffers.begin(); it != buffers.end(); ++it)
+      sum += ((**it).*count)();
+   return sum;
+}
+
+/**
+ * Returns the buffer holding the image that arrived first, among the
+ * circular buffer and the buffers of cameras that have their own.
+ *
+ * Only buffers holding images of the current camera's format are considered,
+ * because the Java and Python wrappers size the pixel arrays they return
+ * from that format. If none of them has an image, the current camera's
+ * buffer is returned.
+ */
+CircularBuffer* CMMCore::getNextSequenceBuffer(
+      boost::shared_ptr<CircularBuffer>& holder) const
+{
+   std::vector< boost::shared_ptr<CircularBuffer> > buffers = getCameraBuffers();
+   if (buffers.empty())
+      return cbuf_;
+
+   std::vector<CircularBuffer*> candidates;
+   candidates.push_back(cbuf_);
+   for (std::vector< boost::shared_ptr<CircularBuffer> >::iterator it =
+         buffers.begin(); it != buffers.end(); ++it)
+      candidates.push_back(it->get());
+
+   unsigned width, height, depth;
+   getCurrentImageFormat(width, height, depth);
+   CircularBuffer* next =
+      CircularBuffer::EarliestOfFormat(candidates, width, height, depth);
+   if (!next)
+      return getSequenceBuffer(currentCameraDevice_.lock(), holder);
+
+   for (std::vector< boost::shared_ptr<CircularBuffer> >::iterator it =
+         buffers.begin(); it != buffers.end(); ++it)
+   {
+      if (it->get() == next)
+         holder = *it;
+   }
+   return next;
+}
+
+/**
+ * Gets the size and depth of the current camera's images; all zero if there
+ * is no current camera.
+ */
+void CMMCore::getCurrentImageFormat(unsigned& width, unsigned& height,
+      unsigned& depth) const
+{
+   width = height = depth = 0;
+   boost::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
+   if (!camera)
+      return;
+
+   mm::DeviceModuleLockGuard guard(camera);
+   width = camera->GetImageWidth();
+   height = camera->GetImageHeight();
+   depth = camera->GetImageBytesPerPixel();
+}
+
+/**
+ * Throws unless the images in the camera's own buffer have the current
+ * camera's format, which the Java and Python wrappers use to size the pixel
+ * arrays they return.
+ */
+void CMMCore::checkCurrentImageFormat(const char* cameraLabel,
+      const CircularBuffer& buffer) const throw (CMMError)
+{
+   unsigned width, height, depth;
+   getCurrentImageFormat(width, height, depth);
+   if (!buffer.HasFormat(width, height, depth))
+      throw CMMError("Images of camera " + ToQuotedString(cameraLabel) +
+            " differ in size or depth from those of the current camera; "
+            "make it the current camera to retrieve them",
+            MMERR_CircularBufferIncompatibleImage);
+}
+
+/**
+ * Sizes the camera's sequence buffer for its current image format, and
+ * discards any images in it.
+ */
+void CMMCore::initializeSequenceBuffer(boost::shared_ptr<CameraInstance> camera)
+   throw (CMMError)
+{
+   boost::shared_ptr<CircularBuffer> holder;
+   CircularBuffer* cbuf = getSequenceBuffer(camera, holder);
+   if (!cbuf->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
+   {
+      logError(getDeviceName(camera).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
+   }
+   cbuf->Clear();
 }
 
 /**
@@ -3006,12 +3927,26 @@ void CMMCore::clearCircularBuffer() throw (CMMError)
 void CMMCore::setCircularBufferMemoryFootprint(unsigned sizeMB ///< n megabytes
                                                ) throw (CMMError)
 {
+   // Overflow handling is a setting of the core, not of the buffer instance
+   CircularBuffer::OverflowPolicy policy = cbuf_->GetOverflowPolicy();
+   double timeoutMs = cbuf_->GetOverflowTimeoutMs();
+   std::string spillDirectory = cbuf_->GetSpillDirectory();
+   unsigned long spillCapacityMB = cbuf_->GetSpillCapacityMB();
+   double spillHighWaterMark = cbuf_->GetSpillHighWaterMark();
+   mm::FrameSlab::Options allocationOptions = cbuf_->GetAllocationOptions();
+
    delete cbuf_; // discard old buffer
    LOG_DEBUG(coreLogger_) << "Will set circular buffer size to " <<
       sizeMB << " MB";
 	try
 	{
-		cbuf_ = new CircularBuffer(sizeMB);
+		cbuf_ = new CircularBuffer(sizeMB, metadataKeys_);
+      cbuf_->SetOverflowPolicy(policy);
+      cbuf_->SetOverflowTimeoutMs(timeoutMs);
+      cbuf_->SetSpillDirectory(spillDirectory);
+      cbuf_->SetSpillCapacityMB(spillCapacityMB);
+      cbuf_->SetSpillHighWaterMark(spillHighWaterMark);
+      cbuf_->SetAllocationOptions(allocationOptions);
 	}
 	catch(bad_alloc& ex)
 	{
@@ -3057,13 +3992,22 @@ unsigned CMMCore::getCircularBufferMemoryFootprint()
    return 0;
 }
 
+/**
+ * Returns the number of images waiting in the circular buffer and in the
+ * buffers of cameras that have their own.
+ */
 long CMMCore::getRemainingImageCount()
 {
+   long count = 0;
    if (cbuf_)
    {
-      return cbuf_->GetRemainingImageCount();
+      count = cbuf_->GetRemainingImageCount();
    }
-   return 0;
+   std::vector< boost::shared_ptr<CircularBuffer> > buffers = getCameraBuffers();
+   for (std::vector< boost::shared_ptr<CircularBuffer> >::iterator it =
+         buffers.begin(); it != buffers.end(); ++it)
+      count += (*it)->GetRemainingImageCount();
+   return count;
 }
 
 long CMMCore::getBufferTotalCapacity()
@@ -3086,76 +4030,429 @@ long CMMCore::getBufferFreeCapacity()
 
 bool CMMCore::isBufferOverflowed() const
 {
-   return cbuf_->Overflow();
+   if (cbuf_->Overflow())
+      return true;
+   std::vector< boost::shared_ptr<CircularBuffer> > buffers = getCameraBuffers();
+   for (std::vector< boost::shared_ptr<CircularBuffer> >::iterator it =
+         buffers.begin(); it != buffers.end(); ++it)
+   {
+      if ((*it)->Overflow())
+         return true;
+   }
+   return false;
 }
 
 /**
- * Returns the label of the currently selected camera device.
- * @return camera name
- */
-string CMMCore::getCameraDevice()
-{
-   boost::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
-   if (camera)
-   {
-      return camera->GetLabel();
-   }
-   return std::string();
+ * Sets what happens when a camera inserts an image into a full circular
+ * buffer.
+ *
+ * - "Report" (default): the insertion fails, the buffer is flagged as
+ *   overflowed and the camera stops the sequence acquisition.
+ * - "DropOldest": the oldest image in the buffer is discarded.
+ * - "Block": the camera waits for an image to be retrieved, for at most
+ *   the time set with setBufferOverflowTimeoutMs(); the new image is
+ *   discarded if the wait times out.
+ * - "SpillToDisk": once the buffer is filled past the high-water mark (see
+ *   setBufferSpillHighWaterMark()), the oldest images are moved to a
+ *   preallocated, memory-mapped temporary file (see setBufferSpillDirectory()
+ *   and setBufferSpillCapacityMB()). Images are retrieved from the file and
+ *   the buffer in the order they were inserted, so the two act as one larger
+ *   buffer. Overflow is reported as with "Report" if the file is full.
+ *
+ * @param policy   one of "Report", "DropOldest", "Block" or "SpillToDisk"
+ */
+void CMMCore::setBufferOverflowPolicy(const char* policy) throw (CMMError)
+{
+   if (!policy)
+      throw CMMError("Null buffer overflow policy", MMERR_NullPointerException);
+   CircularBuffer::OverflowPolicy value;
+   if (strcmp(policy, "Report") == 0)
+      value = CircularBuffer::ReportOverflow;
+   else if (strcmp(policy, "DropOldest") == 0)
+      value = CircularBuffer::DropOldest;
+   else if (strcmp(policy, "Block") == 0)
+      value = CircularBuffer::BlockProducer;
+   else if (strcmp(policy, "SpillToDisk") == 0)
+      value = CircularBuffer::SpillToDisk;
+   else
+      throw CMMError("Unknown buffer overflow policy: " + ToQuotedString(policy),
+            MMERR_InvalidContents);
+
+   cbuf_->SetOverflowPolicy(value);
+   updateCameraBufferSettings(false);
+   LOG_DEBUG(coreLogger_) << "Did set buffer overflow policy to " << policy;
 }
 
 /**
- * Returns the label of the currently selected shutter device.
- * @return shutter name
+ * Returns the circular buffer overflow policy.
+ * @see setBufferOverflowPolicy
  */
-string CMMCore::getShutterDevice()
+std::string CMMCore::getBufferOverflowPolicy() const
 {
-   boost::shared_ptr<ShutterInstance> shutter = currentShutterDevice_.lock();
-   if (shutter)
+   switch (cbuf_->GetOverflowPolicy())
    {
-      return shutter->GetLabel();
+      case CircularBuffer::DropOldest:
+         return "DropOldest";
+      case CircularBuffer::BlockProducer:
+         return "Block";
+      case CircularBuffer::SpillToDisk:
+         return "SpillToDisk";
+      default:
+         return "Report";
    }
-   return std::string();
 }
 
 /**
- * Returns the label of the currently selected focus device.
- * @return focus stage name
+ * Sets how long a camera waits for room in the circular buffer under the
+ * "Block" overflow policy.
+ *
+ * @param timeoutMs   the maximum wait in milliseconds
  */
-string CMMCore::getFocusDevice()
+void CMMCore::setBufferOverflowTimeoutMs(double timeoutMs) throw (CMMError)
 {
-   boost::shared_ptr<StageInstance> focus = currentFocusDevice_.lock();
-   if (focus)
-   {
-      return focus->GetLabel();
-   }
-   return std::string();
+   if (timeoutMs < 0.0)
+      throw CMMError("Buffer overflow timeout must not be negative",
+            MMERR_InvalidContents);
+   cbuf_->SetOverflowTimeoutMs(timeoutMs);
+   updateCameraBufferSettings(false);
 }
 
 /**
- * Returns the label of the currently selected XYStage device.
+ * Returns the wait time of the "Block" overflow policy in milliseconds.
  */
-string CMMCore::getXYStageDevice()
+double CMMCore::getBufferOverflowTimeoutMs() const
 {
-   boost::shared_ptr<XYStageInstance> xyStage = currentXYStageDevice_.lock();
-   if (xyStage)
-   {
-      return xyStage->GetLabel();
-   }
-   return std::string();
+   return cbuf_->GetOverflowTimeoutMs();
 }
 
 /**
- * Returns the label of the currently selected auto-focus device.
+ * Sets the directory in which the "SpillToDisk" overflow policy creates its
+ * temporary file. An empty path selects the system temporary directory (on
+ * Linux, /var/tmp if that is tmpfs). A local, fast disk should be chosen; a
+ * directory in memory, such as a tmpfs /tmp, saves no memory. While the
+ * policy is selected, the file is recreated in the new directory unless it
+ * holds images.
  */
-string CMMCore::getAutoFocusDevice()
+void CMMCore::setBufferSpillDirectory(const char* path) throw (CMMError)
 {
-   boost::shared_ptr<AutoFocusInstance> autofocus =
-      currentAutofocusDevice_.lock();
-   if (autofocus)
-   {
-      return autofocus->GetLabel();
-   }
-   return std::string();
+   if (!path)
+      throw CMMError("Null spill directory", MMERR_NullPointerException);
+   cbuf_->SetSpillDirectory(path);
+   updateCameraBufferSettings(false);
+}
+
+/**
+ * Returns the directory used by the "SpillToDisk" overflow policy.
+ */
+std::string CMMCore::getBufferSpillDirectory() const
+{
+   return cbuf_->GetSpillDirectory();
+}
+
+/**
+ * Sets the size of the file used by the "SpillToDisk" overflow policy. The
+ * disk space is reserved in full when the file is created: when the policy
+ * is selected, when this or the spill directory changes (unless the file
+ * holds images), and when the buffer is initialized.
+ *
+ * @param capacityMB   the file size in megabytes
+ */
+void CMMCore::setBufferSpillCapacityMB(unsigned capacityMB) throw (CMMError)
+{
+   if (capacityMB == 0)
+      throw CMMError("Spill file capacity must not be zero",
+            MMERR_InvalidContents);
+   cbuf_->SetSpillCapacityMB(capacityMB);
+   updateCameraBufferSettings(false);
+}
+
+/**
+ * Returns the size of the file used by the "SpillToDisk" overflow policy in
+ * megabytes.
+ */
+unsigned CMMCore::getBufferSpillCapacityMB() const
+{
+   return static_cast<unsigned>(cbuf_->GetSpillCapacityMB());
+}
+
+/**
+ * Sets the fill level of the circular buffer above which the "SpillToDisk"
+ * overflow policy moves images to the spill file. Keeping room in the
+ * buffer lets the camera insert images without waiting for the disk.
+ *
+ * @param fraction   fill level between 0 and 1 (default 0.75)
+ */
+void CMMCore::setBufferSpillHighWaterMark(double fraction) throw (CMMError)
+{
+   if (!(fraction >= 0.0 && fraction <= 1.0))
+      throw CMMError("Spill high-water mark must be between 0 and 1",
+            MMERR_InvalidContents);
+   cbuf_->SetSpillHighWaterMark(fraction);
+   updateCameraBufferSettings(false);
+}
+
+/**
+ * Returns the fill level above which images are moved to the spill file.
+ */
+double CMMCore::getBufferSpillHighWaterMark() const
+{
+   return cbuf_->GetSpillHighWaterMark();
+}
+
+/**
+ * Selects the use of huge pages for the circular buffer memory, reducing
+ * the TLB misses when large amounts of image data pass through it.
+ *
+ * - "None" (default): ordinary pages.
+ * - "Transparent": asks the operating system to use huge pages where it
+ *   can (transparent huge pages on Linux, large pages on Windows).
+ * - "Explicit": allocates from the reserved huge page pool on Linux
+ *   (vm.nr_hugepages), or large pages on Windows.
+ *
+ * Falls back to ordinary pages if huge pages are not available (on Windows,
+ * large pages require the "Lock pages in memory" privilege); see
+ * isBufferUsingHugePages(). Takes effect the next time the buffer is
+ * initialized (e.g. by initializeCircularBuffer()).
+ *
+ * @param mode   one of "None", "Transparent" or "Explicit"
+ */
+void CMMCore::setBufferHugePages(const char* mode) throw (CMMError)
+{
+   if (!mode)
+      throw CMMError("Null huge page mode", MMERR_NullPointerException);
+   mm::FrameSlab::Options options = cbuf_->GetAllocationOptions();
+   if (strcmp(mode, "None") == 0)
+      options.hugePages = mm::FrameSlab::NoHugePages;
+   else if (strcmp(mode, "Transparent") == 0)
+      options.hugePages = mm::FrameSlab::TransparentHugePages;
+   else if (strcmp(mode, "Explicit") == 0)
+      options.hugePages = mm::FrameSlab::ExplicitHugePages;
+   else
+      throw CMMError("Unknown huge page mode: " + ToQuotedString(mode),
+            MMERR_InvalidContents);
+   cbuf_->SetAllocationOptions(options);
+   updateCameraBufferSettings(true);
+}
+
+/**
+ * Returns the huge page mode of the circular buffer.
+ * @see setBufferHugePages
+ */
+std::string CMMCore::getBufferHugePages() const
+{
+   switch (cbuf_->GetAllocationOptions().hugePages)
+   {
+      case mm::FrameSlab::TransparentHugePages:
+         return "Transparent";
+      case mm::FrameSlab::ExplicitHugePages:
+         return "Explicit";
+      default:
+         return "None";
+   }
+}
+
+/**
+ * Enables or disables touching all circular buffer memory when it is
+ * allocated (enabled by default). This moves the cost of page faults from
+ * the first images of an acquisition to the initialization of the buffer.
+ * Takes effect the next time the buffer is initialized.
+ */
+void CMMCore::enableBufferPrefault(bool enable)
+{
+   mm::FrameSlab::Options options = cbuf_->GetAllocationOptions();
+   options.prefault = enable;
+   cbuf_->SetAllocationOptions(options);
+   updateCameraBufferSettings(true);
+}
+
+/**
+ * Returns whether the circular buffer memory is touched when allocated.
+ */
+bool CMMCore::isBufferPrefaultEnabled() const
+{
+   return cbuf_->GetAllocationOptions().prefault;
+}
+
+/**
+ * Binds the circular buffer memory to a NUMA node, typically the one the
+ * camera's frame grabber is attached to (on Linux, see
+ * /sys/bus/pci/devices/.../numa_node). Binding is supported on Linux and
+ * Windows; see isBufferNumaBound(). Takes effect the next time the buffer is
+ * initialized.
+ *
+ * @param node   the NUMA node number, or -1 for no binding (default)
+ */
+void CMMCore::setBufferNumaNode(int node) throw (CMMError)
+{
+   if (node < -1)
+      throw CMMError("Invalid NUMA node", MMERR_InvalidContents);
+   mm::FrameSlab::Options options = cbuf_->GetAllocationOptions();
+   options.numaNode = node;
+   cbuf_->SetAllocationOptions(options);
+   updateCameraBufferSettings(true);
+}
+
+/**
+ * Returns the NUMA node the circular buffer memory is bound to, or -1.
+ */
+int CMMCore::getBufferNumaNode() const
+{
+   return cbuf_->GetAllocationOptions().numaNode;
+}
+
+/**
+ * Returns the time the last allocation of the circular buffer memory took,
+ * including prefaulting, in milliseconds.
+ */
+double CMMCore::getBufferAllocationTimeMs() const
+{
+   return cbuf_->GetAllocationTimeMs();
+}
+
+/**
+ * Returns whether the circular buffer memory was obtained with huge pages.
+ */
+bool CMMCore::isBufferUsingHugePages() const
+{
+   return cbuf_->HasHugePages();
+}
+
+/**
+ * Returns whether the circular buffer memory is bound to a NUMA node.
+ */
+bool CMMCore::isBufferNumaBound() const
+{
+   return cbuf_->IsNumaBound();
+}
+
+/**
+ * Returns the mean time taken to copy an image into the circular buffer,
+ * in microseconds, over the images inserted since the buffer memory was
+ * allocated and until each slot has been used once. Compared with the
+ * steady state, this shows the cost of first access to the memory.
+ */
+double CMMCore::getBufferFirstPassMeanInsertTimeUs() const
+{
+   return cbuf_->GetFirstPassMeanInsertTimeUs();
+}
+
+/**
+ * Returns the longest time taken to copy an image into the circular buffer
+ * during the first pass through the buffer, in microseconds.
+ * @see getBufferFirstPassMeanInsertTimeUs
+ */
+double CMMCore::getBufferFirstPassMaxInsertTimeUs() const
+{
+   return cbuf_->GetFirstPassMaxInsertTimeUs();
+}
+
+/**
+ * Returns how many images were inserted while the circular buffer (or the
+ * buffer of a camera that has its own) was full, whatever the overflow
+ * policy did with them.
+ */
+long long CMMCore::getBufferOverflowCount() const
+{
+   return sumBufferCounts(&CircularBuffer::GetOverflowCount);
+}
+
+/**
+ * Returns how many images the overflow policy discarded, either the oldest
+ * images ("DropOldest", or when the buffer was cleared after an overflow)
+ * or the new ones (on timeout of "Block").
+ */
+long long CMMCore::getBufferDroppedImageCount() const
+{
+   return sumBufferCounts(&CircularBuffer::GetDroppedImageCount);
+}
+
+/**
+ * Returns how many images were moved to the spill file.
+ */
+long long CMMCore::getBufferSpilledImageCount() const
+{
+   return sumBufferCounts(&CircularBuffer::GetSpilledImageCount);
+}
+
+/**
+ * Sets the overflow, dropped and spilled image counts to zero.
+ */
+void CMMCore::resetBufferOverflowCounters()
+{
+   cbuf_->ResetOverflowCounters();
+   std::vector< boost::shared_ptr<CircularBuffer> > buffers = getCameraBuffers();
+   for (std::vector< boost::shared_ptr<CircularBuffer> >::iterator it =
+         buffers.begin(); it != buffers.end(); ++it)
+      (*it)->ResetOverflowCounters();
+}
+
+/**
+ * Returns the label of the currently selected camera device.
+ * @return camera name
+ */
+string CMMCore::getCameraDevice()
+{
+   boost::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
+   if (camera)
+   {
+      return camera->GetLabel();
+   }
+   return std::string();
+}
+
+/**
+ * Returns the label of the currently selected shutter device.
+ * @return shutter name
+ */
+string CMMCore::getShutterDevice()
+{
+   boost::shared_ptr<ShutterInstance> shutter = currentShutterDevice_.lock();
+   if (shutter)
+   {
+      return shutter->GetLabel();
+   }
+   return std::string();
+}
+
+/**
+ * Returns the label of the currently selected focus device.
+ * @return focus stage name
+ */
+string CMMCore::getFocusDevice()
+{
+   boost::shared_ptr<StageInstance> focus = currentFocusDevice_.lock();
+   if (focus)
+   {
+      return focus->GetLabel();
+   }
+   return std::string();
+}
+
+/**
+ * Returns the label of the currently selected XYStage device.
+ */
+string CMMCore::getXYStageDevice()
+{
+   boost::shared_ptr<XYStageInstance> xyStage = currentXYStageDevice_.lock();
+   if (xyStage)
+   {
+      return xyStage->GetLabel();
+   }
+   return std::string();
+}
+
+/**
+ * Returns the label of the currently selected auto-focus device.
+ */
+string CMMCore::getAutoFocusDevice()
+{
+   boost::shared_ptr<AutoFocusInstance> autofocus =
+      currentAutofocusDevice_.lock();
+   if (autofocus)
+   {
+      return autofocus->GetLabel();
+   }
+   return std::string();
 }
 
 /**
@@ -4135,7 +5432,8 @@ void CMMCore::setROI(int x, int y, int xSize, int ySize) throw (CMMError)
       // inconsistent with the current image size. There is no way to "fix"
       // popNextImage() to handle this correctly, so we need to make sure we
       // discard such images.
-      cbuf_->Clear();
+      boost::shared_ptr<CircularBuffer> holder;
+      getSequenceBuffer(camera, holder)->Clear();
    }
    else
       throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
@@ -4214,7 +5512,8 @@ void CMMCore::setROI(const char* label, int x, int y, int xSize, int ySize) thro
      // inconsistent with the current image size. There is no way to "fix"
      // popNextImage() to handle this correctly, so we need to make sure we
      // discard such images.
-     cbuf_->Clear();
+     boost::shared_ptr<CircularBuffer> holder;
+     getSequenceBuffer(camera, holder)->Clear();
   }
   else
      throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
@@ -4273,7 +5572,8 @@ void CMMCore::clearROI() throw (CMMError)
       // inconsistent with the current image size. There is no way to "fix"
       // popNextImage() to handle this correctly, so we need to make sure we
       // discard such images.
-      cbuf_->Clear();
+      boost::shared_ptr<CircularBuffer> holder;
+      getSequenceBuffer(camera, holder)->Clear();
    }
 }
 
@@ -4831,6 +6131,8 @@ void CMMCore::setPixelSizeConfig(const char* resolutionID) throw (CMMError)
             MMERR_NoConfiguration);
    }
    
+   const boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
    try {
       applyConfiguration(*psc);
    } catch (CMMError& err) {
@@ -4839,7 +6141,9 @@ void CMMCore::setPixelSizeConfig(const char* resolutionID) throw (CMMError)
    }
 
    LOG_DEBUG(coreLogger_) << "Applied pixel size configuration preset " <<
-      resolutionID;
+      resolutionID << " in " << std::fixed << std::setprecision(3) <<
+      (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000.0 <<
+      " ms";
 }
 
 /**
@@ -4868,6 +6172,8 @@ void CMMCore::setConfig(const char* groupName, const char* configName) throw (CM
    LOG_DEBUG(coreLogger_) << "Config group " << groupName <<
       ": will apply preset " << configName;
 
+   const boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
    try {
       applyConfiguration(*pCfg);
    } catch (CMMError&) {
@@ -4875,7 +6181,10 @@ void CMMCore::setConfig(const char* groupName, const char* configName) throw (CM
    }
 
    LOG_DEBUG(coreLogger_) << "Config group " << groupName <<
-      ": did apply preset " << configName;
+      ": did apply preset " << configName << " in " << std::fixed <<
+      std::setprecision(3) <<
+      (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000.0 <<
+      " ms";
 }
 
 /**
@@ -4996,21 +6305,12 @@ string CMMCore::getCurrentConfig(const char* groupName) throw (CMMError)
 {
    CheckConfigGroupName(groupName);
 
-   vector<string> cfgs = configGroups_->GetAvailableConfigs(groupName);
-   if (cfgs.empty())
+   boost::shared_ptr<const mm::PresetMatcher> matcher =
+      configGroups_->GetMatcher(groupName);
+   if (!matcher || matcher->GetPresetCount() == 0)
       return "";
 
-   Configuration curState = getConfigGroupState(groupName, false);
-
-   for (size_t i=0; i<cfgs.size(); i++)
-   {
-      Configuration* pCfg = configGroups_->Find(groupName, cfgs[i].c_str());
-      if (pCfg && curState.isConfigurationIncluded(*pCfg))
-         return cfgs[i];
-   }
-
-   // no match
-   return "";
+   return getMatchingPreset(*matcher, false);
 }
 
 /**
@@ -5026,21 +6326,12 @@ string CMMCore::getCurrentConfigFromCache(const char* groupName) throw (CMMError
 {
    CheckConfigGroupName(groupName);
 
-   vector<string> cfgs = configGroups_->GetAvailableConfigs(groupName);
-   if (cfgs.empty())
+   boost::shared_ptr<const mm::PresetMatcher> matcher =
+      configGroups_->GetMatcher(groupName);
+   if (!matcher || matcher->GetPresetCount() == 0)
       return "";
 
-   Configuration curState = getConfigGroupState(groupName, true);
-
-   for (size_t i=0; i<cfgs.size(); i++)
-   {
-      Configuration* pCfg = configGroups_->Find(groupName, cfgs[i].c_str());
-      if (pCfg && curState.isConfigurationIncluded(*pCfg))
-         return cfgs[i];
-   }
-
-   // no match
-   return "";
+   return getMatchingPreset(*matcher, true);
 }
 
 /**
@@ -5144,57 +6435,13 @@ string CMMCore::getCurrentPixelSizeConfig() throw (CMMError)
  **/
 string CMMCore::getCurrentPixelSizeConfig(bool cached) throw (CMMError)
 {
-   // get a list of configuration names
-   vector<string> cfgs = pixelSizeGroup_->GetAvailable();
-   if (cfgs.empty())
+   boost::shared_ptr<const mm::PresetMatcher> matcher =
+      pixelSizeGroup_->GetMatcher();
+   if (matcher->GetPresetCount() == 0)
       return "";
 
-   // create a union of configuration settings used in this group
-   // and obtain the current state of the system
-   Configuration curState;
-   for (size_t i=0; i<cfgs.size(); i++) {
-      PixelSizeConfiguration* cfgData = pixelSizeGroup_->Find(cfgs[i].c_str());
-      assert(cfgData);
-      for (size_t i=0; i < cfgData->size(); i++)
-      {
-         PropertySetting cs = cfgData->getSetting(i); // config setting
-         if (!curState.isPropertyIncluded(cs.getDeviceLabel().c_str(), cs.getPropertyName().c_str()))
-         {
-            try
-            {
-				string value;
-				if (!cached)
-				{
-                   value = getProperty(cs.getDeviceLabel().c_str(), cs.getPropertyName().c_str());
-				}
-				else
-				{
-               MMThreadGuard scg(stateCacheLock_);
-               value = stateCache_.getSetting(cs.getDeviceLabel().c_str(), cs.getPropertyName().c_str()).getPropertyValue();
-				}
-               PropertySetting ss(cs.getDeviceLabel().c_str(), cs.getPropertyName().c_str(), value.c_str()); // state setting
-               curState.addSetting(ss);
-            }
-            catch (CMMError& err)
-            {
-               // just log error
-               logError("GetPixelSizeUm", err.getMsg().c_str());
-            }
-         }
-      }
-   }
-
-   // check which one matches the current state
-   for (size_t i=0; i<cfgs.size(); i++)
-   {
-      PixelSizeConfiguration* pCfg = pixelSizeGroup_->Find(cfgs[i].c_str());
-      if (pCfg && curState.isConfigurationIncluded(*pCfg))
-      {
-		 return cfgs[i];
-      }
-   }
-
-   return "";
+   // Properties that cannot be read just do not match
+   return getMatchingPreset(*matcher, cached, "GetPixelSizeUm");
 }
 
 /**
@@ -6820,11 +8067,504 @@ double CMMCore::getAutoFocusOffset() throw (CMMError)
 }
 
 
+// The asynchronous commands, which are carried out with the synchronous
+// functions on a thread of the device pool
+namespace
+{
+   class SetPositionCommand
+   {
+      CMMCore* core_;
+      std::string label_;
+      double position_;
+   public:
+      SetPositionCommand(CMMCore* core, const char* label, double position) :
+         core_(core), label_(label), position_(position)
+      {}
+
+      void operator()() const
+      {
+         core_->setPosition(label_.c_str(), position_);
+         core_->waitForDevice(label_.c_str());
+      }
+   };
+
+   class SetXYPositionCommand
+   {
+      CMMCore* core_;
+      std::string label_;
+      double x_, y_;
+   public:
+      SetXYPositionCommand(CMMCore* core, const char* label, double x, double y) :
+         core_(core), label_(label), x_(x), y_(y)
+      {}
+
+      void operator()() const
+      {
+         core_->setXYPosition(label_.c_str(), x_, y_);
+         core_->waitForDevice(label_.c_str());
+      }
+   };
+
+   class SetConfigCommand
+   {
+      CMMCore* core_;
+      std::string group_;
+      std::string config_;
+   public:
+      SetConfigCommand(CMMCore* core, const char* group, const char* config) :
+         core_(core), group_(group), config_(config)
+      {}
+
+      void operator()() const
+      {
+         core_->setConfig(group_.c_str(), config_.c_str());
+         core_->waitForConfig(group_.c_str(), config_.c_str());
+      }
+   };
+
+   class SnapImageCommand
+   {
+      CMMCore* core_;
+   public:
+      explicit SnapImageCommand(CMMCore* core) : core_(core) {}
+
+      void operator()() const { core_->snapImage(); }
+   };
+} // anonymous namespace
+
+/**
+ * Moves the stage to the given position, without waiting for it.
+ * @param stageLabel  the single-axis drive device label
+ * @param position    the desired stage position, in microns
+ * @return the future of the move
+ */
+boost::shared_ptr<mm::CommandFuture>
+CMMCore::setPositionAsync(const char* stageLabel, double position) throw (CMMError)
+{
+   boost::shared_ptr<StageInstance> pStage =
+      deviceManager_->GetDeviceOfType<StageInstance>(stageLabel);
+
+   std::ostringstream description;
+   description << "setPosition " << stageLabel << " " << std::fixed <<
+      std::setprecision(5) << position;
+   return commandScheduler_->Submit(description.str(),
+         std::vector<mm::CommandScheduler::Key>(1, pStage->GetAdapterModule().get()),
+         SetPositionCommand(this, stageLabel, position));
+}
+
+/**
+ * Moves the XY stage to the given position, without waiting for it.
+ * @param xyStageLabel  the XY stage device label
+ * @param x             the X axis position in microns
+ * @param y             the Y axis position in microns
+ * @return the future of the move
+ */
+boost::shared_ptr<mm::CommandFuture>
+CMMCore::setXYPositionAsync(const char* xyStageLabel, double x, double y) throw (CMMError)
+{
+   boost::shared_ptr<XYStageInstance> pXYStage =
+      deviceManager_->GetDeviceOfType<XYStageInstance>(xyStageLabel);
+
+   std::ostringstream description;
+   description << "setXYPosition " << xyStageLabel << " " << std::fixed <<
+      std::setprecision(3) << x << " " << y;
+   return commandScheduler_->Submit(description.str(),
+         std::vector<mm::CommandScheduler::Key>(1, pXYStage->GetAdapterModule().get()),
+         SetXYPositionCommand(this, xyStageLabel, x, y));
+}
+
+/**
+ * Applies a configuration preset, without waiting for it.
+ * @param groupName   the configuration group name
+ * @param configName  the configuration preset name
+ * @return the future of the change
+ */
+boost::shared_ptr<mm::CommandFuture>
+CMMCore::setConfigAsync(const char* groupName, const char* configName) throw (CMMError)
+{
+   CheckConfigGroupName(groupName);
+   CheckConfigPresetName(configName);
+
+   Configuration* pCfg = configGroups_->Find(groupName, configName);
+   if (!pCfg)
+   {
+      throw CMMError("Preset " + ToQuotedString(configName) +
+            " of configuration group " + ToQuotedString(groupName) +
+            " does not exist",
+            MMERR_NoConfiguration);
+   }
+
+   // The preset's settings of core properties are ordered with the core
+   // itself as key
+   std::vector<mm::CommandScheduler::Key> keys;
+   for (size_t i = 0; i < pCfg->size(); i++)
+   {
+      std::string label = pCfg->getSetting(i).getDeviceLabel();
+      if (IsCoreDeviceLabel(label.c_str()))
+         keys.push_back(this);
+      else
+         keys.push_back(deviceManager_->GetDevice(label)->GetAdapterModule().get());
+   }
+
+   return commandScheduler_->Submit(
+         std::string("setConfig ") + groupName + " " + configName, keys,
+         SetConfigCommand(this, groupName, configName));
+}
+
+/**
+ * Snaps an image with the current camera, without waiting for it. The image
+ * can be retrieved with getImage() once the future is done.
+ * @return the future of the exposure
+ */
+boost::shared_ptr<mm::CommandFuture> CMMCore::snapImageAsync() throw (CMMError)
+{
+   boost::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
+   if (!camera)
+      throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
+
+   // Also wait for earlier commands to the devices that snapImage() waits
+   // for or opens
+   std::vector<mm::CommandScheduler::Key> keys;
+   keys.push_back(camera->GetAdapterModule().get());
+   boost::shared_ptr<ShutterInstance> shutter = currentShutterDevice_.lock();
+   if (autoShutter_ && shutter)
+      keys.push_back(shutter->GetAdapterModule().get());
+   for (std::vector< boost::weak_ptr<DeviceInstance> >::const_iterator
+         it = imageSynchroDevices_.begin(), end = imageSynchroDevices_.end();
+         it != end; ++it)
+   {
+      boost::shared_ptr<DeviceInstance> device = it->lock();
+      if (device)
+         keys.push_back(device->GetAdapterModule().get());
+   }
+
+   return commandScheduler_->Submit("snapImage", keys, SnapImageCommand(this));
+}
+
+/**
+ * Waits until all asynchronous commands issued so far are done.
+ */
+void CMMCore::waitForAsyncCommands()
+{
+   commandScheduler_->WaitForAll();
+}
+
+/**
+ * Splits an acquisition plan into the runs of images that
+ * runAcquisitionPlan() takes with one sequence acquisition each: runs in
+ * which every setting either stays the same or is sequenceable (by the
+ * current focus stage, XY stage and camera, for positions and exposure)
+ * and holds the run.
+ * @param plan  the acquisition plan
+ * @return the number of images in each run
+ */
+std::vector<long> CMMCore::compileAcquisitionPlan(const AcquisitionPlan& plan) throw (CMMError)
+{
+   mm::SequenceCompiler compiler(plan);
+   setPlanSequenceLimits(compiler);
+   std::vector<mm::SequenceCompiler::Chunk> chunks = compiler.Compile();
+
+   std::vector<long> lengths;
+   for (size_t i = 0; i < chunks.size(); ++i)
+      lengths.push_back(static_cast<long>(chunks[i].imageCount));
+   return lengths;
+}
+
+/**
+ * Takes the images of an acquisition plan with the current camera, into the
+ * circular buffer. The plan is split as by compileAcquisitionPlan(); for
+ * each run, the settings that stay the same are applied, the sequences of
+ * the others are loaded and started together, and a sequence acquisition
+ * of the run's images is taken. Returns when all images have been taken.
+ * @param plan  the acquisition plan
+ */
+void CMMCore::runAcquisitionPlan(const AcquisitionPlan& plan) throw (CMMError)
+{
+   boost::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
+   if (!camera)
+      throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
+   const std::string cameraLabel = camera->GetLabel();
+   if (camera->IsCapturing())
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
+
+   mm::SequenceCompiler compiler(plan);
+   setPlanSequenceLimits(compiler);
+   std::vector<mm::SequenceCompiler::Chunk> chunks = compiler.Compile();
+   LOG_INFO(coreLogger_) << "Acquisition plan of " << compiler.GetImageCount() <<
+      " images compiled into " << chunks.size() << " sequences";
+
+   // The images of all runs go to the buffer in turn
+   initializeSequenceBuffer(camera);
+   boost::shared_ptr<CircularBuffer> bufferHolder;
+   CircularBuffer* buffer = getSequenceBuffer(camera, bufferHolder);
+
+   std::vector<bool> wasSequenced(compiler.GetAxisCount(), false);
+   for (size_t c = 0; c < chunks.size(); ++c)
+   {
+      const mm::SequenceCompiler::Chunk& chunk = chunks[c];
+      const size_t sequencedCount =
+         std::count(chunk.sequenced.begin(), chunk.sequenced.end(), true);
+      LOG_DEBUG(coreLogger_) << "Acquisition plan sequence " << (c + 1) <<
+         ": " << chunk.imageCount << " images from image " << chunk.firstImage <<
+         ", " << sequencedCount << " sequenced settings";
+
+      // Go to the settings of the first image, leaving out those that
+      // have not changed since the previous run
+      for (size_t a = 0; a < compiler.GetAxisCount(); ++a)
+      {
+         if (c > 0 && !wasSequenced[a] &&
+               compiler.GetAxis(a).SameValue(chunk.firstImage - 1, chunk.firstImage))
+            continue;
+         applyPlanAxis(compiler, a, chunk.firstImage);
+      }
+      waitForSystem();
+
+      {
+         mm::DeviceModuleLockGuard guard(camera);
+         if (buffer->Width() != camera->GetImageWidth() ||
+               buffer->Height() != camera->GetImageHeight() ||
+               buffer->Depth() != camera->GetImageBytesPerPixel())
+            throw CMMError("Acquisition plan changes the image size of camera " +
+                  ToQuotedString(cameraLabel), MMERR_CircularBufferIncompatibleImage);
+      }
+
+      // Load all sequences before starting any, so that they start together
+      std::vector<size_t> started;
+      try
+      {
+         for (size_t a = 0; a < compiler.GetAxisCount(); ++a)
+         {
+            if (chunk.sequenced[a])
+               loadPlanSequence(compiler, a, chunk.firstImage, chunk.imageCount);
+         }
+         for (size_t a = 0; a < compiler.GetAxisCount(); ++a)
+         {
+            if (chunk.sequenced[a])
+            {
+               startPlanSequence(compiler, a);
+               started.push_back(a);
+            }
+         }
+
+         {
+            mm::DeviceModuleLockGuard guard(camera);
+            int nRet = camera->StartSequenceAcquisition(
+                  static_cast<long>(chunk.imageCount), 0.0, true);
+            if (nRet != DEVICE_OK)
+               throw CMMError(getDeviceErrorText(nRet, camera).c_str(), MMERR_DEVICE_GENERIC);
+         }
+         while (isSequenceRunning(cameraLabel.c_str()))
+            CDeviceUtils::SleepMs(1);
+         if (buffer->Overflow())
+            throw CMMError("Acquisition plan stopped: the sequence buffer "
+                  "overflowed", MMERR_GENERIC);
+      }
+      catch (const CMMError&)
+      {
+         for (size_t i = 0; i < started.size(); ++i)
+         {
+            try
+            {
+               stopPlanSequence(compiler, started[i]);
+            }
+            catch (const CMMError&)
+            {
+               // Report the original error
+            }
+         }
+         throw;
+      }
+
+      for (size_t i = 0; i < started.size(); ++i)
+         stopPlanSequence(compiler, started[i]);
+      wasSequenced = chunk.sequenced;
+   }
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // Private methods
 ///////////////////////////////////////////////////////////////////////////////
 
+// Records the time taken by an asynchronous command
+void CMMCore::logCommandDone(const mm::CommandFuture& future)
+{
+   bool failed = false;
+   std::string error;
+   try
+   {
+      future.Wait();
+   }
+   catch (const CMMError& e)
+   {
+      failed = true;
+      error = e.getMsg();
+   }
+
+   LOG_DEBUG(coreLogger_) << "Async command " << future.GetDescription() <<
+      (failed ? " failed" : " done") << " in " << std::fixed <<
+      std::setprecision(3) << future.GetLatencyMs() << " ms, after waiting " <<
+      future.GetQueuedMs() << " ms" << (failed ? ": " + error : std::string());
+}
+
+namespace
+{
+   // Returns the label of the device that an acquisition plan axis is
+   // applied to
+   std::string GetPlanAxisDevice(CMMCore& core, const mm::SequenceCompiler::Axis& axis)
+   {
+      switch (axis.type)
+      {
+         case mm::SequenceCompiler::AxisZ:
+            return core.getFocusDevice();
+         case mm::SequenceCompiler::AxisXY:
+            return core.getXYStageDevice();
+         case mm::SequenceCompiler::AxisExposure:
+            return core.getCameraDevice();
+         default:
+            return axis.device;
+      }
+   }
+} // anonymous namespace
+
+// Sets the maximum sequence length of each axis of an acquisition plan from
+// the devices
+void CMMCore::setPlanSequenceLimits(mm::SequenceCompiler& compiler) throw (CMMError)
+{
+   for (size_t a = 0; a < compiler.GetAxisCount(); ++a)
+   {
+      const mm::SequenceCompiler::Axis& axis = compiler.GetAxis(a);
+      const std::string label = GetPlanAxisDevice(*this, axis);
+      long maxLength = 0;
+      switch (axis.type)
+      {
+         case mm::SequenceCompiler::AxisZ:
+            if (label.empty())
+               throw CMMError(getCoreErrorText(MMERR_InvalidStageDevice).c_str(), MMERR_InvalidStageDevice);
+            if (isStageSequenceable(label.c_str()))
+               maxLength = getStageSequenceMaxLength(label.c_str());
+            break;
+         case mm::SequenceCompiler::AxisXY:
+            if (label.empty())
+               throw CMMError(getCoreErrorText(MMERR_InvalidXYStageDevice).c_str(), MMERR_InvalidXYStageDevice);
+            if (isXYStageSequenceable(label.c_str()))
+               maxLength = getXYStageSequenceMaxLength(label.c_str());
+            break;
+         case mm::SequenceCompiler::AxisExposure:
+            if (label.empty())
+               throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
+            if (isExposureSequenceable(label.c_str()))
+               maxLength = getExposureSequenceMaxLength(label.c_str());
+            break;
+         case mm::SequenceCompiler::AxisProperty:
+            if (isPropertySequenceable(label.c_str(), axis.property.c_str()))
+               maxLength = getPropertySequenceMaxLength(label.c_str(), axis.property.c_str());
+            break;
+      }
+      compiler.SetMaxSequenceLength(a, maxLength);
+   }
+}
+
+// Applies the setting of an acquisition plan axis for one image
+void CMMCore::applyPlanAxis(const mm::SequenceCompiler& compiler, size_t axis,
+      size_t image) throw (CMMError)
+{
+   const mm::SequenceCompiler::Axis& a = compiler.GetAxis(axis);
+   const std::string label = GetPlanAxisDevice(*this, a);
+   switch (a.type)
+   {
+      case mm::SequenceCompiler::AxisZ:
+         setPosition(label.c_str(), a.positions[image]);
+         break;
+      case mm::SequenceCompiler::AxisXY:
+         setXYPosition(label.c_str(), a.positions[image], a.yPositions[image]);
+         break;
+      case mm::SequenceCompiler::AxisExposure:
+         setExposure(label.c_str(), a.positions[image]);
+         break;
+      case mm::SequenceCompiler::AxisProperty:
+         setProperty(label.c_str(), a.property.c_str(), a.values[image].c_str());
+         break;
+   }
+}
+
+// Loads the sequence of an acquisition plan axis for a run of images
+void CMMCore::loadPlanSequence(const mm::SequenceCompiler& compiler,
+      size_t axis, size_t firstImage, size_t imageCount) throw (CMMError)
+{
+   const mm::SequenceCompiler::Axis& a = compiler.GetAxis(axis);
+   const std::string label = GetPlanAxisDevice(*this, a);
+   const size_t end = firstImage + imageCount;
+   switch (a.type)
+   {
+      case mm::SequenceCompiler::AxisZ:
+         loadStageSequence(label.c_str(), std::vector<double>(
+                  a.positions.begin() + firstImage, a.positions.begin() + end));
+         break;
+      case mm::SequenceCompiler::AxisXY:
+         loadXYStageSequence(label.c_str(),
+               std::vector<double>(a.positions.begin() + firstImage,
+                  a.positions.begin() + end),
+               std::vector<double>(a.yPositions.begin() + firstImage,
+                  a.yPositions.begin() + end));
+         break;
+      case mm::SequenceCompiler::AxisExposure:
+         loadExposureSequence(label.c_str(), std::vector<double>(
+                  a.positions.begin() + firstImage, a.positions.begin() + end));
+         break;
+      case mm::SequenceCompiler::AxisProperty:
+         loadPropertySequence(label.c_str(), a.property.c_str(),
+               std::vector<std::string>(a.values.begin() + firstImage,
+                  a.values.begin() + end));
+         break;
+   }
+}
+
+void CMMCore::startPlanSequence(const mm::SequenceCompiler& compiler,
+      size_t axis) throw (CMMError)
+{
+   const mm::SequenceCompiler::Axis& a = compiler.GetAxis(axis);
+   const std::string label = GetPlanAxisDevice(*this, a);
+   switch (a.type)
+   {
+      case mm::SequenceCompiler::AxisZ:
+         startStageSequence(label.c_str());
+         break;
+      case mm::SequenceCompiler::AxisXY:
+         startXYStageSequence(label.c_str());
+         break;
+      case mm::SequenceCompiler::AxisExposure:
+         startExposureSequence(label.c_str());
+         break;
+      case mm::SequenceCompiler::AxisProperty:
+         startPropertySequence(label.c_str(), a.property.c_str());
+         break;
+   }
+}
+
+void CMMCore::stopPlanSequence(const mm::SequenceCompiler& compiler,
+      size_t axis) throw (CMMError)
+{
+   const mm::SequenceCompiler::Axis& a = compiler.GetAxis(axis);
+   const std::string label = GetPlanAxisDevice(*this, a);
+   switch (a.type)
+   {
+      case mm::SequenceCompiler::AxisZ:
+         stopStageSequence(label.c_str());
+         break;
+      case mm::SequenceCompiler::AxisXY:
+         stopXYStageSequence(label.c_str());
+         break;
+      case mm::SequenceCompiler::AxisExposure:
+         stopExposureSequence(label.c_str());
+         break;
+      case mm::SequenceCompiler::AxisProperty:
+         stopPropertySequence(label.c_str(), a.property.c_str());
+         break;
+   }
+}
+
 void CMMCore::InitializeErrorMessages()
 {
    errorText_[MMERR_OK] = "No errors.";
@@ -7025,17 +8765,85 @@ bool CMMCore::IsCoreDeviceLabel(const char* label) const throw (CMMError)
    return (strcmp(label, MM::g_Keyword_CoreDevice) == 0);
 }
 
+namespace {
+
+// Sets, in order, the properties of devices in one adapter module
+class ModulePropertySetter
+{
+public:
+   typedef std::pair< boost::shared_ptr<DeviceInstance>, PropertySetting > Item;
+
+   ModulePropertySetter(MMThreadLock& stateCacheLock, Configuration& stateCache) :
+      stateCacheLock_(&stateCacheLock), stateCache_(&stateCache)
+   {}
+
+   void Add(size_t index, boost::shared_ptr<DeviceInstance> device,
+         const PropertySetting& setting)
+   {
+      indices_.push_back(index);
+      items_.push_back(Item(device, setting));
+   }
+
+   // Runs on a pool thread
+   void Run()
+   {
+      errors_.assign(items_.size(), boost::shared_ptr<CMMError>());
+      for (size_t i = 0; i < items_.size(); ++i)
+      {
+         const boost::shared_ptr<DeviceInstance>& device = items_[i].first;
+         const PropertySetting& setting = items_[i].second;
+         mm::DeviceModuleLockGuard guard(device);
+         try
+         {
+            device->SetProperty(setting.getPropertyName(),
+                  setting.getPropertyValue());
+
+            MMThreadGuard scg(*stateCacheLock_);
+            stateCache_->addSetting(setting);
+         }
+         catch (const CMMError& e)
+         {
+            errors_[i].reset(new CMMError(e));
+         }
+         catch (const std::exception& e)
+         {
+            // Pool tasks must not throw
+            errors_[i].reset(new CMMError(
+                     std::string("Unexpected error: ") + e.what()));
+         }
+         catch (...)
+         {
+            errors_[i].reset(new CMMError("Unexpected error"));
+         }
+      }
+   }
+
+   size_t Size() const { return items_.size(); }
+   size_t Index(size_t i) const { return indices_[i]; }
+   const boost::shared_ptr<CMMError>& Error(size_t i) const { return errors_[i]; }
+
+private:
+   MMThreadLock* stateCacheLock_;
+   Configuration* stateCache_;
+   std::vector<size_t> indices_;
+   std::vector<Item> items_;
+   std::vector< boost::shared_ptr<CMMError> > errors_;
+};
+
+} // anonymous namespace
+
 /**
  * Set all properties in a configuration
  * Upon error, don't stop, but try to set all failed properties again
  * until all success or no more change takes place
  * If errors remain, throw an error 
+ *
+ * Core properties are set first. The device properties are then set
+ * concurrently for each adapter module, in the order given within a module.
  */
 void CMMCore::applyConfiguration(const Configuration& config) throw (CMMError)
 {
-   std::ostringstream sall;
-   bool error = false;
-   vector<PropertySetting> failedProps;
+   vector<PropertySetting> deviceProps;
    for (size_t i=0; i<config.size(); i++)
    {
       PropertySetting setting = config.getSetting(i);
@@ -7051,38 +8859,25 @@ void CMMCore::applyConfiguration(const Configuration& config) throw (CMMError)
       }
       else
       {
-         // normal processing
-         boost::shared_ptr<DeviceInstance> pDevice =
-            deviceManager_->GetDevice(setting.getDeviceLabel());
-         mm::DeviceModuleLockGuard guard(pDevice);
-         try
-         {
-            pDevice->SetProperty(setting.getPropertyName(),
-                  setting.getPropertyValue());
-
-            {
-               MMThreadGuard scg(stateCacheLock_);
-               stateCache_.addSetting(setting);
-            }
-         }
-         catch (const CMMError&)
-         {
-            failedProps.push_back(setting);
-            error = true;
-         }
+         deviceProps.push_back(setting);
       }
    }
-   if (error) 
+
+   // Settings that fail may depend on others that have not been set yet, so
+   // retry the failed ones for as long as some succeed. Errors are only
+   // logged when retrying.
+   string errorString;
+   if (applyProperties(deviceProps, errorString, false) == 0)
+      return;
+   size_t failed;
+   do
    {
-      string errorString;
-      while (failedProps.size() > (unsigned) applyProperties(failedProps, errorString) )
-      {
-         if (failedProps.size() == 0)
-            return;
-      }
+      failed = deviceProps.size();
+      if (applyProperties(deviceProps, errorString, true) == 0)
+         return;
+   } while (deviceProps.size() < failed);
 
-      throw CMMError(errorString.c_str(), MMERR_DEVICE_GENERIC);
-   }
+   throw CMMError(errorString.c_str(), MMERR_DEVICE_GENERIC);
 }
 
 /*
@@ -7090,35 +8885,52 @@ void CMMCore::applyConfiguration(const Configuration& config) throw (CMMError)
  * It is possible that setting certain properties failed because they are dependent
  * on other properties to be set first. As a workaround, continue to apply these failed
  * properties until there are none left or none succeed
- * returns number of properties successfully set
+ * Leaves the failed properties, in their original order, in props, and
+ * returns their number
  */
-int CMMCore::applyProperties(vector<PropertySetting>& props, string& lastError)
+int CMMCore::applyProperties(vector<PropertySetting>& props, string& lastError,
+      bool logErrors)
 {
-  // int succeeded = 0;
-   vector<PropertySetting> failedProps;
+   std::vector< boost::shared_ptr<ModulePropertySetter> > setters;
+   std::map<LoadedDeviceAdapter*, size_t> setterForModule;
    for (size_t i=0; i<props.size(); i++)
    {
-      // normal processing
       boost::shared_ptr<DeviceInstance> pDevice =
          deviceManager_->GetDevice(props[i].getDeviceLabel());
-      mm::DeviceModuleLockGuard guard(pDevice);
-      try
+      LoadedDeviceAdapter* module = pDevice->GetAdapterModule().get();
+      std::map<LoadedDeviceAdapter*, size_t>::iterator it =
+         setterForModule.find(module);
+      if (it == setterForModule.end())
       {
-         pDevice->SetProperty(props[i].getPropertyName(),
-               props[i].getPropertyValue());
-
-         {
-            MMThreadGuard scg(stateCacheLock_);
-            stateCache_.addSetting(props[i]);
-         }
+         it = setterForModule.insert(std::make_pair(module, setters.size())).first;
+         setters.push_back(boost::make_shared<ModulePropertySetter>(
+                  boost::ref(stateCacheLock_), boost::ref(stateCache_)));
       }
-      catch (const CMMError& e)
-      {
-         failedProps.push_back(props[i]);
-         std::string message = e.getFullMsg();
+      setters[it->second]->Add(i, pDevice, props[i]);
+   }
+
+   std::vector<mm::ThreadPool::Task> tasks;
+   for (size_t i = 0; i < setters.size(); ++i)
+      tasks.push_back(boost::bind(&ModulePropertySetter::Run, setters[i]));
+   devicePool_->RunAll(tasks);
+
+   std::vector< boost::shared_ptr<CMMError> > errors(props.size());
+   for (size_t i = 0; i < setters.size(); ++i)
+   {
+      for (size_t j = 0; j < setters[i]->Size(); ++j)
+         errors[setters[i]->Index(j)] = setters[i]->Error(j);
+   }
+
+   vector<PropertySetting> failedProps;
+   for (size_t i=0; i<props.size(); i++)
+   {
+      if (!errors[i])
+         continue;
+      failedProps.push_back(props[i]);
+      std::string message = errors[i]->getFullMsg();
+      if (logErrors)
          logError(props[i].getDeviceLabel().c_str(), message.c_str());
-         lastError = message;
-      }
+      lastError = message;
    }
    props = failedProps;
    return (int) failedProps.size();
@@ -85,6 +85,7 @@
 #endif
 
 
+class AcquisitionPlan;
 class CPluginManager;
 class CircularBuffer;
 class ConfigGroupCollection;
@@ -108,8 +109,17 @@ class XYStageInstance;
 class CMMCore;
 
 namespace mm {
+   class CommandFuture;
+   class CommandScheduler;
    class DeviceManager;
+   class DeviceStateReader;
+   class FrameLease;
+   class IdleNotifier;
    class LogManager;
+   class MetadataKeyTable;
+   class PresetMatcher;
+   class SequenceCompiler;
+   class ThreadPool;
 } // namespace mm
 
 typedef unsigned int* imgRGB32;
@@ -149,6 +159,8 @@ public:
    void unloadAllDevices() throw (CMMError);
    void initializeAllDevices() throw (CMMError);
    void initializeDevice(const char* label) throw (CMMError);
+   void enableParallelInitialization(bool enable);
+   bool isParallelInitializationEnabled() const;
    void reset() throw (CMMError);
 
    void unloadLibrary(const char* moduleName) throw (CMMError);
@@ -186,6 +198,17 @@ public:
          bool truncate = true, bool synchronous = false) throw (CMMError);
    void stopSecondaryLogFile(int handle) throw (CMMError);
 
+   void setPrimaryLogRotation(long maxSegmentMB, long maxSegmentHours,
+         long maxTotalMB, bool compress) throw (CMMError);
+   int startSecondaryRotatingLogFile(const char* filename, bool enableDebug,
+         long maxSegmentMB, long maxSegmentHours, long maxTotalMB,
+         bool compress, bool truncate = true) throw (CMMError);
+
+   void setLogQueueOverflowPolicy(const char* policy) throw (CMMError);
+   std::string getLogQueueOverflowPolicy() const;
+   long long getLogQueueOverflowCount() const;
+   long long getLogDroppedEntryCount() const;
+
    ///@}
 
    /** \name Device listing. */
@@ -193,6 +216,8 @@ public:
    std::vector<std::string> getDeviceAdapterSearchPaths();
    void setDeviceAdapterSearchPaths(const std::vector<std::string>& paths);
    MMCORE_DEPRECATED(static void addSearchPath(const char *path));
+   void setDeviceAdapterCatalogFile(const char* filename) throw (CMMError);
+   std::string getDeviceAdapterCatalogFile() const;
 
    std::vector<std::string> getDeviceAdapterNames() throw (CMMError);
    MMCORE_DEPRECATED(static std::vector<std::string> getDeviceLibraries() throw (CMMError));
@@ -414,16 +439,58 @@ public:
    void* getNBeforeLastImageMD(unsigned long n, Metadata& md)
       const throw (CMMError);
    void* popNextImageMD(Metadata& md) throw (CMMError);
+   unsigned popNextImages(unsigned maxCount, void* pixels,
+         unsigned long bufferBytes, std::vector<Metadata>& md)
+      throw (CMMError);
+   boost::shared_ptr<mm::FrameLease> getLastImageLease() const
+      throw (CMMError);
+   boost::shared_ptr<mm::FrameLease> popNextImageLease() throw (CMMError);
 
    long getRemainingImageCount();
    long getBufferTotalCapacity();
    long getBufferFreeCapacity();
    bool isBufferOverflowed() const;
+   void setBufferOverflowPolicy(const char* policy) throw (CMMError);
+   std::string getBufferOverflowPolicy() const;
+   void setBufferOverflowTimeoutMs(double timeoutMs) throw (CMMError);
+   double getBufferOverflowTimeoutMs() const;
+   void setBufferSpillDirectory(const char* path) throw (CMMError);
+   std::string getBufferSpillDirectory() const;
+   void setBufferSpillCapacityMB(unsigned capacityMB) throw (CMMError);
+   unsigned getBufferSpillCapacityMB() const;
+   void setBufferSpillHighWaterMark(double fraction) throw (CMMError);
+   double getBufferSpillHighWaterMark() const;
+   long long getBufferOverflowCount() const;
+   long long getBufferDroppedImageCount() const;
+   long long getBufferSpilledImageCount() const;
+   void resetBufferOverflowCounters();
+   void setBufferHugePages(const char* mode) throw (CMMError);
+   std::string getBufferHugePages() const;
+   void enableBufferPrefault(bool enable);
+   bool isBufferPrefaultEnabled() const;
+   void setBufferNumaNode(int node) throw (CMMError);
+   int getBufferNumaNode() const;
+   double getBufferAllocationTimeMs() const;
+   bool isBufferUsingHugePages() const;
+   bool isBufferNumaBound() const;
+   double getBufferFirstPassMeanInsertTimeUs() const;
+   double getBufferFirstPassMaxInsertTimeUs() const;
    void setCircularBufferMemoryFootprint(unsigned sizeMB) throw (CMMError);
    unsigned getCircularBufferMemoryFootprint();
    void initializeCircularBuffer() throw (CMMError);
    void clearCircularBuffer() throw (CMMError);
 
+   void setCameraBufferMemoryFootprint(const char* cameraLabel,
+         unsigned sizeMB) throw (CMMError);
+   unsigned getCameraBufferMemoryFootprint(const char* cameraLabel)
+      throw (CMMError);
+   void* getLastImageMD(const char* cameraLabel, Metadata& md)
+      const throw (CMMError);
+   void* popNextImageMD(const char* cameraLabel, Metadata& md)
+      throw (CMMError);
+   long getRemainingImageCount(const char* cameraLabel) throw (CMMError);
+   void clearCircularBuffer(const char* cameraLabel) throw (CMMError);
+
    bool isExposureSequenceable(const char* cameraLabel) throw (CMMError);
    void startExposureSequence(const char* cameraLabel) throw (CMMError);
    void stopExposureSequence(const char* cameraLabel) throw (CMMError);
@@ -623,6 +690,37 @@ public:
    std::vector<std::string> getLoadedPeripheralDevices(const char* hubLabel) throw (CMMError);
    ///@}
 
+   /** \name Asynchronous commands.
+    *
+    * Return at once, with a future that is done when the command has been
+    * carried out and the devices involved are no longer busy. Commands to
+    * devices in the same adapter module are carried out one at a time, in
+    * the order they were issued; commands to other modules are carried out
+    * concurrently.
+    */
+   ///@{
+   boost::shared_ptr<mm::CommandFuture> setPositionAsync(const char* stageLabel,
+         double position) throw (CMMError);
+   boost::shared_ptr<mm::CommandFuture> setXYPositionAsync(const char* xyStageLabel,
+         double x, double y) throw (CMMError);
+   boost::shared_ptr<mm::CommandFuture> setConfigAsync(const char* groupName,
+         const char* configName) throw (CMMError);
+   boost::shared_ptr<mm::CommandFuture> snapImageAsync() throw (CMMError);
+   void waitForAsyncCommands();
+   ///@}
+
+   /** \name Hardware-sequenced acquisition.
+    *
+    * Run an acquisition plan with as few sequence acquisitions as possible,
+    * stepping the focus stage, XY stage, exposure and properties with
+    * hardware sequences triggered by the current camera. The devices must
+    * be set up for triggering (e.g. wired to the camera's trigger output).
+    */
+   ///@{
+   std::vector<long> compileAcquisitionPlan(const AcquisitionPlan& plan) throw (CMMError);
+   void runAcquisitionPlan(const AcquisitionPlan& plan) throw (CMMError);
+   ///@}
+
    /** \name Miscellaneous. */
    ///@{
    std::string getUserId() const;
@@ -659,12 +757,25 @@ private:
    long pollingIntervalMs_;
    long timeoutMs_;
    bool autoShutter_;
+   bool parallelInitialization_;
    MM::Core* callback_;                 // core services for devices
    ConfigGroupCollection* configGroups_;
    CorePropertyCollection* properties_;
    MMEventCallback* externalCallback_;  // notification hook to the higher layer (e.g. GUI)
    PixelSizeConfigGroup* pixelSizeGroup_;
    CircularBuffer* cbuf_;
+   // Outlives any one cbuf_, because cameras keep the keys they registered
+   boost::shared_ptr<mm::MetadataKeyTable> metadataKeys_;
+   // The buffers of cameras that do not use cbuf_, by camera label (each
+   // also held by its camera)
+   std::map< std::string, boost::shared_ptr<CircularBuffer> > cameraBuffers_;
+   mutable MMThreadLock cameraBuffersLock_;
+
+   boost::shared_ptr<mm::IdleNotifier> idleNotifier_;
+   // For calls to devices in different modules that can be made concurrently
+   boost::shared_ptr<mm::ThreadPool> devicePool_;
+   boost::shared_ptr<mm::DeviceStateReader> stateReader_;
+   boost::shared_ptr<mm::CommandScheduler> commandScheduler_;
 
    std::vector< boost::weak_ptr<DeviceInstance> > imageSynchroDevices_;
    boost::shared_ptr<CPluginManager> pluginManager_;
@@ -695,9 +806,21 @@ private:
    bool IsCoreDeviceLabel(const char* label) const throw (CMMError);
 
    void applyConfiguration(const Configuration& config) throw (CMMError);
-   int applyProperties(std::vector<PropertySetting>& props, std::string& lastError);
+   int applyProperties(std::vector<PropertySetting>& props, std::string& lastError,
+         bool logErrors);
    void waitForDevice(boost::shared_ptr<DeviceInstance> pDev) throw (CMMError);
+   void waitForDevices(const std::vector< boost::shared_ptr<DeviceInstance> >& devices) throw (CMMError);
    Configuration getConfigGroupState(const char* group, bool fromCache) throw (CMMError);
+   void logCommandDone(const mm::CommandFuture& future);
+   void setPlanSequenceLimits(mm::SequenceCompiler& compiler) throw (CMMError);
+   void applyPlanAxis(const mm::SequenceCompiler& compiler, size_t axis,
+         size_t image) throw (CMMError);
+   void loadPlanSequence(const mm::SequenceCompiler& compiler, size_t axis,
+         size_t firstImage, size_t imageCount) throw (CMMError);
+   void startPlanSequence(const mm::SequenceCompiler& compiler, size_t axis) throw (CMMError);
+   void stopPlanSequence(const mm::SequenceCompiler& compiler, size_t axis) throw (CMMError);
+   std::string getMatchingPreset(const mm::PresetMatcher& matcher, bool fromCache,
+         const char* errorContext = 0) throw (CMMError);
    std::string getDeviceErrorText(int deviceCode, boost::shared_ptr<DeviceInstance> pDevice);
    std::string getDeviceName(boost::shared_ptr<DeviceInstance> pDev);
    void logError(const char* device, const char* msg);
@@ -705,6 +828,22 @@ private:
    void assignDefaultRole(boost::shared_ptr<DeviceInstance> pDev);
    void updateCoreProperty(const char* propName, MM::DeviceType devType) throw (CMMError);
    void loadSystemConfigurationImpl(const char* fileName) throw (CMMError);
+   CircularBuffer* getSequenceBuffer(boost::shared_ptr<CameraInstance> camera,
+         boost::shared_ptr<CircularBuffer>& holder) const;
+   boost::shared_ptr<CircularBuffer> getCameraBuffer(const char* cameraLabel)
+      const throw (CMMError);
+   std::vector< boost::shared_ptr<CircularBuffer> > getCameraBuffers() const;
+   void copyBufferSettings(CircularBuffer& buffer, bool allocationOptions) const;
+   void updateCameraBufferSettings(bool allocationOptions);
+   long long sumBufferCounts(long long (CircularBuffer::*count)() const) const;
+   CircularBuffer* getNextSequenceBuffer(
+         boost::shared_ptr<CircularBuffer>& holder) const;
+   void getCurrentImageFormat(unsigned& width, unsigned& height,
+         unsigned& depth) const;
+   void checkCurrentImageFormat(const char* cameraLabel,
+         const CircularBuffer& buffer) const throw (CMMError);
+   void initializeSequenceBuffer(boost::shared_ptr<CameraInstance> camera)
+      throw (CMMError);
 };
 
 #endif //_MMCORE_H_
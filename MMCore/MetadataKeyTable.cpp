@@ -0,0 +1,48 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Interned metadata tag keys for MM::FrameMetadata
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "MetadataKeyTable.h"
+
+namespace mm {
+
+unsigned
+MetadataKeyTable::Intern(const std::string& name, const std::string& deviceLabel)
+{
+   Entry entry(name, deviceLabel);
+
+   MMThreadGuard g(lock_);
+   std::map<Entry, unsigned>::const_iterator it = index_.find(entry);
+   if (it != index_.end())
+      return it->second;
+
+   unsigned key = static_cast<unsigned>(entries_.size());
+   entries_.push_back(entry);
+   index_.insert(std::make_pair(entry, key));
+   return key;
+}
+
+bool
+MetadataKeyTable::Lookup(unsigned key, std::string& name, std::string& deviceLabel) const
+{
+   MMThreadGuard g(lock_);
+   if (key >= entries_.size())
+      return false;
+   name = entries_[key].first;
+   deviceLabel = entries_[key].second;
+   return true;
+}
+
+} // namespace mm
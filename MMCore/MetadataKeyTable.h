@@ -0,0 +1,54 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Interned metadata tag keys for MM::FrameMetadata
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "../MMDevice/DeviceThreads.h"
+
+#include <boost/utility.hpp>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+
+namespace mm {
+
+/**
+ * Maps metadata tag names (with their device labels) to small integer keys,
+ * so that MM::FrameMetadata can refer to them without storing strings.
+ *
+ * Keys are never removed, so a key stays valid for the lifetime of the
+ * table. Camera labels are interned in the same table (with device label
+ * "_").
+ */
+class MetadataKeyTable : boost::noncopyable
+{
+public:
+   unsigned Intern(const std::string& name, const std::string& deviceLabel);
+
+   // Returns false if key was not issued by this table
+   bool Lookup(unsigned key, std::string& name, std::string& deviceLabel) const;
+
+private:
+   typedef std::pair<std::string, std::string> Entry;
+
+   mutable MMThreadLock lock_;
+   std::deque<Entry> entries_;
+   std::map<Entry, unsigned> index_;
+};
+
+} // namespace mm
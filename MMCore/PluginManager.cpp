@@ -65,7 +65,8 @@ const char* const LIB_NAME_SUFFIX = "";
 
 std::vector<std::string> CPluginManager::fallbackSearchPaths_;
 
-CPluginManager::CPluginManager()
+CPluginManager::CPluginManager() :
+   catalogChanged_(false)
 {
    const std::vector<std::string> paths = GetDefaultSearchPaths();
    SetSearchPaths(paths.begin(), paths.end());
@@ -73,6 +74,7 @@ CPluginManager::CPluginManager()
 
 CPluginManager::~CPluginManager()
 {
+   SaveCatalog();
 }
 
 
@@ -114,6 +116,19 @@ CPluginManager::FindInSearchPath(std::string filename)
    return filename;
 }
 
+/**
+ * Return the path of a device adapter module's file, as found in the search
+ * paths (or the bare filename if not found).
+ */
+std::string
+CPluginManager::FindModuleFile(const std::string& moduleName)
+{
+   std::string filename(LIB_NAME_PREFIX);
+   filename += moduleName;
+   filename += LIB_NAME_SUFFIX;
+   return FindInSearchPath(filename);
+}
+
 /** 
  * Load a plugin library.
  *
@@ -145,13 +160,9 @@ CPluginManager::GetDeviceAdapter(const std::string& moduleName)
       return it->second;
    }
 
-   std::string filename(LIB_NAME_PREFIX);
-   filename += moduleName;
-   filename += LIB_NAME_SUFFIX;
-   filename = FindInSearchPath(filename);
-
    boost::shared_ptr<LoadedDeviceAdapter> module =
-      boost::make_shared<LoadedDeviceAdapter>(moduleName, filename);
+      boost::make_shared<LoadedDeviceAdapter>(moduleName,
+            FindModuleFile(moduleName));
    moduleMap_[moduleName] = module;
    return module;
 }
@@ -166,6 +177,94 @@ CPluginManager::GetDeviceAdapter(const char* moduleName)
    return GetDeviceAdapter(std::string(moduleName));
 }
 
+/**
+ * Return the devices provided by a device adapter module.
+ *
+ * Listing the devices of every module (as the Hardware Configuration Wizard
+ * does) would otherwise load every module found, so the results are kept in
+ * the catalog, keyed by the module file's path, modification time and size.
+ * A module that has already been loaded is asked directly, since it may
+ * have been loaded from a path that is no longer searched.
+ *
+ * @param moduleName Simple module name without path, prefix, or suffix.
+ */
+std::vector<mm::DeviceAdapterCatalog::Device>
+CPluginManager::GetAvailableDevices(const char* moduleName)
+{
+   if (!moduleName)
+   {
+      throw CMMError("Null device adapter module name");
+   }
+   if (moduleName[0] == '\0')
+   {
+      throw CMMError("Empty device adapter module name");
+   }
+
+   std::string path;
+   mm::DeviceAdapterCatalog::FileStamp stamp;
+   bool haveStamp = false;
+   if (moduleMap_.find(moduleName) == moduleMap_.end())
+   {
+      path = FindModuleFile(moduleName);
+      haveStamp = mm::DeviceAdapterCatalog::GetFileStamp(path, stamp);
+      if (haveStamp)
+      {
+         const std::vector<mm::DeviceAdapterCatalog::Device>* devices =
+            catalog_.Find(path, stamp);
+         if (devices)
+            return *devices;
+      }
+   }
+
+   boost::shared_ptr<LoadedDeviceAdapter> module = GetDeviceAdapter(moduleName);
+   std::vector<std::string> names = module->GetAvailableDeviceNames();
+   std::vector<mm::DeviceAdapterCatalog::Device> devices(names.size());
+   for (size_t i = 0; i < names.size(); ++i)
+   {
+      devices[i].name = names[i];
+      devices[i].description = module->GetDeviceDescription(names[i]);
+      try
+      {
+         devices[i].type = module->GetAdvertisedDeviceType(names[i]);
+      }
+      catch (const CMMError&)
+      {
+         // Recorded as such; getAvailableDeviceTypes() reports the error
+         devices[i].type = MM::UnknownType;
+      }
+   }
+
+   if (haveStamp)
+   {
+      // Saved later, so that listing every module writes the file once
+      catalog_.Store(path, stamp, devices);
+      catalogChanged_ = true;
+   }
+   return devices;
+}
+
+size_t
+CPluginManager::SetCatalogFile(const std::string& filename)
+{
+   SaveCatalog();
+   catalogFile_ = filename;
+   catalog_.Clear();
+   catalogChanged_ = false;
+   if (!catalogFile_.empty())
+      catalog_.Load(catalogFile_);
+   return catalog_.GetModuleCount();
+}
+
+void
+CPluginManager::SaveCatalog()
+{
+   if (!catalogChanged_ || catalogFile_.empty())
+      return;
+   // Failing to save only costs loading the modules again next session
+   catalog_.Save(catalogFile_);
+   catalogChanged_ = false;
+}
+
 /** 
  * Unload a module.
  */
@@ -25,6 +25,7 @@
 
 
 #include "../MMDevice/DeviceThreads.h"
+#include "DeviceAdapterCatalog.h"
 
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
@@ -64,16 +65,36 @@ public:
    boost::shared_ptr<LoadedDeviceAdapter>
    GetDeviceAdapter(const char* moduleName);
 
+   /**
+    * Return the devices provided by a device adapter module, from the
+    * catalog if it has an entry for the unchanged module file; otherwise the
+    * module is loaded, and the catalog updated (see SaveCatalog())
+    */
+   std::vector<mm::DeviceAdapterCatalog::Device>
+   GetAvailableDevices(const char* moduleName);
+
+   // The file in which the catalog is kept across sessions; empty to keep it
+   // in memory only. Returns the number of modules read from the file.
+   size_t SetCatalogFile(const std::string& filename);
+   std::string GetCatalogFile() const { return catalogFile_; }
+   // Write the catalog to its file, if it has changed since last written
+   void SaveCatalog();
+
 private:
    static std::vector<std::string> GetDefaultSearchPaths();
    std::vector<std::string> GetActualSearchPaths() const;
    static void GetModules(std::vector<std::string> &modules, const char *path);
    std::string FindInSearchPath(std::string filename);
+   std::string FindModuleFile(const std::string& moduleName);
 
    std::vector<std::string> preferredSearchPaths_;
    static std::vector<std::string> fallbackSearchPaths_;
 
    std::map< std::string, boost::shared_ptr<LoadedDeviceAdapter> > moduleMap_;
+
+   mm::DeviceAdapterCatalog catalog_;
+   std::string catalogFile_;
+   bool catalogChanged_;
 };
 
 #endif //_PLUGIN_MANAGER_H_
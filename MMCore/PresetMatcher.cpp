@@ -0,0 +1,91 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Compiled form of a group of presets, for finding the preset
+//                that matches the current property values
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "PresetMatcher.h"
+
+
+namespace mm {
+
+PresetMatcher::PresetMatcher() :
+   firstEmptyPreset_(NoPreset)
+{
+}
+
+void PresetMatcher::AddPreset(const std::string& name,
+      const Configuration& preset)
+{
+   const size_t presetNumber = presetNames_.size();
+   presetNames_.push_back(name);
+   presetSizes_.push_back(preset.size());
+   if (preset.size() == 0 && firstEmptyPreset_ == NoPreset)
+      firstEmptyPreset_ = presetNumber;
+
+   for (size_t i = 0; i < preset.size(); ++i)
+   {
+      PropertySetting setting = preset.getSetting(i);
+      const std::string key = setting.getKey();
+
+      boost::unordered_map<std::string, size_t>::const_iterator found =
+         propertyNumbers_.find(key);
+      size_t propertyNumber;
+      if (found != propertyNumbers_.end())
+         propertyNumber = found->second;
+      else
+      {
+         propertyNumber = properties_.size();
+         propertyNumbers_[key] = propertyNumber;
+         properties_.push_back(Property());
+         Property& property = properties_.back();
+         property.deviceLabel = setting.getDeviceLabel();
+         property.propertyName = setting.getPropertyName();
+         property.key = key;
+      }
+
+      properties_[propertyNumber].presetsByValue[setting.getPropertyValue()].
+         push_back(presetNumber);
+   }
+}
+
+std::string PresetMatcher::Match(const std::vector<const std::string*>& values) const
+{
+   // Count, for each preset, the settings that have the current value
+   std::vector<size_t> matchCounts(presetNames_.size(), 0);
+   size_t best = firstEmptyPreset_;
+   for (size_t i = 0; i < properties_.size() && i < values.size(); ++i)
+   {
+      if (!values[i])
+         continue;
+      const Property& property = properties_[i];
+      boost::unordered_map<std::string, std::vector<size_t> >::const_iterator it =
+         property.presetsByValue.find(*values[i]);
+      if (it == property.presetsByValue.end())
+         continue;
+
+      for (std::vector<size_t>::const_iterator preset = it->second.begin(),
+            end = it->second.end(); preset != end; ++preset)
+      {
+         if (++matchCounts[*preset] == presetSizes_[*preset] && *preset < best)
+            best = *preset;
+      }
+   }
+
+   if (best == NoPreset)
+      return std::string();
+   return presetNames_[best];
+}
+
+} // namespace mm
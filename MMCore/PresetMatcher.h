@@ -0,0 +1,86 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Compiled form of a group of presets, for finding the preset
+//                that matches the current property values
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Configuration.h"
+
+#include <boost/unordered_map.hpp>
+
+#include <string>
+#include <vector>
+
+namespace mm {
+
+/**
+ * The presets of a group, compiled for finding which preset the current
+ * property values match.
+ *
+ * The properties used by any of the presets are numbered (in the order in
+ * which they first appear), and for each property the presets are indexed
+ * by the value they require, so that matching takes one hash lookup per
+ * property, with no copying of the values. Immutable once built.
+ */
+class PresetMatcher
+{
+public:
+   PresetMatcher();
+
+   // Presets must be added in the order in which they are to be preferred
+   // when more than one matches
+   void AddPreset(const std::string& name, const Configuration& preset);
+
+   size_t GetPresetCount() const { return presetNames_.size(); }
+
+   size_t GetPropertyCount() const { return properties_.size(); }
+   const std::string& GetDeviceLabel(size_t property) const
+   { return properties_[property].deviceLabel; }
+   const std::string& GetPropertyName(size_t property) const
+   { return properties_[property].propertyName; }
+   // The setting key (see PropertySetting::getKey())
+   const std::string& GetKey(size_t property) const
+   { return properties_[property].key; }
+
+   /**
+    * Returns the name of the first preset whose settings all have the
+    * current values, or an empty string if there is none.
+    *
+    * values[i] points to the current value of property i, or is null if the
+    * value is not known (which no preset using the property matches).
+    */
+   std::string Match(const std::vector<const std::string*>& values) const;
+
+private:
+   struct Property
+   {
+      std::string deviceLabel;
+      std::string propertyName;
+      std::string key;
+      // Presets (by number) that include the property, by required value
+      boost::unordered_map<std::string, std::vector<size_t> > presetsByValue;
+   };
+
+   static const size_t NoPreset = static_cast<size_t>(-1);
+
+   std::vector<Property> properties_;
+   boost::unordered_map<std::string, size_t> propertyNumbers_; // By key
+   std::vector<std::string> presetNames_;
+   std::vector<size_t> presetSizes_; // Number of settings of each preset
+   size_t firstEmptyPreset_; // Matches anything
+};
+
+} // namespace mm
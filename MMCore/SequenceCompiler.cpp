@@ -0,0 +1,199 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Splits an acquisition plan into runs of images that can be
+//                taken with hardware sequences
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "SequenceCompiler.h"
+
+#include "AcquisitionPlan.h"
+
+#include <map>
+
+
+namespace mm {
+
+namespace {
+
+// Gives the images without a value that of the image before them, or (for
+// those before the first value) the first value
+template <typename T>
+void FillGaps(std::vector<T>& values, const std::vector<bool>& given)
+{
+   size_t first = 0;
+   while (first < given.size() && !given[first])
+      ++first;
+   if (first == given.size())
+      return;
+   for (size_t i = 0; i < first; ++i)
+      values[i] = values[first];
+   for (size_t i = first + 1; i < values.size(); ++i)
+   {
+      if (!given[i])
+         values[i] = values[i - 1];
+   }
+}
+
+} // anonymous namespace
+
+
+bool SequenceCompiler::Axis::SameValue(size_t image1, size_t image2) const
+{
+   switch (type)
+   {
+      case AxisProperty:
+         return values[image1] == values[image2];
+      case AxisXY:
+         if (yPositions[image1] != yPositions[image2])
+            return false;
+         // Fall through
+      default:
+         return positions[image1] == positions[image2];
+   }
+}
+
+
+SequenceCompiler::SequenceCompiler(const AcquisitionPlan& plan) :
+   imageCount_(plan.size())
+{
+   const size_t n = imageCount_;
+   const size_t noAxis = size_t(-1);
+   size_t zAxis = noAxis, xyAxis = noAxis, exposureAxis = noAxis;
+   std::map<std::string, size_t> propertyAxes; // By "device-property" key
+   std::vector< std::vector<bool> > given;
+
+   for (size_t i = 0; i < n; ++i)
+   {
+      AcquisitionEvent event = plan.getEvent(i);
+
+      // Axes are created in the order they first appear in the plan
+      if (event.hasZPosition())
+      {
+         if (zAxis == noAxis)
+         {
+            zAxis = axes_.size();
+            axes_.push_back(Axis());
+            axes_.back().type = AxisZ;
+            axes_.back().positions.resize(n);
+            given.push_back(std::vector<bool>(n, false));
+         }
+         axes_[zAxis].positions[i] = event.getZPosition();
+         given[zAxis][i] = true;
+      }
+      if (event.hasXYPosition())
+      {
+         if (xyAxis == noAxis)
+         {
+            xyAxis = axes_.size();
+            axes_.push_back(Axis());
+            axes_.back().type = AxisXY;
+            axes_.back().positions.resize(n);
+            axes_.back().yPositions.resize(n);
+            given.push_back(std::vector<bool>(n, false));
+         }
+         axes_[xyAxis].positions[i] = event.getXPosition();
+         axes_[xyAxis].yPositions[i] = event.getYPosition();
+         given[xyAxis][i] = true;
+      }
+      if (event.hasExposure())
+      {
+         if (exposureAxis == noAxis)
+         {
+            exposureAxis = axes_.size();
+            axes_.push_back(Axis());
+            axes_.back().type = AxisExposure;
+            axes_.back().positions.resize(n);
+            given.push_back(std::vector<bool>(n, false));
+         }
+         axes_[exposureAxis].positions[i] = event.getExposure();
+         given[exposureAxis][i] = true;
+      }
+
+      Configuration props = event.getProperties();
+      for (size_t j = 0; j < props.size(); ++j)
+      {
+         PropertySetting setting = props.getSetting(j);
+         std::map<std::string, size_t>::iterator it =
+            propertyAxes.find(setting.getKey());
+         if (it == propertyAxes.end())
+         {
+            it = propertyAxes.insert(std::make_pair(setting.getKey(),
+                     axes_.size())).first;
+            axes_.push_back(Axis());
+            axes_.back().type = AxisProperty;
+            axes_.back().device = setting.getDeviceLabel();
+            axes_.back().property = setting.getPropertyName();
+            axes_.back().values.resize(n);
+            given.push_back(std::vector<bool>(n, false));
+         }
+         axes_[it->second].values[i] = setting.getPropertyValue();
+         given[it->second][i] = true;
+      }
+   }
+
+   for (size_t a = 0; a < axes_.size(); ++a)
+   {
+      Axis& axis = axes_[a];
+      axis.maxSequenceLength = 0;
+      if (axis.type == AxisProperty)
+         FillGaps(axis.values, given[a]);
+      else
+         FillGaps(axis.positions, given[a]);
+      if (axis.type == AxisXY)
+         FillGaps(axis.yPositions, given[a]);
+   }
+}
+
+void SequenceCompiler::SetMaxSequenceLength(size_t axis, long maxLength)
+{
+   axes_[axis].maxSequenceLength = maxLength > 0 ? maxLength : 0;
+}
+
+std::vector<SequenceCompiler::Chunk> SequenceCompiler::Compile() const
+{
+   std::vector<Chunk> chunks;
+   size_t first = 0;
+   while (first < imageCount_)
+   {
+      Chunk chunk;
+      chunk.firstImage = first;
+      chunk.imageCount = 1;
+      chunk.sequenced.assign(axes_.size(), false);
+
+      for (size_t image = first + 1; image < imageCount_; ++image)
+      {
+         const size_t length = image - first + 1;
+         std::vector<bool> sequenced = chunk.sequenced;
+         bool fits = true;
+         for (size_t a = 0; a < axes_.size() && fits; ++a)
+         {
+            if (!sequenced[a] && !axes_[a].SameValue(first, image))
+               sequenced[a] = true;
+            if (sequenced[a] &&
+                  length > static_cast<size_t>(axes_[a].maxSequenceLength))
+               fits = false;
+         }
+         if (!fits)
+            break;
+         chunk.sequenced.swap(sequenced);
+         chunk.imageCount = length;
+      }
+
+      chunks.push_back(chunk);
+      first += chunk.imageCount;
+   }
+   return chunks;
+}
+
+} // namespace mm
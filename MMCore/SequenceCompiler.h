@@ -0,0 +1,88 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Splits an acquisition plan into runs of images that can be
+//                taken with hardware sequences
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+class AcquisitionPlan;
+
+namespace mm {
+
+/**
+ * Compiles an acquisition plan into chunks: runs of consecutive images
+ * during which every setting either stays the same or can be stepped by a
+ * hardware sequence (triggered by the camera), so that each chunk can be
+ * taken with a single sequence acquisition.
+ *
+ * Each setting that the plan changes (Z, XY, exposure, each property) is an
+ * axis, with one value per image: an image that does not give a value
+ * keeps that of the image before it (images before the first value take
+ * the first value). The caller sets the maximum sequence length of each
+ * axis (0 if the device is not sequenceable) before compiling.
+ */
+class SequenceCompiler
+{
+public:
+   enum AxisType
+   {
+      AxisZ,
+      AxisXY,
+      AxisExposure,
+      AxisProperty
+   };
+
+   struct Axis
+   {
+      AxisType type;
+      std::string device; // Property axes only
+      std::string property; // Property axes only
+      std::vector<double> positions; // Z, X or exposure (ms), per image
+      std::vector<double> yPositions; // XY only
+      std::vector<std::string> values; // Property values, per image
+      long maxSequenceLength; // 0 if not sequenceable
+
+      bool SameValue(size_t image1, size_t image2) const;
+   };
+
+   struct Chunk
+   {
+      size_t firstImage;
+      size_t imageCount;
+      // Per axis: whether it changes within the chunk (and is to be run
+      // as a sequence)
+      std::vector<bool> sequenced;
+   };
+
+   explicit SequenceCompiler(const AcquisitionPlan& plan);
+
+   size_t GetImageCount() const { return imageCount_; }
+   size_t GetAxisCount() const { return axes_.size(); }
+   const Axis& GetAxis(size_t axis) const { return axes_[axis]; }
+   void SetMaxSequenceLength(size_t axis, long maxLength);
+
+   // Splits the plan greedily: each chunk is extended for as long as the
+   // axes that change within it can hold its length as a sequence
+   std::vector<Chunk> Compile() const;
+
+private:
+   size_t imageCount_;
+   std::vector<Axis> axes_;
+};
+
+} // namespace mm
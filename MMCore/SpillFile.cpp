@@ -0,0 +1,246 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Temporary file holding frames that overflowed the sequence
+//                buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "SpillFile.h"
+
+#include "CoreUtils.h"
+#include "ErrorCodes.h"
+#include "MetadataKeyTable.h"
+
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+#endif
+
+namespace mm {
+
+namespace {
+
+// Pixels of each record start at a multiple of this
+const unsigned long long recordAlignment = 64;
+
+// Creates the file and reserves disk space for all of it. Without the
+// reservation, writing to a mapped sparse file on a full disk would crash
+// the process instead of failing.
+bool CreatePreallocatedFile(const std::string& path, unsigned long long bytes)
+{
+#ifdef __linux__
+   int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+   if (fd < 0)
+      return false;
+   bool ok = (::posix_fallocate(fd, 0, (off_t)bytes) == 0);
+   ok = (::close(fd) == 0) && ok;
+   return ok;
+#else
+   // Extending the file allocates it on Windows (NTFS) and macOS (APFS and
+   // HFS+ do not create sparse files this way).
+   std::filebuf file;
+   if (!file.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc))
+      return false;
+   bool ok = file.pubseekoff((std::streamoff)(bytes - 1), std::ios::beg) != std::streampos(-1) &&
+      file.sputc(0) != std::filebuf::traits_type::eof();
+   ok = (file.close() != 0) && ok;
+   return ok;
+#endif
+}
+
+#ifdef __linux__
+const long tmpfsMagic = 0x01021994; // TMPFS_MAGIC from linux/magic.h
+
+// Whether files in the directory are kept in memory
+bool IsInMemoryFileSystem(const std::string& directory)
+{
+   struct statfs info;
+   return ::statfs(directory.c_str(), &info) == 0 && info.f_type == tmpfsMagic;
+}
+#endif
+
+} // anonymous namespace
+
+SpillFile::SpillFile(const std::string& directory, unsigned long capacityMB,
+      unsigned numChannels, unsigned width, unsigned height,
+      unsigned byteDepth) throw (CMMError) :
+   numChannels_(numChannels),
+   channelBytes_((unsigned long)width * height * byteDepth),
+   head_(0),
+   tail_(0)
+{
+   const unsigned long long unaligned = sizeof(MM::FrameMetadata) +
+      (unsigned long long)numChannels * channelBytes_;
+   recordBytes_ = (unaligned + recordAlignment - 1) / recordAlignment * recordAlignment;
+   capacity_ = (unsigned long)(((unsigned long long)capacityMB << 20) / recordBytes_);
+   if (capacity_ == 0)
+      throw CMMError("Sequence buffer spill file is too small to hold one image",
+            MMERR_InvalidContents);
+
+   std::string dir = directory.empty() ? DefaultDirectory() : directory;
+   path_ = dir + "/MMCoreSpill-" +
+      boost::lexical_cast<std::string>(GetMMTimeNow().getUsec()) + "-" +
+      boost::lexical_cast<std::string>(this) + ".tmp";
+
+   if (!CreatePreallocatedFile(path_, capacity_ * recordBytes_))
+   {
+      std::remove(path_.c_str());
+      throw CMMError("Cannot create sequence buffer spill file " + path_ +
+            " of " + boost::lexical_cast<std::string>(capacityMB) + " MB",
+            MMERR_FileOpenFailed);
+   }
+
+   try
+   {
+      boost::interprocess::file_mapping file(path_.c_str(),
+            boost::interprocess::read_write);
+      boost::interprocess::mapped_region region(file,
+            boost::interprocess::read_write, 0,
+            (std::size_t)(capacity_ * recordBytes_));
+      region_.swap(region);
+   }
+   catch (const boost::interprocess::interprocess_exception& e)
+   {
+      std::remove(path_.c_str());
+      throw CMMError("Cannot map sequence buffer spill file " + path_ +
+            ": " + e.what(), MMERR_FileOpenFailed);
+   }
+
+   // Frames are written and read in order
+   region_.advise(boost::interprocess::mapped_region::advice_sequential);
+}
+
+SpillFile::~SpillFile()
+{
+   // The file cannot be removed while mapped on Windows
+   boost::interprocess::mapped_region unmapped;
+   region_.swap(unmapped);
+   std::remove(path_.c_str());
+}
+
+unsigned char* SpillFile::Record(long long index) const
+{
+   return static_cast<unsigned char*>(region_.get_address()) +
+      (std::size_t)((unsigned long long)(index % capacity_) * recordBytes_);
+}
+
+void SpillFile::Write(const FrameBuffer& frame)
+{
+   unsigned char* record = Record(tail_);
+   unsigned char* pixels = record + sizeof(MM::FrameMetadata);
+   written_ = Entry();
+   for (unsigned i = 0; i < numChannels_; ++i)
+   {
+      const ImgBuffer* img = frame.FindImage(i);
+      if (!img)
+         continue;
+      if (i == 0)
+      {
+         // Constructed in place, so that Read() can refer to it
+         new (record) MM::FrameMetadata(img->GetRecord());
+         written_.tags = img->GetTags();
+         written_.insertTimeUs = img->GetInsertTimeUs();
+      }
+      std::memcpy(pixels + i * channelBytes_, img->GetPixels(), channelBytes_);
+   }
+}
+
+void SpillFile::Append()
+{
+   entries_.push_back(written_);
+   written_ = Entry();
+   ++tail_;
+}
+
+bool SpillFile::Pop(FrameBuffer& frame, const MetadataKeyTable* keys)
+{
+   if (head_ == tail_)
+      return false;
+
+   Entry entry = entries_.front();
+   entries_.pop_front();
+   return Read(head_++, frame, entry, keys);
+}
+
+bool SpillFile::Peek(unsigned long n, FrameBuffer& frame,
+      const MetadataKeyTable* keys) const
+{
+   if (n >= GetCount())
+      return false;
+   return Read(tail_ - 1 - n, frame, entries_[entries_.size() - 1 - n], keys);
+}
+
+void SpillFile::Clear()
+{
+   entries_.clear();
+   head_ = tail_;
+}
+
+double SpillFile::GetOldestInsertTimeUs() const
+{
+   if (entries_.empty())
+      return 0.0;
+   return entries_.front().insertTimeUs;
+}
+
+bool SpillFile::Read(long long index, FrameBuffer& frame, const Entry& entry,
+      const MetadataKeyTable* keys) const
+{
+   const unsigned char* record = Record(index);
+   const unsigned char* pixels = record + sizeof(MM::FrameMetadata);
+
+   const MM::FrameMetadata& md =
+      *reinterpret_cast<const MM::FrameMetadata*>(record);
+   for (unsigned i = 0; i < numChannels_; ++i)
+   {
+      ImgBuffer* img = frame.FindImage(i);
+      if (!img)
+         return false;
+      std::memcpy(img->GetPixelsRW(), pixels + i * channelBytes_, channelBytes_);
+      img->SetMetadata(md, entry.tags, keys);
+      img->SetInsertTimeUs(entry.insertTimeUs);
+   }
+   return true;
+}
+
+std::string SpillFile::DefaultDirectory()
+{
+#ifdef _WIN32
+   const char* dir = std::getenv("TEMP");
+   if (!dir)
+      dir = std::getenv("TMP");
+   return dir ? dir : ".";
+#else
+   const char* dir = std::getenv("TMPDIR");
+   std::string path = dir ? dir : "/tmp";
+#ifdef __linux__
+   // A spill file on tmpfs would save no memory
+   if (IsInMemoryFileSystem(path) && !IsInMemoryFileSystem("/var/tmp"))
+      return "/var/tmp";
+#endif
+   return path;
+#endif
+}
+
+} // namespace mm
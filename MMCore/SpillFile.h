@@ -0,0 +1,105 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Temporary file holding frames that overflowed the sequence
+//                buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Error.h"
+#include "FrameBuffer.h"
+
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <deque>
+#include <string>
+
+namespace mm {
+
+class MetadataKeyTable;
+
+/**
+ * First-in, first-out store of frames in a preallocated, memory-mapped
+ * temporary file, used by the sequence buffer as a second tier behind its
+ * frames in memory.
+ *
+ * The file is a ring of fixed-size records (metadata record followed by the
+ * pixels of all channels), sized once when it is created. Disk space is
+ * reserved up front, so that writing to the mapping cannot fail later. The
+ * file is deleted when the object is destroyed. The directory should be on
+ * disk: a file in memory (tmpfs) takes as much memory as the frames would.
+ *
+ * Not thread-safe, with one exception: the record written by Write() is not
+ * touched by Pop(), Peek() or Clear(), so the (slow) copy can proceed while
+ * readers use the file, as long as the calls to IsFull(), Append() and the
+ * reading functions are serialized.
+ */
+class SpillFile : boost::noncopyable
+{
+public:
+   SpillFile(const std::string& directory, unsigned long capacityMB,
+         unsigned numChannels, unsigned width, unsigned height,
+         unsigned byteDepth) throw (CMMError);
+   ~SpillFile();
+
+   const std::string& GetPath() const { return path_; }
+   unsigned long GetCapacity() const { return capacity_; }
+   unsigned long GetCount() const { return (unsigned long)(tail_ - head_); }
+   bool IsFull() const { return GetCount() >= capacity_; }
+
+   // Copies frame into the record after the newest frame. The frame becomes
+   // part of the file only when Append() is called.
+   void Write(const FrameBuffer& frame);
+   void Append();
+
+   // Removes the oldest frame and reads it into frame
+   bool Pop(FrameBuffer& frame, const MetadataKeyTable* keys);
+   // Reads the n-th newest frame (0 = newest) into frame
+   bool Peek(unsigned long n, FrameBuffer& frame,
+         const MetadataKeyTable* keys) const;
+   void Clear();
+   // When the oldest frame entered the sequence buffer; 0 if there is none
+   double GetOldestInsertTimeUs() const;
+
+   // The system temporary directory, or /var/tmp where that is tmpfs
+   static std::string DefaultDirectory();
+
+private:
+   // What a stored frame keeps outside of its record
+   struct Entry
+   {
+      boost::shared_ptr<const Metadata> tags; // Usually shared by all frames
+      double insertTimeUs;
+      Entry() : insertTimeUs(0.0) {}
+   };
+
+   unsigned char* Record(long long index) const;
+   bool Read(long long index, FrameBuffer& frame, const Entry& entry,
+         const MetadataKeyTable* keys) const;
+
+   std::string path_;
+   boost::interprocess::mapped_region region_;
+   unsigned numChannels_;
+   unsigned long channelBytes_;
+   unsigned long long recordBytes_;
+   unsigned long capacity_;
+   long long head_; // Index of the oldest frame
+   long long tail_; // Index one past the newest frame
+   std::deque<Entry> entries_;
+   Entry written_; // Of the frame last written
+};
+
+} // namespace mm
@@ -0,0 +1,151 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Worker threads for device calls that can run concurrently
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "ThreadPool.h"
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <algorithm>
+
+namespace mm {
+
+// The tasks of one RunAll() call; whichever thread is free takes the next
+class ThreadPool::Batch : boost::noncopyable
+{
+public:
+   explicit Batch(const std::vector<Task>& tasks) :
+      tasks_(tasks), count_(tasks.size()), next_(0), finished_(0)
+   {}
+
+   // Runs tasks until none is left to start
+   void Work()
+   {
+      for (;;)
+      {
+         size_t index;
+         {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (next_ == count_)
+               return;
+            index = next_++;
+         }
+
+         tasks_[index]();
+
+         boost::mutex::scoped_lock lock(mutex_);
+         if (++finished_ == count_)
+            allFinished_.notify_all();
+      }
+   }
+
+   void WaitForAll()
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (finished_ < count_)
+         allFinished_.wait(lock);
+   }
+
+private:
+   const std::vector<Task>& tasks_; // Not used once all are started
+   const size_t count_;
+   boost::mutex mutex_;
+   boost::condition_variable allFinished_;
+   size_t next_;
+   size_t finished_;
+};
+
+
+ThreadPool::ThreadPool(unsigned threadCount) :
+   threadCount_(threadCount > 0 ? threadCount : 1),
+   started_(false),
+   stopping_(false)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      stopping_ = true;
+   }
+   queueChanged_.notify_all();
+   threads_.join_all();
+}
+
+void
+ThreadPool::StartThreads()
+{
+   if (started_)
+      return;
+   for (unsigned i = 0; i < threadCount_; ++i)
+      threads_.create_thread(boost::bind(&ThreadPool::WorkerLoop, this));
+   started_ = true;
+}
+
+void
+ThreadPool::Submit(const Task& task)
+{
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      StartThreads();
+      queue_.push_back(task);
+   }
+   queueChanged_.notify_one();
+}
+
+void
+ThreadPool::RunAll(const std::vector<Task>& tasks)
+{
+   if (tasks.empty())
+      return;
+   if (tasks.size() == 1)
+   {
+      tasks[0]();
+      return;
+   }
+
+   // Helpers that only start after RunAll() returns find nothing left to
+   // do; they keep the batch alive until then
+   boost::shared_ptr<Batch> batch = boost::make_shared<Batch>(tasks);
+   size_t helpers = std::min<size_t>(tasks.size() - 1, threadCount_);
+   for (size_t i = 0; i < helpers; ++i)
+      Submit(boost::bind(&Batch::Work, batch));
+
+   batch->Work();
+   batch->WaitForAll();
+}
+
+void
+ThreadPool::WorkerLoop()
+{
+   for (;;)
+   {
+      Task task;
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         while (queue_.empty() && !stopping_)
+            queueChanged_.wait(lock);
+         if (queue_.empty())
+            return;
+         task = queue_.front();
+         queue_.pop_front();
+      }
+      task();
+   }
+}
+
+} // namespace mm
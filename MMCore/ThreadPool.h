@@ -0,0 +1,73 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//
+// DESCRIPTION:   Worker threads for device calls that can run concurrently
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+
+#include <deque>
+#include <vector>
+
+namespace mm {
+
+/**
+ * A fixed number of worker threads, started when first needed.
+ *
+ * Used to make calls to devices in different adapter modules at the same
+ * time (calls to devices in one module are serialized by the module lock
+ * anyway). Tasks must not throw.
+ */
+class ThreadPool : boost::noncopyable
+{
+public:
+   typedef boost::function<void ()> Task;
+
+   explicit ThreadPool(unsigned threadCount);
+   ~ThreadPool(); // Waits for the queued tasks to finish
+
+   unsigned GetThreadCount() const { return threadCount_; }
+
+   // Runs task on a worker thread, when one is free
+   void Submit(const Task& task);
+
+   /**
+    * Runs the tasks concurrently and returns when all have finished. The
+    * calling thread runs tasks too, so this completes even if all workers
+    * are busy (e.g. when called from a task).
+    */
+   void RunAll(const std::vector<Task>& tasks);
+
+private:
+   class Batch;
+
+   void StartThreads(); // Called with mutex_ held
+   void WorkerLoop();
+
+   const unsigned threadCount_;
+   boost::mutex mutex_;
+   boost::condition_variable queueChanged_;
+   std::deque<Task> queue_;
+   boost::thread_group threads_;
+   bool started_;
+   bool stopping_;
+};
+
+} // namespace mm
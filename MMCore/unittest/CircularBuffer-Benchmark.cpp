@@ -0,0 +1,186 @@
+// Sustained throughput of the sequence buffer with one inserting thread (the
+// camera), one popping thread (e.g. the acquisition engine) and one peeking
+// thread (e.g. the live view).
+//
+// Usage: CircularBuffer-Benchmark [seconds [width height [bytesPerPixel]]]
+
+#include "CircularBuffer.h"
+
+#include "../MMDevice/ImageMetadata.h"
+
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+namespace {
+
+struct Counters
+{
+   boost::atomic<unsigned long long> inserted;
+   boost::atomic<unsigned long long> overflowed;
+   boost::atomic<unsigned long long> popped;
+   boost::atomic<unsigned long long> peeked;
+
+   Counters() : inserted(0), overflowed(0), popped(0), peeked(0) {}
+};
+
+class Producer
+{
+   CircularBuffer& cb_;
+   Counters& counters_;
+   boost::atomic<bool>& stop_;
+
+public:
+   Producer(CircularBuffer& cb, Counters& counters, boost::atomic<bool>& stop) :
+      cb_(cb), counters_(counters), stop_(stop)
+   {}
+
+   void Run()
+   {
+      std::vector<unsigned char> pixels(cb_.Width() * cb_.Height() * cb_.Depth());
+      Metadata md;
+      md.put("Camera", "BenchmarkCamera");
+      while (!stop_.load(boost::memory_order_relaxed))
+      {
+         if (cb_.InsertImage(&pixels[0], cb_.Width(), cb_.Height(),
+                  cb_.Depth(), &md))
+            ++counters_.inserted;
+         else
+         {
+            ++counters_.overflowed;
+            boost::this_thread::yield();
+         }
+      }
+   }
+};
+
+class Popper
+{
+   CircularBuffer& cb_;
+   Counters& counters_;
+   boost::atomic<bool>& stop_;
+
+public:
+   Popper(CircularBuffer& cb, Counters& counters, boost::atomic<bool>& stop) :
+      cb_(cb), counters_(counters), stop_(stop)
+   {}
+
+   void Run()
+   {
+      // Copy out each frame as the language wrappers do
+      std::vector<unsigned char> copy(cb_.Width() * cb_.Height() * cb_.Depth());
+      while (!stop_.load(boost::memory_order_relaxed))
+      {
+         const mm::ImgBuffer* img = cb_.GetNextImageBuffer(0);
+         if (img)
+         {
+            Metadata md = img->GetMetadata();
+            std::memcpy(&copy[0], img->GetPixels(), copy.size());
+            ++counters_.popped;
+         }
+         else
+            boost::this_thread::yield();
+      }
+   }
+};
+
+class Peeker
+{
+   CircularBuffer& cb_;
+   Counters& counters_;
+   boost::atomic<bool>& stop_;
+
+public:
+   Peeker(CircularBuffer& cb, Counters& counters, boost::atomic<bool>& stop) :
+      cb_(cb), counters_(counters), stop_(stop)
+   {}
+
+   void Run()
+   {
+      while (!stop_.load(boost::memory_order_relaxed))
+      {
+         const mm::ImgBuffer* img = cb_.GetTopImageBuffer(0);
+         if (img)
+            ++counters_.peeked;
+         else
+            boost::this_thread::yield();
+      }
+   }
+};
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   double seconds = 5.0;
+   unsigned width = 2048;
+   unsigned height = 2048;
+   unsigned depth = 2;
+   try
+   {
+      if (argc > 1)
+         seconds = boost::lexical_cast<double>(argv[1]);
+      if (argc > 3)
+      {
+         width = boost::lexical_cast<unsigned>(argv[2]);
+         height = boost::lexical_cast<unsigned>(argv[3]);
+      }
+      if (argc > 4)
+         depth = boost::lexical_cast<unsigned>(argv[4]);
+   }
+   catch (const boost::bad_lexical_cast&)
+   {
+      std::cerr << "Usage: " << argv[0] <<
+         " [seconds [width height [bytesPerPixel]]]\n";
+      return 2;
+   }
+
+   CircularBuffer cb(1024);
+   if (!cb.Initialize(1, width, height, depth))
+   {
+      std::cerr << "Failed to initialize buffer\n";
+      return 1;
+   }
+
+   Counters counters;
+   boost::atomic<bool> stop(false);
+   Producer producer(cb, counters, stop);
+   Popper popper(cb, counters, stop);
+   Peeker peeker(cb, counters, stop);
+
+   boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
+   boost::thread popThread(&Popper::Run, &popper);
+   boost::thread peekThread(&Peeker::Run, &peeker);
+   boost::thread insertThread(&Producer::Run, &producer);
+
+   boost::this_thread::sleep(boost::posix_time::microseconds(
+            static_cast<long>(seconds * 1e6)));
+   stop.store(true);
+   insertThread.join();
+   popThread.join();
+   peekThread.join();
+   double elapsed = (boost::posix_time::microsec_clock::universal_time() -
+         start).total_microseconds() / 1e6;
+
+   std::cout << "Frame " << width << "x" << height << "x" << depth <<
+      ", " << cb.GetSize() << " slots, " << elapsed << " s\n";
+   std::cout << std::fixed << std::setprecision(1);
+   std::cout << "allocation: " << cb.GetAllocationTimeMs() << " ms" <<
+      (cb.HasHugePages() ? " (huge pages)" : "") << "\n";
+   std::cout << "first pass: " << cb.GetFirstPassMeanInsertTimeUs() <<
+      " us/insert mean, " << cb.GetFirstPassMaxInsertTimeUs() << " us max\n";
+   std::cout << "inserted:   " << counters.inserted / elapsed << " frames/s\n";
+   std::cout << "popped:     " << counters.popped / elapsed << " frames/s\n";
+   std::cout << "peeked:     " << counters.peeked / elapsed << " frames/s\n";
+   std::cout << "overflowed: " << counters.overflowed / elapsed << " inserts/s\n";
+   return 0;
+}
@@ -0,0 +1,983 @@
+#include <gtest/gtest.h>
+
+#include "CircularBuffer.h"
+
+#include "../MMDevice/ImageMetadata.h"
+#include "../MMDevice/MMDeviceConstants.h"
+
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <dirent.h>
+
+#include <string>
+#include <vector>
+
+
+namespace {
+
+const unsigned width = 64;
+const unsigned height = 32;
+const unsigned depth = 2;
+const unsigned frameBytes = width * height * depth;
+
+Metadata CameraMetadata(const std::string& camera)
+{
+   Metadata md;
+   md.put("Camera", camera);
+   return md;
+}
+
+long ImageNumber(const mm::ImgBuffer* img)
+{
+   return boost::lexical_cast<long>(img->GetMetadata().
+         GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue());
+}
+
+size_t CountSpillFiles(const std::string& directory)
+{
+   size_t count = 0;
+   DIR* dp = opendir(directory.c_str());
+   if (!dp)
+      return 0;
+   while (struct dirent* entry = readdir(dp))
+   {
+      if (std::string(entry->d_name).compare(0, 12, "MMCoreSpill-") == 0)
+         ++count;
+   }
+   closedir(dp);
+   return count;
+}
+
+} // anonymous namespace
+
+
+TEST(CircularBufferTests, InsertAndPopInOrder)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   ASSERT_GT(cb.GetSize(), 3u);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   for (unsigned char i = 0; i < 3; ++i)
+   {
+      pixels[0] = i;
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   }
+   EXPECT_EQ(3u, cb.GetRemainingImageCount());
+   EXPECT_EQ(cb.GetSize() - 3, cb.GetFreeSize());
+
+   for (unsigned char i = 0; i < 3; ++i)
+   {
+      const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+      ASSERT_TRUE(img != 0);
+      EXPECT_EQ(i, img->GetPixels()[0]);
+      EXPECT_EQ(i, ImageNumber(img));
+   }
+   EXPECT_TRUE(cb.GetNextImageBuffer(0) == 0);
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+}
+
+
+TEST(CircularBufferTests, NthFromTop)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   for (unsigned char i = 0; i < 5; ++i)
+   {
+      pixels[0] = i;
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   }
+
+   EXPECT_EQ(4, cb.GetTopImage()[0]);
+   EXPECT_EQ(2, cb.GetNthFromTopImageBuffer(2UL)->GetPixels()[0]);
+   EXPECT_TRUE(cb.GetNthFromTopImageBuffer(5UL) == 0);
+
+   // Peeking does not consume
+   EXPECT_EQ(5u, cb.GetRemainingImageCount());
+}
+
+
+TEST(CircularBufferTests, OverflowAndClear)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   for (unsigned long i = 0; i < cb.GetSize(); ++i)
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_FALSE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_TRUE(cb.Overflow());
+
+   cb.Clear();
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   EXPECT_EQ(cb.GetSize(), cb.GetFreeSize());
+   EXPECT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+}
+
+
+TEST(CircularBufferTests, RejectsIncompatibleImage)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+
+   std::vector<unsigned char> pixels(frameBytes);
+   EXPECT_THROW(cb.InsertImage(&pixels[0], width / 2, height, depth, 0),
+         CMMError);
+}
+
+
+TEST(CircularBufferTests, DropOldestOnOverflow)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetOverflowPolicy(CircularBuffer::DropOldest);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   const unsigned long size = cb.GetSize();
+   for (unsigned long i = 0; i < size + 2; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   }
+
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(size, cb.GetRemainingImageCount());
+   EXPECT_EQ(2, cb.GetOverflowCount());
+   EXPECT_EQ(2, cb.GetDroppedImageCount());
+   EXPECT_EQ(2, cb.GetNextImageBuffer(0)->GetPixels()[0]);
+
+   cb.ResetOverflowCounters();
+   EXPECT_EQ(0, cb.GetOverflowCount());
+   EXPECT_EQ(0, cb.GetDroppedImageCount());
+}
+
+
+TEST(CircularBufferTests, BlockTimesOutAndDropsNewImage)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetOverflowPolicy(CircularBuffer::BlockProducer);
+   cb.SetOverflowTimeoutMs(1.0);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   const unsigned long size = cb.GetSize();
+   for (unsigned long i = 0; i < size; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   }
+
+   pixels[0] = 0xff;
+   EXPECT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(1, cb.GetOverflowCount());
+   EXPECT_EQ(1, cb.GetDroppedImageCount());
+   EXPECT_EQ(size, cb.GetRemainingImageCount());
+   EXPECT_EQ(static_cast<unsigned char>(size - 1), cb.GetTopImage()[0]);
+}
+
+
+TEST(CircularBufferTests, BlockWaitsForConsumer)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetOverflowPolicy(CircularBuffer::BlockProducer);
+   cb.SetOverflowTimeoutMs(10000.0);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   const unsigned long size = cb.GetSize();
+   for (unsigned long i = 0; i < size; ++i)
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+
+   struct Consumer
+   {
+      CircularBuffer& cb;
+      explicit Consumer(CircularBuffer& cb) : cb(cb) {}
+      void operator()()
+      {
+         boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+         cb.GetNextImageBuffer(0);
+      }
+   };
+   boost::thread consumer((Consumer(cb)));
+   EXPECT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   consumer.join();
+
+   EXPECT_EQ(1, cb.GetOverflowCount());
+   EXPECT_EQ(0, cb.GetDroppedImageCount());
+   EXPECT_EQ(size, cb.GetRemainingImageCount());
+}
+
+
+TEST(CircularBufferTests, SpillToDiskKeepsOrder)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetSpillCapacityMB(1);
+   cb.SetOverflowPolicy(CircularBuffer::SpillToDisk);
+   // Only move frames when the buffer is full, so that the test does not
+   // depend on the timing of the background thread
+   cb.SetSpillHighWaterMark(1.0);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   const unsigned long size = cb.GetSize();
+   const unsigned long total = size + 5;
+   for (unsigned long i = 0; i < total; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   }
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(total, cb.GetRemainingImageCount());
+   EXPECT_EQ(5, cb.GetOverflowCount());
+   EXPECT_EQ(5, cb.GetSpilledImageCount());
+
+   // The oldest images are read back from the spill file
+   EXPECT_EQ(static_cast<unsigned char>(total - 1), cb.GetTopImage()[0]);
+   EXPECT_EQ(3, cb.GetNthFromTopImageBuffer(total - 4)->GetPixels()[0]);
+   EXPECT_TRUE(cb.GetNthFromTopImageBuffer(total) == 0);
+
+   double lastInsertTimeUs = 0.0;
+   for (unsigned long i = 0; i < total; ++i)
+   {
+      double insertTimeUs;
+      ASSERT_TRUE(cb.GetNextInsertTimeUs(insertTimeUs));
+      EXPECT_LE(lastInsertTimeUs, insertTimeUs);
+      lastInsertTimeUs = insertTimeUs;
+
+      const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+      ASSERT_TRUE(img != 0);
+      EXPECT_EQ(static_cast<unsigned char>(i), img->GetPixels()[0]);
+      EXPECT_EQ(static_cast<long>(i), ImageNumber(img));
+      EXPECT_EQ("Cam", img->GetMetadata().GetSingleTag("Camera").GetValue());
+      EXPECT_EQ(insertTimeUs, img->GetInsertTimeUs());
+   }
+   EXPECT_TRUE(cb.GetNextImageBuffer(0) == 0);
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   double insertTimeUs;
+   EXPECT_FALSE(cb.GetNextInsertTimeUs(insertTimeUs));
+}
+
+
+TEST(CircularBufferTests, SpillFileIsCreatedWhenPolicyIsSelected)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetSpillDirectory(".");
+   cb.SetSpillCapacityMB(1);
+   const size_t before = CountSpillFiles(".");
+   cb.SetOverflowPolicy(CircularBuffer::SpillToDisk);
+   EXPECT_EQ(before + 1, CountSpillFiles("."));
+
+   // Replaced (not added to) when the settings change
+   cb.SetSpillCapacityMB(2);
+   EXPECT_EQ(before + 1, CountSpillFiles("."));
+   cb.SetOverflowPolicy(CircularBuffer::ReportOverflow);
+   EXPECT_EQ(before, CountSpillFiles("."));
+}
+
+
+TEST(CircularBufferTests, SpillToDiskWithoutFileReportsOverflow)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetSpillHighWaterMark(1.0);
+   // The file cannot be created there, so spilling is not possible
+   cb.SetSpillDirectory("./no-such-directory");
+   cb.SetSpillCapacityMB(1);
+   cb.SetOverflowPolicy(CircularBuffer::SpillToDisk);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   for (unsigned long i = 0; i < cb.GetSize(); ++i)
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_FALSE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_TRUE(cb.Overflow());
+   EXPECT_EQ(0, cb.GetSpilledImageCount());
+}
+
+
+TEST(CircularBufferTests, SpillToDiskReportsOverflowWhenFileIsFull)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetSpillCapacityMB(1);
+   cb.SetOverflowPolicy(CircularBuffer::SpillToDisk);
+   cb.SetSpillHighWaterMark(1.0);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   unsigned long inserted = 0;
+   while (cb.InsertImage(&pixels[0], width, height, depth, &md))
+   {
+      ++inserted;
+      ASSERT_LT(inserted, cb.GetSize() + (1UL << 20) / frameBytes);
+   }
+   EXPECT_TRUE(cb.Overflow());
+   EXPECT_GT(inserted, cb.GetSize());
+   EXPECT_EQ(inserted, cb.GetRemainingImageCount());
+   EXPECT_EQ(static_cast<long long>(inserted - cb.GetSize()),
+         cb.GetSpilledImageCount());
+
+   cb.Clear();
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   EXPECT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+}
+
+
+TEST(CircularBufferTests, SpillToDiskMovesFramesInBackground)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetSpillCapacityMB(4);
+   cb.SetOverflowPolicy(CircularBuffer::SpillToDisk);
+   cb.SetSpillHighWaterMark(0.5);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   const unsigned long total = 2 * cb.GetSize();
+   for (unsigned long i = 0; i < total; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   }
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(total, cb.GetRemainingImageCount());
+
+   // The buffer is brought back to the high-water mark
+   for (int i = 0; i < 500 && cb.GetFreeSize() < cb.GetSize() / 2; ++i)
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+   EXPECT_GE(cb.GetFreeSize(), cb.GetSize() / 2);
+
+   for (unsigned long i = 0; i < total; ++i)
+   {
+      const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+      ASSERT_TRUE(img != 0);
+      EXPECT_EQ(static_cast<long>(i), ImageNumber(img));
+   }
+   EXPECT_TRUE(cb.GetNextImageBuffer(0) == 0);
+}
+
+
+TEST(CircularBufferTests, ClearAfterOverflowCountsDroppedImages)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   for (unsigned long i = 0; i < cb.GetSize(); ++i)
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_FALSE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+
+   cb.ClearAfterOverflow();
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   EXPECT_EQ(1, cb.GetOverflowCount());
+   EXPECT_EQ(static_cast<long long>(cb.GetSize()), cb.GetDroppedImageCount());
+}
+
+
+TEST(CircularBufferTests, AllocationOptions)
+{
+   CircularBuffer cb(8);
+   mm::FrameSlab::Options options;
+   options.hugePages = mm::FrameSlab::TransparentHugePages;
+   options.prefault = false;
+   cb.SetAllocationOptions(options);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   EXPECT_EQ(mm::FrameSlab::TransparentHugePages,
+         cb.GetAllocationOptions().hugePages);
+   EXPECT_GE(cb.GetAllocationTimeMs(), 0.0);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   for (unsigned char i = 0; i < 3; ++i)
+   {
+      pixels[0] = i;
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   }
+   EXPECT_GT(cb.GetFirstPassMeanInsertTimeUs(), 0.0);
+   EXPECT_GE(cb.GetFirstPassMaxInsertTimeUs(), cb.GetFirstPassMeanInsertTimeUs());
+   EXPECT_EQ(0, cb.GetNextImageBuffer(0)->GetPixels()[0]);
+
+   // Changing the options reallocates the buffer at the next Initialize()
+   options.prefault = true;
+   options.hugePages = mm::FrameSlab::NoHugePages;
+   cb.SetAllocationOptions(options);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   EXPECT_FALSE(cb.HasHugePages());
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   EXPECT_EQ(0.0, cb.GetFirstPassMaxInsertTimeUs());
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_EQ(2, cb.GetTopImage()[0]);
+}
+
+
+TEST(CircularBufferTests, ImageNumbersArePerCamera)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata mdA = CameraMetadata("A");
+   Metadata mdB = CameraMetadata("B");
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &mdA));
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &mdB));
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &mdA));
+
+   EXPECT_EQ(0, ImageNumber(cb.GetNextImageBuffer(0)));
+   EXPECT_EQ(0, ImageNumber(cb.GetNextImageBuffer(0)));
+   EXPECT_EQ(1, ImageNumber(cb.GetNextImageBuffer(0)));
+}
+
+
+TEST(CircularBufferTests, PopImagesInBatches)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   for (unsigned i = 0; i < 10; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   }
+
+   std::vector<unsigned char> batch(4 * frameBytes);
+   std::vector<Metadata> batchMd;
+   const unsigned batchSizes[] = {4, 4, 2};
+   unsigned next = 0;
+   for (unsigned b = 0; b < 3; ++b)
+   {
+      batchMd.clear();
+      ASSERT_EQ(batchSizes[b], cb.PopImages(4, 0, &batch[0], batchMd));
+      ASSERT_EQ(batchSizes[b], batchMd.size());
+      for (unsigned i = 0; i < batchSizes[b]; ++i, ++next)
+      {
+         EXPECT_EQ(next, batch[i * frameBytes]);
+         EXPECT_EQ(static_cast<long>(next), boost::lexical_cast<long>(batchMd[i].
+                  GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue()));
+         EXPECT_EQ("Cam", batchMd[i].GetSingleTag("Camera").GetValue());
+      }
+   }
+   EXPECT_EQ(10u, next);
+   EXPECT_EQ(0u, cb.PopImages(4, 0, &batch[0], batchMd));
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+}
+
+TEST(CircularBufferTests, PopImagesFromSpillFile)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetSpillCapacityMB(1);
+   cb.SetOverflowPolicy(CircularBuffer::SpillToDisk);
+   cb.SetSpillHighWaterMark(1.0);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   const unsigned long total = cb.GetSize() + 3;
+   for (unsigned long i = 0; i < total; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, 0));
+   }
+   ASSERT_EQ(3, cb.GetSpilledImageCount());
+
+   // The batch spans the spill file and the frames in memory
+   std::vector<unsigned char> batch(5 * frameBytes);
+   std::vector<Metadata> batchMd;
+   ASSERT_EQ(5u, cb.PopImages(5, 0, &batch[0], batchMd));
+   for (unsigned i = 0; i < 5; ++i)
+      EXPECT_EQ(i, batch[i * frameBytes]);
+   EXPECT_EQ(total - 5, cb.GetRemainingImageCount());
+}
+
+TEST(CircularBufferTests, InsertTimesMergeBuffersInArrivalOrder)
+{
+   // As when two cameras each have a buffer of their own
+   CircularBuffer first(1);
+   CircularBuffer second(1);
+   ASSERT_TRUE(first.Initialize(1, width, height, depth));
+   ASSERT_TRUE(second.Initialize(1, width, height, depth));
+
+   std::vector<unsigned char> pixels(frameBytes);
+   const unsigned total = 6;
+   for (unsigned i = 0; i < total; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      CircularBuffer& cb = (i % 3 == 0) ? first : second;
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, 0));
+      boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+   }
+
+   for (unsigned i = 0; i < total; ++i)
+   {
+      double firstUs, secondUs;
+      bool hasFirst = first.GetNextInsertTimeUs(firstUs);
+      bool hasSecond = second.GetNextInsertTimeUs(secondUs);
+      ASSERT_TRUE(hasFirst || hasSecond);
+      CircularBuffer& cb = (hasFirst && (!hasSecond || firstUs < secondUs)) ?
+         first : second;
+      const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+      ASSERT_TRUE(img != 0);
+      EXPECT_EQ(i, img->GetPixels()[0]);
+   }
+}
+
+TEST(CircularBufferTests, MergeSkipsBuffersOfAnotherFormat)
+{
+   // As when a large and a small camera each have a buffer of their own
+   const unsigned smallWidth = 16;
+   const unsigned smallHeight = 8;
+   const unsigned smallDepth = 1;
+   CircularBuffer large(1);
+   CircularBuffer small(1);
+   ASSERT_TRUE(large.Initialize(1, width, height, depth));
+   ASSERT_TRUE(small.Initialize(1, smallWidth, smallHeight, smallDepth));
+   std::vector<CircularBuffer*> buffers;
+   buffers.push_back(&large);
+   buffers.push_back(&small);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   const unsigned total = 6;
+   for (unsigned i = 0; i < total; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      if (i % 2 == 0)
+         ASSERT_TRUE(large.InsertImage(&pixels[0], width, height, depth, 0));
+      else
+         ASSERT_TRUE(small.InsertImage(&pixels[0], smallWidth, smallHeight,
+                  smallDepth, 0));
+      boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+   }
+
+   // The small frames arrived in between but are never picked for the
+   // large format, which the caller sizes the frame from
+   for (unsigned i = 0; i < total; i += 2)
+   {
+      CircularBuffer* cb =
+         CircularBuffer::EarliestOfFormat(buffers, width, height, depth);
+      ASSERT_TRUE(cb == &large);
+      const mm::ImgBuffer* img = cb->GetNextImageBuffer(0);
+      ASSERT_TRUE(img != 0);
+      EXPECT_EQ(i, img->GetPixels()[0]);
+      EXPECT_EQ(width, img->Width());
+      EXPECT_EQ(height, img->Height());
+      EXPECT_EQ(depth, img->Depth());
+   }
+   EXPECT_TRUE(CircularBuffer::EarliestOfFormat(buffers,
+            width, height, depth) == 0);
+   EXPECT_EQ(3u, small.GetRemainingImageCount());
+
+   for (unsigned i = 1; i < total; i += 2)
+   {
+      CircularBuffer* cb = CircularBuffer::EarliestOfFormat(buffers,
+            smallWidth, smallHeight, smallDepth);
+      ASSERT_TRUE(cb == &small);
+      const mm::ImgBuffer* img = cb->GetNextImageBuffer(0);
+      ASSERT_TRUE(img != 0);
+      EXPECT_EQ(i, img->GetPixels()[0]);
+      EXPECT_EQ(smallWidth, img->Width());
+      EXPECT_EQ(smallHeight, img->Height());
+   }
+   EXPECT_TRUE(CircularBuffer::EarliestOfFormat(buffers,
+            smallWidth, smallHeight, smallDepth) == 0);
+}
+
+TEST(CircularBufferTests, RejectedInsertLeavesBufferConsistent)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+
+   std::vector<unsigned char> pixels(2 * frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   EXPECT_FALSE(cb.InsertMultiChannel(&pixels[0], 2, width, height, depth, &md));
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+
+   pixels[0] = 7;
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+   ASSERT_TRUE(img != 0);
+   EXPECT_EQ(7, img->GetPixels()[0]);
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+}
+
+TEST(CircularBufferTests, FillSlotInPlace)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+
+   Metadata md = CameraMetadata("Cam");
+   unsigned char* slot = cb.AcquireSlot(width, height, depth, 1);
+   ASSERT_TRUE(slot != 0);
+   slot[0] = 42;
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   ASSERT_TRUE(cb.CommitSlot(slot, &md));
+   EXPECT_EQ(1u, cb.GetRemainingImageCount());
+
+   // A discarded slot is not published and is reused by the next insert
+   slot = cb.AcquireSlot(width, height, depth, 1);
+   ASSERT_TRUE(slot != 0);
+   ASSERT_TRUE(cb.DiscardSlot(slot));
+   EXPECT_FALSE(cb.CommitSlot(slot, &md));
+   EXPECT_EQ(1u, cb.GetRemainingImageCount());
+
+   const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+   ASSERT_TRUE(img != 0);
+   EXPECT_EQ(42, img->GetPixels()[0]);
+   EXPECT_EQ(0, ImageNumber(img));
+   EXPECT_THROW(cb.AcquireSlot(width / 2, height, depth, 1), CMMError);
+}
+
+
+namespace {
+
+void InsertFromOtherThread(CircularBuffer* cb, bool* inserted)
+{
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   *inserted = cb->InsertImage(&pixels[0], width, height, depth, &md);
+}
+
+} // anonymous namespace
+
+TEST(CircularBufferTests, ReservedSlotDoesNotHoldInsertLock)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+
+   Metadata md = CameraMetadata("Cam");
+   unsigned char* slot = cb.AcquireSlot(width, height, depth, 1);
+   ASSERT_TRUE(slot != 0);
+   // The reserving thread cannot insert, nor reserve a second slot
+   std::vector<unsigned char> pixels(frameBytes);
+   EXPECT_FALSE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_TRUE(cb.AcquireSlot(width, height, depth, 1) == 0);
+   cb.Clear();
+
+   // Another thread waits for the slot to be committed
+   bool inserted = false;
+   boost::thread other(InsertFromOtherThread, &cb, &inserted);
+   boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   EXPECT_FALSE(cb.CommitSlot(slot + 1, &md));
+   ASSERT_TRUE(cb.CommitSlot(slot, &md));
+   other.join();
+   EXPECT_TRUE(inserted);
+   EXPECT_EQ(2u, cb.GetRemainingImageCount());
+
+   // A pointer that was never reserved is rejected without blocking
+   EXPECT_FALSE(cb.DiscardSlot(&pixels[0]));
+   boost::thread another(InsertFromOtherThread, &cb, &inserted);
+   another.join();
+   EXPECT_TRUE(inserted);
+}
+
+TEST(CircularBufferTests, MetadataRecordIsConvertedWhenRead)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   mm::MetadataKeyTable& keys = cb.GetMetadataKeys();
+
+   MM::FrameMetadata md;
+   md.SetCameraKey(keys.Intern("Cam", "_"));
+   md.SetElapsedTimeMs(12.5);
+   md.SetROI(16, 8);
+   md.PutTag(keys.Intern("Gain", "Cam"), 3L);
+   md.PutTag(keys.Intern("Mode", "_"), "Fast");
+
+   boost::shared_ptr<Metadata> cameraTags(new Metadata());
+   cameraTags->PutTag("Temperature", "Cam", "-20");
+
+   std::vector<unsigned char> pixels(frameBytes);
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, 1, md,
+            cameraTags));
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, 1, md,
+            boost::shared_ptr<const Metadata>()));
+
+   Metadata read = cb.GetNextImageBuffer(0)->GetMetadata();
+   EXPECT_EQ("Cam", read.GetSingleTag("Camera").GetValue());
+   EXPECT_EQ("0", read.GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue());
+   EXPECT_EQ("12.50", read.GetSingleTag(MM::g_Keyword_Elapsed_Time_ms).GetValue());
+   EXPECT_EQ("16", read.GetSingleTag(MM::g_Keyword_Metadata_ROI_X).GetValue());
+   EXPECT_EQ("8", read.GetSingleTag(MM::g_Keyword_Metadata_ROI_Y).GetValue());
+   EXPECT_EQ("3", read.GetSingleTag("Cam-Gain").GetValue());
+   EXPECT_EQ("Fast", read.GetSingleTag("Mode").GetValue());
+   EXPECT_EQ("-20", read.GetSingleTag("Cam-Temperature").GetValue());
+   EXPECT_EQ("64", read.GetSingleTag("Width").GetValue());
+   EXPECT_EQ("32", read.GetSingleTag("Height").GetValue());
+   EXPECT_EQ("GRAY16", read.GetSingleTag("PixelType").GetValue());
+   EXPECT_FALSE(read.HasTag(MM::g_Keyword_Binning));
+
+   read = cb.GetNextImageBuffer(0)->GetMetadata();
+   EXPECT_EQ("1", read.GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue());
+   EXPECT_FALSE(read.HasTag("Cam-Temperature"));
+}
+
+
+TEST(CircularBufferTests, ImageNumbersAreSharedBetweenMetadataForms)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+
+   MM::FrameMetadata record;
+   record.SetCameraKey(cb.GetMetadataKeys().Intern("Cam", "_"));
+   Metadata md = CameraMetadata("Cam");
+
+   std::vector<unsigned char> pixels(frameBytes);
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, 1, record,
+            boost::shared_ptr<const Metadata>()));
+
+   EXPECT_EQ(0, ImageNumber(cb.GetNextImageBuffer(0)));
+   EXPECT_EQ(1, ImageNumber(cb.GetNextImageBuffer(0)));
+}
+
+
+TEST(CircularBufferTests, LeasedFrameIsNotOverwritten)
+{
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetOverflowPolicy(CircularBuffer::DropOldest);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata("Cam");
+   const unsigned long size = cb.GetSize();
+   for (unsigned long i = 0; i < size; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   }
+
+   boost::shared_ptr<mm::FrameLease> lease = cb.LeaseNextImage(0);
+   ASSERT_TRUE(lease);
+   EXPECT_FALSE(lease->IsCopy());
+   EXPECT_EQ(0, lease->GetPixels()[0]);
+   EXPECT_EQ(size - 1, cb.GetRemainingImageCount());
+
+   // The next frame would go into the leased slot
+   pixels[0] = 0xff;
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_EQ(1, cb.GetDroppedImageCount());
+   EXPECT_EQ(0, lease->GetPixels()[0]);
+
+   lease.reset();
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_EQ(size, cb.GetRemainingImageCount());
+}
+
+
+TEST(CircularBufferTests, LeaseOutlivesBuffer)
+{
+   boost::shared_ptr<mm::FrameLease> lease;
+   {
+      CircularBuffer cb(1);
+      ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+      EXPECT_FALSE(cb.LeaseTopImage(0));
+
+      std::vector<unsigned char> pixels(frameBytes);
+      Metadata md = CameraMetadata("Cam");
+      pixels[0] = 7;
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], width, height, depth, &md));
+      lease = cb.LeaseTopImage(0);
+      ASSERT_TRUE(lease);
+
+      // Leasing the top frame does not retrieve it
+      EXPECT_EQ(1u, cb.GetRemainingImageCount());
+   }
+   EXPECT_EQ(7, lease->GetPixels()[0]);
+   EXPECT_EQ(width, lease->Width());
+   EXPECT_EQ("Cam", lease->GetMetadata().GetSingleTag("Camera").GetValue());
+}
+
+
+class CircularBufferTestProducer
+{
+   CircularBuffer& cb_;
+   unsigned count_;
+
+public:
+   CircularBufferTestProducer(CircularBuffer& cb, unsigned count) :
+      cb_(cb), count_(count)
+   {}
+
+   void Run()
+   {
+      std::vector<unsigned char> pixels(frameBytes);
+      Metadata md = CameraMetadata("Cam");
+      for (unsigned i = 0; i < count_; )
+      {
+         pixels[0] = static_cast<unsigned char>(i);
+         if (cb_.InsertImage(&pixels[0], width, height, depth, &md))
+            ++i;
+         else
+            boost::this_thread::yield();
+      }
+   }
+};
+
+
+class CircularBufferTestConsumer
+{
+   CircularBuffer& cb_;
+   boost::atomic<unsigned>& popped_;
+   unsigned total_;
+   bool inOrder_;
+
+public:
+   CircularBufferTestConsumer(CircularBuffer& cb,
+         boost::atomic<unsigned>& popped, unsigned total) :
+      cb_(cb), popped_(popped), total_(total), inOrder_(true)
+   {}
+
+   bool InOrder() const { return inOrder_; }
+
+   void Run()
+   {
+      long last = -1;
+      while (popped_.load() < total_)
+      {
+         const mm::ImgBuffer* img = cb_.GetNextImageBuffer(0);
+         if (!img)
+         {
+            boost::this_thread::yield();
+            continue;
+         }
+         long number = ImageNumber(img);
+         if (number <= last)
+            inOrder_ = false;
+         last = number;
+         ++popped_;
+      }
+   }
+};
+
+
+TEST(CircularBufferTests, ConcurrentProducerAndConsumers)
+{
+   // A popped frame is only valid until the buffer wraps around onto its
+   // slot, so make room for all frames: the consumers read the metadata
+   // after popping.
+   const unsigned total = 5000;
+   CircularBuffer cb(total * frameBytes / (1 << 20) + 1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   ASSERT_GE(cb.GetSize(), total);
+
+   boost::atomic<unsigned> popped(0);
+   CircularBufferTestProducer producer(cb, total);
+   CircularBufferTestConsumer consumer1(cb, popped, total);
+   CircularBufferTestConsumer consumer2(cb, popped, total);
+
+   boost::thread t1(&CircularBufferTestConsumer::Run, &consumer1);
+   boost::thread t2(&CircularBufferTestConsumer::Run, &consumer2);
+   boost::thread tp(&CircularBufferTestProducer::Run, &producer);
+   tp.join();
+   t1.join();
+   t2.join();
+
+   EXPECT_EQ(total, popped.load());
+   EXPECT_TRUE(consumer1.InOrder());
+   EXPECT_TRUE(consumer2.InOrder());
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+}
+
+
+
+void RunProducer(CircularBufferTestProducer* producer, boost::atomic<bool>* done)
+{
+   producer->Run();
+   done->store(true);
+}
+
+
+TEST(CircularBufferTests, ConcurrentBatchPopsWithDropOldest)
+{
+   // The producer overwrites unread frames, but not while they are copied
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetOverflowPolicy(CircularBuffer::DropOldest);
+
+   CircularBufferTestProducer producer(cb, 5000);
+   boost::atomic<bool> producerDone(false);
+   boost::thread tp(RunProducer, &producer, &producerDone);
+
+   std::vector<unsigned char> batch(8 * frameBytes);
+   std::vector<Metadata> batchMd;
+   long last = -1;
+   bool consistent = true;
+   bool inOrder = true;
+   for (;;)
+   {
+      const bool done = producerDone.load();
+      batchMd.clear();
+      const unsigned long count = cb.PopImages(8, 0, &batch[0], batchMd);
+      if (count == 0 && done)
+         break;
+      for (unsigned long i = 0; i < count; ++i)
+      {
+         const long number = boost::lexical_cast<long>(batchMd[i].
+               GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue());
+         if (batch[i * frameBytes] != static_cast<unsigned char>(number))
+            consistent = false;
+         if (number <= last)
+            inOrder = false;
+         last = number;
+      }
+   }
+
+   tp.join();
+
+   EXPECT_TRUE(consistent);
+   EXPECT_TRUE(inOrder);
+   EXPECT_GE(last, 0);
+}
+
+
+TEST(CircularBufferTests, ConcurrentSpillToDisk)
+{
+   // The producer finishes first, because a popped frame is only valid
+   // until the buffer wraps around onto its slot. The consumer then races
+   // the thread moving frames to the spill file.
+   const unsigned total = 900;
+   CircularBuffer cb(1);
+   ASSERT_TRUE(cb.Initialize(1, width, height, depth));
+   cb.SetSpillCapacityMB(4);
+   cb.SetOverflowPolicy(CircularBuffer::SpillToDisk);
+   cb.SetSpillHighWaterMark(0.25);
+
+   boost::atomic<unsigned> popped(0);
+   CircularBufferTestProducer producer(cb, total);
+   CircularBufferTestConsumer consumer(cb, popped, total);
+
+   boost::thread tp(&CircularBufferTestProducer::Run, &producer);
+   tp.join();
+   EXPECT_GT(cb.GetSpilledImageCount(), 0);
+   boost::thread tc(&CircularBufferTestConsumer::Run, &consumer);
+   tc.join();
+
+   EXPECT_EQ(total, popped.load());
+   EXPECT_TRUE(consumer.InOrder());
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
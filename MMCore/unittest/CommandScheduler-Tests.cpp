@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+
+#include "CommandFuture.h"
+#include "CommandScheduler.h"
+#include "ThreadPool.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+
+#include <string>
+#include <vector>
+
+
+namespace {
+
+// Records the order in which commands start, and how many run at once
+class Recorder
+{
+public:
+   Recorder() : running_(0), maxRunning_(0) {}
+
+   void Run(const std::string& name, long ms)
+   {
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         order_ += name;
+         if (++running_ > maxRunning_)
+            maxRunning_ = running_;
+      }
+      boost::this_thread::sleep(boost::posix_time::milliseconds(ms));
+      boost::mutex::scoped_lock lock(mutex_);
+      --running_;
+   }
+
+   std::string Order() { boost::mutex::scoped_lock lock(mutex_); return order_; }
+   int MaxRunning() { boost::mutex::scoped_lock lock(mutex_); return maxRunning_; }
+
+private:
+   boost::mutex mutex_;
+   std::string order_;
+   int running_;
+   int maxRunning_;
+};
+
+void Fail()
+{
+   throw CMMError("Device error", MMERR_DEVICE_GENERIC);
+}
+
+std::vector<mm::CommandScheduler::Key> Keys(const void* a, const void* b = 0)
+{
+   std::vector<mm::CommandScheduler::Key> keys(1, a);
+   if (b)
+      keys.push_back(b);
+   return keys;
+}
+
+const int moduleA = 0, moduleB = 0;
+
+} // anonymous namespace
+
+
+TEST(CommandSchedulerTests, CommandsWithSameKeyRunInOrder)
+{
+   mm::CommandScheduler scheduler(boost::make_shared<mm::ThreadPool>(4),
+         mm::CommandScheduler::DoneCallback());
+   Recorder recorder;
+   for (int i = 0; i < 5; ++i)
+      scheduler.Submit("", Keys(&moduleA),
+            boost::bind(&Recorder::Run, &recorder, std::string(1, char('0' + i)), 10L));
+   scheduler.WaitForAll();
+   EXPECT_EQ("01234", recorder.Order());
+   EXPECT_EQ(1, recorder.MaxRunning());
+}
+
+TEST(CommandSchedulerTests, CommandsWithOtherKeysRunConcurrently)
+{
+   mm::CommandScheduler scheduler(boost::make_shared<mm::ThreadPool>(4),
+         mm::CommandScheduler::DoneCallback());
+   Recorder recorder;
+   boost::shared_ptr<mm::CommandFuture> a = scheduler.Submit("a", Keys(&moduleA),
+         boost::bind(&Recorder::Run, &recorder, std::string("a"), 200L));
+   boost::shared_ptr<mm::CommandFuture> b = scheduler.Submit("b", Keys(&moduleB),
+         boost::bind(&Recorder::Run, &recorder, std::string("b"), 200L));
+   a->Wait();
+   b->Wait();
+   EXPECT_EQ(2, recorder.MaxRunning());
+   EXPECT_GE(a->GetLatencyMs(), 190.0);
+   EXPECT_LT(a->GetQueuedMs(), 150.0);
+}
+
+TEST(CommandSchedulerTests, CommandWithSeveralKeysWaitsForEach)
+{
+   mm::CommandScheduler scheduler(boost::make_shared<mm::ThreadPool>(4),
+         mm::CommandScheduler::DoneCallback());
+   Recorder recorder;
+   scheduler.Submit("a", Keys(&moduleA),
+         boost::bind(&Recorder::Run, &recorder, std::string("a"), 50L));
+   scheduler.Submit("b", Keys(&moduleB),
+         boost::bind(&Recorder::Run, &recorder, std::string("b"), 100L));
+   scheduler.Submit("c", Keys(&moduleA, &moduleB),
+         boost::bind(&Recorder::Run, &recorder, std::string("c"), 10L));
+   scheduler.Submit("d", Keys(&moduleA),
+         boost::bind(&Recorder::Run, &recorder, std::string("d"), 10L));
+   scheduler.WaitForAll();
+   EXPECT_EQ('c', recorder.Order()[2]);
+   EXPECT_EQ('d', recorder.Order()[3]);
+}
+
+TEST(CommandSchedulerTests, ErrorIsPassedToFuture)
+{
+   mm::CommandScheduler scheduler(boost::make_shared<mm::ThreadPool>(2),
+         mm::CommandScheduler::DoneCallback());
+   boost::shared_ptr<mm::CommandFuture> f =
+      scheduler.Submit("fail", Keys(&moduleA), &Fail);
+   EXPECT_THROW(f->Wait(), CMMError);
+   EXPECT_TRUE(f->IsDone());
+
+   // The key is released after a failure
+   Recorder recorder;
+   f = scheduler.Submit("", Keys(&moduleA),
+         boost::bind(&Recorder::Run, &recorder, std::string("a"), 1L));
+   EXPECT_TRUE(f->WaitFor(1000.0));
+   EXPECT_NO_THROW(f->Wait());
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
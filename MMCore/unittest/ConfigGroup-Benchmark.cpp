@@ -0,0 +1,133 @@
+// Time to find the current preset of every group from the state cache, as
+// done by the GUI on each refresh, comparing the previous way (assembling
+// the group state and testing each preset with isConfigurationIncluded())
+// with the compiled presets. The synthetic configuration has the given
+// number of groups, each with its own devices; the cache matches the last
+// preset of each group.
+//
+// Usage: ConfigGroup-Benchmark [groups [presets [properties [rounds]]]]
+
+#include "ConfigGroup.h"
+#include "Configuration.h"
+#include "PresetMatcher.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+std::string Name(const char* prefix, int n)
+{
+   return prefix + boost::lexical_cast<std::string>(n);
+}
+
+// What getCurrentConfigFromCache() did before the presets were compiled
+std::string MatchAsBefore(ConfigGroupCollection& groups, const char* group,
+      Configuration& cache)
+{
+   std::vector<std::string> presets = groups.GetAvailableConfigs(group);
+   Configuration state;
+   for (size_t i = 0; i < presets.size(); ++i)
+   {
+      Configuration preset = *groups.Find(group, presets[i].c_str());
+      for (size_t j = 0; j < preset.size(); ++j)
+      {
+         PropertySetting cs = preset.getSetting(j);
+         if (state.isPropertyIncluded(cs.getDeviceLabel().c_str(),
+                  cs.getPropertyName().c_str()))
+            continue;
+         std::string value = cache.getSetting(cs.getDeviceLabel().c_str(),
+               cs.getPropertyName().c_str()).getPropertyValue();
+         state.addSetting(PropertySetting(cs.getDeviceLabel().c_str(),
+                  cs.getPropertyName().c_str(), value.c_str()));
+      }
+   }
+   for (size_t i = 0; i < presets.size(); ++i)
+   {
+      if (state.isConfigurationIncluded(*groups.Find(group, presets[i].c_str())))
+         return presets[i];
+   }
+   return "";
+}
+
+std::string MatchCompiled(ConfigGroupCollection& groups, const char* group,
+      const Configuration& cache)
+{
+   boost::shared_ptr<const mm::PresetMatcher> matcher = groups.GetMatcher(group);
+   std::vector<const std::string*> values(matcher->GetPropertyCount());
+   for (size_t i = 0; i < values.size(); ++i)
+      values[i] = cache.findValue(matcher->GetKey(i));
+   return matcher->Match(values);
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   const int groupCount = argc > 1 ? boost::lexical_cast<int>(argv[1]) : 30;
+   const int presetCount = argc > 2 ? boost::lexical_cast<int>(argv[2]) : 50;
+   const int propertyCount = argc > 3 ? boost::lexical_cast<int>(argv[3]) : 8;
+   const int rounds = argc > 4 ? boost::lexical_cast<int>(argv[4]) : 100;
+
+   ConfigGroupCollection groups;
+   Configuration cache;
+   std::vector<std::string> groupNames;
+   for (int g = 0; g < groupCount; ++g)
+   {
+      groupNames.push_back(Name("Group", g));
+      for (int p = 0; p < presetCount; ++p)
+      {
+         for (int k = 0; k < propertyCount; ++k)
+         {
+            // Presets differ in their first property only
+            std::string value = Name("Value", k == 0 ? p : 0);
+            groups.Define(groupNames[g].c_str(), Name("Preset", p).c_str(),
+                  Name("Device", g * propertyCount + k).c_str(), "State",
+                  value.c_str());
+            if (p == presetCount - 1)
+               cache.addSetting(PropertySetting(
+                        Name("Device", g * propertyCount + k).c_str(), "State",
+                        value.c_str()));
+         }
+      }
+   }
+
+   // Compile before timing, as the core does once after loading
+   for (int g = 0; g < groupCount; ++g)
+      groups.GetMatcher(groupNames[g].c_str());
+
+   using namespace boost::posix_time;
+   std::string lastBefore, lastCompiled;
+   ptime start = microsec_clock::universal_time();
+   for (int r = 0; r < rounds; ++r)
+      for (int g = 0; g < groupCount; ++g)
+         lastBefore = MatchAsBefore(groups, groupNames[g].c_str(), cache);
+   double beforeUs = (microsec_clock::universal_time() - start).total_microseconds();
+
+   start = microsec_clock::universal_time();
+   for (int r = 0; r < rounds; ++r)
+      for (int g = 0; g < groupCount; ++g)
+         lastCompiled = MatchCompiled(groups, groupNames[g].c_str(), cache);
+   double compiledUs = (microsec_clock::universal_time() - start).total_microseconds();
+
+   if (lastBefore != lastCompiled)
+   {
+      std::cerr << "Results differ: " << lastBefore << " vs " << lastCompiled << '\n';
+      return 1;
+   }
+
+   std::cout << groupCount << " groups, " << presetCount << " presets, " <<
+      propertyCount << " properties; time to match all groups:\n";
+   std::cout << std::fixed << std::setprecision(1);
+   std::cout << "   as before: " << beforeUs / rounds << " us\n";
+   std::cout << "   compiled:  " << compiledUs / rounds << " us\n";
+   return 0;
+}
@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+
+#include "ConfigGroup.h"
+#include "PresetMatcher.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+
+TEST(ConfigGroupTests, GroupsIncludingPropertyFollowDefinitions)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Filter", "Label", "1");
+   groups.Define("Channel", "FITC", "Filter", "Label", "2");
+   groups.Define("Channel", "FITC", "Shutter", "State", "1");
+   groups.Define("Objective", "10x", "Nosepiece", "Label", "A");
+
+   std::vector<std::string> found =
+      groups.GetGroupsIncludingProperty("Filter", "Label");
+   ASSERT_EQ(1u, found.size());
+   EXPECT_EQ("Channel", found[0]);
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Filter", "State").empty());
+
+   groups.Define("Objective", "10x", "Filter", "Label", "1");
+   EXPECT_EQ(2u, groups.GetGroupsIncludingProperty("Filter", "Label").size());
+}
+
+
+TEST(ConfigGroupTests, GroupsIncludingPropertyFollowDeletions)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Filter", "Label", "1");
+   groups.Define("Channel", "FITC", "Filter", "Label", "2");
+   groups.Define("Channel", "FITC", "Shutter", "State", "1");
+
+   // Still included in the other preset
+   ASSERT_TRUE(groups.Delete("Channel", "DAPI"));
+   EXPECT_EQ(1u, groups.GetGroupsIncludingProperty("Filter", "Label").size());
+
+   ASSERT_TRUE(groups.Delete("Channel", "FITC", "Filter", "Label"));
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Filter", "Label").empty());
+   EXPECT_EQ(1u, groups.GetGroupsIncludingProperty("Shutter", "State").size());
+
+   ASSERT_TRUE(groups.Delete("Channel"));
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Shutter", "State").empty());
+
+   groups.Define("Channel", "DAPI", "Filter", "Label", "1");
+   groups.Clear();
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Filter", "Label").empty());
+}
+
+
+TEST(ConfigGroupTests, GroupsIncludingPropertyFollowRenames)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Filter", "Label", "1");
+   groups.Define("Other", "X", "Shutter", "State", "1");
+
+   ASSERT_TRUE(groups.RenameConfig("Channel", "DAPI", "Blue"));
+   EXPECT_EQ(1u, groups.GetGroupsIncludingProperty("Filter", "Label").size());
+
+   ASSERT_TRUE(groups.RenameGroup("Channel", "Colors"));
+   std::vector<std::string> found =
+      groups.GetGroupsIncludingProperty("Filter", "Label");
+   ASSERT_EQ(1u, found.size());
+   EXPECT_EQ("Colors", found[0]);
+
+   // Renaming onto an existing group replaces it
+   ASSERT_TRUE(groups.RenameGroup("Colors", "Other"));
+   found = groups.GetGroupsIncludingProperty("Filter", "Label");
+   ASSERT_EQ(1u, found.size());
+   EXPECT_EQ("Other", found[0]);
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Shutter", "State").empty());
+}
+
+
+TEST(ConfigGroupTests, PixelSizePropertyInclusion)
+{
+   PixelSizeConfigGroup pixelSizes;
+   pixelSizes.DefinePixelSize("Res10x", "Nosepiece", "Label", "A", 0.65);
+   pixelSizes.DefinePixelSize("Res20x", "Nosepiece", "Label", "B", 0.325);
+   EXPECT_TRUE(pixelSizes.IsPropertyIncluded("Nosepiece", "Label"));
+   EXPECT_FALSE(pixelSizes.IsPropertyIncluded("Nosepiece", "State"));
+
+   ASSERT_TRUE(pixelSizes.Rename("Res10x", "Res20x"));
+   EXPECT_TRUE(pixelSizes.IsPropertyIncluded("Nosepiece", "Label"));
+   ASSERT_TRUE(pixelSizes.Delete("Res20x"));
+   EXPECT_FALSE(pixelSizes.IsPropertyIncluded("Nosepiece", "Label"));
+}
+
+
+TEST(ConfigGroupTests, MatcherFindsFirstMatchingPreset)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Filter", "Label", "1");
+   groups.Define("Channel", "DAPI", "Shutter", "State", "1");
+   groups.Define("Channel", "FITC", "Filter", "Label", "2");
+   groups.Define("Channel", "FITC-Open", "Filter", "Label", "2");
+   groups.Define("Channel", "FITC-Open", "Shutter", "State", "1");
+
+   boost::shared_ptr<const mm::PresetMatcher> matcher =
+      groups.GetMatcher("Channel");
+   ASSERT_TRUE(matcher);
+   ASSERT_EQ(2u, matcher->GetPropertyCount());
+   EXPECT_EQ("Filter", matcher->GetDeviceLabel(0));
+   EXPECT_EQ("Label", matcher->GetPropertyName(0));
+   EXPECT_EQ(PropertySetting::generateKey("Shutter", "State"), matcher->GetKey(1));
+
+   std::string one("1"), two("2"), zero("0");
+   std::vector<const std::string*> values(2);
+   values[0] = &one; values[1] = &one;
+   EXPECT_EQ("DAPI", matcher->Match(values));
+   values[0] = &two;
+   EXPECT_EQ("FITC", matcher->Match(values)); // Both FITC presets match
+   values[0] = &zero;
+   EXPECT_EQ("", matcher->Match(values));
+   values[0] = &one; values[1] = 0; // Unknown value
+   EXPECT_EQ("", matcher->Match(values));
+}
+
+
+TEST(ConfigGroupTests, MatcherFollowsChanges)
+{
+   ConfigGroupCollection groups;
+   EXPECT_FALSE(groups.GetMatcher("Channel"));
+   groups.Define("Channel", "DAPI", "Filter", "Label", "1");
+
+   std::string two("2");
+   std::vector<const std::string*> values(1, &two);
+   EXPECT_EQ("", groups.GetMatcher("Channel")->Match(values));
+
+   groups.Define("Channel", "DAPI", "Filter", "Label", "2");
+   EXPECT_EQ("DAPI", groups.GetMatcher("Channel")->Match(values));
+   ASSERT_TRUE(groups.RenameConfig("Channel", "DAPI", "Blue"));
+   EXPECT_EQ("Blue", groups.GetMatcher("Channel")->Match(values));
+
+   // A preset without settings matches anything
+   groups.Define("Channel", "Any");
+   EXPECT_EQ("Any", groups.GetMatcher("Channel")->Match(values));
+   ASSERT_TRUE(groups.Delete("Channel", "Any"));
+   EXPECT_EQ("Blue", groups.GetMatcher("Channel")->Match(values));
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
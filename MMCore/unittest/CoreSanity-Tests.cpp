@@ -24,6 +24,13 @@ TEST(CoreSanityTests, CreateAndReset)
    c.reset();
 }
 
+TEST(CoreSanityTests, DevicesAreInitializedOneAtATimeByDefault)
+{
+   // Configurations may rely on devices being initialized in load order
+   CMMCore c;
+   EXPECT_FALSE(c.isParallelInitializationEnabled());
+}
+
 int main(int argc, char **argv)
 {
    ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+
+#include "DeviceAdapterCatalog.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+typedef mm::DeviceAdapterCatalog::Device Device;
+typedef mm::DeviceAdapterCatalog::FileStamp FileStamp;
+
+
+namespace {
+
+// Each test uses a fake module file and a catalog file in the working
+// directory, named after the test
+class DeviceAdapterCatalogTests : public ::testing::Test
+{
+protected:
+   std::string module_;
+   std::string catalogFile_;
+
+   virtual void SetUp()
+   {
+      std::string name = std::string("DeviceAdapterCatalog-") +
+         ::testing::UnitTest::GetInstance()->current_test_info()->name();
+      module_ = name + ".module";
+      catalogFile_ = name + ".catalog";
+      WriteModule("module contents");
+      std::remove(catalogFile_.c_str());
+   }
+
+   virtual void TearDown()
+   {
+      std::remove(module_.c_str());
+      std::remove(catalogFile_.c_str());
+   }
+
+   void WriteModule(const std::string& contents)
+   {
+      std::ofstream(module_.c_str(), std::ios::out | std::ios::trunc) <<
+         contents;
+   }
+
+   FileStamp Stamp()
+   {
+      FileStamp stamp;
+      EXPECT_TRUE(mm::DeviceAdapterCatalog::GetFileStamp(module_, stamp));
+      return stamp;
+   }
+};
+
+Device MakeDevice(const char* name, long type, const char* description)
+{
+   Device device;
+   device.name = name;
+   device.type = type;
+   device.description = description;
+   return device;
+}
+
+} // anonymous namespace
+
+
+TEST_F(DeviceAdapterCatalogTests, MissingFileHasNoStamp)
+{
+   FileStamp stamp;
+   EXPECT_FALSE(mm::DeviceAdapterCatalog::GetFileStamp(
+            "DeviceAdapterCatalog-NoSuchModule", stamp));
+   EXPECT_TRUE(mm::DeviceAdapterCatalog::GetFileStamp(module_, stamp));
+   EXPECT_EQ(15, stamp.size);
+}
+
+TEST_F(DeviceAdapterCatalogTests, EntryRequiresSameStamp)
+{
+   mm::DeviceAdapterCatalog catalog;
+   FileStamp stamp = Stamp();
+   EXPECT_EQ(0, catalog.Find(module_, stamp));
+
+   catalog.Store(module_, stamp,
+         std::vector<Device>(1, MakeDevice("Camera", 2, "A camera")));
+   const std::vector<Device>* devices = catalog.Find(module_, stamp);
+   ASSERT_TRUE(devices != 0);
+   ASSERT_EQ(1u, devices->size());
+   EXPECT_EQ("Camera", (*devices)[0].name);
+
+   FileStamp changed = stamp;
+   ++changed.size;
+   EXPECT_EQ(0, catalog.Find(module_, changed));
+   changed = stamp;
+   ++changed.modificationTime;
+   EXPECT_EQ(0, catalog.Find(module_, changed));
+}
+
+TEST_F(DeviceAdapterCatalogTests, SaveAndLoadRoundTrip)
+{
+   std::vector<Device> devices;
+   devices.push_back(MakeDevice("Camera", 2, "A camera"));
+   devices.push_back(MakeDevice("Odd\tname", 5, "Line 1\nLine 2\\ \r"));
+   devices.push_back(MakeDevice("Legacy", 0, ""));
+
+   mm::DeviceAdapterCatalog catalog;
+   FileStamp stamp = Stamp();
+   catalog.Store(module_, stamp, devices);
+   catalog.Store(module_ + ".empty", stamp, std::vector<Device>());
+   ASSERT_TRUE(catalog.Save(catalogFile_));
+
+   mm::DeviceAdapterCatalog loaded;
+   ASSERT_TRUE(loaded.Load(catalogFile_));
+   // The entry for a file that does not exist is not saved
+   EXPECT_EQ(1u, loaded.GetModuleCount());
+   const std::vector<Device>* found = loaded.Find(module_, stamp);
+   ASSERT_TRUE(found != 0);
+   ASSERT_EQ(devices.size(), found->size());
+   for (size_t i = 0; i < devices.size(); ++i)
+   {
+      EXPECT_EQ(devices[i].name, (*found)[i].name);
+      EXPECT_EQ(devices[i].type, (*found)[i].type);
+      EXPECT_EQ(devices[i].description, (*found)[i].description);
+   }
+}
+
+TEST_F(DeviceAdapterCatalogTests, ChangedModuleIsDroppedOnSave)
+{
+   mm::DeviceAdapterCatalog catalog;
+   catalog.Store(module_, Stamp(),
+         std::vector<Device>(1, MakeDevice("Camera", 2, "A camera")));
+
+   WriteModule("rebuilt module contents");
+   ASSERT_TRUE(catalog.Save(catalogFile_));
+
+   mm::DeviceAdapterCatalog loaded;
+   ASSERT_TRUE(loaded.Load(catalogFile_));
+   EXPECT_EQ(0u, loaded.GetModuleCount());
+   EXPECT_EQ(0, loaded.Find(module_, Stamp()));
+}
+
+TEST_F(DeviceAdapterCatalogTests, InvalidFileLeavesCatalogEmpty)
+{
+   mm::DeviceAdapterCatalog catalog;
+   catalog.Store(module_, Stamp(),
+         std::vector<Device>(1, MakeDevice("Camera", 2, "A camera")));
+   EXPECT_FALSE(catalog.Load(catalogFile_)); // Missing
+   EXPECT_EQ(0u, catalog.GetModuleCount());
+
+   // Written for other interface versions
+   std::ofstream(catalogFile_.c_str()) << "MMDeviceAdapterCatalog\t1\t0\t0\n";
+   EXPECT_FALSE(catalog.Load(catalogFile_));
+
+   ASSERT_TRUE(catalog.Save(catalogFile_));
+   std::string header;
+   {
+      std::ifstream file(catalogFile_.c_str());
+      std::getline(file, header);
+   }
+   std::ofstream(catalogFile_.c_str()) << header << "\nM\tmodule\tnot a time\t1\n";
+   EXPECT_FALSE(catalog.Load(catalogFile_));
+   std::ofstream(catalogFile_.c_str()) << header << "\nD\tCamera\t2\tNo module\n";
+   EXPECT_FALSE(catalog.Load(catalogFile_));
+   EXPECT_EQ(0u, catalog.GetModuleCount());
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,233 @@
+#include <gtest/gtest.h>
+
+#include "DeviceInitializer.h"
+#include "Error.h"
+#include "ThreadPool.h"
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+typedef mm::DeviceInitializer::Device Device;
+
+int moduleA, moduleB, moduleC; // Only their addresses are used
+
+Device MakeDevice(const char* label, const int* module,
+      const char* parent = "", const char* port = "")
+{
+   Device device;
+   device.label = label;
+   device.module = module;
+   device.parentLabel = parent;
+   device.port = port;
+   return device;
+}
+
+// Records the order of initialization and the largest number of devices
+// being initialized at once
+class Recorder
+{
+public:
+   explicit Recorder(const std::string& failing = "") :
+      failing_(failing), running_(0), maxRunning_(0)
+   {}
+
+   void Initialize(const std::vector<Device>* devices, size_t index)
+   {
+      {
+         boost::lock_guard<boost::mutex> lock(mutex_);
+         maxRunning_ = std::max(maxRunning_, ++running_);
+      }
+      boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+      {
+         boost::lock_guard<boost::mutex> lock(mutex_);
+         --running_;
+         order_.push_back((*devices)[index].label);
+      }
+      if ((*devices)[index].label == failing_)
+         throw CMMError("Cannot initialize " + failing_);
+   }
+
+   // Whether first was initialized before second
+   bool Before(const std::string& first, const std::string& second) const
+   {
+      std::vector<std::string>::const_iterator f =
+         std::find(order_.begin(), order_.end(), first);
+      std::vector<std::string>::const_iterator s =
+         std::find(order_.begin(), order_.end(), second);
+      return f != order_.end() && s != order_.end() && f < s;
+   }
+
+   const std::vector<std::string>& Order() const { return order_; }
+   int MaxRunning() const { return maxRunning_; }
+
+private:
+   std::string failing_;
+   boost::mutex mutex_;
+   std::vector<std::string> order_;
+   int running_;
+   int maxRunning_;
+};
+
+void ThrowNonStandard(size_t)
+{
+   throw 42;
+}
+
+} // anonymous namespace
+
+
+TEST(DeviceInitializerTests, DependenciesAreFound)
+{
+   std::vector<Device> devices;
+   devices.push_back(MakeDevice("COM1", &moduleA));
+   devices.push_back(MakeDevice("COM2", &moduleA));
+   devices.push_back(MakeDevice("Hub", &moduleB, "", "COM1"));
+   devices.push_back(MakeDevice("Stage", &moduleB, "Hub"));
+   devices.push_back(MakeDevice("Lamp", &moduleC, "", "COM1"));
+   devices.push_back(MakeDevice("Camera", &moduleC));
+
+   mm::DeviceInitializer initializer(boost::make_shared<mm::ThreadPool>(4),
+         devices);
+   EXPECT_FALSE(initializer.HasCycle());
+   EXPECT_TRUE(initializer.GetPrerequisites(0).empty());
+   EXPECT_EQ(std::vector<size_t>(1, 0), initializer.GetPrerequisites(1));
+   EXPECT_EQ(std::vector<size_t>(1, 0), initializer.GetPrerequisites(2));
+   EXPECT_EQ(std::vector<size_t>(1, 2), initializer.GetPrerequisites(3));
+
+   // Lamp shares the port with Hub
+   std::vector<size_t> lamp = initializer.GetPrerequisites(4);
+   std::sort(lamp.begin(), lamp.end());
+   ASSERT_EQ(2u, lamp.size());
+   EXPECT_EQ(0u, lamp[0]);
+   EXPECT_EQ(2u, lamp[1]);
+   EXPECT_EQ(std::vector<size_t>(1, 4), initializer.GetPrerequisites(5));
+}
+
+TEST(DeviceInitializerTests, IndependentModulesRunConcurrently)
+{
+   static int modules[4];
+   std::vector<Device> devices;
+   const char* labels[] = { "A1", "B1", "C1", "D1", "A2", "B2", "C2", "D2" };
+   for (int i = 0; i < 8; ++i)
+      devices.push_back(MakeDevice(labels[i], &modules[i % 4]));
+
+   mm::DeviceInitializer initializer(boost::make_shared<mm::ThreadPool>(4),
+         devices);
+   Recorder recorder;
+   initializer.Run(boost::bind(&Recorder::Initialize, &recorder, &devices, _1),
+         true);
+
+   EXPECT_EQ(8u, recorder.Order().size());
+   EXPECT_LT(1, recorder.MaxRunning());
+   EXPECT_TRUE(recorder.Before("A1", "A2"));
+   EXPECT_TRUE(recorder.Before("D1", "D2"));
+   for (size_t i = 0; i < devices.size(); ++i)
+   {
+      EXPECT_TRUE(initializer.WasInitialized(i));
+      EXPECT_LE(19.0, initializer.GetTimeMs(i));
+   }
+   EXPECT_GT(8 * 20.0, initializer.GetTotalTimeMs());
+}
+
+TEST(DeviceInitializerTests, PeripheralsWaitForHubAndPort)
+{
+   std::vector<Device> devices;
+   devices.push_back(MakeDevice("Camera", &moduleA));
+   devices.push_back(MakeDevice("COM1", &moduleB));
+   devices.push_back(MakeDevice("Hub", &moduleC, "", "COM1"));
+   devices.push_back(MakeDevice("Stage", &moduleC, "Hub"));
+
+   mm::DeviceInitializer initializer(boost::make_shared<mm::ThreadPool>(4),
+         devices);
+   Recorder recorder;
+   initializer.Run(boost::bind(&Recorder::Initialize, &recorder, &devices, _1),
+         true);
+   EXPECT_TRUE(recorder.Before("COM1", "Hub"));
+   EXPECT_TRUE(recorder.Before("Hub", "Stage"));
+}
+
+TEST(DeviceInitializerTests, CycleFallsBackToListOrder)
+{
+   // The peripheral is listed before its hub, in the module holding the
+   // hub's port
+   std::vector<Device> devices;
+   devices.push_back(MakeDevice("Stage", &moduleA, "Hub"));
+   devices.push_back(MakeDevice("COM1", &moduleA));
+   devices.push_back(MakeDevice("Hub", &moduleB, "", "COM1"));
+   devices.push_back(MakeDevice("Camera", &moduleC));
+
+   mm::DeviceInitializer initializer(boost::make_shared<mm::ThreadPool>(4),
+         devices);
+   EXPECT_TRUE(initializer.HasCycle());
+   Recorder recorder;
+   initializer.Run(boost::bind(&Recorder::Initialize, &recorder, &devices, _1),
+         true);
+   ASSERT_EQ(4u, recorder.Order().size());
+   EXPECT_EQ("Stage", recorder.Order()[0]);
+   EXPECT_EQ("Camera", recorder.Order()[3]);
+   EXPECT_EQ(1, recorder.MaxRunning());
+}
+
+TEST(DeviceInitializerTests, OneAtATimeKeepsReferencesAcrossModules)
+{
+   // The stage uses the DA device (of another module) from Initialize(),
+   // which the dependencies do not show
+   std::vector<Device> devices;
+   devices.push_back(MakeDevice("DA", &moduleA));
+   devices.push_back(MakeDevice("DAZStage", &moduleB));
+   devices.push_back(MakeDevice("Camera", &moduleC));
+
+   mm::DeviceInitializer initializer(boost::make_shared<mm::ThreadPool>(4),
+         devices);
+   EXPECT_TRUE(initializer.GetPrerequisites(1).empty());
+   Recorder recorder;
+   initializer.Run(boost::bind(&Recorder::Initialize, &recorder, &devices, _1),
+         false);
+   ASSERT_EQ(3u, recorder.Order().size());
+   EXPECT_TRUE(recorder.Before("DA", "DAZStage"));
+   EXPECT_EQ(1, recorder.MaxRunning());
+}
+
+TEST(DeviceInitializerTests, FailureStopsLaterDevices)
+{
+   std::vector<Device> devices;
+   devices.push_back(MakeDevice("Hub", &moduleA));
+   devices.push_back(MakeDevice("Stage", &moduleA, "Hub"));
+   devices.push_back(MakeDevice("Camera", &moduleB));
+
+   mm::DeviceInitializer initializer(boost::make_shared<mm::ThreadPool>(4),
+         devices);
+   Recorder recorder("Hub");
+   EXPECT_THROW(initializer.Run(boost::bind(&Recorder::Initialize,
+               &recorder, &devices, _1), true), CMMError);
+   EXPECT_FALSE(initializer.WasInitialized(0));
+   EXPECT_FALSE(initializer.WasInitialized(1));
+   EXPECT_EQ(0.0, initializer.GetTimeMs(1));
+   // Started at the same time as the hub
+   EXPECT_TRUE(initializer.WasInitialized(2));
+}
+
+TEST(DeviceInitializerTests, NonStandardExceptionBecomesError)
+{
+   std::vector<Device> devices;
+   devices.push_back(MakeDevice("Camera", &moduleA));
+
+   mm::DeviceInitializer initializer(boost::make_shared<mm::ThreadPool>(2),
+         devices);
+   EXPECT_THROW(initializer.Run(&ThrowNonStandard, true), CMMError);
+   EXPECT_FALSE(initializer.WasInitialized(0));
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -56,6 +56,35 @@ TEST(LoggerTests, BasicLogStream)
 }
 
 
+TEST(LoggerTests, EntriesBelowMinLevelAreNotFormatted)
+{
+   boost::shared_ptr<LoggingCore> c =
+      boost::make_shared<LoggingCore>();
+
+   c->AddSink(boost::make_shared<StdErrLogSink>(), SinkModeSynchronous);
+   c->SetMinEntryLevel(LogLevelInfo);
+
+   Logger lgr = c->NewLogger("mylabel");
+   EXPECT_FALSE(lgr.IsEnabled(LogLevelDebug));
+   EXPECT_TRUE(lgr.IsEnabled(LogLevelInfo));
+
+   int formatted = 0;
+   LOG_DEBUG(lgr) << ++formatted;
+   EXPECT_EQ(0, formatted);
+   LOG_INFO(lgr) << ++formatted;
+   EXPECT_EQ(1, formatted);
+
+   // The macro can be used as the body of an if-else statement
+   bool elseTaken = false;
+   if (formatted == 0)
+      LOG_INFO(lgr) << ++formatted;
+   else
+      elseTaken = true;
+   EXPECT_TRUE(elseTaken);
+   EXPECT_EQ(1, formatted);
+}
+
+
 class LoggerTestThreadFunc
 {
    unsigned n_;
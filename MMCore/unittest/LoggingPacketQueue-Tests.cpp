@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+
+#include "Logging/GenericPacketQueue.h"
+#include "Logging/Logging.h"
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace mm::logging;
+
+typedef internal::GenericPacketArray<Metadata> PacketArrayType;
+typedef internal::GenericPacketQueue<Metadata> PacketQueueType;
+
+
+namespace {
+
+// Collects the packets received by the queue's receive loop
+class Receiver
+{
+public:
+   void Consume(PacketArrayType& packets)
+   {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      for (PacketArrayType::ConstIteratorType it = packets.Begin(),
+            end = packets.End(); it != end; ++it)
+      {
+         states_.push_back(it->GetPacketState());
+         texts_.push_back(it->GetText());
+      }
+   }
+
+   std::vector<internal::PacketState> States()
+   { boost::lock_guard<boost::mutex> lock(mutex_); return states_; }
+   std::vector<std::string> Texts()
+   { boost::lock_guard<boost::mutex> lock(mutex_); return texts_; }
+
+private:
+   boost::mutex mutex_;
+   std::vector<internal::PacketState> states_;
+   std::vector<std::string> texts_;
+};
+
+void SendEntry(PacketQueueType& queue, LogLevel level, const std::string& text)
+{
+   Metadata::StampDataType stamp;
+   stamp.Stamp();
+   PacketArrayType packets;
+   packets.AppendEntry("component", level, stamp, text.c_str());
+   queue.SendPackets(packets.Begin(), packets.End(), level);
+}
+
+void SendEntries(PacketQueueType* queue, char tag, size_t count)
+{
+   // Each entry has three lines, so that interleaving would show
+   for (size_t i = 0; i < count; ++i)
+      SendEntry(*queue, LogLevelInfo, std::string(3, tag) + "\n" +
+            std::string(3, tag) + "\n" + std::string(3, tag));
+}
+
+} // anonymous namespace
+
+
+TEST(LoggingPacketQueueTests, EntriesFromManyThreadsStayWhole)
+{
+   PacketQueueType queue(64);
+   Receiver receiver;
+   queue.RunReceiveLoop(boost::bind(&Receiver::Consume, &receiver, _1));
+
+   boost::thread_group threads;
+   for (char tag = 'a'; tag < 'a' + 8; ++tag)
+      threads.create_thread(boost::bind(&SendEntries, &queue, tag, 500));
+   threads.join_all();
+   queue.ShutdownReceiveLoop();
+
+   std::vector<internal::PacketState> states = receiver.States();
+   std::vector<std::string> texts = receiver.Texts();
+   ASSERT_EQ(8u * 500 * 3, texts.size());
+   for (size_t i = 0; i < texts.size(); i += 3)
+   {
+      EXPECT_EQ(internal::PacketStateEntryFirstLine, states[i]);
+      EXPECT_EQ(internal::PacketStateNewLine, states[i + 1]);
+      EXPECT_EQ(texts[i], texts[i + 1]);
+      EXPECT_EQ(texts[i], texts[i + 2]);
+   }
+   EXPECT_EQ(0, queue.GetDroppedCount());
+}
+
+TEST(LoggingPacketQueueTests, NothingIsDroppedWhileThereIsRoom)
+{
+   // Room for all the entries, even if none were received
+   PacketQueueType queue(1 << 17);
+   queue.SetOverflowPolicy(QueueOverflowDropLowLevelFirst, LogLevelWarning);
+   Receiver receiver;
+   queue.RunReceiveLoop(boost::bind(&Receiver::Consume, &receiver, _1));
+
+   boost::thread_group threads;
+   for (char tag = 'a'; tag < 'a' + 8; ++tag)
+      threads.create_thread(boost::bind(&SendEntries, &queue, tag, 4000));
+   threads.join_all();
+   queue.ShutdownReceiveLoop();
+
+   EXPECT_EQ(8u * 4000 * 3, receiver.Texts().size());
+   EXPECT_EQ(0, queue.GetOverflowCount());
+   EXPECT_EQ(0, queue.GetDroppedCount());
+}
+
+TEST(LoggingPacketQueueTests, LowLevelEntriesAreDroppedFirst)
+{
+   // With no receive loop running, the queue fills up
+   PacketQueueType queue(16);
+   queue.SetOverflowPolicy(QueueOverflowDropLowLevelFirst, LogLevelInfo);
+
+   for (int i = 0; i < 16; ++i)
+      SendEntry(queue, LogLevelDebug, "debug");
+   EXPECT_EQ(4, queue.GetDroppedCount());
+   for (int i = 0; i < 8; ++i)
+      SendEntry(queue, LogLevelError, "error");
+   EXPECT_EQ(8, queue.GetDroppedCount());
+   EXPECT_EQ(8, queue.GetOverflowCount());
+
+   Receiver receiver;
+   queue.RunReceiveLoop(boost::bind(&Receiver::Consume, &receiver, _1));
+   queue.ShutdownReceiveLoop();
+   std::vector<std::string> texts = receiver.Texts();
+   ASSERT_EQ(16u, texts.size());
+   EXPECT_EQ("debug", texts[11]);
+   EXPECT_EQ("error", texts[12]);
+}
+
+TEST(LoggingPacketQueueTests, BlockedEntriesWaitForRoom)
+{
+   PacketQueueType queue(4);
+   queue.SetOverflowPolicy(QueueOverflowBlock, LogLevelInfo);
+
+   boost::thread sender(boost::bind(&SendEntries, &queue, 'x', 3));
+   boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+   EXPECT_EQ(1, queue.GetOverflowCount());
+
+   Receiver receiver;
+   queue.RunReceiveLoop(boost::bind(&Receiver::Consume, &receiver, _1));
+   sender.join();
+   queue.ShutdownReceiveLoop();
+   EXPECT_EQ(9u, receiver.Texts().size());
+   EXPECT_EQ(0, queue.GetDroppedCount());
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
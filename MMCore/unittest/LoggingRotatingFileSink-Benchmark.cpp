@@ -0,0 +1,120 @@
+// Sustained rate of lines written through the asynchronous queue to a plain
+// log file and to a rotating log file, with and without compression of the
+// closed segments. The rate covers logging and draining the queue; the time
+// to finish compressing the last segments is shown separately.
+//
+// Usage: LoggingRotatingFileSink-Benchmark [lines [threads [segmentMB]]]
+
+#include "Logging/LogFileSegments.h"
+#include "Logging/Logging.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace mm::logging;
+
+
+namespace {
+
+const char* const filename = "LoggingRotatingFileSink-Benchmark.log";
+
+void RemoveFiles()
+{
+   std::vector<std::string> segments = internal::ListLogSegments(filename);
+   for (size_t i = 0; i < segments.size(); ++i)
+      std::remove(segments[i].c_str());
+   std::remove(filename);
+}
+
+void LogLines(boost::shared_ptr<LoggingCore> core, int thread, int count)
+{
+   Logger logger = core->NewLogger("Thread" +
+         boost::lexical_cast<std::string>(thread));
+   for (int i = 0; i < count; ++i)
+   {
+      LOG_DEBUG(logger) << "Waiting for device Z to become ready (" << i <<
+         " of " << count << "), position " << 0.25 * i << " um";
+   }
+}
+
+void Run(const char* title, boost::shared_ptr<LogSink> sink,
+      int lines, int threads)
+{
+   boost::shared_ptr<LoggingCore> core = boost::make_shared<LoggingCore>();
+   core->AddSink(sink, SinkModeAsynchronous);
+
+   boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
+   boost::thread_group group;
+   for (int t = 0; t < threads; ++t)
+      group.create_thread(boost::bind(&LogLines, core, t, lines / threads));
+   group.join_all();
+   core->RemoveSink(sink, SinkModeAsynchronous); // Drains the queue
+   boost::posix_time::ptime drained =
+      boost::posix_time::microsec_clock::universal_time();
+   sink.reset(); // Waits for the closed segments to be processed
+   boost::posix_time::ptime finished =
+      boost::posix_time::microsec_clock::universal_time();
+
+   double seconds = (drained - start).total_microseconds() / 1e6;
+   long long bytes = internal::LogFileSize(filename);
+   std::vector<std::string> segments = internal::ListLogSegments(filename);
+   for (size_t i = 0; i < segments.size(); ++i)
+      bytes += internal::LogFileSize(segments[i]);
+
+   std::cout << std::setw(20) << std::left << title << std::right <<
+      std::setw(12) << std::fixed << std::setprecision(0) <<
+      (lines / seconds) << " lines/s" <<
+      std::setw(10) << std::setprecision(1) <<
+      (finished - drained).total_milliseconds() / 1e3 << " s after" <<
+      std::setw(8) << segments.size() << " segments" <<
+      std::setw(10) << bytes / (1024 * 1024) << " MB on disk\n";
+
+   RemoveFiles();
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   const int lines = argc > 1 ? boost::lexical_cast<int>(argv[1]) : 2000000;
+   const int threads = argc > 2 ? boost::lexical_cast<int>(argv[2]) : 4;
+   const int segmentMB = argc > 3 ? boost::lexical_cast<int>(argv[3]) : 16;
+
+   std::cout << lines << " lines from " << threads << " threads, " <<
+      segmentMB << " MB segments\n";
+   RemoveFiles();
+
+   Run("Plain file", boost::make_shared<FileLogSink>(filename), lines, threads);
+
+   FileRotationPolicy policy;
+   policy.maxSegmentBytes = segmentMB * 1024LL * 1024LL;
+   Run("Rotating", boost::make_shared<RotatingFileLogSink>(filename, policy),
+         lines, threads);
+
+   policy.maxTotalBytes = 4 * policy.maxSegmentBytes;
+   Run("Rotating, capped",
+         boost::make_shared<RotatingFileLogSink>(filename, policy),
+         lines, threads);
+
+   if (internal::CanCompressLogSegments())
+   {
+      policy.maxTotalBytes = 0;
+      policy.compress = true;
+      Run("Rotating, gzip",
+            boost::make_shared<RotatingFileLogSink>(filename, policy),
+            lines, threads);
+   }
+   return 0;
+}
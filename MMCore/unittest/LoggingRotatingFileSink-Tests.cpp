@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+
+#include "Logging/GenericRotatingFileSink.h"
+#include "Logging/LogFileSegments.h"
+#include "Logging/Logging.h"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace mm::logging;
+
+typedef internal::GenericPacketArray<Metadata> PacketArrayType;
+
+
+namespace {
+
+// Each test logs to its own file in the working directory, and removes it
+// along with its segments
+class LoggingRotatingFileSinkTests : public ::testing::Test
+{
+protected:
+   std::string filename_;
+
+   virtual void SetUp()
+   {
+      filename_ = std::string("LoggingRotatingFileSink-") +
+         ::testing::UnitTest::GetInstance()->current_test_info()->name() +
+         ".log";
+      RemoveFiles();
+   }
+
+   virtual void TearDown() { RemoveFiles(); }
+
+   void RemoveFiles()
+   {
+      std::vector<std::string> segments =
+         internal::ListLogSegments(filename_);
+      for (size_t i = 0; i < segments.size(); ++i)
+         std::remove(segments[i].c_str());
+      std::remove(filename_.c_str());
+   }
+
+   // Logs count single-line entries, a few per batch
+   void LogEntries(RotatingFileLogSink& sink, int count)
+   {
+      Metadata::StampDataType stamp;
+      stamp.Stamp();
+      PacketArrayType packets;
+      for (int i = 0; i < count; ++i)
+      {
+         packets.AppendEntry("component", LogLevelInfo, stamp,
+               ("entry " + boost::lexical_cast<std::string>(i)).c_str());
+         if (i % 4 == 3 || i == count - 1)
+         {
+            sink.Consume(packets);
+            packets.Clear();
+         }
+      }
+   }
+
+   std::vector<std::string> Segments()
+   { return internal::ListLogSegments(filename_); }
+};
+
+size_t CountLines(const std::string& filename)
+{
+   std::ifstream file(filename.c_str());
+   std::string line;
+   size_t count = 0;
+   while (std::getline(file, line))
+      ++count;
+   return count;
+}
+
+bool EndsWith(const std::string& s, const std::string& suffix)
+{
+   return s.size() >= suffix.size() &&
+      s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // anonymous namespace
+
+
+TEST_F(LoggingRotatingFileSinkTests, RotatesBySizeWithoutLosingEntries)
+{
+   FileRotationPolicy policy;
+   policy.maxSegmentBytes = 4096;
+   {
+      RotatingFileLogSink sink(filename_, policy);
+      LogEntries(sink, 1000);
+   }
+
+   std::vector<std::string> segments = Segments();
+   ASSERT_LT(5u, segments.size());
+   size_t lines = CountLines(filename_);
+   for (size_t i = 0; i < segments.size(); ++i)
+   {
+      EXPECT_LE(4096, internal::LogFileSize(segments[i]));
+      EXPECT_GT(4096 + 1024, internal::LogFileSize(segments[i]));
+      lines += CountLines(segments[i]);
+   }
+   EXPECT_EQ(1000u, lines);
+
+   // The oldest segment comes first
+   std::ifstream first(segments[0].c_str());
+   std::string line;
+   std::getline(first, line);
+   EXPECT_TRUE(EndsWith(line, " entry 0"));
+}
+
+TEST_F(LoggingRotatingFileSinkTests, LaterSessionKeepsEarlierSegments)
+{
+   FileRotationPolicy policy;
+   policy.maxSegmentBytes = 4096;
+   {
+      RotatingFileLogSink sink(filename_, policy);
+      LogEntries(sink, 500);
+   }
+   size_t firstSessionSegments = Segments().size();
+   ASSERT_LT(2u, firstSessionSegments);
+   {
+      // Likely to rotate within the same second as the first session
+      RotatingFileLogSink sink(filename_, policy, true);
+      LogEntries(sink, 500);
+   }
+
+   std::vector<std::string> segments = Segments();
+   EXPECT_LT(firstSessionSegments, segments.size());
+   size_t lines = CountLines(filename_);
+   for (size_t i = 0; i < segments.size(); ++i)
+      lines += CountLines(segments[i]);
+   EXPECT_EQ(1000u, lines);
+}
+
+TEST_F(LoggingRotatingFileSinkTests, OldestSegmentsAreDeletedBeyondTotalSize)
+{
+   FileRotationPolicy policy;
+   policy.maxSegmentBytes = 4096;
+   policy.maxTotalBytes = 16384;
+   {
+      RotatingFileLogSink sink(filename_, policy);
+      LogEntries(sink, 2000);
+   }
+
+   std::vector<std::string> segments = Segments();
+   ASSERT_LT(0u, segments.size());
+   long long total = 0;
+   for (size_t i = 0; i < segments.size(); ++i)
+      total += internal::LogFileSize(segments[i]);
+   EXPECT_GE(16384, total);
+
+   // The newest entries are the ones kept
+   std::string line, last;
+   std::ifstream file(filename_.c_str());
+   while (std::getline(file, line))
+      last = line;
+   EXPECT_TRUE(EndsWith(last, " entry 1999"));
+}
+
+TEST_F(LoggingRotatingFileSinkTests, ClosedSegmentsAreCompressed)
+{
+   if (!internal::CanCompressLogSegments())
+      return;
+
+   FileRotationPolicy policy;
+   policy.maxSegmentBytes = 4096;
+   policy.compress = true;
+   {
+      RotatingFileLogSink sink(filename_, policy);
+      LogEntries(sink, 1000);
+   }
+
+   std::vector<std::string> segments = Segments();
+   ASSERT_LT(0u, segments.size());
+   for (size_t i = 0; i < segments.size(); ++i)
+   {
+      EXPECT_TRUE(EndsWith(segments[i], ".log.gz")) << segments[i];
+      EXPECT_GT(4096, internal::LogFileSize(segments[i]));
+   }
+}
+
+TEST_F(LoggingRotatingFileSinkTests, OnlySegmentNamesAreListed)
+{
+   boost::posix_time::ptime closedAt(boost::gregorian::date(2026, 10, 16),
+         boost::posix_time::hours(9) + boost::posix_time::minutes(30));
+   std::string segment = internal::LogSegmentFilename(filename_, closedAt, 12);
+   EXPECT_EQ("LoggingRotatingFileSink-OnlySegmentNamesAreListed."
+         "20261016T093000-0012.log", segment);
+
+   std::vector<std::string> others;
+   others.push_back(filename_);
+   others.push_back(filename_ + ".bak");
+   others.push_back("LoggingRotatingFileSink-OnlySegmentNamesAreListed.old.log");
+   others.push_back(segment);
+   for (size_t i = 0; i < others.size(); ++i)
+      std::ofstream(others[i].c_str()) << "text\n";
+
+   std::vector<std::string> segments = Segments();
+   ASSERT_EQ(1u, segments.size());
+   EXPECT_EQ(segment, segments[0]);
+
+   for (size_t i = 0; i < others.size(); ++i)
+      std::remove(others[i].c_str());
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
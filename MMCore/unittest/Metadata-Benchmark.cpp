@@ -0,0 +1,206 @@
+// Per-frame cost of image metadata on the insertion path, comparing metadata
+// passed as serialized Metadata with metadata passed as MM::FrameMetadata.
+// Frames are tiny so that copying the pixels does not dominate.
+//
+// Usage: Metadata-Benchmark [frames]
+
+#include "CircularBuffer.h"
+
+#include "../MMDevice/DeviceUtils.h"
+#include "../MMDevice/ImageMetadata.h"
+#include "../MMDevice/MMDeviceConstants.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+const unsigned width = 16;
+const unsigned height = 16;
+const unsigned depth = 2;
+
+// Tags set by a typical camera for every frame (as in DemoCamera)
+Metadata MakeMetadata(long frame)
+{
+   Metadata md;
+   md.put("Camera", "Camera");
+   md.put(MM::g_Keyword_Metadata_StartTime, CDeviceUtils::ConvertToString(1000.0));
+   md.put(MM::g_Keyword_Elapsed_Time_ms, CDeviceUtils::ConvertToString(10.0 * frame));
+   md.put(MM::g_Keyword_Metadata_ROI_X, CDeviceUtils::ConvertToString(0L));
+   md.put(MM::g_Keyword_Metadata_ROI_Y, CDeviceUtils::ConvertToString(0L));
+   md.put(MM::g_Keyword_Binning, "1");
+   return md;
+}
+
+MM::FrameMetadata MakeRecord(long frame)
+{
+   MM::FrameMetadata md;
+   md.SetStartTimeMs(1000.0);
+   md.SetElapsedTimeMs(10.0 * frame);
+   md.SetROI(0, 0);
+   md.SetBinning(1);
+   return md;
+}
+
+Metadata CameraTags()
+{
+   Metadata tags;
+   tags.PutTag("Temperature", "Camera", "-20");
+   return tags;
+}
+
+// The metadata handling done for each frame before MM::FrameMetadata was
+// introduced: the adapter serialized its Metadata, CoreCallback restored it,
+// merged the camera tags (serialized by the camera for every frame), and
+// the buffer added its tags and stored a copy by serializing and restoring.
+bool InsertAsBefore(CircularBuffer& cb, const unsigned char* pixels,
+      long frame, long& imageNumber, const std::string& serializedCameraTags)
+{
+   std::string serialized = MakeMetadata(frame).Serialize();
+
+   Metadata restored;
+   restored.Restore(serialized.c_str());
+   Metadata md = restored;
+   md.put("Camera", std::string("Camera"));
+   Metadata cameraTags;
+   cameraTags.Restore(serializedCameraTags.c_str());
+   md.Merge(cameraTags);
+
+   Metadata channelMd = md;
+   channelMd.put(MM::g_Keyword_Metadata_ImageNumber,
+         CDeviceUtils::ConvertToString(imageNumber++));
+   channelMd.PutImageTag("Width", width);
+   channelMd.PutImageTag("Height", height);
+   channelMd.PutImageTag("PixelType", "GRAY16");
+   Metadata stored;
+   stored.Restore(channelMd.Serialize().c_str());
+
+   // Pixels only; the stored metadata above replaces that of the buffer
+   return cb.InsertImage(pixels, width, height, depth, 1,
+         MM::FrameMetadata(), boost::shared_ptr<const Metadata>());
+}
+
+bool InsertSerialized(CircularBuffer& cb, const unsigned char* pixels,
+      long frame, const boost::shared_ptr<const Metadata>& cameraTags)
+{
+   std::string serialized = MakeMetadata(frame).Serialize();
+
+   Metadata md;
+   md.Restore(serialized.c_str());
+   md.put("Camera", std::string("Camera"));
+   md.Merge(*cameraTags);
+   return cb.InsertImage(pixels, width, height, depth, 1, &md);
+}
+
+bool InsertRecord(CircularBuffer& cb, const unsigned char* pixels,
+      long frame, unsigned cameraKey,
+      const boost::shared_ptr<const Metadata>& cameraTags)
+{
+   MM::FrameMetadata md = MakeRecord(frame);
+
+   MM::FrameMetadata cameraMd(md);
+   cameraMd.SetCameraKey(cameraKey);
+   return cb.InsertImage(pixels, width, height, depth, 1, cameraMd,
+         cameraTags);
+}
+
+class Stopwatch
+{
+   boost::posix_time::ptime start_;
+public:
+   Stopwatch() : start_(boost::posix_time::microsec_clock::universal_time()) {}
+   double NsPer(long count) const
+   {
+      return (boost::posix_time::microsec_clock::universal_time() -
+            start_).total_nanoseconds() / double(count);
+   }
+};
+
+void Report(const char* what, double ns)
+{
+   std::cout << std::left << std::setw(40) << what << std::right <<
+      std::setw(10) << ns << " ns/frame\n";
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   long frames = 200000;
+   try
+   {
+      if (argc > 1)
+         frames = boost::lexical_cast<long>(argv[1]);
+   }
+   catch (const boost::bad_lexical_cast&)
+   {
+      std::cerr << "Usage: " << argv[0] << " [frames]\n";
+      return 2;
+   }
+
+   boost::shared_ptr<mm::MetadataKeyTable> keys(new mm::MetadataKeyTable());
+   CircularBuffer cb(1, keys);
+   if (!cb.Initialize(1, width, height, depth))
+   {
+      std::cerr << "Failed to initialize buffer\n";
+      return 1;
+   }
+
+   std::vector<unsigned char> pixels(width * height * depth);
+   const std::string serializedCameraTags = CameraTags().Serialize();
+   const boost::shared_ptr<const Metadata> cameraTags(new Metadata(CameraTags()));
+   const unsigned cameraKey = keys->Intern("Camera", "_");
+
+   std::cout << std::fixed << std::setprecision(1);
+
+   {
+      long imageNumber = 0;
+      Stopwatch sw;
+      for (long i = 0; i < frames; ++i)
+      {
+         InsertAsBefore(cb, &pixels[0], i, imageNumber, serializedCameraTags);
+         cb.GetNextImageBuffer(0);
+      }
+      Report("insert, serialized (previous path)", sw.NsPer(frames));
+   }
+
+   {
+      Stopwatch sw;
+      for (long i = 0; i < frames; ++i)
+      {
+         InsertSerialized(cb, &pixels[0], i, cameraTags);
+         cb.GetNextImageBuffer(0);
+      }
+      Report("insert, serialized", sw.NsPer(frames));
+   }
+
+   {
+      Stopwatch sw;
+      for (long i = 0; i < frames; ++i)
+      {
+         InsertRecord(cb, &pixels[0], i, cameraKey, cameraTags);
+         cb.GetNextImageBuffer(0);
+      }
+      Report("insert, FrameMetadata", sw.NsPer(frames));
+   }
+
+   {
+      Stopwatch sw;
+      for (long i = 0; i < frames; ++i)
+      {
+         InsertRecord(cb, &pixels[0], i, cameraKey, cameraTags);
+         Metadata md = cb.GetNextImageBuffer(0)->GetMetadata();
+      }
+      Report("insert and read, FrameMetadata", sw.NsPer(frames));
+   }
+
+   return 0;
+}
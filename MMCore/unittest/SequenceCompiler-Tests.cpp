@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+
+#include "AcquisitionPlan.h"
+#include "SequenceCompiler.h"
+
+#include <string>
+#include <vector>
+
+
+namespace {
+
+// A Z-stack of the given slices in each of the given channels, channel by
+// channel (or slice by slice if slicesFirst is false)
+AcquisitionPlan ZStack(size_t slices, const std::vector<std::string>& channels,
+      bool slicesFirst)
+{
+   AcquisitionPlan plan;
+   size_t outer = slicesFirst ? channels.size() : slices;
+   size_t inner = slicesFirst ? slices : channels.size();
+   for (size_t i = 0; i < outer; ++i)
+   {
+      for (size_t j = 0; j < inner; ++j)
+      {
+         size_t slice = slicesFirst ? j : i;
+         size_t channel = slicesFirst ? i : j;
+         AcquisitionEvent event;
+         event.setZPosition(double(slice));
+         event.setProperty("Filter", "State", channels[channel].c_str());
+         plan.addEvent(event);
+      }
+   }
+   return plan;
+}
+
+std::vector<size_t> ChunkLengths(const std::vector<mm::SequenceCompiler::Chunk>& chunks)
+{
+   std::vector<size_t> lengths;
+   for (size_t i = 0; i < chunks.size(); ++i)
+      lengths.push_back(chunks[i].imageCount);
+   return lengths;
+}
+
+const char* const twoChannels[] = { "DAPI", "FITC" };
+
+} // anonymous namespace
+
+
+TEST(SequenceCompilerTests, UnsetValuesAreFilledIn)
+{
+   AcquisitionPlan plan;
+   AcquisitionEvent event;
+   plan.addEvent(event);
+   event.setZPosition(1.0);
+   plan.addEvent(event);
+   plan.addEvent(AcquisitionEvent());
+   event.setZPosition(2.0);
+   plan.addEvent(event);
+
+   mm::SequenceCompiler compiler(plan);
+   ASSERT_EQ(4u, compiler.GetImageCount());
+   ASSERT_EQ(1u, compiler.GetAxisCount());
+   const mm::SequenceCompiler::Axis& z = compiler.GetAxis(0);
+   EXPECT_EQ(mm::SequenceCompiler::AxisZ, z.type);
+   EXPECT_EQ(1.0, z.positions[0]);
+   EXPECT_EQ(1.0, z.positions[1]);
+   EXPECT_EQ(1.0, z.positions[2]);
+   EXPECT_EQ(2.0, z.positions[3]);
+}
+
+TEST(SequenceCompilerTests, NothingSequenceableSplitsAtEachChange)
+{
+   std::vector<std::string> channels(twoChannels, twoChannels + 2);
+   mm::SequenceCompiler compiler(ZStack(3, channels, true));
+   std::vector<mm::SequenceCompiler::Chunk> chunks = compiler.Compile();
+   EXPECT_EQ(6u, chunks.size());
+
+   // Images with no change are taken together
+   AcquisitionPlan plan;
+   AcquisitionEvent event;
+   event.setExposure(10.0);
+   for (int i = 0; i < 5; ++i)
+      plan.addEvent(event);
+   mm::SequenceCompiler constant(plan);
+   chunks = constant.Compile();
+   ASSERT_EQ(1u, chunks.size());
+   EXPECT_EQ(5u, chunks[0].imageCount);
+   EXPECT_FALSE(chunks[0].sequenced[0]);
+}
+
+TEST(SequenceCompilerTests, SequenceableAxisSpansWholeStack)
+{
+   std::vector<std::string> channels(twoChannels, twoChannels + 2);
+   mm::SequenceCompiler compiler(ZStack(10, channels, true));
+   ASSERT_EQ(2u, compiler.GetAxisCount());
+   compiler.SetMaxSequenceLength(0, 100); // Z
+
+   // Split at the channel change only
+   std::vector<mm::SequenceCompiler::Chunk> chunks = compiler.Compile();
+   ASSERT_EQ(2u, chunks.size());
+   EXPECT_EQ(10u, chunks[0].imageCount);
+   EXPECT_EQ(10u, chunks[1].firstImage);
+   EXPECT_TRUE(chunks[0].sequenced[0]);
+   EXPECT_FALSE(chunks[0].sequenced[1]);
+
+   // With both sequenceable, the whole plan is one chunk
+   compiler.SetMaxSequenceLength(1, 100);
+   chunks = compiler.Compile();
+   ASSERT_EQ(1u, chunks.size());
+   EXPECT_EQ(20u, chunks[0].imageCount);
+   EXPECT_TRUE(chunks[0].sequenced[1]);
+}
+
+TEST(SequenceCompilerTests, ChunksAreLimitedByMaxSequenceLength)
+{
+   std::vector<std::string> channels(twoChannels, twoChannels + 2);
+   mm::SequenceCompiler compiler(ZStack(10, channels, false));
+   compiler.SetMaxSequenceLength(0, 100); // Z
+   compiler.SetMaxSequenceLength(1, 4); // Filter
+
+   std::vector<size_t> expected;
+   expected.push_back(4);
+   expected.push_back(4);
+   expected.push_back(4);
+   expected.push_back(4);
+   expected.push_back(4);
+   EXPECT_EQ(expected, ChunkLengths(compiler.Compile()));
+}
+
+TEST(SequenceCompilerTests, PlanIndexIsChecked)
+{
+   AcquisitionPlan plan;
+   EXPECT_THROW(plan.getEvent(0), CMMError);
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,125 @@
+// Round-trip latency of serial port queries through the Core, against a
+// simulated device on a pseudo-terminal that echoes each command. The
+// delays emulate the transmission time per byte and the time the device
+// takes to process a command.
+//
+// Usage: SerialPort-Benchmark adapterDir [queries [byteDelayUs [replyDelayUs]]]
+//
+// adapterDir is the directory containing the SerialManager adapter (for the
+// autotools build, DeviceAdapters/SerialManager/.libs).
+
+#include "MMCore.h"
+
+#include "../testing/SerialSimulator.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+double Percentile(const std::vector<double>& sorted, double p)
+{
+   size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+   return sorted[i];
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   long queries = 2000;
+   long byteDelayUs = 0;
+   long replyDelayUs = 0;
+   try
+   {
+      if (argc < 2)
+         throw boost::bad_lexical_cast();
+      if (argc > 2)
+         queries = boost::lexical_cast<long>(argv[2]);
+      if (argc > 3)
+         byteDelayUs = boost::lexical_cast<long>(argv[3]);
+      if (argc > 4)
+         replyDelayUs = boost::lexical_cast<long>(argv[4]);
+   }
+   catch (const boost::bad_lexical_cast&)
+   {
+      std::cerr << "Usage: " << argv[0] <<
+         " adapterDir [queries [byteDelayUs [replyDelayUs]]]\n";
+      return 2;
+   }
+   if (queries < 1)
+      queries = 1;
+
+   SerialSimulator simulator;
+   simulator.SetCommandTerminator("\r");
+   simulator.SetReplyTerminator("\r");
+   simulator.SetByteDelayUs(byteDelayUs);
+   simulator.SetReplyDelayUs(replyDelayUs);
+   simulator.AddRule("*", "$CMD");
+   if (!simulator.Start())
+   {
+      std::cerr << "Failed to open pseudo-terminal\n";
+      return 1;
+   }
+   const std::string port = simulator.GetPortName();
+
+   CMMCore core;
+   std::vector<double> latencies;
+   latencies.reserve(queries);
+   boost::posix_time::time_duration total;
+   try
+   {
+      core.enableStderrLog(false);
+      std::vector<std::string> searchPaths;
+      searchPaths.push_back(argv[1]);
+      core.setDeviceAdapterSearchPaths(searchPaths);
+      core.loadDevice(port.c_str(), "SerialManager", port.c_str());
+      core.setProperty(port.c_str(), MM::g_Keyword_BaudRate, "115200");
+      core.initializeDevice(port.c_str());
+
+      const std::string command = "W X Y Z";
+      const boost::posix_time::ptime start =
+         boost::posix_time::microsec_clock::universal_time();
+      for (long i = 0; i < queries; ++i)
+      {
+         const boost::posix_time::ptime sent =
+            boost::posix_time::microsec_clock::universal_time();
+         core.setSerialPortCommand(port.c_str(), command.c_str(), "\r");
+         std::string answer = core.getSerialPortAnswer(port.c_str(), "\r");
+         const boost::posix_time::ptime received =
+            boost::posix_time::microsec_clock::universal_time();
+         if (answer != command)
+         {
+            std::cerr << "Unexpected answer: " << answer << "\n";
+            return 1;
+         }
+         latencies.push_back((received - sent).total_microseconds() / 1000.0);
+      }
+      total = boost::posix_time::microsec_clock::universal_time() - start;
+      core.unloadAllDevices();
+   }
+   catch (const CMMError& e)
+   {
+      std::cerr << e.getFullMsg() << "\n";
+      return 1;
+   }
+
+   std::sort(latencies.begin(), latencies.end());
+   std::cout << std::fixed << std::setprecision(3) <<
+      "queries:     " << queries << "\n" <<
+      "queries/sec: " << std::setprecision(1) <<
+         queries / (total.total_microseconds() / 1e6) << "\n" <<
+      std::setprecision(3) <<
+      "p50:         " << Percentile(latencies, 0.50) << " ms\n" <<
+      "p99:         " << Percentile(latencies, 0.99) << " ms\n" <<
+      "max:         " << latencies.back() << " ms\n";
+   return 0;
+}
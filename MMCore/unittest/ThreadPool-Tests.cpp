@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+
+#include "ThreadPool.h"
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+
+namespace {
+
+void Count(boost::atomic<int>* counter)
+{
+   ++*counter;
+}
+
+void SleepAndCount(boost::atomic<int>* counter, long ms)
+{
+   boost::this_thread::sleep(boost::posix_time::milliseconds(ms));
+   ++*counter;
+}
+
+void RunNested(mm::ThreadPool* pool, boost::atomic<int>* counter)
+{
+   std::vector<mm::ThreadPool::Task> tasks;
+   for (int i = 0; i < 4; ++i)
+      tasks.push_back(boost::bind(&Count, counter));
+   pool->RunAll(tasks);
+}
+
+} // anonymous namespace
+
+
+TEST(ThreadPoolTests, RunAllRunsEveryTask)
+{
+   mm::ThreadPool pool(3);
+   boost::atomic<int> counter(0);
+   std::vector<mm::ThreadPool::Task> tasks;
+   for (int i = 0; i < 100; ++i)
+      tasks.push_back(boost::bind(&Count, &counter));
+   pool.RunAll(tasks);
+   EXPECT_EQ(100, counter.load());
+}
+
+TEST(ThreadPoolTests, RunAllRunsTasksConcurrently)
+{
+   mm::ThreadPool pool(3);
+   boost::atomic<int> counter(0);
+   std::vector<mm::ThreadPool::Task> tasks;
+   for (int i = 0; i < 4; ++i)
+      tasks.push_back(boost::bind(&SleepAndCount, &counter, 200L));
+
+   boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+   pool.RunAll(tasks);
+   boost::posix_time::time_duration elapsed =
+      boost::posix_time::microsec_clock::universal_time() - start;
+   EXPECT_EQ(4, counter.load());
+   EXPECT_LT(elapsed.total_milliseconds(), 600);
+}
+
+TEST(ThreadPoolTests, NestedRunAllCompletes)
+{
+   mm::ThreadPool pool(2);
+   boost::atomic<int> counter(0);
+   std::vector<mm::ThreadPool::Task> tasks;
+   for (int i = 0; i < 4; ++i)
+      tasks.push_back(boost::bind(&RunNested, &pool, &counter));
+   pool.RunAll(tasks);
+   EXPECT_EQ(16, counter.load());
+}
+
+TEST(ThreadPoolTests, SubmittedTasksFinishBeforeDestruction)
+{
+   boost::atomic<int> counter(0);
+   {
+      mm::ThreadPool pool(2);
+      for (int i = 0; i < 10; ++i)
+         pool.Submit(boost::bind(&SleepAndCount, &counter, 5L));
+   }
+   EXPECT_EQ(10, counter.load());
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
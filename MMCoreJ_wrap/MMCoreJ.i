@@ -32,6 +32,7 @@
 %include std_map.i
 %include std_pair.i
 %include "typemaps.i"
+%include <boost_shared_ptr.i>
 
 
 //
@@ -556,6 +557,67 @@
 }
 
 
+// Java typemap
+// caller-provided pixel buffer for batched image retrieval: any byte[],
+// short[], int[] or float[], filled in place
+%typemap(jni) (void* pixels, unsigned long bufferBytes) "jobject"
+%typemap(jtype) (void* pixels, unsigned long bufferBytes)      "Object"
+%typemap(jstype) (void* pixels, unsigned long bufferBytes)     "Object"
+%typemap(javain) (void* pixels, unsigned long bufferBytes)     "$javainput"
+%typemap(in) (void* pixels, unsigned long bufferBytes) (jint elementBytes = 0)
+{
+   if ($input == 0)
+   {
+      jclass excep = jenv->FindClass("java/lang/NullPointerException");
+      if (excep)
+         jenv->ThrowNew(excep, "Pixel array is null.");
+      return $null;
+   }
+
+   jsize length = JCALL1(GetArrayLength, jenv, (jarray) $input);
+   if (JCALL2(IsInstanceOf, jenv, $input, jenv->FindClass("[B")))
+   {
+      elementBytes = 1;
+      $1 = JCALL2(GetByteArrayElements, jenv, (jbyteArray) $input, 0);
+   }
+   else if (JCALL2(IsInstanceOf, jenv, $input, jenv->FindClass("[S")))
+   {
+      elementBytes = 2;
+      $1 = JCALL2(GetShortArrayElements, jenv, (jshortArray) $input, 0);
+   }
+   else if (JCALL2(IsInstanceOf, jenv, $input, jenv->FindClass("[I")))
+   {
+      elementBytes = 4;
+      $1 = JCALL2(GetIntArrayElements, jenv, (jintArray) $input, 0);
+   }
+   else if (JCALL2(IsInstanceOf, jenv, $input, jenv->FindClass("[F")))
+   {
+      elementBytes = -4; // Distinguishes float[] from int[] when releasing
+      $1 = JCALL2(GetFloatArrayElements, jenv, (jfloatArray) $input, 0);
+   }
+   else
+   {
+      jclass excep = jenv->FindClass("java/lang/IllegalArgumentException");
+      if (excep)
+         jenv->ThrowNew(excep, "Pixel array must be byte[], short[], int[] or float[].");
+      return $null;
+   }
+   $2 = (unsigned long) length * (elementBytes < 0 ? -elementBytes : elementBytes);
+}
+
+%typemap(freearg) (void* pixels, unsigned long bufferBytes)
+{
+   // Copy the pixels back (if the array was copied) and unpin the array
+   switch (elementBytes$argnum)
+   {
+      case 1: JCALL3(ReleaseByteArrayElements, jenv, (jbyteArray) $input, (jbyte*) $1, 0); break;
+      case 2: JCALL3(ReleaseShortArrayElements, jenv, (jshortArray) $input, (jshort*) $1, 0); break;
+      case 4: JCALL3(ReleaseIntArrayElements, jenv, (jintArray) $input, (jint*) $1, 0); break;
+      case -4: JCALL3(ReleaseFloatArrayElements, jenv, (jfloatArray) $input, (jfloat*) $1, 0); break;
+   }
+}
+
+
 %typemap(jni) imgRGB32 "jintArray"
 %typemap(jtype) imgRGB32      "int[]"
 %typemap(jstype) imgRGB32     "int[]"
@@ -628,6 +690,103 @@
 %ignore MetadataKeyError;
 %ignore MetadataIndexError;
 
+// Internal lookup returning a pointer into the configuration
+%ignore Configuration::findValue;
+
+// Frame leases are FrameLease objects, which release the frame when they are
+// deleted or garbage collected. getPixelBuffer() gives a read-only direct
+// ByteBuffer aliasing the frame; the lease is kept alive as long as any such
+// buffer is reachable, so delete() must not be called while one is in use.
+%shared_ptr(mm::FrameLease)
+%ignore mm::FrameLease::FrameLease;
+%ignore mm::FrameLease::GetPixels;
+%ignore mm::FrameLease::PinCounts;
+%javamethodmodifiers mm::FrameLease::getPixelBufferNative "private";
+
+%typemap(javacode) mm::FrameLease %{
+   // Each buffer handed out is tracked by a phantom reference that holds
+   // the lease, so that the frame stays pinned until the buffer has been
+   // collected. A daemon thread then drops the reference.
+   private static final java.lang.ref.ReferenceQueue<java.nio.ByteBuffer> collectedBuffers_ =
+      new java.lang.ref.ReferenceQueue<java.nio.ByteBuffer>();
+   private static final java.util.Set<BufferReference> liveBuffers_ =
+      java.util.Collections.synchronizedSet(new java.util.HashSet<BufferReference>());
+   private static Thread reaper_;
+
+   private static class BufferReference extends java.lang.ref.PhantomReference<java.nio.ByteBuffer> {
+      private final FrameLease lease_;
+
+      BufferReference(java.nio.ByteBuffer buffer, FrameLease lease) {
+         super(buffer, collectedBuffers_);
+         lease_ = lease;
+      }
+   }
+
+   private static synchronized void startReaper() {
+      if (reaper_ != null) {
+         return;
+      }
+      reaper_ = new Thread("FrameLease buffer reaper") {
+         @Override
+         public void run() {
+            for (;;) {
+               try {
+                  liveBuffers_.remove(collectedBuffers_.remove());
+               } catch (InterruptedException e) {
+                  return;
+               }
+            }
+         }
+      };
+      reaper_.setDaemon(true);
+      reaper_.start();
+   }
+
+   /**
+    * Returns a read-only direct ByteBuffer, in native byte order, holding
+    * the pixels of the frame without copying them. The frame remains leased
+    * at least as long as the buffer is reachable.
+    */
+   public java.nio.ByteBuffer getPixelBuffer() {
+      startReaper();
+      java.nio.ByteBuffer buffer = getPixelBufferNative();
+      liveBuffers_.add(new BufferReference(buffer, this));
+      return buffer;
+   }
+%}
+
+// Asynchronous commands return CommandFuture objects; Wait() throws the
+// command's error
+%shared_ptr(mm::CommandFuture)
+%ignore mm::CommandFuture::CommandFuture;
+%ignore mm::CommandFuture::SetStarted;
+%ignore mm::CommandFuture::SetDone;
+
+%typemap(in, numinputs=0) JNIEnv* jenv "$1 = jenv;"
+%typemap(jni) jobject "jobject"
+%typemap(jtype) jobject "java.nio.ByteBuffer"
+%typemap(jstype) jobject "java.nio.ByteBuffer"
+%typemap(out) jobject "$result = $1;"
+%typemap(javaout) jobject {
+      return $jnicall.asReadOnlyBuffer().order(java.nio.ByteOrder.nativeOrder());
+   }
+
+%extend mm::FrameLease {
+   jobject getPixelBufferNative(JNIEnv* jenv)
+   {
+      jlong bytes = (jlong) $self->Width() * $self->Height() * $self->Depth();
+      jobject buffer = jenv->NewDirectByteBuffer(
+            const_cast<unsigned char*>($self->GetPixels()), bytes);
+      if (buffer == 0 && !jenv->ExceptionCheck())
+      {
+         jclass excep = jenv->FindClass("java/lang/UnsupportedOperationException");
+         if (excep)
+            jenv->ThrowNew(excep, "Direct buffer access is not supported by this JVM.");
+      }
+      return buffer;
+   }
+}
+
 
 %typemap(javaimports) CMMCore %{
    import org.json.JSONObject;
@@ -638,14 +797,10 @@
 %}
 
 %typemap(javacode) CMMCore %{
-   private JSONObject metadataToMap(Metadata md) {
-      JSONObject tags = new JSONObject();
-      for (String key:md.GetKeys()) {
-         try {
-            tags.put(key, md.GetSingleTag(key).GetValue());
-         } catch (Exception e) {} 
-      }
-      return tags;
+   private JSONObject metadataToMap(Metadata md) throws java.lang.Exception {
+      // One native call, rather than one per tag; as before, only the
+      // single-valued tags are included
+      return new JSONObject(md.ToJSON());
    }
 
    private String getROITag() throws java.lang.Exception {
@@ -789,6 +944,50 @@
       return popNextTaggedImage(0);
    }
 
+   /**
+    * Gets and removes up to maxCount images from the circular buffer (or the
+    * current camera's own buffer, if it has one) in one call. The pixels are returned in one array (of the type popNextImage()
+    * returns) holding the images one after the other; md receives the
+    * metadata of each image, so md.size() is the number of images.
+    */
+   public Object popNextImages(int maxCount, MetadataVector md) throws java.lang.Exception {
+      int count = (int) Math.min(maxCount, getRemainingImageCount());
+      int imageLength = (int) (getImageWidth() * getImageHeight());
+      Object pixels;
+      switch ((int) getBytesPerPixel()) {
+         case 1:
+            pixels = new byte[count * imageLength];
+            break;
+         case 2:
+            pixels = new short[count * imageLength];
+            break;
+         case 4:
+            if (getNumberOfComponents() == 1) {
+               pixels = new float[count * imageLength];
+            } else {
+               imageLength *= 4;
+               pixels = new byte[count * imageLength];
+            }
+            break;
+         case 8:
+            imageLength *= 4;
+            pixels = new short[count * imageLength];
+            break;
+         default:
+            throw new Exception("Unsupported pixel type");
+      }
+
+      long popped = popNextImages(count, pixels, md);
+      if (popped < count) {
+         // Another reader took some of the images
+         Object trimmed = java.lang.reflect.Array.newInstance(
+               pixels.getClass().getComponentType(), (int) popped * imageLength);
+         System.arraycopy(pixels, 0, trimmed, 0, (int) popped * imageLength);
+         pixels = trimmed;
+      }
+      return pixels;
+   }
+
    // convenience functions follow
    
    /*
@@ -884,14 +1083,19 @@
 %{
 #include "../MMDevice/MMDeviceConstants.h"
 #include "../MMCore/Configuration.h"
+#include "../MMCore/AcquisitionPlan.h"
 #include "../MMDevice/ImageMetadata.h"
 #include "../MMCore/MMEventCallback.h"
 #include "../MMCore/MMCore.h"
+#include "../MMCore/FrameLease.h"
+#include "../MMCore/CommandFuture.h"
 %}
 
 
 // instantiate STL mappings
 
+class Metadata;
+
 namespace std {
 
 	%typemap(javaimports) vector<string> %{
@@ -1050,6 +1254,7 @@ namespace std {
     %template(UnsignedVector) vector<unsigned>;
     %template(pair_ss)      pair<string, string>;
     %template(StrMap)       map<string, string>;
+    %template(MetadataVector) vector<Metadata>;
 
 
 
@@ -1059,7 +1264,10 @@ namespace std {
 
 %include "../MMDevice/MMDeviceConstants.h"
 %include "../MMCore/Configuration.h"
+%include "../MMCore/AcquisitionPlan.h"
 %include "../MMCore/MMCore.h"
 %include "../MMDevice/ImageMetadata.h"
 %include "../MMCore/MMEventCallback.h"
+%include "../MMCore/FrameLease.h"
+%include "../MMCore/CommandFuture.h"
 
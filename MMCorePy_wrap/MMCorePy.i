@@ -39,6 +39,7 @@
 %include std_map.i
 %include std_pair.i
 %include "typemaps.i"
+%include <boost_shared_ptr.i>
 
 
 %{
@@ -97,6 +98,79 @@ import_array();
 }
 
 
+// caller-provided pixel buffer for batched image retrieval: a writable,
+// C-contiguous numpy array, filled in place
+%typemap(in) (void* pixels, unsigned long bufferBytes)
+{
+   if (!PyArray_Check($input) ||
+         !PyArray_ISCARRAY((PyArrayObject *) $input))
+   {
+      PyErr_SetString(PyExc_TypeError,
+            "Pixel array must be a writable, C-contiguous numpy array");
+      SWIG_fail;
+   }
+   $1 = PyArray_DATA((PyArrayObject *) $input);
+   $2 = (unsigned long) PyArray_NBYTES((PyArrayObject *) $input);
+}
+
+
+// asynchronous commands return CommandFuture objects; Wait() raises the
+// command's error
+%shared_ptr(mm::CommandFuture)
+%ignore mm::CommandFuture::CommandFuture;
+%ignore mm::CommandFuture::SetStarted;
+%ignore mm::CommandFuture::SetDone;
+
+// leased frames: a read-only numpy array viewing the frame in place, which
+// holds the lease until it is garbage collected, and the frame's metadata
+%typemap(out) boost::shared_ptr<mm::FrameLease>
+{
+   npy_intp dims[2];
+   dims[0] = result->Height();
+   dims[1] = result->Width();
+
+   int typenum;
+   switch (result->Depth())
+   {
+      case 1: typenum = NPY_UINT8; break;
+      case 2: typenum = NPY_UINT16; break;
+      case 4: typenum = NPY_UINT32; break;
+      case 8: typenum = NPY_UINT64; break;
+      default:
+         PyErr_SetString(PyExc_ValueError, "Unsupported pixel depth");
+         SWIG_fail;
+   }
+
+   PyObject * numpyArray = PyArray_New(&PyArray_Type, 2, dims, typenum, NULL,
+         const_cast<unsigned char*>(result->GetPixels()), 0,
+         NPY_ARRAY_C_CONTIGUOUS | NPY_ARRAY_ALIGNED, NULL);
+   if (!numpyArray)
+      SWIG_fail;
+   boost::shared_ptr<mm::FrameLease> * holder =
+      new boost::shared_ptr<mm::FrameLease>(result);
+   PyObject * capsule = PyCapsule_New(holder, "mm::FrameLease",
+         ReleaseFrameLease);
+   if (!capsule)
+   {
+      delete holder;
+      Py_DECREF(numpyArray);
+      SWIG_fail;
+   }
+   // Steals the reference to capsule, even on failure
+   if (PyArray_SetBaseObject((PyArrayObject *) numpyArray, capsule) < 0)
+   {
+      Py_DECREF(numpyArray);
+      SWIG_fail;
+   }
+
+   PyObject * md = SWIG_NewPointerObj(new Metadata(result->GetMetadata()),
+         $descriptor(Metadata *), SWIG_POINTER_OWN);
+   $result = PyTuple_Pack(2, numpyArray, md);
+   Py_DECREF(numpyArray);
+   Py_DECREF(md);
+}
+
+
 %typemap(out) unsigned int*
 {
    //Here we assume we are getting RGBA (32 bits).
@@ -150,9 +224,18 @@ import_array();
 #include "../MMDevice/MMDeviceConstants.h"
 #include "../MMCore/Error.h"
 #include "../MMCore/Configuration.h"
+#include "../MMCore/AcquisitionPlan.h"
 #include "../MMDevice/ImageMetadata.h"
 #include "../MMCore/MMEventCallback.h"
 #include "../MMCore/MMCore.h"
+#include "../MMCore/FrameLease.h"
+#include "../MMCore/CommandFuture.h"
+
+static void ReleaseFrameLease(PyObject* capsule)
+{
+   delete static_cast< boost::shared_ptr<mm::FrameLease>* >(
+         PyCapsule_GetPointer(capsule, "mm::FrameLease"));
+}
 %}
 
 // Extend exception objects to return the exception object message in python.
@@ -191,6 +274,8 @@ import_array();
 
 
 // instantiate STL mappings
+class Metadata;
+
 namespace std {
     %template(CharVector)   vector<char>;
     %template(LongVector)   vector<long>;
@@ -198,6 +283,31 @@ namespace std {
     %template(StrVector)    vector<string>;
     %template(pair_ss)      pair<string, string>;
     %template(StrMap)       map<string, string>;
+    %template(MetadataVector) vector<Metadata>;
+}
+
+
+// popNextImages() returning an array of shape (N, H, W)
+%rename(_popNextImages) CMMCore::popNextImages;
+
+%extend CMMCore {
+%pythoncode %{
+def popNextImages(self, maxCount):
+    """Gets and removes up to maxCount images from the circular buffer, or
+    from the current camera's own buffer if it has one.
+
+    Returns a numpy array of shape (N, height, width) holding the images,
+    and a MetadataVector with the metadata of each image.
+    """
+    import numpy
+    dtypes = {1: numpy.uint8, 2: numpy.uint16, 4: numpy.uint32, 8: numpy.uint64}
+    count = min(maxCount, self.getRemainingImageCount())
+    pixels = numpy.empty((count, self.getImageHeight(), self.getImageWidth()),
+                         dtypes[self.getBytesPerPixel()])
+    md = MetadataVector()
+    popped = self._popNextImages(count, pixels, md)
+    return pixels[:popped], md
+%}
 }
 
 
@@ -213,7 +323,10 @@ namespace std {
 
 %include "../MMDevice/MMDeviceConstants.h"
 %include "../MMCore/Error.h"
+%ignore Configuration::findValue; // Internal, returns a pointer
 %include "../MMCore/Configuration.h"
+%include "../MMCore/AcquisitionPlan.h"
 %include "../MMCore/MMCore.h"
 %include "../MMDevice/ImageMetadata.h"
 %include "../MMCore/MMEventCallback.h"
+%include "../MMCore/CommandFuture.h"
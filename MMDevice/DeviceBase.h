@@ -180,6 +180,14 @@ public:
    */
    virtual bool UsesDelay() {return usesDelay_;}
 
+   /**
+   * Signals if the device calls OnDeviceIdle() whenever it stops being busy.
+   * Devices that can tell when they finish (e.g. from an unsolicited reply
+   * of the controller) should override this to return true, so that the
+   * Core does not have to poll Busy().
+   */
+   virtual bool NotifiesIdle() {return false;}
+
    /**
    * Returns the number of properties.
    */
@@ -1120,6 +1128,16 @@ protected:
       return DEVICE_NO_CALLBACK_REGISTERED;
    }
 
+   /**
+    * Signals to the core that the device is no longer busy
+    */
+   int OnDeviceIdle()
+   {
+      if (callback_)
+         return callback_->OnDeviceIdle(this);
+      return DEVICE_NO_CALLBACK_REGISTERED;
+   }
+
    /**
    * Gets the system ticks in microseconds.
    * OBSOLETE, use GetCurrentTime()
@@ -1403,8 +1421,10 @@ public:
     */
    virtual void GetTags(char* serializedMetadata)
    {
-      std::string data = metadata_.Serialize();
-      data.copy(serializedMetadata, data.size(), 0);
+      // Called for every inserted image; serialize only after a change
+      if (serializedTags_.empty())
+         serializedTags_ = metadata_.Serialize();
+      serializedTags_.copy(serializedMetadata, serializedTags_.size(), 0);
    }
 
    // temporary debug methods
@@ -1461,12 +1481,14 @@ public:
    virtual void AddTag(const char* key, const char* deviceLabel, const char* value)
    {
       metadata_.PutTag(key, deviceLabel, value);
+      serializedTags_.clear();
    }
 
 
    virtual void RemoveTag(const char* key)
    {
       metadata_.RemoveTag(key);
+      serializedTags_.clear();
    }
 
    virtual bool SupportsMultiROI()
@@ -1512,10 +1534,23 @@ protected:
       return metadata_.GetSingleTag(key).GetValue();
    }
 
+   // Cameras that can acquire directly into memory supplied by the caller
+   // should return true here and implement SnapImageInto(). The default
+   // sequence thread then acquires each frame straight into the Core's
+   // sequence buffer instead of copying it from GetImageBuffer().
+   virtual bool SupportsSnapImageInto() const {return false;}
+
+   // Acquire one frame of GetImageWidth() x GetImageHeight() x
+   // GetImageBytesPerPixel() bytes into pixels
+   virtual int SnapImageInto(unsigned char* /*pixels*/) {return DEVICE_UNSUPPORTED_COMMAND;}
+
    // Do actual capturing
    // Called from inside the thread
    virtual int ThreadRun (void)
    {
+      if (SupportsSnapImageInto())
+         return InsertImageInPlace();
+
       int ret=DEVICE_ERR;
       ret = SnapImage();
       if (ret != DEVICE_OK)
@@ -1532,24 +1567,52 @@ protected:
 
    virtual int InsertImage()
    {
-      char label[MM::MaxStrLength];
-      this->GetLabel(label);
-      Metadata md;
-      md.put("Camera", label);
+      // The Core adds the camera label
+      MM::FrameMetadata md;
       int ret = GetCoreCallback()->InsertImage(this, GetImageBuffer(), GetImageWidth(),
-         GetImageHeight(), GetImageBytesPerPixel(),
-         md.Serialize().c_str());
+         GetImageHeight(), GetImageBytesPerPixel(), GetNumberOfComponents(),
+         md);
       if (!stopWhenCBOverflows_ && ret == DEVICE_BUFFER_OVERFLOW)
       {
          // do not stop on overflow - just reset the buffer
          GetCoreCallback()->ClearImageBuffer(this);
          return GetCoreCallback()->InsertImage(this, GetImageBuffer(), GetImageWidth(),
-            GetImageHeight(), GetImageBytesPerPixel(),
-            md.Serialize().c_str());
+            GetImageHeight(), GetImageBytesPerPixel(), GetNumberOfComponents(),
+            md);
       } else
          return ret;
    }
 
+   // Acquire a frame directly into the sequence buffer with SnapImageInto()
+   virtual int InsertImageInPlace()
+   {
+      unsigned char* pixels = 0;
+      int ret = GetCoreCallback()->AcquireFrameSlot(this, GetImageWidth(),
+         GetImageHeight(), GetImageBytesPerPixel(), GetNumberOfComponents(),
+         pixels);
+      if (!stopWhenCBOverflows_ && ret == DEVICE_BUFFER_OVERFLOW)
+      {
+         // do not stop on overflow - just reset the buffer
+         GetCoreCallback()->ClearImageBuffer(this);
+         ret = GetCoreCallback()->AcquireFrameSlot(this, GetImageWidth(),
+            GetImageHeight(), GetImageBytesPerPixel(), GetNumberOfComponents(),
+            pixels);
+      }
+      if (ret != DEVICE_OK)
+         return ret;
+
+      ret = SnapImageInto(pixels);
+      if (ret != DEVICE_OK)
+      {
+         GetCoreCallback()->DiscardFrameSlot(this, pixels);
+         return ret;
+      }
+
+      // The Core adds the camera label
+      MM::FrameMetadata md;
+      return GetCoreCallback()->CommitFrameSlot(this, pixels, md);
+   }
+
    virtual double GetIntervalMs() {return thd_->GetIntervalMs();}
    virtual long GetImageCounter() {return thd_->GetImageCounter();}
    virtual long GetNumberOfImages() {return thd_->GetNumberOfImages();}
@@ -1702,6 +1765,7 @@ private:
    bool busy_;
    bool stopWhenCBOverflows_;
    Metadata metadata_;
+   std::string serializedTags_; // Cache of metadata_.Serialize(), or empty
 
    BaseSequenceThread * thd_;
    friend class BaseSequenceThread;
@@ -142,6 +142,8 @@ public:
    }
 
 private:
+   friend class MMThreadCondition;
+
    // Forbid copying
    MMThreadLock(const MMThreadLock&);
    MMThreadLock& operator=(const MMThreadLock&);
@@ -183,3 +185,64 @@ private:
 
    MMThreadLock* lock_;
 };
+
+/**
+ * Condition variable, used together with an MMThreadLock.
+ */
+class MMThreadCondition
+{
+public:
+   MMThreadCondition()
+   {
+#ifdef _WIN32
+      InitializeConditionVariable(&cond_);
+#else
+      pthread_cond_init(&cond_, 0);
+#endif
+   }
+
+   ~MMThreadCondition()
+   {
+#ifdef _WIN32
+      // Windows condition variables need no cleanup
+#else
+      pthread_cond_destroy(&cond_);
+#endif
+   }
+
+   /**
+    * Unlocks lock, waits to be notified, and locks lock again. The lock must
+    * be held exactly once by the calling thread. As with all condition
+    * variables, the wait can end spuriously, so callers should wait in a
+    * loop that checks their condition.
+    */
+   void Wait(MMThreadLock& lock)
+   {
+#ifdef _WIN32
+      SleepConditionVariableCS(&cond_, &lock.lock_, INFINITE);
+#else
+      pthread_cond_wait(&cond_, &lock.lock_);
+#endif
+   }
+
+   void NotifyAll()
+   {
+#ifdef _WIN32
+      WakeAllConditionVariable(&cond_);
+#else
+      pthread_cond_broadcast(&cond_);
+#endif
+   }
+
+private:
+   // Forbid copying
+   MMThreadCondition(const MMThreadCondition&);
+   MMThreadCondition& operator=(const MMThreadCondition&);
+
+#ifdef _WIN32
+   CONDITION_VARIABLE
+#else
+   pthread_cond_t
+#endif
+   cond_;
+};
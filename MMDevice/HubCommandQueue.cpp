@@ -0,0 +1,201 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          HubCommandQueue.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMDevice - Device adapter kit
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Pipelined command/reply queue for hub devices whose
+//                peripherals share one serial connection
+//
+// LICENSE:       This file is distributed under the BSD license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "HubCommandQueue.h"
+
+#include "DeviceUtils.h"
+#include "MMDeviceConstants.h"
+
+
+HubCommandQueue::HubCommandQueue(Transport& transport, unsigned maxOutstanding) :
+   transport_(transport),
+   maxOutstanding_(maxOutstanding > 0 ? maxOutstanding : 1),
+   pumping_(false),
+   coalescedCount_(0)
+{
+}
+
+HubCommandQueue::~HubCommandQueue()
+{
+   // No query can be in progress when the queue is destroyed
+}
+
+void HubCommandQueue::SetMaxOutstanding(unsigned maxOutstanding)
+{
+   MMThreadGuard g(lock_);
+   maxOutstanding_ = maxOutstanding > 0 ? maxOutstanding : 1;
+}
+
+unsigned HubCommandQueue::GetMaxOutstanding()
+{
+   MMThreadGuard g(lock_);
+   return maxOutstanding_;
+}
+
+long HubCommandQueue::GetCoalescedCount()
+{
+   MMThreadGuard g(lock_);
+   return coalescedCount_;
+}
+
+int HubCommandQueue::Query(const std::string& command,
+      const std::string& terminator, long delayMs, bool coalesce,
+      std::string& reply)
+{
+   MMThreadGuard g(lock_);
+
+   Request* request = 0;
+   if (coalesce)
+   {
+      for (std::deque<Request*>::iterator it = pending_.begin(), end = pending_.end();
+            it != end; ++it)
+      {
+         Request* r = *it;
+         if (r->coalesce && r->command == command &&
+               r->terminator == terminator && r->delayMs == delayMs)
+         {
+            request = r;
+            ++coalescedCount_;
+            break;
+         }
+      }
+   }
+   if (!request)
+   {
+      request = new Request(command, terminator, delayMs, coalesce);
+      pending_.push_back(request);
+   }
+   ++request->waiters;
+
+   while (!request->done)
+   {
+      if (pumping_)
+      {
+         completed_.Wait(lock_);
+         continue;
+      }
+
+      // Send and receive on behalf of all threads until our reply arrives,
+      // then let a waiting thread take over
+      pumping_ = true;
+      Pump(*request);
+      pumping_ = false;
+      completed_.NotifyAll();
+   }
+
+   int result = request->result;
+   reply = request->reply;
+   if (--request->waiters == 0)
+      delete request;
+   return result;
+}
+
+void HubCommandQueue::AcquireConnection()
+{
+   MMThreadGuard g(lock_);
+   while (pumping_)
+      completed_.Wait(lock_);
+   pumping_ = true;
+
+   // Pending commands stay queued until the connection is released
+   while (!inFlight_.empty())
+      ReceiveOne();
+}
+
+void HubCommandQueue::ReleaseConnection()
+{
+   MMThreadGuard g(lock_);
+   pumping_ = false;
+   completed_.NotifyAll();
+}
+
+void HubCommandQueue::Pump(const Request& until)
+{
+   while (!until.done)
+   {
+      SendPending();
+      if (!inFlight_.empty())
+         ReceiveOne();
+   }
+}
+
+void HubCommandQueue::SendPending()
+{
+   while (!pending_.empty() && inFlight_.size() < maxOutstanding_)
+   {
+      Request* request = pending_.front();
+      // Delayed commands are sent alone
+      if (!inFlight_.empty() &&
+            (request->delayMs > 0 || inFlight_.back()->delayMs > 0))
+         break;
+
+      // Once in flight, the request can no longer be coalesced with
+      pending_.pop_front();
+      bool idle = inFlight_.empty();
+      inFlight_.push_back(request);
+
+      lock_.Unlock();
+      int ret = DEVICE_OK;
+      if (idle)
+         ret = transport_.Purge();
+      if (ret == DEVICE_OK)
+         ret = transport_.Send(request->command);
+      lock_.Lock();
+
+      if (ret != DEVICE_OK)
+      {
+         inFlight_.pop_back();
+         Complete(request, ret, "");
+      }
+   }
+}
+
+void HubCommandQueue::ReceiveOne()
+{
+   Request* request = inFlight_.front();
+
+   lock_.Unlock();
+   if (request->delayMs > 0)
+      CDeviceUtils::SleepMs(request->delayMs);
+   std::string reply;
+   int ret = transport_.Receive(request->terminator, reply);
+   lock_.Lock();
+
+   inFlight_.pop_front();
+   Complete(request, ret, reply);
+
+   if (ret != DEVICE_OK)
+   {
+      // The replies to the later commands can no longer be told apart
+      while (!inFlight_.empty())
+      {
+         Complete(inFlight_.front(), ret, "");
+         inFlight_.pop_front();
+      }
+   }
+}
+
+void HubCommandQueue::Complete(Request* request, int result,
+      const std::string& reply)
+{
+   request->result = result;
+   request->reply = reply;
+   request->done = true;
+   completed_.NotifyAll();
+}
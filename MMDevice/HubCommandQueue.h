@@ -0,0 +1,153 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          HubCommandQueue.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMDevice - Device adapter kit
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Pipelined command/reply queue for hub devices whose
+//                peripherals share one serial connection
+//
+// LICENSE:       This file is distributed under the BSD license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "DeviceThreads.h"
+
+#include <deque>
+#include <string>
+
+/**
+ * Queue of the commands that the peripherals of a hub send to their
+ * controller over one connection.
+ *
+ * Any number of threads can call Query() at the same time. Instead of one
+ * thread holding the connection for a whole command/reply round trip, the
+ * thread that is reading replies also sends the commands queued by the
+ * other threads, up to GetMaxOutstanding() commands ahead of the replies.
+ * Replies are matched to commands by order, so the controller must answer
+ * its commands in the order it receives them.
+ *
+ * Identical queries that are marked as coalescable (typically status
+ * polls) and that are both waiting to be sent are sent only once, and
+ * share the reply. A query is never coalesced with one that has already
+ * been sent, so that its reply is never older than the query.
+ *
+ * The connection is abstracted by Transport, so that the queue can be
+ * used with any port (and tested against a stand-in for the controller).
+ */
+class HubCommandQueue
+{
+public:
+   /**
+    * The connection to the controller. Only one thread at a time calls
+    * these functions.
+    */
+   class Transport
+   {
+   public:
+      virtual ~Transport() {}
+
+      // Discards unread input. Called before sending when no reply is
+      // outstanding.
+      virtual int Purge() = 0;
+      virtual int Send(const std::string& command) = 0;
+      // Reads one reply, up to terminator (which is not included in reply)
+      virtual int Receive(const std::string& terminator, std::string& reply) = 0;
+   };
+
+   HubCommandQueue(Transport& transport, unsigned maxOutstanding = 1);
+   ~HubCommandQueue();
+
+   void SetMaxOutstanding(unsigned maxOutstanding);
+   unsigned GetMaxOutstanding();
+
+   /**
+    * Sends command and waits for its reply.
+    *
+    * If delayMs is positive, the command is sent when no other command is
+    * outstanding, and its reply is read delayMs after it was sent; no
+    * other command is sent in the meantime.
+    *
+    * If the reply to a command cannot be read, the commands sent after it
+    * fail with the same error, because their replies can no longer be
+    * matched.
+    */
+   int Query(const std::string& command, const std::string& terminator,
+         long delayMs, bool coalesce, std::string& reply);
+
+   // Number of queries that were answered by the reply to another query
+   long GetCoalescedCount();
+
+   /**
+    * Takes the connection for a transaction that Query() cannot express
+    * (such as a reply without a terminator): waits until no other thread
+    * is using the connection, reads the replies to the commands in flight,
+    * and keeps other threads from sending until ReleaseConnection().
+    */
+   void AcquireConnection();
+   void ReleaseConnection();
+
+   // Holds the connection for the lifetime of the guard
+   class ConnectionGuard
+   {
+   public:
+      explicit ConnectionGuard(HubCommandQueue& queue) : queue_(queue)
+      { queue_.AcquireConnection(); }
+      ~ConnectionGuard() { queue_.ReleaseConnection(); }
+
+   private:
+      ConnectionGuard(const ConnectionGuard&);
+      ConnectionGuard& operator=(const ConnectionGuard&);
+
+      HubCommandQueue& queue_;
+   };
+
+private:
+   struct Request
+   {
+      Request(const std::string& command, const std::string& terminator,
+            long delayMs, bool coalesce) :
+         command(command), terminator(terminator), delayMs(delayMs),
+         coalesce(coalesce), waiters(0), done(false), result(0)
+      {}
+
+      std::string command;
+      std::string terminator;
+      long delayMs;
+      bool coalesce;
+      int waiters; // Threads waiting for the reply; the last one deletes
+      bool done;
+      int result;
+      std::string reply;
+   };
+
+   // These are called with lock_ held, which they release during I/O
+   void Pump(const Request& until);
+   void SendPending();
+   void ReceiveOne();
+   void Complete(Request* request, int result, const std::string& reply);
+
+   // Forbid copying
+   HubCommandQueue(const HubCommandQueue&);
+   HubCommandQueue& operator=(const HubCommandQueue&);
+
+   Transport& transport_;
+
+   MMThreadLock lock_;
+   MMThreadCondition completed_; // Notified when a request is done or
+                                 // when pumping_ becomes false
+   unsigned maxOutstanding_;
+   std::deque<Request*> pending_; // Not yet sent
+   std::deque<Request*> inFlight_; // Sent, in order, awaiting replies
+   bool pumping_; // A thread is sending commands and reading replies, or
+                  // holds the connection (AcquireConnection())
+   long coalescedCount_;
+};
@@ -37,6 +37,7 @@
 #include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 ///////////////////////////////////////////////////////////////////////////////
 // MetadataError
@@ -95,13 +96,9 @@ public:
    const std::string& GetName() const {return name_;}
    const std::string GetQualifiedName() const
    {
-      std::stringstream os;
-      if (deviceLabel_.compare("_") != 0)
-      {
-         os << deviceLabel_ << "-";
-      }
-      os << name_;
-      return os.str();
+      if (deviceLabel_.compare("_") == 0)
+         return name_;
+      return deviceLabel_ + "-" + name_;
    }
    const bool IsReadOnly() const  {return readOnly_;}
 
@@ -296,7 +293,7 @@ public:
       return keyList;
    }
 
-   bool HasTag(const char* key)
+   bool HasTag(const char* key) const
    {
       TagIterator it = tags_.find(key);
       if (it != tags_.end())
@@ -500,7 +497,74 @@ public:
       return os.str();
    }
 
+   /*
+    * Serializes the tags as one JSON object of strings, keyed by qualified
+    * name. Array tags are left out, unless includeArrayTags is true, in
+    * which case they become arrays of strings.
+    */
+   std::string ToJSON(bool includeArrayTags = false) const
+   {
+      std::ostringstream os;
+      os << '{';
+      bool first = true;
+      for (TagIterator it = tags_.begin(); it != tags_.end(); it++)
+      {
+         const MetadataArrayTag* at = it->second->ToArrayTag();
+         if (at && !includeArrayTags)
+            continue;
+
+         if (!first)
+            os << ',';
+         first = false;
+         WriteJSONString(os, it->first);
+         os << ':';
+
+         if (at)
+         {
+            os << '[';
+            for (size_t i=0; i<at->GetSize(); i++)
+            {
+               if (i > 0)
+                  os << ',';
+               WriteJSONString(os, at->GetValue(i));
+            }
+            os << ']';
+         }
+         else
+         {
+            WriteJSONString(os, it->second->ToSingleTag()->GetValue());
+         }
+      }
+      os << '}';
+      return os.str();
+   }
+
 private:
+   static void WriteJSONString(std::ostringstream& os, const std::string& str)
+   {
+      os << '"';
+      for (std::string::const_iterator it = str.begin(); it != str.end(); ++it)
+      {
+         switch (*it)
+         {
+            case '"': os << "\\\""; break;
+            case '\\': os << "\\\\"; break;
+            case '\n': os << "\\n"; break;
+            case '\r': os << "\\r"; break;
+            case '\t': os << "\\t"; break;
+            default:
+               if ((unsigned char)*it < 0x20)
+               {
+                  const char* hex = "0123456789abcdef";
+                  os << "\\u00" << hex[(*it >> 4) & 0xf] << hex[*it & 0xf];
+               }
+               else
+                  os << *it;
+         }
+      }
+      os << '"';
+   }
+
    MetadataTag* FindTag(const char* key) const
    {
       TagIterator it = tags_.find(key);
@@ -514,4 +578,207 @@ private:
    typedef std::map<std::string, MetadataTag*>::const_iterator TagIterator;
 };
 
+namespace MM {
+
+/**
+ * Fixed-size metadata record for a single frame, which can be filled in
+ * without allocating memory.
+ *
+ * The well-known tags have typed fields. Other tags go into a small side
+ * table, under a key obtained once (not per frame) from
+ * MM::Core::RegisterMetadataKey(). The Core fills in the camera, image
+ * number, image size and pixel type, and converts the record to Metadata
+ * only when an application retrieves the image.
+ */
+class FrameMetadata
+{
+public:
+   enum
+   {
+      MaxTags = 16,
+      MaxTagValueLength = 64 // Including the terminating null
+   };
+
+   enum TagType
+   {
+      StringTag,
+      LongTag,
+      DoubleTag
+   };
+
+   struct Tag
+   {
+      unsigned key;
+      TagType type;
+      long longValue;
+      double doubleValue;
+      char stringValue[MaxTagValueLength];
+   };
+
+   FrameMetadata() { Clear(); }
+
+   FrameMetadata(const FrameMetadata& other) { CopyFrom(other); }
+
+   FrameMetadata& operator=(const FrameMetadata& rhs)
+   {
+      if (&rhs != this)
+         CopyFrom(rhs);
+      return *this;
+   }
+
+   void Clear()
+   {
+      fields_ = 0;
+      startTimeMs_ = elapsedTimeMs_ = 0.0;
+      roiX_ = roiY_ = binning_ = imageNumber_ = 0;
+      cameraKey_ = width_ = height_ = byteDepth_ = nComponents_ = 0;
+      nTags_ = 0;
+   }
+
+   // Tags set by the camera
+
+   void SetStartTimeMs(double ms) { startTimeMs_ = ms; fields_ |= StartTimeField; }
+   bool HasStartTimeMs() const { return (fields_ & StartTimeField) != 0; }
+   double GetStartTimeMs() const { return startTimeMs_; }
+
+   void SetElapsedTimeMs(double ms) { elapsedTimeMs_ = ms; fields_ |= ElapsedTimeField; }
+   bool HasElapsedTimeMs() const { return (fields_ & ElapsedTimeField) != 0; }
+   double GetElapsedTimeMs() const { return elapsedTimeMs_; }
+
+   void SetROI(long x, long y) { roiX_ = x; roiY_ = y; fields_ |= ROIField; }
+   bool HasROI() const { return (fields_ & ROIField) != 0; }
+   long GetROIX() const { return roiX_; }
+   long GetROIY() const { return roiY_; }
+
+   void SetBinning(long binning) { binning_ = binning; fields_ |= BinningField; }
+   bool HasBinning() const { return (fields_ & BinningField) != 0; }
+   long GetBinning() const { return binning_; }
+
+   /**
+    * Sets a tag registered with MM::Core::RegisterMetadataKey(). String
+    * values longer than MaxTagValueLength - 1 are truncated. Returns false
+    * if the record already holds MaxTags other tags.
+    */
+   bool PutTag(unsigned key, const char* value)
+   {
+      Tag* tag = FindOrAddTag(key);
+      if (!tag)
+         return false;
+      tag->type = StringTag;
+      strncpy(tag->stringValue, value, MaxTagValueLength - 1);
+      tag->stringValue[MaxTagValueLength - 1] = '\0';
+      return true;
+   }
+
+   bool PutTag(unsigned key, long value)
+   {
+      Tag* tag = FindOrAddTag(key);
+      if (!tag)
+         return false;
+      tag->type = LongTag;
+      tag->longValue = value;
+      return true;
+   }
+
+   bool PutTag(unsigned key, double value)
+   {
+      Tag* tag = FindOrAddTag(key);
+      if (!tag)
+         return false;
+      tag->type = DoubleTag;
+      tag->doubleValue = value;
+      return true;
+   }
+
+   unsigned GetTagCount() const { return nTags_; }
+   const Tag& GetTag(unsigned index) const { return tags_[index]; }
+
+   // Tags set by the Core
+
+   void SetCameraKey(unsigned key) { cameraKey_ = key; fields_ |= CameraField; }
+   bool HasCameraKey() const { return (fields_ & CameraField) != 0; }
+   unsigned GetCameraKey() const { return cameraKey_; }
+
+   void SetImageNumber(long n) { imageNumber_ = n; fields_ |= ImageNumberField; }
+   bool HasImageNumber() const { return (fields_ & ImageNumberField) != 0; }
+   long GetImageNumber() const { return imageNumber_; }
+
+   void SetImageFormat(unsigned width, unsigned height, unsigned byteDepth,
+         unsigned nComponents)
+   {
+      width_ = width;
+      height_ = height;
+      byteDepth_ = byteDepth;
+      nComponents_ = nComponents;
+      fields_ |= ImageFormatField;
+   }
+   bool HasImageFormat() const { return (fields_ & ImageFormatField) != 0; }
+   unsigned GetWidth() const { return width_; }
+   unsigned GetHeight() const { return height_; }
+   unsigned GetByteDepth() const { return byteDepth_; }
+   unsigned GetNumberOfComponents() const { return nComponents_; }
+
+private:
+   enum
+   {
+      StartTimeField = 1 << 0,
+      ElapsedTimeField = 1 << 1,
+      ROIField = 1 << 2,
+      BinningField = 1 << 3,
+      CameraField = 1 << 4,
+      ImageNumberField = 1 << 5,
+      ImageFormatField = 1 << 6
+   };
+
+   Tag* FindOrAddTag(unsigned key)
+   {
+      for (unsigned i = 0; i < nTags_; ++i)
+      {
+         if (tags_[i].key == key)
+            return &tags_[i];
+      }
+      if (nTags_ == MaxTags)
+         return 0;
+      tags_[nTags_].key = key;
+      return &tags_[nTags_++];
+   }
+
+   // Only the tags in use are copied
+   void CopyFrom(const FrameMetadata& other)
+   {
+      fields_ = other.fields_;
+      startTimeMs_ = other.startTimeMs_;
+      elapsedTimeMs_ = other.elapsedTimeMs_;
+      roiX_ = other.roiX_;
+      roiY_ = other.roiY_;
+      binning_ = other.binning_;
+      cameraKey_ = other.cameraKey_;
+      imageNumber_ = other.imageNumber_;
+      width_ = other.width_;
+      height_ = other.height_;
+      byteDepth_ = other.byteDepth_;
+      nComponents_ = other.nComponents_;
+      nTags_ = other.nTags_;
+      for (unsigned i = 0; i < nTags_; ++i)
+         tags_[i] = other.tags_[i];
+   }
+
+   unsigned fields_;
+   double startTimeMs_;
+   double elapsedTimeMs_;
+   long roiX_;
+   long roiY_;
+   long binning_;
+   unsigned cameraKey_;
+   long imageNumber_;
+   unsigned width_;
+   unsigned height_;
+   unsigned byteDepth_;
+   unsigned nComponents_;
+   unsigned nTags_;
+   Tag tags_[MaxTags];
+};
+
+} // namespace MM
+
 #endif //_IMAGE_METADATA_H_
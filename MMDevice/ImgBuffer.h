@@ -40,6 +40,7 @@ class ImgBuffer
 {
 public:
    ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth);
+   ImgBuffer(unsigned char* externalPixels, unsigned xSize, unsigned ySize, unsigned pixDepth);
    ImgBuffer(const ImgBuffer& ib);
    ImgBuffer();
    ~ImgBuffer();
@@ -66,7 +67,10 @@ public:
    ImgBuffer& operator=(const ImgBuffer& rhs);
 
 private:
+   void ReleasePixels();
+
    unsigned char* pixels_;
+   bool ownsPixels_;
    unsigned int width_;
    unsigned int height_;
    unsigned int pixDepth_;
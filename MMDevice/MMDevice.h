@@ -27,7 +27,7 @@
 // Header version
 // If any of the class definitions changes, the interface version
 // must be incremented
-#define DEVICE_INTERFACE_VERSION 67
+#define DEVICE_INTERFACE_VERSION 70
 ///////////////////////////////////////////////////////////////////////////////
 
 
@@ -294,6 +294,12 @@ namespace MM {
       virtual double GetDelayMs() const = 0;
       virtual void SetDelayMs(double delay) = 0;
       virtual bool UsesDelay() = 0;
+      /**
+       * Returns true if the device calls Core::OnDeviceIdle() every time it
+       * stops being busy. The Core then waits for such a notification
+       * instead of repeatedly calling Busy().
+       */
+      virtual bool NotifiesIdle() = 0;
 
       /**
        * library handle management (for use only in the client code)
@@ -1282,6 +1288,11 @@ namespace MM {
        * Magnifiers can use this to signal changes in magnification
        */
       virtual int OnMagnifierChanged(const Device* caller) = 0;
+      /**
+       * Devices whose NotifiesIdle() returns true must call this when they
+       * stop being busy (e.g. when a stage has reached its target)
+       */
+      virtual int OnDeviceIdle(const Device* caller) = 0;
 
       virtual unsigned long GetClockTicksUs(const Device* caller) = 0;
       virtual MM::MMTime GetCurrentMMTime() = 0;
@@ -1294,11 +1305,51 @@ namespace MM {
       virtual int InsertImage(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const Metadata* md = 0, const bool doProcess = true) = 0;
       /// \deprecated Use the other forms instead.
       virtual int InsertImage(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess = true) = 0;
+      /// Insert an image with metadata in a fixed-size record.
+      /**
+       * Unlike the forms taking serialized metadata, this does not convert
+       * the metadata to and from text for each frame.
+       */
+      virtual int InsertImage(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const FrameMetadata& md, const bool doProcess = true) = 0;
+      /// Get the key under which a custom tag is stored in MM::FrameMetadata.
+      /**
+       * Keys remain valid for the lifetime of the Core, so they should be
+       * registered once (e.g. when starting a sequence) rather than for each
+       * frame. Pass "_" as deviceLabel for a tag not associated with a
+       * device, as with Metadata::PutImageTag().
+       */
+      virtual int RegisterMetadataKey(const Device* caller, const char* key, const char* deviceLabel, unsigned& keyId) = 0;
       virtual void ClearImageBuffer(const Device* caller) = 0;
       virtual bool InitializeImageBuffer(unsigned channels, unsigned slices, unsigned int w, unsigned int h, unsigned int pixDepth) = 0;
       /// \deprecated Use the other forms instead.
       virtual int InsertMultiChannel(const Device* caller, const unsigned char* buf, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, Metadata* md = 0) = 0;
 
+      /// Reserve the next frame of the sequence buffer for direct writing.
+      /**
+       * On success, pixels points to width * height * byteDepth bytes of
+       * sequence buffer memory that the camera may fill in place (by
+       * rendering or DMA) instead of copying a finished image with
+       * InsertImage(). Every successful call must be followed by exactly one
+       * CommitFrameSlot() or DiscardFrameSlot() for the returned pointer.
+       * Until then, other threads inserting into the buffer wait (and report
+       * a buffer overflow after a second), and the reserving thread cannot
+       * insert. Only single-channel images are supported.
+       *
+       * Returns DEVICE_BUFFER_OVERFLOW if the buffer is full, and
+       * DEVICE_INCOMPATIBLE_IMAGE if the image dimensions do not match the
+       * buffer.
+       */
+      virtual int AcquireFrameSlot(const Device* caller, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, unsigned char*& pixels) = 0;
+      /// Make a frame filled in place available to the application.
+      /**
+       * The metadata and (if doProcess is true) image processing are handled
+       * as for InsertImage().
+       */
+      virtual int CommitFrameSlot(const Device* caller, unsigned char* pixels, const char* serializedMetadata, const bool doProcess = true) = 0;
+      virtual int CommitFrameSlot(const Device* caller, unsigned char* pixels, const FrameMetadata& md, const bool doProcess = true) = 0;
+      /// Give back a frame obtained with AcquireFrameSlot() without inserting it.
+      virtual int DiscardFrameSlot(const Device* caller, unsigned char* pixels) = 0;
+
       // autofocus
       // TODO This interface needs improvement: the caller pointer should be
       // passed, and it should be clarified whether the use of these methods is
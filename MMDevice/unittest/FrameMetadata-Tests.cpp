@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include "ImageMetadata.h"
+
+#include <string>
+
+using namespace MM;
+
+
+TEST(FrameMetadataTests, WellKnownTagsAreUnsetInitially)
+{
+   FrameMetadata md;
+   EXPECT_FALSE(md.HasStartTimeMs());
+   EXPECT_FALSE(md.HasElapsedTimeMs());
+   EXPECT_FALSE(md.HasROI());
+   EXPECT_FALSE(md.HasBinning());
+   EXPECT_FALSE(md.HasCameraKey());
+   EXPECT_FALSE(md.HasImageNumber());
+   EXPECT_FALSE(md.HasImageFormat());
+   EXPECT_EQ(0u, md.GetTagCount());
+
+   md.SetElapsedTimeMs(1.5);
+   md.SetROI(3, 4);
+   EXPECT_TRUE(md.HasElapsedTimeMs());
+   EXPECT_DOUBLE_EQ(1.5, md.GetElapsedTimeMs());
+   EXPECT_EQ(3, md.GetROIX());
+   EXPECT_EQ(4, md.GetROIY());
+
+   md.Clear();
+   EXPECT_FALSE(md.HasElapsedTimeMs());
+   EXPECT_FALSE(md.HasROI());
+}
+
+
+TEST(FrameMetadataTests, PutTagReplacesValueOfSameKey)
+{
+   FrameMetadata md;
+   ASSERT_TRUE(md.PutTag(7u, 1L));
+   ASSERT_TRUE(md.PutTag(7u, "abc"));
+   ASSERT_EQ(1u, md.GetTagCount());
+   EXPECT_EQ(FrameMetadata::StringTag, md.GetTag(0).type);
+   EXPECT_EQ(std::string("abc"), md.GetTag(0).stringValue);
+}
+
+
+TEST(FrameMetadataTests, TagTableIsBounded)
+{
+   FrameMetadata md;
+   for (unsigned i = 0; i < FrameMetadata::MaxTags; ++i)
+      ASSERT_TRUE(md.PutTag(i, 0.5));
+   EXPECT_FALSE(md.PutTag(FrameMetadata::MaxTags, 0.5));
+   EXPECT_TRUE(md.PutTag(0u, 1.5));
+
+   FrameMetadata copy(md);
+   ASSERT_EQ(unsigned(FrameMetadata::MaxTags), copy.GetTagCount());
+   EXPECT_DOUBLE_EQ(1.5, copy.GetTag(0).doubleValue);
+}
+
+
+TEST(FrameMetadataTests, LongStringValuesAreTruncated)
+{
+   FrameMetadata md;
+   std::string longValue(FrameMetadata::MaxTagValueLength + 10, 'x');
+   ASSERT_TRUE(md.PutTag(0u, longValue.c_str()));
+   EXPECT_EQ(std::string(FrameMetadata::MaxTagValueLength - 1, 'x'),
+         md.GetTag(0).stringValue);
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
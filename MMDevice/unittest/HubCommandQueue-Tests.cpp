@@ -0,0 +1,273 @@
+#include <gtest/gtest.h>
+
+#include "HubCommandQueue.h"
+#include "DeviceThreads.h"
+#include "DeviceUtils.h"
+#include "MMDeviceConstants.h"
+
+#include <deque>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+// Stand-in for a controller that answers each command, in order, with
+// "<command>:<number of times it was received>"
+class FakeController : public HubCommandQueue::Transport
+{
+public:
+   FakeController() :
+      gated_(false), failCommand_(""), purges_(0), outstanding_(0),
+      maxOutstanding_(0)
+   {}
+
+   int Purge()
+   {
+      MMThreadGuard g(lock_);
+      ++purges_;
+      replies_.clear();
+      return DEVICE_OK;
+   }
+
+   int Send(const std::string& command)
+   {
+      MMThreadGuard g(lock_);
+      std::ostringstream reply;
+      reply << command << ":" << ++sendCounts_[command];
+      replies_.push_back(command == failCommand_ ? "" : reply.str());
+      if (++outstanding_ > maxOutstanding_)
+         maxOutstanding_ = outstanding_;
+      return DEVICE_OK;
+   }
+
+   int Receive(const std::string& /*terminator*/, std::string& reply)
+   {
+      MMThreadGuard g(lock_);
+      while (gated_)
+         gate_.Wait(lock_);
+      if (replies_.empty() || replies_.front().empty())
+      {
+         replies_.clear();
+         outstanding_ = 0;
+         return DEVICE_SERIAL_TIMEOUT;
+      }
+      reply = replies_.front();
+      replies_.pop_front();
+      --outstanding_;
+      return DEVICE_OK;
+   }
+
+   void SetGated(bool gated)
+   {
+      MMThreadGuard g(lock_);
+      gated_ = gated;
+      gate_.NotifyAll();
+   }
+
+   void SetFailingCommand(const std::string& command)
+   {
+      MMThreadGuard g(lock_);
+      failCommand_ = command;
+   }
+
+   int SendCount(const std::string& command)
+   {
+      MMThreadGuard g(lock_);
+      return sendCounts_[command];
+   }
+
+   int Purges() { MMThreadGuard g(lock_); return purges_; }
+   int MaxOutstanding() { MMThreadGuard g(lock_); return maxOutstanding_; }
+
+private:
+   MMThreadLock lock_;
+   MMThreadCondition gate_;
+   bool gated_;
+   std::string failCommand_;
+   std::deque<std::string> replies_;
+   std::map<std::string, int> sendCounts_;
+   int purges_;
+   int outstanding_;
+   int maxOutstanding_;
+};
+
+
+class QueryThread : public MMDeviceThreadBase
+{
+public:
+   QueryThread(HubCommandQueue& queue, const std::string& command,
+         bool coalesce, int repeat) :
+      queue_(queue), command_(command), coalesce_(coalesce),
+      repeat_(repeat), errors_(0), mismatches_(0)
+   {}
+
+   int svc()
+   {
+      for (int i = 0; i < repeat_; ++i)
+      {
+         std::string reply;
+         if (queue_.Query(command_, "\r", 0, coalesce_, reply) != DEVICE_OK)
+            ++errors_;
+         else if (reply.compare(0, command_.size() + 1, command_ + ":") != 0)
+            ++mismatches_;
+         lastReply_ = reply;
+      }
+      return 0;
+   }
+
+   int Errors() const { return errors_; }
+   int Mismatches() const { return mismatches_; }
+   const std::string& LastReply() const { return lastReply_; }
+
+private:
+   HubCommandQueue& queue_;
+   std::string command_;
+   bool coalesce_;
+   int repeat_;
+   int errors_;
+   int mismatches_;
+   std::string lastReply_;
+};
+
+} // anonymous namespace
+
+
+TEST(HubCommandQueueTests, QueryGetsReply)
+{
+   FakeController controller;
+   HubCommandQueue queue(controller);
+
+   std::string reply;
+   ASSERT_EQ(DEVICE_OK, queue.Query("W X", "\r", 0, false, reply));
+   EXPECT_EQ("W X:1", reply);
+   ASSERT_EQ(DEVICE_OK, queue.Query("W X", "\r", 0, false, reply));
+   EXPECT_EQ("W X:2", reply);
+   EXPECT_EQ(2, controller.Purges());
+}
+
+
+TEST(HubCommandQueueTests, ConcurrentQueriesGetTheirOwnReplies)
+{
+   FakeController controller;
+   HubCommandQueue queue(controller, 4);
+
+   std::vector<QueryThread*> threads;
+   for (int i = 0; i < 6; ++i)
+   {
+      std::ostringstream command;
+      command << "W " << char('A' + i);
+      threads.push_back(new QueryThread(queue, command.str(), false, 200));
+   }
+   for (size_t i = 0; i < threads.size(); ++i)
+      threads[i]->activate();
+   for (size_t i = 0; i < threads.size(); ++i)
+   {
+      threads[i]->wait();
+      EXPECT_EQ(0, threads[i]->Errors());
+      EXPECT_EQ(0, threads[i]->Mismatches());
+      delete threads[i];
+   }
+   EXPECT_LE(controller.MaxOutstanding(), 4);
+}
+
+
+TEST(HubCommandQueueTests, PendingStatusPollsAreCoalesced)
+{
+   FakeController controller;
+   HubCommandQueue queue(controller, 1);
+
+   // Hold the first reply back, so that the polls queue up behind it
+   controller.SetGated(true);
+   QueryThread move(queue, "M X=1", false, 1);
+   move.activate();
+   CDeviceUtils::SleepMs(100);
+
+   QueryThread poll1(queue, "RS X?", true, 1);
+   QueryThread poll2(queue, "RS X?", true, 1);
+   poll1.activate();
+   poll2.activate();
+   CDeviceUtils::SleepMs(100);
+   controller.SetGated(false);
+
+   move.wait();
+   poll1.wait();
+   poll2.wait();
+   EXPECT_EQ("M X=1:1", move.LastReply());
+   EXPECT_EQ("RS X?:1", poll1.LastReply());
+   EXPECT_EQ("RS X?:1", poll2.LastReply());
+   EXPECT_EQ(1, controller.SendCount("RS X?"));
+   EXPECT_EQ(1, queue.GetCoalescedCount());
+}
+
+
+TEST(HubCommandQueueTests, CommandsAreNotCoalescedUnlessRequested)
+{
+   FakeController controller;
+   HubCommandQueue queue(controller, 1);
+
+   controller.SetGated(true);
+   QueryThread first(queue, "R X=1", false, 1);
+   first.activate();
+   CDeviceUtils::SleepMs(100);
+   QueryThread second(queue, "R X=1", false, 1);
+   second.activate();
+   CDeviceUtils::SleepMs(100);
+   controller.SetGated(false);
+
+   first.wait();
+   second.wait();
+   EXPECT_EQ(2, controller.SendCount("R X=1"));
+   EXPECT_EQ(0, queue.GetCoalescedCount());
+}
+
+
+TEST(HubCommandQueueTests, ReceiveErrorIsReportedAndQueueRecovers)
+{
+   FakeController controller;
+   HubCommandQueue queue(controller);
+   controller.SetFailingCommand("BAD");
+
+   std::string reply;
+   EXPECT_EQ(DEVICE_SERIAL_TIMEOUT, queue.Query("BAD", "\r", 0, false, reply));
+   ASSERT_EQ(DEVICE_OK, queue.Query("W X", "\r", 0, false, reply));
+   EXPECT_EQ("W X:1", reply);
+}
+
+
+TEST(HubCommandQueueTests, AcquiredConnectionIsNotShared)
+{
+   FakeController controller;
+   HubCommandQueue queue(controller, 4);
+
+   // A command in flight is answered before the connection is handed over
+   controller.SetGated(true);
+   QueryThread first(queue, "W A", false, 1);
+   first.activate();
+   CDeviceUtils::SleepMs(100);
+   controller.SetGated(false);
+
+   QueryThread second(queue, "W B", false, 1);
+   {
+      HubCommandQueue::ConnectionGuard guard(queue);
+      EXPECT_EQ(1, controller.SendCount("W A"));
+      first.wait();
+      EXPECT_EQ("W A:1", first.LastReply());
+
+      // Other threads wait until the connection is released
+      second.activate();
+      CDeviceUtils::SleepMs(100);
+      EXPECT_EQ(0, controller.SendCount("W B"));
+   }
+   second.wait();
+   EXPECT_EQ("W B:1", second.LastReply());
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,334 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     Testing
+//
+// DESCRIPTION:   Stand-in for a serial device controller, on a pseudo-terminal
+//
+// LICENSE:       This file is distributed under the BSD license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "SerialSimulator.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <sstream>
+
+
+namespace {
+
+// Splits a script line into words and (unescaped) quoted strings
+bool Tokenize(const std::string& line, std::vector<std::string>& tokens,
+      std::string& errorMessage)
+{
+   std::string::const_iterator it = line.begin(), end = line.end();
+   while (it != end)
+   {
+      if (*it == ' ' || *it == '\t' || *it == '\r')
+      {
+         ++it;
+         continue;
+      }
+      if (*it == '#')
+         break;
+
+      std::string token;
+      if (*it == '"')
+      {
+         for (++it; ; ++it)
+         {
+            if (it == end)
+            {
+               errorMessage = "Unterminated string";
+               return false;
+            }
+            if (*it == '"')
+            {
+               ++it;
+               break;
+            }
+            if (*it == '\\' && it + 1 != end)
+            {
+               switch (*++it)
+               {
+                  case 'r': token += '\r'; break;
+                  case 'n': token += '\n'; break;
+                  case 't': token += '\t'; break;
+                  default: token += *it; break;
+               }
+            }
+            else
+               token += *it;
+         }
+      }
+      else
+      {
+         while (it != end && *it != ' ' && *it != '\t' && *it != '\r')
+            token += *it++;
+      }
+      tokens.push_back(token);
+   }
+   return true;
+}
+
+} // anonymous namespace
+
+
+SerialSimulator::SerialSimulator() :
+   commandTerminator_("\r"),
+   replyTerminator_("\r\n"),
+   byteDelayUs_(0),
+   replyDelayUs_(0),
+   masterFd_(-1),
+   slaveFd_(-1),
+   stop_(false),
+   commandCount_(0)
+{
+}
+
+SerialSimulator::~SerialSimulator()
+{
+   Stop();
+}
+
+void SerialSimulator::SetCommandTerminator(const std::string& terminator)
+{
+   commandTerminator_ = terminator;
+}
+
+void SerialSimulator::SetReplyTerminator(const std::string& terminator)
+{
+   replyTerminator_ = terminator;
+}
+
+void SerialSimulator::SetByteDelayUs(long us)
+{
+   byteDelayUs_ = us;
+}
+
+void SerialSimulator::SetReplyDelayUs(long us)
+{
+   replyDelayUs_ = us;
+}
+
+void SerialSimulator::AddRule(const std::string& pattern, const std::string& reply)
+{
+   Rule rule;
+   rule.pattern = pattern;
+   rule.reply = reply;
+   rules_.push_back(rule);
+}
+
+void SerialSimulator::SetDefaultReply(const std::string& reply)
+{
+   defaultReply_ = reply;
+}
+
+void SerialSimulator::ClearRules()
+{
+   rules_.clear();
+   defaultReply_.clear();
+}
+
+bool SerialSimulator::LoadScript(std::istream& script, std::string& errorMessage)
+{
+   std::string line;
+   for (int lineNumber = 1; std::getline(script, line); ++lineNumber)
+   {
+      std::vector<std::string> tokens;
+      std::string error;
+      if (!Tokenize(line, tokens, error))
+      {
+         errorMessage = "Line " + boost::lexical_cast<std::string>(lineNumber) +
+            ": " + error;
+         return false;
+      }
+      if (tokens.empty())
+         continue;
+
+      try
+      {
+         const std::string& directive = tokens[0];
+         if (directive == "command-terminator" && tokens.size() == 2)
+            SetCommandTerminator(tokens[1]);
+         else if (directive == "reply-terminator" && tokens.size() == 2)
+            SetReplyTerminator(tokens[1]);
+         else if (directive == "byte-delay-us" && tokens.size() == 2)
+            SetByteDelayUs(boost::lexical_cast<long>(tokens[1]));
+         else if (directive == "reply-delay-us" && tokens.size() == 2)
+            SetReplyDelayUs(boost::lexical_cast<long>(tokens[1]));
+         else if (directive == "on" && tokens.size() == 4 && tokens[2] == "reply")
+            AddRule(tokens[1], tokens[3]);
+         else if (directive == "default" && tokens.size() == 3 && tokens[1] == "reply")
+            SetDefaultReply(tokens[2]);
+         else
+         {
+            errorMessage = "Line " + boost::lexical_cast<std::string>(lineNumber) +
+               ": Invalid directive";
+            return false;
+         }
+      }
+      catch (const boost::bad_lexical_cast&)
+      {
+         errorMessage = "Line " + boost::lexical_cast<std::string>(lineNumber) +
+            ": Invalid number";
+         return false;
+      }
+   }
+   return true;
+}
+
+bool SerialSimulator::Start()
+{
+   if (thread_)
+      return true;
+
+   masterFd_ = posix_openpt(O_RDWR | O_NOCTTY);
+   if (masterFd_ < 0)
+      return false;
+   if (grantpt(masterFd_) != 0 || unlockpt(masterFd_) != 0)
+   {
+      close(masterFd_);
+      masterFd_ = -1;
+      return false;
+   }
+   portName_ = ptsname(masterFd_);
+
+   slaveFd_ = open(portName_.c_str(), O_RDWR | O_NOCTTY);
+   if (slaveFd_ < 0)
+   {
+      close(masterFd_);
+      masterFd_ = -1;
+      return false;
+   }
+   // No echo, no line editing or translation
+   struct termios tio;
+   if (tcgetattr(slaveFd_, &tio) == 0)
+   {
+      cfmakeraw(&tio);
+      tcsetattr(slaveFd_, TCSANOW, &tio);
+   }
+
+   stop_.store(false);
+   thread_.reset(new boost::thread(boost::bind(&SerialSimulator::Run, this)));
+   return true;
+}
+
+void SerialSimulator::Stop()
+{
+   if (!thread_)
+      return;
+   stop_.store(true);
+   thread_->join();
+   thread_.reset();
+   close(slaveFd_);
+   close(masterFd_);
+   slaveFd_ = masterFd_ = -1;
+}
+
+void SerialSimulator::Run()
+{
+   std::string received;
+   while (!stop_.load())
+   {
+      struct pollfd pfd;
+      pfd.fd = masterFd_;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if (poll(&pfd, 1, 50) <= 0 || !(pfd.revents & POLLIN))
+         continue;
+
+      char buf[256];
+      ssize_t n = read(masterFd_, buf, sizeof(buf));
+      if (n <= 0)
+         continue;
+      received.append(buf, n);
+
+      std::string::size_type pos;
+      while (!commandTerminator_.empty() &&
+            (pos = received.find(commandTerminator_)) != std::string::npos)
+      {
+         std::string command = received.substr(0, pos);
+         received.erase(0, pos + commandTerminator_.size());
+         ++commandCount_;
+
+         std::string reply = MakeReply(command);
+         if (reply.empty())
+            continue;
+         if (replyDelayUs_ > 0)
+            boost::this_thread::sleep(boost::posix_time::microseconds(replyDelayUs_));
+         WriteReply(reply + replyTerminator_);
+      }
+   }
+}
+
+bool SerialSimulator::Matches(const std::string& pattern,
+      const std::string& command) const
+{
+   if (!pattern.empty() && pattern[pattern.size() - 1] == '*')
+      return command.compare(0, pattern.size() - 1, pattern, 0,
+            pattern.size() - 1) == 0;
+   return command == pattern;
+}
+
+std::string SerialSimulator::MakeReply(const std::string& command) const
+{
+   std::string reply = defaultReply_;
+   for (std::vector<Rule>::const_iterator it = rules_.begin(), end = rules_.end();
+         it != end; ++it)
+   {
+      if (Matches(it->pattern, command))
+      {
+         reply = it->reply;
+         break;
+      }
+   }
+
+   const std::string placeholder("$CMD");
+   std::string::size_type pos = 0;
+   while ((pos = reply.find(placeholder, pos)) != std::string::npos)
+   {
+      reply.replace(pos, placeholder.size(), command);
+      pos += command.size();
+   }
+   return reply;
+}
+
+void SerialSimulator::WriteReply(const std::string& reply)
+{
+   if (byteDelayUs_ <= 0)
+   {
+      std::string::size_type written = 0;
+      while (written < reply.size())
+      {
+         ssize_t n = write(masterFd_, reply.data() + written, reply.size() - written);
+         if (n < 0 && errno != EINTR)
+            return;
+         if (n > 0)
+            written += n;
+      }
+      return;
+   }
+
+   for (std::string::const_iterator it = reply.begin(); it != reply.end(); ++it)
+   {
+      boost::this_thread::sleep(boost::posix_time::microseconds(byteDelayUs_));
+      while (write(masterFd_, &*it, 1) < 0 && errno == EINTR)
+         ;
+   }
+}
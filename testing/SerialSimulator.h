@@ -0,0 +1,105 @@
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     Testing
+//
+// DESCRIPTION:   Stand-in for a serial device controller, on a pseudo-terminal
+//
+// LICENSE:       This file is distributed under the BSD license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+
+#include <istream>
+#include <string>
+#include <vector>
+
+/**
+ * Plays the command/reply protocol of a serial device controller on a
+ * pseudo-terminal, so that the serial port adapter (and device adapters
+ * using it) can be exercised without hardware. Open GetPortName() as the
+ * serial port.
+ *
+ * Commands are matched against the rules in the order they were added. A
+ * pattern ending in '*' matches any command starting with the rest of the
+ * pattern. In a reply, "$CMD" stands for the command. Commands that no
+ * rule matches get the default reply, or no reply if it is empty.
+ *
+ * The protocol can be given as a script (see LoadScript()), one directive
+ * per line; blank lines and lines starting with '#' are ignored. Strings
+ * are double-quoted and may contain the escapes \r, \n, \t, \\ and \".
+ *
+ *    command-terminator "\r"
+ *    reply-terminator "\r\n"
+ *    byte-delay-us 87         # e.g. the time to send a byte at 115200 baud
+ *    reply-delay-us 500       # processing time before each reply
+ *    on "W X" reply ":A 1234"
+ *    on "RS *" reply ":A N"
+ *    on "*" reply "$CMD"      # echo
+ *    default reply ":N-1"
+ */
+class SerialSimulator : boost::noncopyable
+{
+public:
+   SerialSimulator();
+   ~SerialSimulator();
+
+   // The protocol can only be changed while the simulator is stopped
+   void SetCommandTerminator(const std::string& terminator);
+   void SetReplyTerminator(const std::string& terminator);
+   void SetByteDelayUs(long us);
+   void SetReplyDelayUs(long us);
+   void AddRule(const std::string& pattern, const std::string& reply);
+   void SetDefaultReply(const std::string& reply);
+   void ClearRules();
+   // Returns false and sets errorMessage if the script is malformed
+   bool LoadScript(std::istream& script, std::string& errorMessage);
+
+   // Opens the pseudo-terminal and starts answering; returns false on
+   // failure
+   bool Start();
+   void Stop();
+   // Device name of the terminal side, e.g. /dev/pts/3
+   std::string GetPortName() const { return portName_; }
+
+   long GetCommandCount() const { return commandCount_.load(); }
+
+private:
+   struct Rule
+   {
+      std::string pattern;
+      std::string reply;
+   };
+
+   void Run();
+   bool Matches(const std::string& pattern, const std::string& command) const;
+   std::string MakeReply(const std::string& command) const;
+   void WriteReply(const std::string& reply);
+
+   std::string commandTerminator_;
+   std::string replyTerminator_;
+   long byteDelayUs_;
+   long replyDelayUs_;
+   std::vector<Rule> rules_;
+   std::string defaultReply_;
+
+   int masterFd_;
+   // Kept open so that reads on the master do not fail while the port is
+   // closed
+   int slaveFd_;
+   std::string portName_;
+   boost::atomic<bool> stop_;
+   boost::atomic<long> commandCount_;
+   boost::scoped_ptr<boost::thread> thread_;
+};
@@ -0,0 +1,48 @@
+// Runs SerialSimulator on a script, for trying out serial device adapters
+// without hardware. Prints the device name of the port to open, then
+// answers commands until interrupted.
+//
+// Usage: serialsim script
+
+#include "SerialSimulator.h"
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+
+int main(int argc, char** argv)
+{
+   if (argc != 2)
+   {
+      std::cerr << "Usage: " << argv[0] << " script\n";
+      return 2;
+   }
+
+   std::ifstream script(argv[1]);
+   if (!script)
+   {
+      std::cerr << "Cannot open " << argv[1] << "\n";
+      return 1;
+   }
+
+   SerialSimulator simulator;
+   std::string error;
+   if (!simulator.LoadScript(script, error))
+   {
+      std::cerr << argv[1] << ": " << error << "\n";
+      return 1;
+   }
+   if (!simulator.Start())
+   {
+      std::cerr << "Failed to open pseudo-terminal\n";
+      return 1;
+   }
+
+   std::cout << simulator.GetPortName() << std::endl;
+   for (;;)
+      boost::this_thread::sleep(boost::posix_time::seconds(60));
+}